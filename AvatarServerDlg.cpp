@@ -8,6 +8,8 @@
 #include "afxdialogex.h"
 #include "Misc.h"
 #include "StringUtil.h"
+#include "multi_device_capture_source.h"
+#include "portaudio_capture_source.h"
 #include <portaudio.h>
 
 #ifdef _DEBUG
@@ -26,6 +28,8 @@ CAvatarServerDlg::CAvatarServerDlg(CWnd* pParent /*=nullptr*/)
 
 	m_hServerThread = NULL;
 	m_hExitEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	m_Features.AddStage(&m_LipSync);
 }
 
 CAvatarServerDlg::~CAvatarServerDlg()
@@ -80,6 +84,13 @@ BOOL CAvatarServerDlg::OnInitDialog()
 		}
 	}
 
+	// 多个麦克风时可合并录音, 每个设备占一个声道
+	if (m_wndRecordDevices.GetCount() > 1)
+	{
+		int id = m_wndRecordDevices.AddString(L"全部输入设备 (合并为多声道)");
+		m_wndRecordDevices.SetItemData(id, (DWORD_PTR)kAllInputDevices);
+	}
+
 	if (nCount == 0)
 		GetDlgItem(IDC_START_REC)->EnableWindow(FALSE);
 
@@ -131,12 +142,44 @@ HCURSOR CAvatarServerDlg::OnQueryDragIcon()
 void CAvatarServerDlg::OnStartRec()
 {
 	int deviceId = m_wndRecordDevices.GetItemData(m_wndRecordDevices.GetCurSel());
-	if (!m_Recorder.Open(deviceId, 16000, 1, 16))
+	// 按 20 ms 一帧取数, 帧满即发, 降低口型同步的延迟
+	m_Recorder.SetFrameDuration(20);
+	// 自动增益: 各工位麦克风音量差异大, 统一到相近的电平再检测语音和口型,
+	// 前视限幅保证增益后不削波
+	m_Recorder.SetGainControl(true);
+	// 逐帧检测语音, 分帧端口的客户端在静音时只收到静音标记
+	m_Recorder.SetVoiceDetection(true);
+	bool opened = false;
+	if (deviceId == kAllInputDevices)
+	{
+		// 以列表中第一个设备的时钟为准, 其余设备自动补偿时钟漂移
+		std::vector<std::unique_ptr<CaptureSource>> sources;
+		for (int i = 0; i < m_wndRecordDevices.GetCount(); i++)
+		{
+			int id = (int)m_wndRecordDevices.GetItemData(i);
+			if (id != kAllInputDevices)
+				sources.emplace_back(new PortAudioCaptureSource(id));
+		}
+		int channels = (int)sources.size();
+		m_Recorder.SetCaptureSampleRate(0);
+		opened = m_Recorder.Open(std::unique_ptr<CaptureSource>(new MultiDeviceCaptureSource(std::move(sources))), 16000, channels, 16);
+	}
+	else
+	{
+		// 按设备原生采样率录音, 在服务端统一重采样到 16 kHz
+		const PaDeviceInfo* info = Pa_GetDeviceInfo(deviceId);
+		m_Recorder.SetCaptureSampleRate(info ? (int)info->defaultSampleRate : 0);
+		opened = m_Recorder.Open(deviceId, 16000, 1, 16);
+	}
+	if (!opened)
 	{
 		AfxMessageBox(L"打开录音设备失败!", MB_OK | MB_ICONERROR);
 		return;
 	}
 
+	if (!m_Features.Start(&m_Recorder))
+		logger::Log(L"Start feature engine failed.\n");
+
 	GetDlgItem(IDC_START_REC)->EnableWindow(FALSE);
 	GetDlgItem(IDC_STOP_REC)->EnableWindow(TRUE);
 }
@@ -144,6 +187,7 @@ void CAvatarServerDlg::OnStartRec()
 
 void CAvatarServerDlg::OnStopRec()
 {
+	m_Features.Stop();
 	m_Recorder.Close();
 	GetDlgItem(IDC_START_REC)->EnableWindow(TRUE);
 	GetDlgItem(IDC_STOP_REC)->EnableWindow(FALSE);
@@ -156,43 +200,65 @@ DWORD CAvatarServerDlg::ThreadProc(LPVOID param)
 	return 0;
 }
 
-void CAvatarServerDlg::ServerThreadMain()
+SOCKET CAvatarServerDlg::Listen(u_short port, HANDLE hEvent)
 {
-	int ret = 0;
-
 	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 	if (s == INVALID_SOCKET)
 	{
-		return;
+		return INVALID_SOCKET;
 	}
 
 	//绑定IP和端口  
 	sockaddr_in sin;
 	sin.sin_family = AF_INET;
-	sin.sin_port = htons(8888);
+	sin.sin_port = htons(port);
 	sin.sin_addr.S_un.S_addr = INADDR_ANY;
 	if (bind(s, (LPSOCKADDR)&sin, sizeof(sin)) == SOCKET_ERROR)
 	{
 		closesocket(s);
-		return;
+		return INVALID_SOCKET;
 	}
 
-	HANDLE hEvent = WSACreateEvent();
-	ret = WSAEventSelect(s, hEvent, FD_ACCEPT);
+	WSAEventSelect(s, hEvent, FD_ACCEPT);
 
 	//开始监听  
 	if (listen(s, 5) == SOCKET_ERROR)
 	{
 		closesocket(s);
-		return;
+		return INVALID_SOCKET;
+	}
+	return s;
+}
+
+void CAvatarServerDlg::ServerThreadMain()
+{
+	int ret = 0;
+
+	// 8888 端口只发 PCM, 兼容旧客户端; 8889 端口发分帧数据, 静音段只发标记;
+	// 8890 端口只发口型数据, 每 10 ms 一帧
+	const u_short ports[kNumListenPorts] = { 8888, 8889, 8890 };
+	const ClientThread::Mode modes[kNumListenPorts] = {
+		ClientThread::kModePcm, ClientThread::kModeFramed, ClientThread::kModeLipSync };
+	SOCKET sockets[kNumListenPorts];
+	HANDLE handles[kNumListenPorts + 1] = { m_hExitEvent };
+	for (int i = 0; i < kNumListenPorts; i++)
+	{
+		handles[i + 1] = WSACreateEvent();
+		sockets[i] = Listen(ports[i], handles[i + 1]);
+		if (sockets[i] == INVALID_SOCKET)
+			logger::Log(L"Cannot listen on port %d.\n", ports[i]);
 	}
 
 	while (TRUE)
 	{
-		HANDLE handles[2] = { m_hExitEvent, hEvent };
-		ret = WSAWaitForMultipleEvents(2, handles, FALSE, WSA_INFINITE, FALSE);
+		ret = WSAWaitForMultipleEvents(kNumListenPorts + 1, handles, FALSE, WSA_INFINITE, FALSE);
 		if (ret == WAIT_OBJECT_0)
 			break;
+		int index = ret - WAIT_OBJECT_0 - 1;
+		if (index < 0 || index >= kNumListenPorts)
+			continue;
+		SOCKET s = sockets[index];
+		HANDLE hEvent = handles[index + 1];
 
 		WSANETWORKEVENTS networkEvents;
 		if (WSAEnumNetworkEvents(s, hEvent, &networkEvents) == SOCKET_ERROR)
@@ -218,13 +284,26 @@ void CAvatarServerDlg::ServerThreadMain()
 				int flag = 1;
 				setsockopt(sAccept, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(int));
 
-				m_pClientThread.reset(ClientThread::Create(sAccept, &m_Recorder));
+				// 清理已断开的客户端, 所有客户端共享同一路录音
+				for (auto it = m_ClientThreads.begin(); it != m_ClientThreads.end();)
+				{
+					if ((*it)->IsRunning())
+						++it;
+					else
+						it = m_ClientThreads.erase(it);
+				}
+				m_ClientThreads.emplace_back(ClientThread::Create(sAccept, &m_Recorder, modes[index], &m_LipSync));
 			}
 		}
 	}
 
-	closesocket(s);
-	WSACloseEvent(hEvent);
+	m_ClientThreads.clear();
+	for (int i = 0; i < kNumListenPorts; i++)
+	{
+		if (sockets[i] != INVALID_SOCKET)
+			closesocket(sockets[i]);
+		WSACloseEvent(handles[i + 1]);
+	}
 	logger::Log(L"ServerThread exit!\n");
 }
 
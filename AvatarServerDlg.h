@@ -4,18 +4,31 @@
 
 #pragma once
 #include "ClientThread.h"
+#include "feature_engine.h"
+#include "lip_sync_stream.h"
 #include "recorder.h"
 #include <memory>
+#include <vector>
 
 // CAvatarServerDlg 对话框
 class CAvatarServerDlg : public CDialogEx
 {
+	// 设备列表中 "全部输入设备" 一项的 ItemData
+	static const int kAllInputDevices = -1;
+
+	// 监听端口: 纯 PCM, 分帧协议 (stream_protocol.h), 口型数据
+	static const int kNumListenPorts = 3;
+
 	CComboBox m_wndRecordDevices;
 	Recorder m_Recorder;
+	// 在服务端统一计算口型, 所有口型端口的客户端共享
+	LipSyncStream m_LipSync;
+	// 每 10 ms 算一次频谱和 MFCC, 供口型等各个环节共用
+	FeatureEngine m_Features;
 
 	HANDLE m_hServerThread;
 	HANDLE m_hExitEvent;
-	std::unique_ptr<ClientThread> m_pClientThread;
+	std::vector<std::unique_ptr<ClientThread>> m_ClientThreads;
 
 // 构造
 public:
@@ -46,6 +59,7 @@ protected:
 
 private:
 	static DWORD CALLBACK ThreadProc(LPVOID param);
+	static SOCKET Listen(u_short port, HANDLE hEvent);
 	void ServerThreadMain();
 public:
 	afx_msg void OnClose();
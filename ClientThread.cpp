@@ -1,13 +1,16 @@
 #include "ClientThread.h"
 #include "Misc.h"
+#include "stream_protocol.h"
 
 
-ClientThread::ClientThread(SOCKET s, Recorder* recorder)
+ClientThread::ClientThread(SOCKET s, Recorder* recorder, Mode mode, LipSyncStream* lipSync)
 {
 	m_hThread = NULL;
 	m_Socket = s;
 	m_pRecorder = recorder;
 	m_bKeepRunning = FALSE;
+	m_Mode = mode;
+	m_pLipSync = lipSync;
 }
 
 ClientThread::~ClientThread()
@@ -15,9 +18,9 @@ ClientThread::~ClientThread()
 	Stop();
 }
 
-ClientThread* ClientThread::Create(SOCKET s, Recorder* recorder)
+ClientThread* ClientThread::Create(SOCKET s, Recorder* recorder, Mode mode, LipSyncStream* lipSync)
 {
-	ClientThread* thread = new ClientThread(s, recorder);
+	ClientThread* thread = new ClientThread(s, recorder, mode, lipSync);
 	thread->m_bKeepRunning = TRUE;
 	thread->m_hThread = CreateThread(NULL, 0, ClientThread::ThreadProc, thread, 0, NULL);
 	return thread;
@@ -31,6 +34,11 @@ void ClientThread::Stop()
 	m_hThread = NULL;
 }
 
+BOOL ClientThread::IsRunning()
+{
+	return m_hThread && WAIT_TIMEOUT == WaitForSingleObject(m_hThread, 0);
+}
+
 DWORD ClientThread::ThreadProc(LPVOID param)
 {
 	ClientThread* self = (ClientThread*)param;
@@ -42,11 +50,91 @@ void ClientThread::ThreadMain()
 {
 	logger::Log(L"ClientThread start!\n");
 
+	// Every client gets its own read position, so all of them see every sample.
+	m_pRecorder->Subscribe(&m_Reader);
+
+	if (m_Mode != kModePcm)
+	{
+		// Tells the client what the PCM packets hold, and what the
+		// positions of lip-sync frames count.
+		const pcm::StreamFormat& format = m_pRecorder->GetWireFormat();
+		stream_protocol::FormatPayload payload;
+		payload.sample_rate = m_pRecorder->GetSampleRate();
+		payload.channels = (uint16_t)format.channels;
+		payload.bits_per_sample = (uint16_t)(pcm::GetSampleBytes(format.sample_format) * 8);
+		payload.delay_us = (uint32_t)((m_pRecorder->GetResamplerDelay() + m_pRecorder->GetGainControlDelay()) * 1e6 + 0.5);
+		WSABUF buf;
+		buf.buf = (CHAR*)&payload;
+		buf.len = sizeof(payload);
+		Recorder::CaptureInfo info = { 0 };
+		info.first_sample = m_Reader.GetPosition();
+		if (SendPacket(stream_protocol::kPacketFormat, info, 0, &buf, 1) == SOCKET_ERROR)
+			m_bKeepRunning = FALSE;
+	}
+
+	if (m_Mode == kModeLipSync)
+	{
+		SendLipSync();
+		closesocket(m_Socket);
+		logger::Log(L"ClientThread exit!\n");
+		return;
+	}
+
 	std::vector<unsigned char> pcm;
 	while (m_bKeepRunning)
 	{
-		m_pRecorder->Read(&pcm);
-		int n = send(m_Socket, (const char*)pcm.data(), pcm.size(), 0);
+		int n = 0;
+		Recorder::CaptureInfo info;
+		// Samples captured in another format need converting for the wire,
+		// which Read() does.
+		if (m_pRecorder->IsUsingRingBuffer() && !m_pRecorder->NeedsConversion(&m_Reader))
+		{
+			// Sends straight out of the ring buffer, both regions in one call.
+			RingBufferRegions regions;
+			ring_buffer_size_t count = m_pRecorder->Peek(&m_Reader, &regions, &info);
+			if (count == 0)
+				continue;
+			int bytesPerFrame = m_pRecorder->GetBytesPerFrame();
+
+			WSABUF bufs[2];
+			bufs[0].buf = (CHAR*)regions.data1;
+			bufs[0].len = regions.size1 * bytesPerFrame;
+			bufs[1].buf = (CHAR*)regions.data2;
+			bufs[1].len = regions.size2 * bytesPerFrame;
+			DWORD numBufs = regions.size2 > 0 ? 2 : 1;
+
+			if (m_Mode == kModeFramed && !info.voice)
+				n = SendPacket(stream_protocol::kPacketSilence, info, count, NULL, 0);
+			else if (m_Mode == kModeFramed)
+				n = SendPacket(stream_protocol::kPacketPcm, info, count, bufs, numBufs);
+			else
+			{
+				DWORD sent = 0;
+				n = WSASend(m_Socket, bufs, numBufs, &sent, 0, NULL, NULL);
+			}
+			if (!m_pRecorder->Consume(&m_Reader, count))
+				logger::Log(L"Samples were overwritten while being sent.\n");
+		}
+		else
+		{
+			m_pRecorder->Read(&m_Reader, &pcm, &info);
+			if (pcm.empty())
+				continue;
+			if (m_Mode == kModeFramed)
+			{
+				uint32_t frames = (uint32_t)(pcm.size() / m_pRecorder->GetWireFormat().GetBytesPerFrame());
+				WSABUF buf;
+				buf.buf = (CHAR*)pcm.data();
+				buf.len = (ULONG)pcm.size();
+				if (info.voice)
+					n = SendPacket(stream_protocol::kPacketPcm, info, frames, &buf, 1);
+				else
+					n = SendPacket(stream_protocol::kPacketSilence, info, frames, NULL, 0);
+			}
+			else
+				n = send(m_Socket, (const char*)pcm.data(), pcm.size(), 0);
+		}
+
 		if (n == SOCKET_ERROR)
 		{
 			logger::Log(L"Send data failed. error: %d\n", WSAGetLastError());
@@ -60,4 +148,71 @@ void ClientThread::ThreadMain()
 
 	closesocket(m_Socket);
 	logger::Log(L"ClientThread exit!\n");
+}
+
+int ClientThread::SendPacket(uint8_t type, const Recorder::CaptureInfo& info, uint32_t frames,
+	WSABUF* payload, DWORD count)
+{
+	stream_protocol::PacketHeader header = { 0 };
+	header.type = type;
+	header.frames = frames;
+	header.position = info.first_sample;
+	for (DWORD i = 0; i < count; i++)
+		header.payload_bytes += payload[i].len;
+
+	// Header and payload go out in one call.
+	WSABUF bufs[3];
+	bufs[0].buf = (CHAR*)&header;
+	bufs[0].len = sizeof(header);
+	for (DWORD i = 0; i < count; i++)
+		bufs[i + 1] = payload[i];
+
+	DWORD sent = 0;
+	return WSASend(m_Socket, bufs, count + 1, &sent, 0, NULL, NULL);
+}
+
+void ClientThread::SendLipSync()
+{
+	LipSyncStream::Reader reader;
+	m_pLipSync->Subscribe(&reader);
+
+	// Sends what has piled up in one packet, split where frames are not
+	// consecutive.
+	const int kMaxEntries = 32;
+	LipSyncStream::Entry entries[kMaxEntries];
+	stream_protocol::LipSyncFrame frames[kMaxEntries];
+	while (m_bKeepRunning)
+	{
+		ring_buffer_size_t count = reader.WaitReadable(1, 100);
+		if (count == 0)
+			continue;
+		if (count > kMaxEntries)
+			count = kMaxEntries;
+		count = reader.Read(entries, count);
+
+		for (ring_buffer_size_t first = 0; first < count;)
+		{
+			ring_buffer_size_t n = 1;
+			frames[0] = entries[first].frame;
+			while (first + n < count &&
+				entries[first + n].first_sample - entries[first + n - 1].first_sample ==
+					(ring_buffer_pos_t)m_pLipSync->GetSampleRate() * stream_protocol::kLipSyncFrameMs / 1000)
+			{
+				frames[n] = entries[first + n].frame;
+				n++;
+			}
+
+			Recorder::CaptureInfo info = { 0 };
+			info.first_sample = entries[first].first_sample;
+			WSABUF buf;
+			buf.buf = (CHAR*)frames;
+			buf.len = (ULONG)(n * sizeof(stream_protocol::LipSyncFrame));
+			if (SendPacket(stream_protocol::kPacketLipSync, info, n, &buf, 1) == SOCKET_ERROR)
+			{
+				logger::Log(L"Send data failed. error: %d\n", WSAGetLastError());
+				return;
+			}
+			first += n;
+		}
+	}
 }
\ No newline at end of file
@@ -1,26 +1,52 @@
 #pragma once
 
 #include <WinSock2.h>
+#include "lip_sync_stream.h"
 #include "recorder.h"
 
 class ClientThread
 {
+public:
+	// What the client is sent: bare PCM, stream_protocol packets with
+	// silence markers in place of frames without voice, or only lip-sync
+	// packets.
+	enum Mode
+	{
+		kModePcm,
+		kModeFramed,
+		kModeLipSync
+	};
+
+private:
 	HANDLE m_hThread;
 	SOCKET m_Socket;
 	Recorder* m_pRecorder;
+	Recorder::Reader m_Reader;
 	BOOL m_bKeepRunning;
+	Mode m_Mode;
+
+	// Source of lip-sync frames in kModeLipSync.
+	LipSyncStream* m_pLipSync;
 
 public:
 	~ClientThread();
 
-	static ClientThread* Create(SOCKET s, Recorder* recorder);
+	static ClientThread* Create(SOCKET s, Recorder* recorder, Mode mode = kModePcm, LipSyncStream* lipSync = NULL);
 	void Stop();
+	BOOL IsRunning();
 
 private:
-	ClientThread(SOCKET s, Recorder* recorder);
+	ClientThread(SOCKET s, Recorder* recorder, Mode mode, LipSyncStream* lipSync);
 	ClientThread& operator =(const ClientThread& other);
 
 	static DWORD CALLBACK ThreadProc(LPVOID param);
 	void ThreadMain();
+
+	// Sends lip-sync packets until the client goes away.
+	void SendLipSync();
+
+	// Sends the header of one packet followed by |count| buffers of payload.
+	int SendPacket(uint8_t type, const Recorder::CaptureInfo& info, uint32_t frames,
+		WSABUF* payload, DWORD count);
 };
 
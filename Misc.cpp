@@ -1,4 +1,5 @@
 #include "Misc.h"
+#include "StringUtil.h"
 
 namespace logger {
 
@@ -12,4 +13,9 @@ void Log(const wchar_t* fmt, ...)
 	OutputDebugStringW(buf);
 }
 
+std::wstring FromUtf8(const std::string &str)
+{
+	return util::Utf8ToUnicode(str);
+}
+
 }
@@ -4,11 +4,6 @@
 #include <windows.h>
 #include <string>
 #include <strsafe.h>
+#include "logger.h"
 
-namespace logger {
-
-void Log(const wchar_t* fmt, ...);
-
-}
-
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,174 @@
+#include "automatic_gain_control.h"
+#include <math.h>
+#include <algorithm>
+#include <limits>
+#include "pcm_kernels.h"
+
+namespace {
+
+const int kBlockMs = 1;
+
+// Time constant of the short-term level the gate looks at.
+const int kGateMs = 5;
+
+float DbToPower(float db)
+{
+    return powf(10.0f, db / 10.0f);
+}
+
+float DbToGain(float db)
+{
+    return powf(10.0f, db / 20.0f);
+}
+
+// Share of the distance to its target a one-pole follower covers per block.
+float BlockCoef(size_t block_frames, int sample_rate, int time_ms)
+{
+    if (time_ms <= 0)
+        return 1.0f;
+    return (float)(1.0 - exp(-(double)block_frames * 1000 / ((double)sample_rate * time_ms)));
+}
+
+}
+
+AutomaticGainControl::AutomaticGainControl()
+{
+    sample_rate_ = 0;
+    channels_ = 1;
+    block_frames_ = 0;
+    block_size_ = 0;
+    lookahead_blocks_ = 0;
+    current_ = 0;
+    fill_ = 0;
+    gate_power_ = 0;
+    gate_coef_ = 1.0f;
+    short_power_ = 0;
+    ceiling_ = 1.0f;
+    attack_coef_ = release_coef_ = limiter_release_coef_ = 1.0f;
+    power_index_ = 0;
+    power_sum_ = 0;
+    envelope_db_ = 0;
+    gain_ = 1.0f;
+}
+
+bool AutomaticGainControl::Configure(int sample_rate, int channels, const Options &options)
+{
+    if (sample_rate < 1000 || channels < 1 || options.min_gain_db > options.max_gain_db ||
+        options.lookahead_ms < 0)
+        return false;
+    options_ = options;
+    sample_rate_ = sample_rate;
+    channels_ = channels;
+    block_frames_ = (size_t)sample_rate * kBlockMs / 1000;
+    block_size_ = block_frames_ * channels;
+    lookahead_blocks_ = (size_t)((options.lookahead_ms + kBlockMs - 1) / kBlockMs);
+
+    gate_power_ = DbToPower(options.gate_db);
+    gate_coef_ = BlockCoef(block_frames_, sample_rate, kGateMs);
+    ceiling_ = DbToGain(options.ceiling_db);
+    attack_coef_ = BlockCoef(block_frames_, sample_rate, options.attack_ms);
+    release_coef_ = BlockCoef(block_frames_, sample_rate, options.release_ms);
+    limiter_release_coef_ = BlockCoef(block_frames_, sample_rate, options.limiter_release_ms);
+
+    blocks_.resize((lookahead_blocks_ + 1) * block_size_);
+    limits_.resize(lookahead_blocks_ + 1);
+    powers_.resize(std::max(options.average_ms / kBlockMs, 1));
+    Reset();
+    return true;
+}
+
+void AutomaticGainControl::Reset()
+{
+    std::fill(blocks_.begin(), blocks_.end(), 0.0f);
+    std::fill(limits_.begin(), limits_.end(), std::numeric_limits<float>::max());
+    current_ = 0;
+    fill_ = 0;
+    std::fill(powers_.begin(), powers_.end(), DbToPower(options_.target_db));
+    power_index_ = 0;
+    short_power_ = 0;
+    power_sum_ = powers_.size() * (double)DbToPower(options_.target_db);
+    envelope_db_ = options_.target_db;
+    gain_ = 1.0f;
+}
+
+void AutomaticGainControl::Process(float *frames, size_t num_frames)
+{
+    // The block going out is swapped for the one coming in, a value at a
+    // time, so this works in place.
+    size_t count = num_frames * channels_;
+    while (count > 0)
+    {
+        size_t n = block_size_ - fill_;
+        if (n > count)
+            n = count;
+        std::swap_ranges(frames, frames + n, &blocks_[current_ * block_size_ + fill_]);
+        frames += n;
+        count -= n;
+        fill_ += n;
+        if (fill_ == block_size_)
+        {
+            EndBlock();
+            fill_ = 0;
+        }
+    }
+}
+
+void AutomaticGainControl::EndBlock()
+{
+    const pcm::Kernels &kernels = pcm::GetKernels();
+    size_t num_blocks = lookahead_blocks_ + 1;
+
+    // The block that came in: how far its peak allows the gain to go, and
+    // its power, which goes into the level as soon as it arrives.
+    const float *in = &blocks_[current_ * block_size_];
+    float peak = kernels.peak(in, block_size_);
+    limits_[current_] = peak > 0 ? ceiling_ / peak : std::numeric_limits<float>::max();
+    float power = kernels.dot(in, in, block_size_) / block_size_;
+    short_power_ += gate_coef_ * (power - short_power_);
+    if (short_power_ > gate_power_)
+    {
+        // The envelope follows the RMS level of the window. Following each
+        // block's power in dB instead averages log power, and with an attack
+        // much faster than the release it sits near the peaks of any
+        // modulation, dB above the RMS level.
+        power_sum_ += power - powers_[power_index_];
+        powers_[power_index_] = power;
+        if (++power_index_ == powers_.size())
+        {
+            power_index_ = 0;
+            power_sum_ = 0;
+            for (float p : powers_)
+                power_sum_ += p;
+        }
+        float level_db = 10 * log10f((float)(power_sum_ / powers_.size()));
+        envelope_db_ += (level_db > envelope_db_ ? attack_coef_ : release_coef_) * (level_db - envelope_db_);
+    }
+
+    // The gain the envelope asks for, approached gently from below so the
+    // gain the limiter took away comes back smoothly.
+    current_ = (current_ + 1) % num_blocks;
+    float gain_db = options_.target_db - envelope_db_;
+    gain_db = std::min(std::max(gain_db, options_.min_gain_db), options_.max_gain_db);
+    float gain = DbToGain(gain_db);
+    if (gain > gain_)
+        gain = gain_ + limiter_release_coef_ * (gain - gain_);
+
+    // The block going out must stay within its own limit, and the gain must
+    // be able to ramp down to the limit of each block ahead by the time
+    // that block starts, at the same rate per block.
+    gain = std::min(gain, limits_[current_]);
+    for (size_t j = 1; j < num_blocks; j++)
+    {
+        float limit = limits_[(current_ + j) % num_blocks];
+        if (limit < gain)
+            gain = std::min(gain, gain_ + (limit - gain_) / j);
+    }
+
+    kernels.ramp(&blocks_[current_ * block_size_], block_size_, gain_, (gain - gain_) / block_size_);
+    gain_ = gain;
+}
+
+float AutomaticGainControl::GetGainDb() const
+{
+    return 20 * log10f(gain_);
+}
@@ -0,0 +1,122 @@
+#ifndef AUTOMATIC_GAIN_CONTROL_H
+#define AUTOMATIC_GAIN_CONTROL_H
+
+#include <stddef.h>
+#include <vector>
+
+// Streaming automatic gain control with a look-ahead peak limiter, on
+// interleaved float frames. The stream is cut into 1 ms blocks. The RMS
+// level over a sliding window of blocks drives an envelope with separate
+// attack and release times, and the gain brings the envelope to the target
+// level. Measuring RMS over the window rather than following each block
+// keeps the envelope from riding the peaks of tremolo and syllables. While
+// the level over the last few blocks is below the gate, blocks leave both
+// alone, so pauses do not pump the noise up.
+// The limiter sees the peaks of the look-ahead blocks before they go out
+// and ramps the gain down in time, so they stay under the ceiling without
+// clipping. Gain changes ramp linearly across each block on the ramp kernel.
+class AutomaticGainControl
+{
+public:
+    struct Options
+    {
+        // Level the envelope is brought to, in dBFS, and the range the gain
+        // stays within.
+        float target_db;
+        float max_gain_db;
+        float min_gain_db;
+
+        // Blocks that come while the stream is quieter than this do not move
+        // the level or the envelope.
+        float gate_db;
+
+        // Window the RMS level is measured over, and how fast the envelope
+        // follows it as it rises and falls.
+        int average_ms;
+        int attack_ms;
+        int release_ms;
+
+        // Peaks after the gain stay below |ceiling_db|. The limiter looks
+        // |lookahead_ms| ahead and gives the gain back over about
+        // |limiter_release_ms|.
+        float ceiling_db;
+        int lookahead_ms;
+        int limiter_release_ms;
+
+        Options()
+            : target_db(-23.0f), max_gain_db(24.0f), min_gain_db(-12.0f), gate_db(-55.0f), average_ms(300),
+              attack_ms(20), release_ms(400), ceiling_db(-1.0f), lookahead_ms(5), limiter_release_ms(60)
+        {
+        }
+    };
+
+    AutomaticGainControl();
+
+    // Processes |channels| channels at |sample_rate|. Returns false for an
+    // unusable format or options.
+    bool Configure(int sample_rate, int channels, const Options &options = Options());
+
+    // Clears the look-ahead and returns to 0 dB.
+    void Reset();
+
+    // Applies the gain to |num_frames| frames in place. What comes out is
+    // GetDelayFrames() behind what went in, silence at first. Does not
+    // allocate.
+    void Process(float *frames, size_t num_frames);
+
+    // Delay added by the look-ahead, in frames and in seconds.
+    size_t GetDelayFrames() const { return (lookahead_blocks_ + 1) * block_frames_; }
+    double GetDelay() const { return sample_rate_ > 0 ? (double)GetDelayFrames() / sample_rate_ : 0; }
+
+    // Gain applied at the end of the last block out, in dB.
+    float GetGainDb() const;
+
+private:
+    // Takes in the block just filled and gains the oldest one, which goes
+    // out next.
+    void EndBlock();
+
+    Options options_;
+    int sample_rate_;
+    int channels_;
+
+    // Frames and samples per block, and blocks the limiter looks ahead.
+    size_t block_frames_;
+    size_t block_size_;
+    size_t lookahead_blocks_;
+
+    // lookahead_blocks_ + 1 blocks in a ring, and the largest gain each
+    // may have without going over the ceiling. current_ is the block going
+    // out while the next one comes in in its place, and fill_ how far that
+    // has got.
+    std::vector<float> blocks_;
+    std::vector<float> limits_;
+    size_t current_;
+    size_t fill_;
+
+    // Linear levels and per-block smoothing coefficients from options_.
+    float gate_power_;
+    float gate_coef_;
+    float ceiling_;
+    float attack_coef_;
+    float release_coef_;
+    float limiter_release_coef_;
+
+    // Power smoothed over a few blocks, which the gate compares to
+    // gate_power_, so it does not shut on single blocks near the zero
+    // crossings of a low note.
+    float short_power_;
+
+    // Powers of the last blocks above the gate, in a ring starting at
+    // power_index_, and their sum, recomputed each lap so it does not drift.
+    std::vector<float> powers_;
+    size_t power_index_;
+    double power_sum_;
+
+    // Level in dBFS the gain is set from, and the linear gain at the end of
+    // the last block out.
+    float envelope_db_;
+    float gain_;
+};
+
+#endif
@@ -0,0 +1,893 @@
+// Producer/consumer throughput benchmark and stress test for the ring buffers.
+//
+// Runs one writer thread and one reader thread over the same ring, pinned to
+// different cores, and reports elements per second. The previous RingBuffer
+// (volatile indices on a shared cache line, full barriers on every region
+// query) is kept here as LegacyRingBuffer so both can be compared on the same
+// machine. With the default ring size FixedRingBuffer<unsigned short, 16384>
+// is measured too.
+//
+// The sweep mode measures RingBuffer over element sizes, chunk sizes and
+// capacities, with ns/element and, where the OS exposes hardware counters
+// (Linux perf events), cache misses per element. The stress mode runs
+// randomized rounds until the time is up, mixing Write/Read with
+// Reserve/Commit and Peek/Consume over small rings so they wrap constantly,
+// under both overflow policies and both storage kinds, and checks that the
+// reader sees the sequence intact.
+//
+// stress-broadcast does the same for BroadcastRingBuffer: one writer, up to
+// four readers, some of them slow enough to get lapped or bounded by a max
+// lag, and a thread resizing the ring under them while they hold regions
+// pinned. Every element holds its own position, so each reader checks that
+// whatever it reads is intact. stress-mpsc runs several writers into one
+// MpscRingBuffer with blocks of random size, so blocks wrap, get padded and
+// get dropped when the ring is full, and checks that the reader sees each
+// writer's sequence complete and in order.
+//
+// Usage: ring_buffer_bench [total_elements] [chunk_elements] [ring_elements]
+//        ring_buffer_bench sweep [total_elements]
+//        ring_buffer_bench stress [seconds] [seed]
+//        ring_buffer_bench stress-broadcast [seconds] [seed]
+//        ring_buffer_bench stress-mpsc [seconds] [seed]
+//
+// RING_BENCH_CPUS=producer,consumer picks the cores (default 0,1).
+
+#include "../broadcast_ring_buffer.h"
+#include "../fixed_ring_buffer.h"
+#include "../mpsc_ring_buffer.h"
+#include "../ring_buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define LegacyFullBarrier() _ReadWriteBarrier()
+#define LegacyReadBarrier() _ReadWriteBarrier()
+#define LegacyWriteBarrier() _ReadWriteBarrier()
+#else
+#define LegacyFullBarrier() __sync_synchronize()
+#define LegacyReadBarrier() __sync_synchronize()
+#define LegacyWriteBarrier() __sync_synchronize()
+#endif
+
+namespace {
+
+// The ring buffer as it was before the indices became atomics.
+class LegacyRingBuffer
+{
+    ring_buffer_size_t bufferSize_;
+    volatile ring_buffer_size_t writeIndex_;
+    volatile ring_buffer_size_t readIndex_;
+    ring_buffer_size_t bigMask_;
+    ring_buffer_size_t smallMask_;
+    ring_buffer_size_t elementSizeBytes_;
+    char *buffer_;
+
+public:
+    LegacyRingBuffer() : bufferSize_(0), writeIndex_(0), readIndex_(0),
+                         bigMask_(0), smallMask_(0), elementSizeBytes_(0), buffer_(nullptr) {}
+    ~LegacyRingBuffer() { free(buffer_); }
+
+    int Initialize(ring_buffer_size_t elementSizeBytes, ring_buffer_size_t elementCount)
+    {
+        if (((elementCount - 1) & elementCount) != 0)
+            return -1;
+        bufferSize_ = elementCount;
+        buffer_ = (char *)malloc(elementCount * elementSizeBytes);
+        writeIndex_ = readIndex_ = 0;
+        bigMask_ = (elementCount * 2) - 1;
+        smallMask_ = elementCount - 1;
+        elementSizeBytes_ = elementSizeBytes;
+        return 0;
+    }
+
+    ring_buffer_size_t Write(const void *data, ring_buffer_size_t elementCount)
+    {
+        ring_buffer_size_t available = bufferSize_ - ((writeIndex_ - readIndex_) & bigMask_);
+        if (elementCount > available)
+            elementCount = available;
+        if (available)
+            LegacyFullBarrier();
+        Copy(writeIndex_, elementCount, (char *)data, true);
+        LegacyWriteBarrier();
+        writeIndex_ = (writeIndex_ + elementCount) & bigMask_;
+        return elementCount;
+    }
+
+    ring_buffer_size_t Read(void *data, ring_buffer_size_t elementCount)
+    {
+        ring_buffer_size_t available = (writeIndex_ - readIndex_) & bigMask_;
+        if (elementCount > available)
+            elementCount = available;
+        if (available)
+            LegacyReadBarrier();
+        Copy(readIndex_, elementCount, (char *)data, false);
+        LegacyFullBarrier();
+        readIndex_ = (readIndex_ + elementCount) & bigMask_;
+        return elementCount;
+    }
+
+private:
+    void Copy(ring_buffer_size_t position, ring_buffer_size_t elementCount, char *data, bool toRing)
+    {
+        ring_buffer_size_t index = position & smallMask_;
+        ring_buffer_size_t size1 = elementCount;
+        if (index + elementCount > bufferSize_)
+            size1 = bufferSize_ - index;
+        ring_buffer_size_t size2 = elementCount - size1;
+        char *ring1 = &buffer_[index * elementSizeBytes_];
+        if (toRing)
+        {
+            memcpy(ring1, data, size1 * elementSizeBytes_);
+            memcpy(buffer_, data + size1 * elementSizeBytes_, size2 * elementSizeBytes_);
+        }
+        else
+        {
+            memcpy(data, ring1, size1 * elementSizeBytes_);
+            memcpy(data + size1 * elementSizeBytes_, buffer_, size2 * elementSizeBytes_);
+        }
+    }
+};
+
+int g_producerCpu = 0;
+int g_consumerCpu = 1;
+
+// Pins the calling thread to |cpu|. Best effort: the run goes on unpinned
+// if the OS refuses.
+void PinThread(int cpu)
+{
+#if defined(_WIN32)
+    if (cpu < (int)sizeof(DWORD_PTR) * 8)
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+// Counts last-level cache misses of the calling thread. Only Linux exposes
+// them to user mode without a driver; elsewhere Valid() is false.
+class CacheMissCounter
+{
+    int fd_;
+
+public:
+    CacheMissCounter() : fd_(-1)
+    {
+#if defined(__linux__)
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd_ >= 0)
+        {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#if defined(__linux__)
+        if (fd_ >= 0)
+            close(fd_);
+#endif
+    }
+
+    bool Valid() const { return fd_ >= 0; }
+
+    long long Read() const
+    {
+        long long count = 0;
+#if defined(__linux__)
+        if (fd_ < 0 || read(fd_, &count, sizeof(count)) != sizeof(count))
+            return -1;
+#endif
+        return count;
+    }
+};
+
+struct Result
+{
+    double seconds;
+    bool ok;
+    long long cacheMisses; // Both threads together, or -1 if not available.
+};
+
+// Writes and reads one element of type T in the ring's own terms. RingBuffer
+// takes untyped elements, FixedRingBuffer<T> typed ones.
+template <class T>
+ring_buffer_size_t WriteTo(RingBuffer &ring, const T *data, ring_buffer_size_t count)
+{
+    return ring.Write(data, count);
+}
+
+template <class T>
+ring_buffer_size_t ReadFrom(RingBuffer &ring, T *data, ring_buffer_size_t count)
+{
+    return ring.Read(data, count);
+}
+
+template <class T>
+ring_buffer_size_t WriteTo(LegacyRingBuffer &ring, const T *data, ring_buffer_size_t count)
+{
+    return ring.Write(data, count);
+}
+
+template <class T>
+ring_buffer_size_t ReadFrom(LegacyRingBuffer &ring, T *data, ring_buffer_size_t count)
+{
+    return ring.Read(data, count);
+}
+
+template <class T, ring_buffer_size_t Capacity>
+ring_buffer_size_t WriteTo(FixedRingBuffer<T, Capacity> &ring, const T *data, ring_buffer_size_t count)
+{
+    return ring.Write(data, count);
+}
+
+template <class T, ring_buffer_size_t Capacity>
+ring_buffer_size_t ReadFrom(FixedRingBuffer<T, Capacity> &ring, T *data, ring_buffer_size_t count)
+{
+    return ring.Read(data, count);
+}
+
+// Streams |total| counters of type T through |ring| and verifies their order.
+template <class T, class Ring>
+Result RunOnce(Ring &ring, long long total, ring_buffer_size_t chunk)
+{
+    bool ok = true;
+    std::atomic<long long> cacheMisses(0);
+    std::atomic<bool> counted(true);
+    auto begin = std::chrono::steady_clock::now();
+
+    std::thread producer([&]() {
+        PinThread(g_producerCpu);
+        CacheMissCounter counter;
+        std::vector<T> buf(chunk);
+        T next = 0;
+        long long written = 0;
+        while (written < total)
+        {
+            ring_buffer_size_t want = (ring_buffer_size_t)(total - written < chunk ? total - written : chunk);
+            for (ring_buffer_size_t i = 0; i < want; i++)
+                buf[i] = (T)(next + i);
+            ring_buffer_size_t n = WriteTo(ring, buf.data(), want);
+            if (n == 0)
+                std::this_thread::yield();
+            next = (T)(next + n);
+            written += n;
+        }
+        if (counter.Valid())
+            cacheMisses += counter.Read();
+        else
+            counted = false;
+    });
+
+    std::thread consumer([&]() {
+        PinThread(g_consumerCpu);
+        CacheMissCounter counter;
+        std::vector<T> buf(chunk);
+        T expected = 0;
+        long long read = 0;
+        while (read < total)
+        {
+            ring_buffer_size_t n = ReadFrom(ring, buf.data(), chunk);
+            if (n == 0)
+                std::this_thread::yield();
+            for (ring_buffer_size_t i = 0; i < n; i++)
+            {
+                if (buf[i] != expected)
+                    ok = false;
+                expected = (T)(expected + 1);
+            }
+            read += n;
+        }
+        if (counter.Valid())
+            cacheMisses += counter.Read();
+        else
+            counted = false;
+    });
+
+    producer.join();
+    consumer.join();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    Result result = {elapsed.count(), ok, counted ? cacheMisses.load() : -1};
+    return result;
+}
+
+void Report(const char *name, const Result &result, long long total)
+{
+    printf("%-8s %8.3f s  %9.2f Melem/s  %6.2f ns/elem  %s\n",
+           name, result.seconds, total / result.seconds / 1e6,
+           result.seconds * 1e9 / total, result.ok ? "ok" : "SEQUENCE ERROR");
+}
+
+// Runs RingBuffer with elements of type T over every chunk size and capacity.
+template <class T>
+bool SweepElementSize(long long total)
+{
+    static const ring_buffer_size_t kChunks[] = {1, 16, 256, 4096};
+    static const ring_buffer_size_t kCapacities[] = {1024, 16384, 262144};
+
+    bool ok = true;
+    for (ring_buffer_size_t capacity : kCapacities)
+    {
+        for (ring_buffer_size_t chunk : kChunks)
+        {
+            if (chunk > capacity)
+                continue;
+            RingBuffer ring;
+            if (ring.Initialize(sizeof(T), capacity) != 0)
+                return false;
+
+            // Single-element chunks are slow; keep their runs short.
+            long long count = chunk == 1 ? total / 16 : total;
+            Result result = RunOnce<T>(ring, count, chunk);
+            char misses[32] = "n/a";
+            if (result.cacheMisses >= 0)
+                snprintf(misses, sizeof(misses), "%.4f", (double)result.cacheMisses / count);
+            printf("%4d %8ld %6ld %8.3f %10s  %s\n", (int)sizeof(T), (long)capacity, (long)chunk,
+                   result.seconds * 1e9 / count, misses, result.ok ? "ok" : "SEQUENCE ERROR");
+            ok = ok && result.ok;
+        }
+    }
+    return ok;
+}
+
+int Sweep(long long total)
+{
+    printf("elements=%lld cpus=%d,%d\n", total, g_producerCpu, g_consumerCpu);
+    printf("size capacity  chunk  ns/elem misses/elem\n");
+    bool ok = SweepElementSize<unsigned char>(total);
+    ok = SweepElementSize<unsigned short>(total) && ok;
+    ok = SweepElementSize<unsigned int>(total) && ok;
+    ok = SweepElementSize<unsigned long long>(total) && ok;
+    return ok ? 0 : 1;
+}
+
+// One randomized stress round: a small ring of 64-bit counters, random chunk
+// sizes, both write and both read paths, partial commits and consumes, and
+// the odd pause on either side so the ring runs both full and empty.
+// Returns false on a sequence error.
+bool StressRound(std::mt19937 &random, double seconds, long long *numElements)
+{
+    typedef unsigned long long Element;
+
+    ring_buffer_size_t capacity = (ring_buffer_size_t)1 << (2 + random() % 11);
+    RingBufferStorage storage = random() % 2 ? kRingBufferMirrored : kRingBufferHeap;
+    RingBufferOverflowPolicy policy = random() % 4 == 0 ? kRingBufferOverwriteOldest : kRingBufferDropNewest;
+
+    RingBuffer ring;
+    if (ring.Initialize(sizeof(Element), capacity, storage) != 0 &&
+        ring.Initialize(sizeof(Element), capacity) != 0)
+    {
+        printf("initialize failed, capacity %ld\n", (long)capacity);
+        return false;
+    }
+    capacity = ring.GetBufferSize();
+    ring.SetOverflowPolicy(policy);
+
+    unsigned int producerSeed = random();
+    unsigned int consumerSeed = random();
+    std::atomic<bool> stop(false);
+    std::atomic<long long> written(0);
+    bool ok = true;
+    long long numRead = 0;
+
+    std::thread producer([&]() {
+        PinThread(g_producerCpu);
+        std::mt19937 rng(producerSeed);
+        std::vector<Element> buf(capacity * 2);
+        Element next = 0;
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            ring_buffer_size_t want = 1 + rng() % (capacity * 2);
+            ring_buffer_size_t n;
+            if (rng() % 2)
+            {
+                for (ring_buffer_size_t i = 0; i < want; i++)
+                    buf[i] = next + i;
+                n = ring.Write(buf.data(), want);
+            }
+            else
+            {
+                RingBufferRegions regions;
+                n = ring.Reserve(want, &regions);
+                if (n > 0)
+                    n -= rng() % n; // Commit only part of it, sometimes.
+                ring_buffer_size_t size1 = n < regions.size1 ? n : regions.size1;
+                for (ring_buffer_size_t i = 0; i < size1; i++)
+                    ((Element *)regions.data1)[i] = next + i;
+                for (ring_buffer_size_t i = size1; i < n; i++)
+                    ((Element *)regions.data2)[i - size1] = next + i;
+                ring.Commit(n);
+            }
+            next += n;
+            written.store((long long)next, std::memory_order_relaxed);
+            if (rng() % 64 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(rng() % 200));
+        }
+    });
+
+    std::thread consumer([&]() {
+        PinThread(g_consumerCpu);
+        std::mt19937 rng(consumerSeed);
+        std::vector<Element> buf(capacity * 2);
+        Element expected = 0;
+        auto check = [&](const Element *data, ring_buffer_size_t n) {
+            // Overwriting only ever skips whole elements ahead of us.
+            if (policy == kRingBufferOverwriteOldest && n > 0 && data[0] > expected)
+                expected = data[0];
+            for (ring_buffer_size_t i = 0; i < n; i++)
+            {
+                if (data[i] != expected + i)
+                {
+                    printf("sequence error: got %llu, expected %llu\n", data[i], expected + i);
+                    ok = false;
+                    return;
+                }
+            }
+            expected += n;
+            numRead += n;
+        };
+        while (ok)
+        {
+            bool stopping = stop.load(std::memory_order_acquire);
+            ring_buffer_size_t want = 1 + rng() % (capacity * 2);
+            ring_buffer_size_t n;
+            if (rng() % 2)
+            {
+                n = ring.Read(buf.data(), want);
+                check(buf.data(), n);
+            }
+            else
+            {
+                RingBufferRegions regions;
+                n = ring.Peek(want, &regions);
+                ring_buffer_size_t use = n > 0 ? n - rng() % n : 0;
+                ring_buffer_size_t size1 = use < regions.size1 ? use : regions.size1;
+                memcpy(buf.data(), regions.data1, size1 * sizeof(Element));
+                if (use > size1)
+                    memcpy(buf.data() + size1, regions.data2, (use - size1) * sizeof(Element));
+                // Data the writer overwrote meanwhile is not checked.
+                if (ring.Consume(use))
+                    check(buf.data(), use);
+                n = use;
+            }
+            if (stopping && n == 0 && ring.GetReadAvailable() == 0)
+                break;
+            if (rng() % 64 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(rng() % 200));
+        }
+        if (ok && policy == kRingBufferDropNewest && (long long)expected != written.load())
+        {
+            printf("read %llu of %lld elements\n", expected, written.load());
+            ok = false;
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop.store(true, std::memory_order_release);
+    producer.join();
+    consumer.join();
+
+    *numElements = numRead;
+    if (!ok)
+    {
+        printf("failed: capacity %ld %s %s\n", (long)capacity,
+               storage == kRingBufferMirrored ? "mirrored" : "heap",
+               policy == kRingBufferOverwriteOldest ? "overwrite-oldest" : "drop-newest");
+    }
+    return ok;
+}
+
+// One randomized round over a BroadcastRingBuffer of 64-bit positions: the
+// writer stores each element's own position, so a reader knows what every
+// element it reads must hold. Readers mix Read, Peek/Consume and ReadBatch,
+// and sometimes sleep with a region pinned while the ring is resized.
+bool BroadcastStressRound(std::mt19937 &random, double seconds, long long *numElements)
+{
+    typedef unsigned long long Element;
+
+    ring_buffer_size_t capacity = (ring_buffer_size_t)1 << (4 + random() % 9);
+    RingBufferStorage storage = random() % 2 ? kRingBufferMirrored : kRingBufferHeap;
+    bool resizing = random() % 2 != 0;
+    int numReaders = 1 + random() % 4;
+
+    BroadcastRingBuffer ring;
+    if (ring.Initialize(sizeof(Element), capacity, storage) != 0 &&
+        ring.Initialize(sizeof(Element), capacity) != 0)
+    {
+        printf("initialize failed, capacity %ld\n", (long)capacity);
+        return false;
+    }
+    capacity = ring.GetBufferSize();
+
+    // Resizes go up to four times the initial size.
+    ring_buffer_size_t maxCapacity = capacity * 4;
+    unsigned int producerSeed = random();
+    unsigned int resizerSeed = random();
+    std::vector<unsigned int> readerSeeds(numReaders);
+    for (int i = 0; i < numReaders; i++)
+        readerSeeds[i] = random();
+    std::atomic<bool> stop(false);
+    std::atomic<bool> ok(true);
+    std::atomic<long long> numRead(0);
+    std::atomic<long long> numLost(0);
+    int numResizes = 0;
+
+    std::thread producer([&]() {
+        PinThread(g_producerCpu);
+        std::mt19937 rng(producerSeed);
+        std::vector<Element> buf(maxCapacity);
+        Element next = 0;
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            ring_buffer_size_t want = 1 + rng() % capacity;
+            ring_buffer_size_t n;
+            if (rng() % 2)
+            {
+                for (ring_buffer_size_t i = 0; i < want; i++)
+                    buf[i] = next + i;
+                n = ring.Write(buf.data(), want);
+            }
+            else
+            {
+                RingBufferRegions regions;
+                n = ring.Reserve(want, &regions);
+                if (n > 0)
+                    n -= rng() % n; // Commit only part of it, sometimes.
+                ring_buffer_size_t size1 = n < regions.size1 ? n : regions.size1;
+                for (ring_buffer_size_t i = 0; i < size1; i++)
+                    ((Element *)regions.data1)[i] = next + i;
+                for (ring_buffer_size_t i = size1; i < n; i++)
+                    ((Element *)regions.data2)[i - size1] = next + i;
+                ring.Commit(n);
+            }
+            next += n;
+            if (rng() % 64 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(rng() % 200));
+        }
+    });
+
+    // Resize() fails while the previous one is pending or pinned; that is
+    // part of what is being tested.
+    std::thread resizer([&]() {
+        std::mt19937 rng(resizerSeed);
+        while (resizing && !stop.load(std::memory_order_relaxed))
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(rng() % 2000));
+            ring_buffer_size_t size = (maxCapacity >> (rng() % 5));
+            if (size >= 4 && ring.Resize(size) == 0)
+                numResizes++;
+        }
+    });
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < numReaders; r++)
+    {
+        readers.push_back(std::thread([&, r]() {
+            std::mt19937 rng(readerSeeds[r]);
+            bool slow = rng() % 3 == 0;
+            BroadcastRingBuffer::Reader reader;
+            reader.Attach(&ring);
+            if (rng() % 3 == 0)
+                reader.SetMaxLag(1 + rng() % capacity);
+            std::vector<Element> buf(maxCapacity);
+            auto check = [&](const Element *data, ring_buffer_pos_t first, ring_buffer_size_t n) {
+                for (ring_buffer_size_t i = 0; i < n; i++)
+                {
+                    if (data[i] != (Element)(first + i))
+                    {
+                        printf("reader %d: got %llu at position %lld\n", r, data[i], (long long)(first + i));
+                        ok = false;
+                        return;
+                    }
+                }
+                numRead += n;
+            };
+            while (ok && !stop.load(std::memory_order_relaxed))
+            {
+                ring_buffer_size_t want = 1 + rng() % maxCapacity;
+                switch (rng() % 3)
+                {
+                case 0:
+                {
+                    ring_buffer_size_t n = reader.Read(buf.data(), want);
+                    check(buf.data(), reader.GetPosition() - n, n);
+                    break;
+                }
+                case 1:
+                {
+                    RingBufferRegions regions;
+                    ring_buffer_size_t n = reader.Peek(want, &regions);
+                    ring_buffer_size_t use = n > 0 ? n - rng() % n : 0;
+                    ring_buffer_size_t size1 = use < regions.size1 ? use : regions.size1;
+                    memcpy(buf.data(), regions.data1, size1 * sizeof(Element));
+                    if (use > size1)
+                        memcpy(buf.data() + size1, regions.data2, (use - size1) * sizeof(Element));
+                    // Holding the region pinned keeps the resizer from reusing it.
+                    if (rng() % 16 == 0)
+                        std::this_thread::sleep_for(std::chrono::microseconds(rng() % 500));
+                    ring_buffer_pos_t first = reader.GetPosition();
+                    if (reader.Consume(use))
+                        check(buf.data(), first, use);
+                    break;
+                }
+                default:
+                {
+                    ring_buffer_size_t minCount = 1 + rng() % capacity;
+                    std::chrono::steady_clock::time_point deadline =
+                        std::chrono::steady_clock::now() + std::chrono::microseconds(rng() % 2000);
+                    ring_buffer_size_t n = reader.ReadBatch(buf.data(), minCount, want, deadline);
+                    check(buf.data(), reader.GetPosition() - n, n);
+                    break;
+                }
+                }
+                if (rng() % (slow ? 4 : 64) == 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(rng() % 1000));
+            }
+            numLost += reader.GetLostCount();
+        }));
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop.store(true, std::memory_order_release);
+    producer.join();
+    resizer.join();
+    for (size_t i = 0; i < readers.size(); i++)
+        readers[i].join();
+
+    *numElements = numRead;
+    if (!ok)
+    {
+        printf("failed: capacity %ld %s, %d readers, %d resizes, %lld lost\n", (long)capacity,
+               storage == kRingBufferMirrored ? "mirrored" : "heap", numReaders, numResizes, numLost.load());
+    }
+    return ok;
+}
+
+// One randomized round over an MpscRingBuffer: two to four writers reserve
+// blocks of random size in a small ring, so blocks wrap, need padding and do
+// not always fit. Each writer numbers its elements, and the reader checks
+// that every writer's numbers arrive complete and in order.
+bool MpscStressRound(std::mt19937 &random, double seconds, long long *numElements)
+{
+    typedef unsigned long long Element;
+    const int kTagShift = 48;
+
+    ring_buffer_size_t bufferBytes = (ring_buffer_size_t)1 << (7 + random() % 8);
+    RingBufferStorage storage = random() % 2 ? kRingBufferMirrored : kRingBufferHeap;
+    int numWriters = 2 + random() % 3;
+
+    MpscRingBuffer ring;
+    if (ring.Initialize(sizeof(Element), bufferBytes, storage) != 0 &&
+        ring.Initialize(sizeof(Element), bufferBytes) != 0)
+    {
+        printf("initialize failed, %ld bytes\n", (long)bufferBytes);
+        return false;
+    }
+    bufferBytes = ring.GetBufferBytes();
+    ring_buffer_size_t maxElements = bufferBytes / (ring_buffer_size_t)sizeof(Element) / 2;
+
+    std::vector<unsigned int> writerSeeds(numWriters);
+    for (int i = 0; i < numWriters; i++)
+        writerSeeds[i] = random();
+    unsigned int consumerSeed = random();
+    std::vector<Element> numSent(numWriters, 0);
+    std::atomic<bool> stop(false);
+    std::atomic<bool> writersDone(false);
+    bool ok = true;
+    long long numRead = 0;
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < numWriters; w++)
+    {
+        writers.push_back(std::thread([&, w]() {
+            std::mt19937 rng(writerSeeds[w]);
+            std::vector<Element> buf(maxElements);
+            Element tag = (Element)w << kTagShift;
+            Element next = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                ring_buffer_size_t want = 1 + rng() % maxElements;
+                ring_buffer_size_t n;
+                if (rng() % 2)
+                {
+                    for (ring_buffer_size_t i = 0; i < want; i++)
+                        buf[i] = tag | (next + i);
+                    n = ring.Write(buf.data(), want, (uint32_t)w);
+                }
+                else
+                {
+                    MpscRingBuffer::Reservation reservation;
+                    n = ring.Reserve(want, (uint32_t)w, &reservation);
+                    if (n > 0)
+                    {
+                        for (ring_buffer_size_t i = 0; i < n; i++)
+                            ((Element *)reservation.data)[i] = tag | (next + i);
+                        // A slow commit holds back the blocks reserved after it.
+                        if (rng() % 32 == 0)
+                            std::this_thread::sleep_for(std::chrono::microseconds(rng() % 100));
+                        ring.Commit(reservation);
+                    }
+                }
+                next += n;
+                if (rng() % 16 == 0)
+                    std::this_thread::yield();
+            }
+            numSent[w] = next;
+        }));
+    }
+
+    std::thread consumer([&]() {
+        PinThread(g_consumerCpu);
+        std::mt19937 rng(consumerSeed);
+        std::vector<Element> expected(numWriters, 0);
+        while (ok)
+        {
+            bool done = writersDone.load(std::memory_order_acquire);
+            MpscRingBuffer::Block block;
+            if (!ring.WaitReadable(done ? 0 : 10) || !ring.Peek(&block))
+            {
+                if (done)
+                    break;
+                continue;
+            }
+            const Element *data = (const Element *)block.data;
+            if ((int)block.tag >= numWriters || block.elementCount < 1)
+            {
+                printf("bad block: tag %u, %ld elements\n", block.tag, (long)block.elementCount);
+                ok = false;
+                break;
+            }
+            Element tag = (Element)block.tag << kTagShift;
+            for (ring_buffer_size_t i = 0; i < block.elementCount; i++)
+            {
+                if (data[i] != (tag | (expected[block.tag] + i)))
+                {
+                    printf("writer %u: got %llx, expected %llx\n", block.tag, data[i],
+                           tag | (expected[block.tag] + i));
+                    ok = false;
+                    break;
+                }
+            }
+            expected[block.tag] += block.elementCount;
+            numRead += block.elementCount;
+            ring.Consume();
+            // Fall behind now and then, so the writers find the ring full.
+            if (rng() % 256 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(rng() % 500));
+        }
+        for (int w = 0; ok && w < numWriters; w++)
+        {
+            if (expected[w] != numSent[w])
+            {
+                printf("writer %d: read %llu of %llu elements\n", w, expected[w], numSent[w]);
+                ok = false;
+            }
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop.store(true, std::memory_order_release);
+    for (size_t i = 0; i < writers.size(); i++)
+        writers[i].join();
+    writersDone.store(true, std::memory_order_release);
+    consumer.join();
+
+    *numElements = numRead;
+    if (!ok)
+    {
+        printf("failed: %ld bytes %s, %d writers, %lld dropped\n", (long)bufferBytes,
+               storage == kRingBufferMirrored ? "mirrored" : "heap", numWriters,
+               (long long)ring.GetDroppedCount());
+    }
+    return ok;
+}
+
+typedef bool (*StressRoundFunction)(std::mt19937 &random, double seconds, long long *numElements);
+
+int Stress(const char *name, StressRoundFunction round, double seconds, unsigned int seed)
+{
+    printf("%s %.0f s seed %u cpus=%d,%d\n", name, seconds, seed, g_producerCpu, g_consumerCpu);
+    std::mt19937 random(seed);
+    auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    int rounds = 0;
+    long long total = 0;
+    while (std::chrono::steady_clock::now() < end)
+    {
+        long long n = 0;
+        if (!round(random, 0.05 + (random() % 100) / 200.0, &n))
+        {
+            printf("round %d FAILED\n", rounds);
+            return 1;
+        }
+        rounds++;
+        total += n;
+    }
+    printf("%d rounds, %lld elements checked, ok\n", rounds, total);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const char *cpus = getenv("RING_BENCH_CPUS");
+    if (cpus)
+        sscanf(cpus, "%d,%d", &g_producerCpu, &g_consumerCpu);
+
+    if (argc > 1 && strcmp(argv[1], "sweep") == 0)
+        return Sweep(argc > 2 ? atoll(argv[2]) : 20000000LL);
+    double seconds = argc > 2 ? atof(argv[2]) : 60.0;
+    unsigned int seed = argc > 3 ? (unsigned int)atol(argv[3]) : 1u;
+    if (argc > 1 && strcmp(argv[1], "stress") == 0)
+        return Stress("stress", StressRound, seconds, seed);
+    if (argc > 1 && strcmp(argv[1], "stress-broadcast") == 0)
+        return Stress("stress-broadcast", BroadcastStressRound, seconds, seed);
+    if (argc > 1 && strcmp(argv[1], "stress-mpsc") == 0)
+        return Stress("stress-mpsc", MpscStressRound, seconds, seed);
+
+    long long total = argc > 1 ? atoll(argv[1]) : 200000000LL;
+    ring_buffer_size_t chunk = argc > 2 ? atol(argv[2]) : 256;
+    ring_buffer_size_t capacity = argc > 3 ? atol(argv[3]) : 16384;
+
+    printf("elements=%lld chunk=%ld ring=%ld element_size=2\n", total, (long)chunk, (long)capacity);
+
+    LegacyRingBuffer legacy;
+    RingBuffer current;
+    if (legacy.Initialize(2, capacity) != 0 || current.Initialize(2, capacity) != 0)
+    {
+        fprintf(stderr, "ring size must be a power of two\n");
+        return 1;
+    }
+
+    Result legacyResult = RunOnce<unsigned short>(legacy, total, chunk);
+    Report("legacy", legacyResult, total);
+    Result currentResult = RunOnce<unsigned short>(current, total, chunk);
+    Report("atomic", currentResult, total);
+    printf("speedup  %.2fx\n", legacyResult.seconds / currentResult.seconds);
+
+    bool ok = legacyResult.ok && currentResult.ok;
+    if (capacity == 16384)
+    {
+        std::unique_ptr<FixedRingBuffer<unsigned short, 16384> > fixed(new FixedRingBuffer<unsigned short, 16384>);
+        Result fixedResult = RunOnce<unsigned short>(*fixed, total, chunk);
+        Report("fixed", fixedResult, total);
+        printf("speedup  %.2fx\n", legacyResult.seconds / fixedResult.seconds);
+        ok = ok && fixedResult.ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,568 @@
+#include "broadcast_ring_buffer.h"
+#include "ring_storage.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits>
+#include <thread>
+
+static const ring_buffer_pos_t kOpenEndPosition = std::numeric_limits<ring_buffer_pos_t>::max();
+
+BroadcastRingBuffer::BroadcastRingBuffer()
+{
+    elementSizeBytes_.store(0, std::memory_order_relaxed);
+    storage_ = kRingBufferHeap;
+    for (int i = 0; i < 2; i++)
+    {
+        layouts_[i].elementSizeBytes = 0;
+        layouts_[i].bufferSize = 0;
+        layouts_[i].smallMask = 0;
+        layouts_[i].buffer = nullptr;
+        layouts_[i].mirrored = false;
+        layouts_[i].endPosition.store(kOpenEndPosition, std::memory_order_relaxed);
+        layouts_[i].copyStart = layouts_[i].copyEnd = 0;
+        pinCount_[i].store(0, std::memory_order_relaxed);
+    }
+    writePosition_.store(0, std::memory_order_relaxed);
+    oldestPosition_.store(0, std::memory_order_relaxed);
+    currentLayout_.store(0, std::memory_order_relaxed);
+    pendingLayout_.store(-1, std::memory_order_relaxed);
+    bufferSize_.store(0, std::memory_order_relaxed);
+}
+
+BroadcastRingBuffer::~BroadcastRingBuffer()
+{
+    FreeLayout(&layouts_[0]);
+    FreeLayout(&layouts_[1]);
+}
+
+void BroadcastRingBuffer::FreeLayout(Layout *layout)
+{
+    ring_storage::Free(&layout->storage);
+    layout->buffer = nullptr;
+    layout->mirrored = false;
+    layout->bufferSize = 0;
+    layout->smallMask = 0;
+}
+
+int BroadcastRingBuffer::AllocateLayout(Layout *layout, ring_buffer_size_t elementSizeBytes,
+                                        ring_buffer_size_t elementCount, RingBufferStorage storage,
+                                        const ring_storage::Options &options)
+{
+    bool mirrored = storage == kRingBufferMirrored;
+    if (mirrored)
+    {
+        /* The mirror must start on a granule boundary, and the granule is a
+           power of two, so doubling the count always gets there. */
+        size_t granularity = ring_storage::GetMirrorGranularity();
+        while (((size_t)elementCount * elementSizeBytes) % granularity != 0)
+            elementCount *= 2;
+    }
+    if (!ring_storage::Allocate((size_t)elementCount * elementSizeBytes, mirrored, options, &layout->storage))
+        return -1;
+
+    layout->elementSizeBytes = elementSizeBytes;
+    layout->buffer = (char *)layout->storage.data;
+    layout->mirrored = mirrored;
+    layout->bufferSize = elementCount;
+    layout->smallMask = elementCount - 1;
+    layout->endPosition.store(kOpenEndPosition, std::memory_order_relaxed);
+    layout->copyStart = layout->copyEnd = 0;
+    return 0;
+}
+
+/***************************************************************************
+ * Wait for readers that pinned layout to finish with it.
+ */
+void BroadcastRingBuffer::WaitUnpinned(int layout) const
+{
+    while (pinCount_[layout].load(std::memory_order_seq_cst) != 0)
+        std::this_thread::yield();
+}
+
+/***************************************************************************
+ * Initialize FIFO.
+ * elementCount must be power of 2, returns -1 if not.
+ */
+int BroadcastRingBuffer::Initialize(ring_buffer_size_t elementSizeBytes, ring_buffer_size_t elementCount,
+                                    RingBufferStorage storage, const ring_storage::Options &options)
+{
+    if (((elementCount - 1) & elementCount) != 0)
+        return -1; /* Not Power of two. */
+
+    /* Build the new storage in the spare layout, as Resize() does, and take
+       the writer's place in switching to it, so readers attached from
+       before never see the storage they have pinned go away. A resize the
+       writer has not picked up yet is dropped. */
+    int current = currentLayout_.load(std::memory_order_relaxed);
+    int spare = 1 - current;
+    pendingLayout_.store(-1, std::memory_order_relaxed);
+    WaitUnpinned(spare);
+    FreeLayout(&layouts_[spare]);
+    if (AllocateLayout(&layouts_[spare], elementSizeBytes, elementCount, storage, options) != 0)
+        return -1;
+
+    elementSizeBytes_.store(elementSizeBytes, std::memory_order_relaxed);
+    storage_ = storage;
+    storageOptions_ = options;
+
+    /* Positions carry on from before, and nothing before the current write
+       position counts as intact, so readers attached across a
+       re-initialization skip to the new data. release: stored before the
+       layout switch, like in AdoptLayout(). */
+    ring_buffer_pos_t writePosition = writePosition_.load(std::memory_order_relaxed);
+    oldestPosition_.store(writePosition, std::memory_order_release);
+    layouts_[current].endPosition.store(writePosition, std::memory_order_release);
+    bufferSize_.store(layouts_[spare].bufferSize, std::memory_order_relaxed);
+    currentLayout_.store(spare, std::memory_order_release);
+    return 0;
+}
+
+/***************************************************************************
+ * Prepare new storage for the writer to switch to.
+ */
+int BroadcastRingBuffer::Resize(ring_buffer_size_t elementCount)
+{
+    if (((elementCount - 1) & elementCount) != 0)
+        return -1; /* Not Power of two. */
+
+    /* The spare layout is the one the writer left at the last resize. Only
+       reuse it once the writer has switched away from it and no reader that
+       pinned it before the switch is still reading it. */
+    if (pendingLayout_.load(std::memory_order_acquire) >= 0)
+        return -1;
+    int spare = 1 - currentLayout_.load(std::memory_order_acquire);
+    if (pinCount_[spare].load(std::memory_order_seq_cst) != 0)
+        return -1;
+
+    Layout &to = layouts_[spare];
+    FreeLayout(&to);
+    if (AllocateLayout(&to, GetElementSize(), elementCount, storage_, storageOptions_) != 0)
+        return -1;
+
+    /* Copy the history here rather than in the writer's callback. The writer
+       keeps going meanwhile, so afterwards drop what it may have overwritten
+       while we copied, as a reader does in Consume(). */
+    const Layout &from = layouts_[1 - spare];
+    ring_buffer_pos_t copyStart = GetOldestIntactPosition();
+    ring_buffer_pos_t copyEnd = writePosition_.load(std::memory_order_acquire);
+    if (copyStart < copyEnd - to.bufferSize)
+        copyStart = copyEnd - to.bufferSize;
+    CopyElements(from, &to, copyStart, copyEnd);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    ring_buffer_pos_t oldestPosition = GetOldestIntactPosition();
+    if (copyStart < oldestPosition)
+        copyStart = oldestPosition < copyEnd ? oldestPosition : copyEnd;
+    to.copyStart = copyStart;
+    to.copyEnd = copyEnd;
+
+    /* release: the writer sees the layout filled in when it picks it up. */
+    pendingLayout_.store(spare, std::memory_order_release);
+    return 0;
+}
+
+/***************************************************************************
+ * Copy the elements from begin up to end, wherever each layout wraps.
+ */
+void BroadcastRingBuffer::CopyElements(const Layout &from, Layout *to, ring_buffer_pos_t begin,
+                                       ring_buffer_pos_t end)
+{
+    for (ring_buffer_pos_t position = begin; position < end;)
+    {
+        ring_buffer_size_t fromIndex = (ring_buffer_size_t)(position & from.smallMask);
+        ring_buffer_size_t toIndex = (ring_buffer_size_t)(position & to->smallMask);
+        ring_buffer_pos_t count = end - position;
+        if (count > from.bufferSize - fromIndex)
+            count = from.bufferSize - fromIndex;
+        if (count > to->bufferSize - toIndex)
+            count = to->bufferSize - toIndex;
+        memcpy(&to->buffer[toIndex * to->elementSizeBytes], &from.buffer[fromIndex * from.elementSizeBytes],
+               (size_t)count * to->elementSizeBytes);
+        position += count;
+    }
+}
+
+/***************************************************************************
+ * Switch the writer to layout next. Resize() has copied the history up to
+ * next.copyEnd; only what was written since is copied here.
+ */
+void BroadcastRingBuffer::AdoptLayout(int next)
+{
+    Layout &from = layouts_[currentLayout_.load(std::memory_order_relaxed)];
+    Layout &to = layouts_[next];
+
+    /* Keep the copied elements and those written since, as many as the new
+       layout holds, but never any the old one no longer has intact: the
+       oldest position only moves forward. */
+    ring_buffer_pos_t writePosition = writePosition_.load(std::memory_order_relaxed);
+    ring_buffer_pos_t oldestPosition = oldestPosition_.load(std::memory_order_relaxed);
+    ring_buffer_pos_t keepPosition = to.copyStart;
+    if (keepPosition < oldestPosition)
+        keepPosition = oldestPosition;
+    if (keepPosition < writePosition - to.bufferSize)
+        keepPosition = writePosition - to.bufferSize;
+    ring_buffer_pos_t copyPosition = to.copyEnd > keepPosition ? to.copyEnd : keepPosition;
+    CopyElements(from, &to, copyPosition, writePosition);
+
+    /* Shrinking drops the oldest elements; readers behind them skip ahead. */
+    if (keepPosition > oldestPosition)
+        oldestPosition_.store(keepPosition, std::memory_order_release);
+
+    /* Readers still holding the old layout must not read past what was
+       written to it. release: stored before any write position beyond it. */
+    from.endPosition.store(writePosition, std::memory_order_release);
+    bufferSize_.store(to.bufferSize, std::memory_order_relaxed);
+
+    /* release: readers that pin the new layout see the copied elements. */
+    currentLayout_.store(next, std::memory_order_release);
+    pendingLayout_.store(-1, std::memory_order_release);
+}
+
+/***************************************************************************
+ */
+void BroadcastRingBuffer::GetRegions(const Layout &layout, ring_buffer_pos_t position,
+                                     ring_buffer_size_t elementCount, RingBufferRegions *regions)
+{
+    ring_buffer_size_t index = (ring_buffer_size_t)(position & layout.smallMask);
+    regions->data1 = &layout.buffer[index * layout.elementSizeBytes];
+    if (!layout.mirrored && (index + elementCount) > layout.bufferSize)
+    {
+        /* Data in two blocks that wrap the buffer. */
+        ring_buffer_size_t firstHalf = layout.bufferSize - index;
+        regions->size1 = firstHalf;
+        regions->data2 = &layout.buffer[0];
+        regions->size2 = elementCount - firstHalf;
+    }
+    else
+    {
+        regions->size1 = elementCount;
+        regions->data2 = NULL;
+        regions->size2 = 0;
+    }
+}
+
+/***************************************************************************
+ */
+ring_buffer_pos_t BroadcastRingBuffer::GetOldestIntactPosition() const
+{
+    /* acquire pairs with the release store in Reserve(): a writePosition_
+       loaded after this is at least the value the reservation started from. */
+    return oldestPosition_.load(std::memory_order_acquire);
+}
+
+/***************************************************************************
+** Return elements reserved. */
+ring_buffer_size_t BroadcastRingBuffer::Reserve(ring_buffer_size_t elementCount, RingBufferRegions *regions)
+{
+    int pendingLayout = pendingLayout_.load(std::memory_order_acquire);
+    if (pendingLayout >= 0)
+        AdoptLayout(pendingLayout);
+
+    const Layout &layout = layouts_[currentLayout_.load(std::memory_order_relaxed)];
+    if (elementCount > layout.bufferSize)
+        elementCount = layout.bufferSize;
+
+    /* Announce the span before touching it, so a reader still copying the
+       elements we are about to overwrite can tell afterwards. The release
+       fence keeps the element stores below from moving above this store.
+       Slots older than oldestPosition_ are already given up, so there is
+       nothing to announce unless it moves. */
+    ring_buffer_pos_t writePosition = writePosition_.load(std::memory_order_relaxed);
+    ring_buffer_pos_t oldestPosition = writePosition + elementCount - layout.bufferSize;
+    if (oldestPosition > oldestPosition_.load(std::memory_order_relaxed))
+    {
+        oldestPosition_.store(oldestPosition, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    GetRegions(layout, writePosition, elementCount, regions);
+    return elementCount;
+}
+
+/***************************************************************************
+ */
+void BroadcastRingBuffer::Commit(ring_buffer_size_t elementCount)
+{
+    /* release pairs with the acquire in Reader::GetReadAvailable */
+    ring_buffer_pos_t writePosition = writePosition_.load(std::memory_order_relaxed) + elementCount;
+    writePosition_.store(writePosition, std::memory_order_release);
+
+    if (waitGate_.HasWaiters())
+        waitGate_.Notify(writePosition);
+}
+
+/***************************************************************************
+** Return elements written. */
+ring_buffer_size_t BroadcastRingBuffer::Write(const void *data, ring_buffer_size_t elementCount)
+{
+    ring_buffer_size_t elementSizeBytes = GetElementSize();
+    RingBufferRegions regions;
+    ring_buffer_size_t numWritten = Reserve(elementCount, &regions);
+    memcpy(regions.data1, data, regions.size1 * elementSizeBytes);
+    if (regions.size2 > 0)
+        memcpy(regions.data2, (const char *)data + regions.size1 * elementSizeBytes,
+               regions.size2 * elementSizeBytes);
+    Commit(numWritten);
+    return numWritten;
+}
+
+/***************************************************************************
+ */
+ring_buffer_pos_t BroadcastRingBuffer::GetWritePosition() const
+{
+    return writePosition_.load(std::memory_order_acquire);
+}
+
+/***************************************************************************
+ */
+ring_buffer_size_t BroadcastRingBuffer::GetBufferSize() const
+{
+    return bufferSize_.load(std::memory_order_relaxed);
+}
+
+/***************************************************************************
+ */
+bool BroadcastRingBuffer::IsLocked() const
+{
+    return layouts_[currentLayout_.load(std::memory_order_acquire)].storage.locked;
+}
+
+/***************************************************************************
+ * Reader
+ */
+BroadcastRingBuffer::Reader::Reader()
+{
+    ring_ = nullptr;
+    position_ = 0;
+    cachedWritePosition_ = 0;
+    lostCount_ = 0;
+    overrunCount_ = 0;
+    maxLag_ = 0;
+    pinnedLayout_ = -1;
+}
+
+BroadcastRingBuffer::Reader::~Reader()
+{
+    Unpin();
+}
+
+void BroadcastRingBuffer::Reader::Attach(const BroadcastRingBuffer *ring)
+{
+    Unpin();
+    ring_ = ring;
+    position_ = cachedWritePosition_ = ring->GetWritePosition();
+    lostCount_ = 0;
+    overrunCount_ = 0;
+}
+
+bool BroadcastRingBuffer::Reader::Seek(ring_buffer_pos_t position)
+{
+    cachedWritePosition_ = ring_->GetWritePosition();
+    position_ = position < cachedWritePosition_ ? position : cachedWritePosition_;
+    CheckOverrun();
+    return position_ == position;
+}
+
+const BroadcastRingBuffer::Layout &BroadcastRingBuffer::Reader::Pin()
+{
+    Unpin();
+
+    /* Resize() only reuses a layout nobody has pinned. Check that the layout
+       is still current after pinning it: if the writer switched in between,
+       Resize() may already be reusing it, so let go without reading it. */
+    while (true)
+    {
+        int layout = ring_->currentLayout_.load(std::memory_order_seq_cst);
+        ring_->pinCount_[layout].fetch_add(1, std::memory_order_seq_cst);
+        if (ring_->currentLayout_.load(std::memory_order_seq_cst) == layout)
+        {
+            pinnedLayout_ = layout;
+            return ring_->layouts_[layout];
+        }
+        ring_->pinCount_[layout].fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void BroadcastRingBuffer::Reader::Unpin()
+{
+    if (pinnedLayout_ >= 0)
+    {
+        /* release: our reads of the layout are done before it can be freed. */
+        ring_->pinCount_[pinnedLayout_].fetch_sub(1, std::memory_order_release);
+        pinnedLayout_ = -1;
+    }
+}
+
+void BroadcastRingBuffer::Reader::CheckOverrun()
+{
+    ring_buffer_pos_t oldest = ring_->GetOldestIntactPosition();
+    if (position_ < oldest)
+    {
+        lostCount_ += oldest - position_;
+        overrunCount_++;
+        position_ = oldest;
+    }
+}
+
+void BroadcastRingBuffer::Reader::CheckMaxLag()
+{
+    if (maxLag_ > 0 && cachedWritePosition_ - position_ > maxLag_)
+    {
+        lostCount_ += cachedWritePosition_ - maxLag_ - position_;
+        position_ = cachedWritePosition_ - maxLag_;
+    }
+}
+
+ring_buffer_size_t BroadcastRingBuffer::Reader::GetReadAvailable()
+{
+    /* Check for overrun first: the write position loaded afterwards is then
+       never behind the position we may have skipped to. */
+    CheckOverrun();
+    cachedWritePosition_ = ring_->writePosition_.load(std::memory_order_acquire);
+    CheckMaxLag();
+    return (ring_buffer_size_t)(cachedWritePosition_ - position_);
+}
+
+ring_buffer_size_t BroadcastRingBuffer::Reader::LimitWaitCount(ring_buffer_size_t elementCount) const
+{
+    ring_buffer_size_t bufferSize = ring_->GetBufferSize();
+    if (elementCount > bufferSize)
+        elementCount = bufferSize;
+    if (maxLag_ > 0 && elementCount > maxLag_)
+        elementCount = (ring_buffer_size_t)maxLag_;
+    return elementCount;
+}
+
+ring_buffer_size_t BroadcastRingBuffer::Reader::WaitReadable(ring_buffer_size_t elementCount, int timeoutMs)
+{
+    elementCount = LimitWaitCount(elementCount);
+    /* The threshold follows position_, which moves if we get skipped ahead. */
+    return ring_wait::WaitReadable(ring_->waitGate_, elementCount, timeoutMs,
+                                   [this, elementCount](int64_t *threshold) {
+                                       ring_buffer_size_t available = GetReadAvailable();
+                                       *threshold = position_ + elementCount;
+                                       return available;
+                                   });
+}
+
+ring_buffer_size_t BroadcastRingBuffer::Reader::Peek(ring_buffer_size_t elementCount, RingBufferRegions *regions)
+{
+    while (true)
+    {
+        /* Pin before anything else, so the positions loaded below match the
+           layout: a layout the writer switched to has its oldest position
+           published first. */
+        const Layout &layout = Pin();
+
+        CheckOverrun();
+        ring_buffer_size_t count = elementCount;
+        ring_buffer_pos_t available = cachedWritePosition_ - position_;
+        if (count > available)
+        {
+            /* Only look at the writer's cache line when the cached position says
+               there is not enough data. */
+            cachedWritePosition_ = ring_->writePosition_.load(std::memory_order_acquire);
+            CheckMaxLag();
+            available = cachedWritePosition_ - position_;
+            if (count > available)
+                count = (ring_buffer_size_t)available;
+        }
+
+        /* The writer may have lapped us since the overrun check; Consume() will
+           tell, but the regions must stay inside the buffer. */
+        if (count > layout.bufferSize)
+            count = layout.bufferSize;
+
+        /* If the writer has moved on to a new layout since we pinned this one,
+           the newer elements are only in the new one. If it has even lapped
+           us there, pin the new one and look again. */
+        ring_buffer_pos_t endPosition = layout.endPosition.load(std::memory_order_acquire);
+        if (count > 0 && position_ + count > endPosition)
+        {
+            if (position_ >= endPosition)
+                continue;
+            count = (ring_buffer_size_t)(endPosition - position_);
+        }
+
+        GetRegions(layout, position_, count, regions);
+        if (count == 0)
+            Unpin();
+        return count;
+    }
+}
+
+bool BroadcastRingBuffer::Reader::Consume(ring_buffer_size_t elementCount)
+{
+    if (elementCount == 0)
+    {
+        Unpin();
+        return true;
+    }
+
+    /* Our loads of the elements must complete before we look at how far the
+       writer has got; pairs with the release fence in Reserve(). */
+    std::atomic_thread_fence(std::memory_order_acquire);
+    bool intact = position_ >= ring_->GetOldestIntactPosition();
+    if (!intact)
+    {
+        lostCount_ += elementCount;
+        overrunCount_++;
+    }
+    position_ += elementCount;
+    Unpin();
+    return intact;
+}
+
+ring_buffer_size_t BroadcastRingBuffer::Reader::Read(void *data, ring_buffer_size_t elementCount)
+{
+    /* data has room for elements of the size the ring has now. Elements
+       still pinned in storage retired by Initialize() may be of another
+       size; they are stale by then, so skip them instead of copying. */
+    ring_buffer_size_t elementSizeBytes = ring_->GetElementSize();
+    while (true)
+    {
+        RingBufferRegions regions;
+        ring_buffer_size_t numRead = Peek(elementCount, &regions);
+        if (numRead > 0 && ring_->layouts_[pinnedLayout_].elementSizeBytes != elementSizeBytes)
+        {
+            Consume(numRead);
+            continue;
+        }
+        memcpy(data, regions.data1, regions.size1 * elementSizeBytes);
+        if (regions.size2 > 0)
+            memcpy((char *)data + regions.size1 * elementSizeBytes, regions.data2,
+                   regions.size2 * elementSizeBytes);
+        if (Consume(numRead))
+            return numRead;
+    }
+}
+
+ring_buffer_size_t BroadcastRingBuffer::Reader::ReadBatch(void *data, ring_buffer_size_t minCount,
+                                                          ring_buffer_size_t maxCount,
+                                                          std::chrono::steady_clock::time_point deadline)
+{
+    if (minCount > maxCount)
+        minCount = maxCount;
+    minCount = LimitWaitCount(minCount);
+    if (minCount < 1)
+        minCount = 1;
+
+    int timeoutMs = RING_WAIT_INFINITE;
+    if (deadline != std::chrono::steady_clock::time_point::max())
+    {
+        /* Round up, so we never give up before the deadline. */
+        std::chrono::steady_clock::duration remaining = deadline - std::chrono::steady_clock::now();
+        timeoutMs = 0;
+        if (remaining > std::chrono::steady_clock::duration::zero())
+            timeoutMs = (int)std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count() + 1;
+    }
+
+    ring_buffer_size_t available = WaitReadable(minCount, timeoutMs);
+    if (available < minCount)
+        return 0;
+    return Read(data, available < maxCount ? available : maxCount);
+}
+
+ring_buffer_pos_t BroadcastRingBuffer::Reader::GetLag() const
+{
+    return ring_->GetWritePosition() - position_;
+}
@@ -0,0 +1,302 @@
+#ifndef BROADCAST_RING_BUFFER_H
+#define BROADCAST_RING_BUFFER_H
+
+/** @file
+ @brief Single-writer multi-reader lock-free broadcast ring buffer
+
+ BroadcastRingBuffer lets one writer publish elements once to any number of
+ readers. Each reader owns a BroadcastRingBuffer::Reader holding its own read
+ position, so every reader sees every element and no reader consumes data on
+ behalf of another.
+
+ The writer never waits for readers: it always overwrites the oldest
+ elements. A reader that falls more than one buffer behind detects the
+ overrun, skips forward to the oldest element still intact, and accounts for
+ the skipped elements in its lost count. Positions are absolute 64-bit
+ element counts, so lapping is always detectable.
+
+ Data handed out by Reader::Peek() is read in place. The writer may overwrite
+ it if the reader is slow to finish with it; Reader::Consume() reports
+ whether that happened.
+
+ The buffer can be resized while it is in use. Resize() prepares new storage
+ on the calling thread and copies the buffered elements into it; the writer
+ switches to it at its next Reserve(), copying over only the elements it
+ wrote since, so nothing readers still need is lost and the writer never
+ copies the whole history.
+ Readers pin the storage they read from between Peek() and Consume(), and
+ the old storage is only released once nobody has it pinned.
+*/
+
+#include "ring_buffer.h"
+
+class BroadcastRingBuffer
+{
+    /** Storage for the elements. Resize() fills the spare one and the writer
+     switches to it. */
+    struct Layout
+    {
+        ring_buffer_size_t elementSizeBytes; /**< Number of bytes per element. */
+        ring_buffer_size_t bufferSize;     /**< Number of elements in FIFO. Power of 2. */
+        ring_buffer_size_t smallMask;      /**< Used for fitting positions to buffer. */
+        char *buffer;                      /**< Pointer to the buffer containing the actual data. */
+        bool mirrored;                     /**< True if buffer is followed by a mirror of itself. */
+        ring_storage::Block storage;       /**< How buffer was allocated. */
+        std::atomic<ring_buffer_pos_t> endPosition; /**< Write position when the writer left this layout. */
+        ring_buffer_pos_t copyStart;       /**< Elements Resize() copied in ahead of the writer, */
+        ring_buffer_pos_t copyEnd;         /**< from copyStart up to copyEnd. */
+    };
+
+    /* Set by Initialize(). Readers use the copy in the layout they pinned. */
+    std::atomic<ring_buffer_size_t> elementSizeBytes_; /**< Number of bytes per element. */
+    RingBufferStorage storage_;              /**< Storage kind, reused by Resize(). */
+    ring_storage::Options storageOptions_;   /**< Storage options, reused by Resize(). */
+    char pad0_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Only changed by Initialize() and Resize(), for the layout not in use.
+       The layout they leave stays allocated until the next one, since
+       readers may still have it pinned. */
+    Layout layouts_[2];
+    char pad1_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Writer side. Readers load these, the writer alone stores them, except
+       for pendingLayout_ which Resize() stores. */
+    std::atomic<ring_buffer_pos_t> writePosition_;  /**< Number of elements published. */
+    std::atomic<ring_buffer_pos_t> oldestPosition_; /**< Oldest element the writer has not started to overwrite. */
+    std::atomic<int> currentLayout_;                /**< Index of the layout the writer writes to. */
+    std::atomic<int> pendingLayout_;                /**< Layout prepared by Resize(), or -1. */
+    std::atomic<ring_buffer_size_t> bufferSize_;    /**< bufferSize of the current layout. */
+    char pad2_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Readers inside Peek()..Consume() on each layout. */
+    mutable std::atomic<int> pinCount_[2];
+    char pad3_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Blocking reads. The writer only loads from here unless a reader is waiting. */
+    mutable RingWaitGate waitGate_;                  /**< Progress is writePosition_. */
+    char pad4_[RING_BUFFER_CACHE_LINE_SIZE];
+
+public:
+    /** A read cursor into a BroadcastRingBuffer. Each reader thread owns one. */
+    class Reader
+    {
+        const BroadcastRingBuffer *ring_;
+        ring_buffer_pos_t position_;            /**< Position of the next element to read. */
+        ring_buffer_pos_t cachedWritePosition_; /**< Last seen writePosition_. */
+        ring_buffer_pos_t lostCount_;           /**< Elements skipped or overwritten before they were read. */
+        ring_buffer_pos_t overrunCount_;        /**< Number of times this reader was lapped. */
+        ring_buffer_pos_t maxLag_;              /**< Skip ahead when further behind than this; 0 for no limit. */
+        int pinnedLayout_;                      /**< Layout pinned by Peek(), or -1. */
+
+    public:
+        Reader();
+        ~Reader();
+
+        /** Start reading from ring at its current write position.
+        */
+        void Attach(const BroadcastRingBuffer *ring);
+
+        /** Continue reading from an absolute position, e.g. one saved from
+         GetPosition() before a reconnect. Positions the writer has already
+         overwritten are skipped up to the oldest intact element and counted
+         as lost; positions past the write position stop there.
+         @param position The absolute position to read from next.
+         @return true if reading continues exactly at position.
+        */
+        bool Seek(ring_buffer_pos_t position);
+
+        /** Bound how far this reader may fall behind the writer. When it is
+         further behind, it skips ahead to maxLag elements before the newest
+         one and adds the skipped elements to the lost count, so the freshest
+         data wins over stale data.
+         @param maxLag The largest allowed lag in elements, or 0 for the buffer size.
+        */
+        void SetMaxLag(ring_buffer_pos_t maxLag) { maxLag_ = maxLag; }
+
+        /** Retrieve the number of elements available for reading. Skips ahead
+         first if the writer has lapped this reader or it is beyond its max lag.
+        */
+        ring_buffer_size_t GetReadAvailable();
+
+        /** Wait until at least elementCount elements are available for reading.
+         Spins briefly, then sleeps until the writer publishes enough.
+         @param elementCount The number of elements needed, limited to the
+                buffer size and the max lag.
+         @param timeoutMs The longest time to wait, 0 to only spin, or RING_WAIT_INFINITE.
+         @return The number of elements available for reading, less than
+                 elementCount if the wait timed out.
+        */
+        ring_buffer_size_t WaitReadable(ring_buffer_size_t elementCount, int timeoutMs);
+
+        /** Get the readable region(s) without copying them out of the ring buffer.
+         The storage stays pinned until Consume(), so the regions stay valid
+         even if the ring buffer is resized meanwhile.
+         @param elementCount The number of elements desired.
+         @param regions Receives the readable region(s).
+         @return The number of elements available, which may be less than elementCount.
+        */
+        ring_buffer_size_t Peek(ring_buffer_size_t elementCount, RingBufferRegions *regions);
+
+        /** Move past elements previously obtained through Peek().
+         @param elementCount The number of elements to move past, not more than peeked.
+         @return false if the writer overwrote some of them before this call,
+                 in which case they are added to the lost count.
+        */
+        bool Consume(ring_buffer_size_t elementCount);
+
+        /** Read data from the ring buffer. Retries if the writer overwrites the
+         data while it is being copied.
+         @param data The address where the data should be stored.
+         @param elementCount The number of elements to be read.
+         @return The number of elements read.
+        */
+        ring_buffer_size_t Read(void *data, ring_buffer_size_t elementCount);
+
+        /** Read a batch of between minCount and maxCount elements, waiting
+         until deadline for at least minCount to be available. Lets a
+         consumer read in steady frames instead of whatever has piled up.
+         @param data The address where the data should be stored, room for maxCount elements.
+         @param minCount The fewest elements worth reading, limited to the
+                buffer size and the max lag.
+         @param maxCount The most elements to read.
+         @param deadline When to give up waiting for minCount elements.
+         @return The number of elements read: 0 if fewer than minCount
+                 arrived by the deadline, in which case nothing is read.
+                 Less than minCount only if the writer lapped this reader
+                 during the copy.
+        */
+        ring_buffer_size_t ReadBatch(void *data, ring_buffer_size_t minCount, ring_buffer_size_t maxCount,
+                                     std::chrono::steady_clock::time_point deadline);
+
+        /** Retrieve the position of the next element this reader will read.
+        */
+        ring_buffer_pos_t GetPosition() const { return position_; }
+
+        /** Retrieve how many elements this reader is behind the writer.
+        */
+        ring_buffer_pos_t GetLag() const;
+
+        /** Retrieve the total number of elements this reader has lost to overruns
+         or skipped because of its max lag.
+        */
+        ring_buffer_pos_t GetLostCount() const { return lostCount_; }
+
+        /** Retrieve the number of times this reader has been lapped by the writer.
+        */
+        ring_buffer_pos_t GetOverrunCount() const { return overrunCount_; }
+
+    private:
+        /** Skip ahead to the oldest intact element if the writer has lapped us. */
+        void CheckOverrun();
+
+        /** Skip ahead to maxLag_ elements before cachedWritePosition_ if we are further behind. */
+        void CheckMaxLag();
+
+        /** Limit elementCount to what can ever be available at once. */
+        ring_buffer_size_t LimitWaitCount(ring_buffer_size_t elementCount) const;
+
+        /** Pin the layout the writer is using, so it is not released while we read it. */
+        const Layout &Pin();
+
+        /** Release the layout pinned by Pin(), if any. */
+        void Unpin();
+    };
+
+    BroadcastRingBuffer();
+    ~BroadcastRingBuffer();
+
+    /** Initialize the ring buffer to empty state ready to have elements written to it.
+     The write position is kept, so attached readers skip to the new data.
+     Readers may keep reading meanwhile: the storage in use is retired like
+     the one left by Resize(), and only released once nobody has it pinned.
+     Waits for readers still reading the storage retired before it. Must not
+     be called while the writer writes, or concurrently with itself or Resize().
+     @param elementSizeBytes The size of a single data element in bytes.
+     @param elementCount The number of elements in the buffer (must be a power of 2).
+     @param storage How the element memory is allocated.
+     @param options Alignment, prefaulting, locking and NUMA placement of the element memory.
+     @return -1 if elementCount is not a power of 2 or the storage could not be allocated, otherwise 0.
+    */
+    int Initialize(ring_buffer_size_t elementSizeBytes, ring_buffer_size_t elementCount,
+                   RingBufferStorage storage = kRingBufferHeap,
+                   const ring_storage::Options &options = ring_storage::Options());
+
+    /** Change the number of elements while the ring buffer is in use.
+     Allocates the new storage and copies the buffered elements into it on
+     the calling thread; the writer switches to it at its next Reserve(),
+     copying only what it wrote meanwhile and keeping the newest elements
+     that fit. Must not
+     be called from the writer or concurrently with itself or Initialize().
+     @param elementCount The new number of elements (must be a power of 2).
+     @return -1 if elementCount is not a power of 2, the storage could not be
+             allocated, or the previous resize is still in progress (the writer
+             has not switched yet, or a reader is still reading the storage
+             before it), otherwise 0.
+    */
+    int Resize(ring_buffer_size_t elementCount);
+
+    /** Reserve space so the writer can fill the ring buffer in place. Always
+     succeeds, overwriting the oldest elements.
+     Must be followed by Commit() with the number of elements actually filled.
+     @param elementCount The number of elements desired.
+     @param regions Receives the writable region(s).
+     @return The number of elements reserved, elementCount limited to the buffer size.
+    */
+    ring_buffer_size_t Reserve(ring_buffer_size_t elementCount, RingBufferRegions *regions);
+
+    /** Publish elements previously filled through Reserve() to the readers.
+     @param elementCount The number of elements to publish, not more than reserved.
+    */
+    void Commit(ring_buffer_size_t elementCount);
+
+    /** Write data to the ring buffer.
+     @param data The address of new data to write to the buffer.
+     @param elementCount The number of elements to be written.
+     @return The number of elements written.
+    */
+    ring_buffer_size_t Write(const void *data, ring_buffer_size_t elementCount);
+
+    /** Retrieve the number of elements published so far.
+    */
+    ring_buffer_pos_t GetWritePosition() const;
+
+    /** Retrieve the size of a single element in bytes.
+    */
+    ring_buffer_size_t GetElementSize() const { return elementSizeBytes_.load(std::memory_order_relaxed); }
+
+    /** Retrieve the number of elements the ring buffer holds. After Resize()
+     this changes once the writer has switched to the new storage.
+    */
+    ring_buffer_size_t GetBufferSize() const;
+
+    /** Return true if the element memory was locked as requested through
+     ring_storage::Options::lock.
+    */
+    bool IsLocked() const;
+
+private:
+    /** Allocate storage for elementCount elements into layout. */
+    static int AllocateLayout(Layout *layout, ring_buffer_size_t elementSizeBytes, ring_buffer_size_t elementCount,
+                              RingBufferStorage storage, const ring_storage::Options &options);
+
+    /** Release the storage of layout, if any. */
+    static void FreeLayout(Layout *layout);
+
+    /** Wait until no reader has layout pinned. */
+    void WaitUnpinned(int layout) const;
+
+    /** Switch the writer to the layout prepared by Resize(). Writer only. */
+    void AdoptLayout(int next);
+
+    /** Copy the elements from begin up to end from one layout to another. */
+    static void CopyElements(const Layout &from, Layout *to, ring_buffer_pos_t begin, ring_buffer_pos_t end);
+
+    /** Fill regions for elementCount elements starting at position. */
+    static void GetRegions(const Layout &layout, ring_buffer_pos_t position, ring_buffer_size_t elementCount,
+                           RingBufferRegions *regions);
+
+    /** Oldest position whose element the writer has not started to overwrite. */
+    ring_buffer_pos_t GetOldestIntactPosition() const;
+};
+
+#endif /* BROADCAST_RING_BUFFER_H */
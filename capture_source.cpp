@@ -0,0 +1,204 @@
+#include "capture_source.h"
+#include "file_capture_source.h"
+#include "multi_device_capture_source.h"
+#include "pipe_capture_source.h"
+#if !defined(CAPTURE_NO_PORTAUDIO)
+#include "portaudio_capture_source.h"
+#endif
+#include "synthetic_capture_source.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+GeneratedCaptureSource::GeneratedCaptureSource(double speed, int block_ms)
+{
+    memset(&format_, 0, sizeof(format_));
+    sink_ = nullptr;
+    speed_ = speed;
+    block_ms_ = block_ms;
+    running_ = false;
+    num_frames_ = 0;
+}
+
+GeneratedCaptureSource::~GeneratedCaptureSource()
+{
+    // Derived classes stop the thread in their own destructors, before
+    // Generate() goes away; this only catches a missed Stop().
+    Stop();
+}
+
+bool GeneratedCaptureSource::Open(const CaptureFormat &format, Sink *sink)
+{
+    Stop();
+    format_ = format;
+    sink_ = sink;
+    error_.clear();
+    return Prepare(format);
+}
+
+bool GeneratedCaptureSource::Start()
+{
+    if (running_)
+    {
+        return true;
+    }
+    num_frames_ = 0;
+    start_time_ = std::chrono::steady_clock::now();
+    running_ = true;
+    if (sink_)
+    {
+        thread_ = std::thread(&GeneratedCaptureSource::ThreadMain, this);
+    }
+    return true;
+}
+
+void GeneratedCaptureSource::Stop()
+{
+    // A source blocked in Generate(), e.g. on an idle pipe, stops once its
+    // current block completes.
+    running_ = false;
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+void GeneratedCaptureSource::Close()
+{
+    Stop();
+    sink_ = nullptr;
+}
+
+unsigned long GeneratedCaptureSource::Read(void *frames, unsigned long frame_count, PaStreamCallbackFlags *status_flags)
+{
+    *status_flags = 0;
+    unsigned char *out = (unsigned char *)frames;
+    int bytes_per_frame = format_.GetBytesPerFrame();
+    unsigned long num_read = 0;
+    while (num_read < frame_count)
+    {
+        unsigned long n = Generate(out + num_read * bytes_per_frame, frame_count - num_read);
+        if (n == 0)
+        {
+            break;
+        }
+        num_read += n;
+    }
+    WaitForFrames(num_frames_ + num_read);
+    num_frames_ += num_read;
+    return num_read;
+}
+
+unsigned long GeneratedCaptureSource::GetReadAvailable()
+{
+    // Unpaced sources have everything at once; let the caller pick a size.
+    if (speed_ <= 0)
+    {
+        return 0;
+    }
+    long long due = (long long)(GetTime() * format_.sample_rate) - num_frames_;
+    return due > 0 ? (unsigned long)due : 0;
+}
+
+PaTime GeneratedCaptureSource::GetTime()
+{
+    if (speed_ <= 0)
+    {
+        return (PaTime)num_frames_ / format_.sample_rate;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time_;
+    return elapsed.count() * speed_;
+}
+
+void GeneratedCaptureSource::WaitForFrames(long long num_frames)
+{
+    if (speed_ <= 0)
+    {
+        return;
+    }
+    std::chrono::duration<double> source_time((double)num_frames / format_.sample_rate / speed_);
+    std::this_thread::sleep_until(start_time_ +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(source_time));
+}
+
+void GeneratedCaptureSource::ThreadMain()
+{
+    unsigned long frames_per_block = format_.frames_per_block;
+    if (frames_per_block == 0)
+    {
+        frames_per_block = (unsigned long)((long long)format_.sample_rate * block_ms_ / 1000);
+    }
+    if (frames_per_block == 0)
+    {
+        frames_per_block = 1;
+    }
+    std::vector<unsigned char> block(frames_per_block * format_.GetBytesPerFrame());
+
+    // Like a sound card, a block is delivered once its last frame has been
+    // captured, and stamped with the time of its first.
+    while (running_)
+    {
+        unsigned long n = Generate(block.data(), frames_per_block);
+        if (n == 0)
+        {
+            break;
+        }
+        long long first_frame = num_frames_;
+        WaitForFrames(first_frame + n);
+        sink_->OnCapture(block.data(), n, (PaTime)first_frame / format_.sample_rate, 0);
+        num_frames_ = first_frame + n;
+    }
+}
+
+std::unique_ptr<CaptureSource> CreateCaptureSource(const std::string &spec, double speed)
+{
+    std::string kind = spec.substr(0, spec.find(':'));
+    std::string arg = spec.find(':') == std::string::npos ? std::string() : spec.substr(spec.find(':') + 1);
+
+#if !defined(CAPTURE_NO_PORTAUDIO)
+    if (kind == "portaudio")
+    {
+        return std::unique_ptr<CaptureSource>(new PortAudioCaptureSource(atoi(arg.c_str())));
+    }
+#endif
+    if (kind == "file")
+    {
+        return std::unique_ptr<CaptureSource>(new FileCaptureSource(arg, true, speed));
+    }
+    if (kind == "synth")
+    {
+        SyntheticCaptureSource::Signal signal;
+        if (arg == "tone")
+            signal = SyntheticCaptureSource::kTone;
+        else if (arg == "noise")
+            signal = SyntheticCaptureSource::kNoise;
+        else if (arg == "speech")
+            signal = SyntheticCaptureSource::kSpeech;
+        else
+            return nullptr;
+        return std::unique_ptr<CaptureSource>(new SyntheticCaptureSource(signal, speed));
+    }
+    if (kind == "stdin")
+    {
+        return std::unique_ptr<CaptureSource>(new PipeCaptureSource(stdin));
+    }
+    if (kind == "multi")
+    {
+        std::vector<std::unique_ptr<CaptureSource>> sources;
+        size_t start = 0;
+        while (start <= arg.size())
+        {
+            size_t end = arg.find('+', start);
+            if (end == std::string::npos)
+                end = arg.size();
+            std::unique_ptr<CaptureSource> source = CreateCaptureSource(arg.substr(start, end - start), speed);
+            if (!source)
+                return nullptr;
+            sources.push_back(std::move(source));
+            start = end + 1;
+        }
+        return std::unique_ptr<CaptureSource>(new MultiDeviceCaptureSource(std::move(sources)));
+    }
+    return nullptr;
+}
@@ -0,0 +1,137 @@
+#ifndef CAPTURE_SOURCE_H
+#define CAPTURE_SOURCE_H
+
+#include <portaudio.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Interleaved PCM: integers, as Recorder serves them, or 32-bit floats in
+// [-1, 1] for Recorder's float capture mode.
+struct CaptureFormat
+{
+    int sample_rate;
+    int channels;
+    int bits_per_sample;
+
+    // Frames per block delivered to the sink, or 0 to let the source pick.
+    // Small blocks let Recorder release short frames as soon as they are
+    // complete.
+    unsigned long frames_per_block;
+
+    // paFloat32 samples; bits_per_sample is then 32.
+    bool float_samples;
+
+    int GetBytesPerFrame() const { return channels * (bits_per_sample / 8); }
+};
+
+// Where Recorder gets its audio from. A source either pushes blocks to a
+// Sink from its own thread once started (callback mode, used with the ring
+// buffer), or is pulled from with Read() (blocking mode).
+class CaptureSource
+{
+public:
+    // Receives the blocks of a source opened in callback mode.
+    class Sink
+    {
+    public:
+        virtual ~Sink() {}
+
+        // Called on the source's thread, one block at a time. |capture_time|
+        // is when the first frame was captured, on the GetTime() clock.
+        virtual void OnCapture(const void *frames, unsigned long frame_count,
+                               PaTime capture_time, PaStreamCallbackFlags status_flags) = 0;
+    };
+
+    virtual ~CaptureSource() {}
+
+    // Prepares to capture |format|. With a |sink| the source calls it once
+    // started; with nullptr the source is read with Read().
+    virtual bool Open(const CaptureFormat &format, Sink *sink) = 0;
+    virtual bool Start() = 0;
+    virtual void Stop() = 0;
+    virtual void Close() = 0;
+
+    // Blocking mode: waits for |frame_count| frames and copies them to
+    // |frames|. Returns the number of frames read, less at the end of input.
+    // |status_flags| receives paInputOverflow if input was lost before them.
+    virtual unsigned long Read(void *frames, unsigned long frame_count, PaStreamCallbackFlags *status_flags) = 0;
+
+    // Blocking mode: frames Read() can return without waiting, or 0 if the
+    // source cannot tell.
+    virtual unsigned long GetReadAvailable() = 0;
+
+    // Current time on the clock capture times are on, in seconds.
+    virtual PaTime GetTime() = 0;
+
+    // Time from capturing a frame to Read() returning it, in seconds.
+    virtual PaTime GetInputLatency() = 0;
+
+    // Why the last Open() or Start() failed.
+    const std::string &GetError() const { return error_; }
+
+protected:
+    std::string error_;
+};
+
+// Base for sources that make their frames in software. A thread hands
+// blocks of CaptureFormat::frames_per_block, or else of |block_ms|, to the
+// sink, paced to |speed| times real time, so the pipeline can be driven
+// faster than real time; speed 0 delivers as fast as the sink takes them.
+// The source clock runs at the same speed, so capture times stay
+// consistent with GetTime().
+class GeneratedCaptureSource : public CaptureSource
+{
+    CaptureFormat format_;
+    Sink *sink_;
+    double speed_;
+    int block_ms_;
+
+    std::thread thread_;
+    std::atomic<bool> running_;
+
+    // Frames produced since Start(), and when Start() was called.
+    std::atomic<long long> num_frames_;
+    std::chrono::steady_clock::time_point start_time_;
+
+public:
+    explicit GeneratedCaptureSource(double speed = 1.0, int block_ms = 10);
+    ~GeneratedCaptureSource() override;
+
+    bool Open(const CaptureFormat &format, Sink *sink) override;
+    bool Start() override;
+    void Stop() override;
+    void Close() override;
+    unsigned long Read(void *frames, unsigned long frame_count, PaStreamCallbackFlags *status_flags) override;
+    unsigned long GetReadAvailable() override;
+    PaTime GetTime() override;
+    PaTime GetInputLatency() override { return 0; }
+
+protected:
+    // Checks that the source can produce |format|. Sets error_ if not.
+    virtual bool Prepare(const CaptureFormat &format) = 0;
+
+    // Produces up to |frame_count| frames. Returns the number produced,
+    // 0 at the end of the input.
+    virtual unsigned long Generate(void *frames, unsigned long frame_count) = 0;
+
+    const CaptureFormat &format() const { return format_; }
+
+private:
+    // Sleeps until |num_frames| frames' worth of source time has passed.
+    void WaitForFrames(long long num_frames);
+
+    void ThreadMain();
+};
+
+// Creates a source from a spec such as "portaudio:3", "file:speech.wav",
+// "synth:tone", "synth:noise", "synth:speech" or "stdin", or merges several
+// into one multichannel source with "multi:portaudio:1+portaudio:3". |speed|
+// paces the file and synthetic sources; 0 runs them as fast as possible.
+// Returns nullptr for an unknown spec, and for "portaudio" when built with
+// CAPTURE_NO_PORTAUDIO.
+std::unique_ptr<CaptureSource> CreateCaptureSource(const std::string &spec, double speed = 1.0);
+
+#endif
@@ -0,0 +1,288 @@
+// Headless driver for the capture pipeline.
+//
+// Opens a Recorder on any source CreateCaptureSource() understands, runs it
+// with the processing the server uses, and reads it the way a client does,
+// without the dialog, the sockets or a sound card. Reports what it got on
+// stderr and can write the PCM a client would receive to a file. With a file
+// or synthetic source and -speed 0 -blocking it runs as fast as the
+// pipeline can go, so the whole chain can be checked and timed offline.
+//
+// capture_driver check runs the cross-checks in checks.cpp instead, which
+// hold the signal processing against slow references.
+//
+// Usage: capture_driver <source> [options]
+//   <source>            portaudio:N, file:speech.wav, synth:tone|noise|speech,
+//                       stdin or multi:a+b, see CreateCaptureSource()
+//   -seconds S          stream time to capture (default 10)
+//   -rate N             rate clients get (default 16000)
+//   -channels N         (default 1)
+//   -bits N             (default 16)
+//   -capture-rate N     capture at N and resample to -rate
+//   -speed X            pace file and synthetic sources at X times real
+//                       time, 0 for as fast as possible (default 1)
+//   -frame-ms N         read frames of N ms (default 10)
+//   -blocking           pull from the source instead of the ring buffer
+//   -agc                automatic gain control
+//   -vad                voice activity detection
+//   -lipsync            run the feature engine and lip-sync stream (needs
+//                       the ring buffer)
+//   -out FILE           write the PCM read to FILE, - for stdout
+//        capture_driver check [name|all]
+//
+// Built with CAPTURE_NO_PORTAUDIO it needs no PortAudio library, and only
+// the portaudio: source is unavailable.
+
+#include "../capture_source.h"
+#include "../feature_engine.h"
+#include "../lip_sync_stream.h"
+#include "../recorder.h"
+#include "checks.h"
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options
+{
+    std::string source;
+    double seconds = 10;
+    int sample_rate = 16000;
+    int channels = 1;
+    int bits_per_sample = 16;
+    int capture_rate = 0;
+    double speed = 1;
+    int frame_ms = 10;
+    bool blocking = false;
+    bool agc = false;
+    bool vad = false;
+    bool lip_sync = false;
+    std::string out;
+};
+
+bool ParseOptions(int argc, char *argv[], Options *options)
+{
+    if (argc < 2 || argv[1][0] == '-')
+        return false;
+    options->source = argv[1];
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (arg == "-blocking")
+            options->blocking = true;
+        else if (arg == "-agc")
+            options->agc = true;
+        else if (arg == "-vad")
+            options->vad = true;
+        else if (arg == "-lipsync")
+            options->lip_sync = true;
+        else if (!value)
+            return false;
+        else
+        {
+            i++;
+            if (arg == "-seconds")
+                options->seconds = atof(value);
+            else if (arg == "-rate")
+                options->sample_rate = atoi(value);
+            else if (arg == "-channels")
+                options->channels = atoi(value);
+            else if (arg == "-bits")
+                options->bits_per_sample = atoi(value);
+            else if (arg == "-capture-rate")
+                options->capture_rate = atoi(value);
+            else if (arg == "-speed")
+                options->speed = atof(value);
+            else if (arg == "-frame-ms")
+                options->frame_ms = atoi(value);
+            else if (arg == "-out")
+                options->out = value;
+            else
+                return false;
+        }
+    }
+    return true;
+}
+
+// Counts the lip-sync frames published while the driver reads, and how
+// often each viseme led.
+struct LipSyncCounts
+{
+    long long num_frames = 0;
+    long long num_voiced = 0;
+    long long num_leading[stream_protocol::kNumVisemes] = {};
+
+    void Add(const stream_protocol::LipSyncFrame &frame)
+    {
+        num_frames++;
+        if (frame.vowel & stream_protocol::kLipSyncVoice)
+            num_voiced++;
+        int leading = 0;
+        for (int v = 1; v < stream_protocol::kNumVisemes; v++)
+        {
+            if (frame.visemes[v] > frame.visemes[leading])
+                leading = v;
+        }
+        num_leading[leading]++;
+    }
+};
+
+int Run(const Options &options)
+{
+    std::unique_ptr<CaptureSource> source = CreateCaptureSource(options.source, options.speed);
+    if (!source)
+    {
+        fprintf(stderr, "unknown source %s\n", options.source.c_str());
+        return 1;
+    }
+    if (options.lip_sync && options.blocking)
+    {
+        fprintf(stderr, "-lipsync needs the ring buffer\n");
+        return 1;
+    }
+
+    FILE *out = nullptr;
+    if (options.out == "-")
+        out = stdout;
+    else if (!options.out.empty() && !(out = fopen(options.out.c_str(), "wb")))
+    {
+        fprintf(stderr, "cannot write %s\n", options.out.c_str());
+        return 1;
+    }
+
+    Recorder recorder(!options.blocking);
+    recorder.SetFrameDuration(options.frame_ms);
+    recorder.SetCaptureSampleRate(options.capture_rate);
+    recorder.SetGainControl(options.agc);
+    recorder.SetVoiceDetection(options.vad);
+    if (!recorder.Open(std::move(source), options.sample_rate, options.channels, options.bits_per_sample))
+    {
+        fprintf(stderr, "cannot open %s\n", options.source.c_str());
+        return 1;
+    }
+
+    LipSyncStream lip_sync;
+    FeatureEngine features;
+    LipSyncStream::Reader lip_sync_reader;
+    LipSyncCounts lip_sync_counts;
+    if (options.lip_sync)
+    {
+        features.AddStage(&lip_sync);
+        lip_sync.Subscribe(&lip_sync_reader);
+        if (!features.Start(&recorder))
+        {
+            fprintf(stderr, "cannot start the feature engine\n");
+            return 1;
+        }
+    }
+
+    Recorder::Reader reader;
+    recorder.Subscribe(&reader);
+
+    // Reads until the stream time is up, or the source has had nothing for
+    // a second, e.g. at the end of a file.
+    const int kMaxEmptyReads = 10;
+    long long target_samples = (long long)(options.seconds * options.sample_rate);
+    long long num_samples = 0;
+    long long num_voiced_samples = 0;
+    long long num_reads = 0;
+    int num_empty_reads = 0;
+    size_t bytes_per_frame = recorder.GetWireFormat().GetBytesPerFrame();
+    std::vector<unsigned char> data;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (num_samples < target_samples && num_empty_reads < kMaxEmptyReads)
+    {
+        Recorder::CaptureInfo info;
+        recorder.Read(&reader, &data, &info);
+        if (data.empty())
+        {
+            num_empty_reads++;
+            continue;
+        }
+        num_empty_reads = 0;
+        num_reads++;
+        long long n = (long long)(data.size() / bytes_per_frame);
+        num_samples += n;
+        if (info.voice)
+            num_voiced_samples += n;
+        if (out)
+            fwrite(data.data(), 1, data.size(), out);
+
+        LipSyncStream::Entry entry;
+        while (options.lip_sync && lip_sync_reader.GetReadAvailable() > 0 && lip_sync_reader.Read(&entry, 1) == 1)
+            lip_sync_counts.Add(entry.frame);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (options.lip_sync)
+        features.Stop();
+    ring_buffer_pos_t num_lost_samples = reader.GetLostSamples();
+    recorder.Close();
+    if (out && out != stdout)
+        fclose(out);
+
+    double stream_seconds = (double)num_samples / options.sample_rate;
+    fprintf(stderr, "%lld samples (%.2f s) in %lld reads, %lld lost\n", num_samples, stream_seconds, num_reads,
+            (long long)num_lost_samples);
+    fprintf(stderr, "%.2f s wall time, %.1fx real time\n", elapsed, elapsed > 0 ? stream_seconds / elapsed : 0);
+    if (options.vad)
+    {
+        fprintf(stderr, "voice in %.1f%% of samples\n",
+                num_samples > 0 ? 100.0 * num_voiced_samples / num_samples : 0.0);
+    }
+    if (options.lip_sync)
+    {
+        static const char *const kVisemeNames[stream_protocol::kNumVisemes] = {
+            "rest", "a", "e", "i", "o", "u", "fricative"};
+        fprintf(stderr, "%lld lip-sync frames, %lld voiced; leading viseme:", lip_sync_counts.num_frames,
+                lip_sync_counts.num_voiced);
+        for (int v = 0; v < stream_protocol::kNumVisemes; v++)
+            fprintf(stderr, " %s %lld", kVisemeNames[v], lip_sync_counts.num_leading[v]);
+        fprintf(stderr, "\n");
+    }
+    return num_samples > 0 ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    // Lets the console logger print non-ASCII paths and errors.
+    setlocale(LC_CTYPE, "");
+
+    if (argc > 1 && strcmp(argv[1], "check") == 0)
+    {
+        if (argc > 3)
+        {
+            fprintf(stderr, "usage: capture_driver check [name|all]\n");
+            checks::PrintNames();
+            return 2;
+        }
+        return checks::Run(argc > 2 ? argv[2] : "all") ? 0 : 1;
+    }
+
+    Options options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        fprintf(stderr, "usage: capture_driver <source> [-seconds S] [-rate N] [-channels N] [-bits N]\n"
+                        "       [-capture-rate N] [-speed X] [-frame-ms N] [-blocking] [-agc] [-vad]\n"
+                        "       [-lipsync] [-out FILE]\n"
+                        "       capture_driver check [name|all]\n");
+        checks::PrintNames();
+        return 2;
+    }
+
+#if !defined(CAPTURE_NO_PORTAUDIO)
+    Pa_Initialize();
+#endif
+    int result = Run(options);
+#if !defined(CAPTURE_NO_PORTAUDIO)
+    Pa_Terminate();
+#endif
+    return result;
+}
@@ -0,0 +1,555 @@
+#include "checks.h"
+#include "../automatic_gain_control.h"
+#include "../fft.h"
+#include "../lip_sync_analyzer.h"
+#include "../pcm_kernels.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+namespace {
+
+/***************************************************************************
+ * SIMD kernels.
+ */
+
+const char *const kSimdLevelNames[] = {"scalar", "sse2", "avx2", "avx512"};
+
+// Largest differences between a kernel set and the scalar one: integer
+// outputs in LSBs, the rest absolute, dot relative to the sum of the
+// magnitudes of its products.
+struct KernelErrors
+{
+    long long pcm_lsb = 0;
+    float mul_add = 0;
+    float dot = 0;
+    float butterfly = 0;
+    float peak = 0;
+    float ramp = 0;
+};
+
+template <typename T>
+void CheckExact(const T *a, const T *b, size_t count, long long *max_error)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        long long error = (long long)a[i] - (long long)b[i];
+        *max_error = std::max(*max_error, error < 0 ? -error : error);
+    }
+}
+
+void CheckClose(const float *a, const float *b, size_t count, float *max_error)
+{
+    for (size_t i = 0; i < count; i++)
+        *max_error = std::max(*max_error, fabsf(a[i] - b[i]));
+}
+
+// Runs every kernel of |kernels| and the scalar ones on the same random
+// input, for every count up to a few vectors past the widest one and a
+// long run, starting at every offset within a vector so unaligned heads
+// and every tail length are covered.
+KernelErrors CompareKernels(const pcm::Kernels &kernels, std::mt19937 *random)
+{
+    const pcm::Kernels &reference = pcm::scalar::kKernels;
+    const size_t kMaxOffset = 16;
+    std::vector<size_t> counts;
+    for (size_t count = 0; count <= 80; count++)
+        counts.push_back(count);
+    counts.push_back(1000);
+    counts.push_back(4099);
+
+    // Past full scale on purpose, so clipping is compared too.
+    std::uniform_real_distribution<float> sample(-1.25f, 1.25f);
+    std::uniform_int_distribution<int32_t> int32(INT32_MIN, INT32_MAX);
+
+    KernelErrors errors;
+    size_t size = counts.back() + kMaxOffset;
+    std::vector<float> in(size), in2(size), in3(size), in4(size), out_a(size), out_b(size);
+    std::vector<float> re_a(size), im_a(size), re_b(size), im_b(size), re_c(size), im_c(size), re_d(size),
+        im_d(size);
+    std::vector<int8_t> i8_a(size), i8_b(size);
+    std::vector<int16_t> pcm16(size), i16_a(size), i16_b(size);
+    std::vector<int32_t> pcm32(size), i32_a(size), i32_b(size);
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        size_t count = counts[i];
+        size_t offset = i % kMaxOffset;
+        for (size_t j = 0; j < size; j++)
+        {
+            in[j] = sample(*random);
+            in2[j] = sample(*random);
+            in3[j] = sample(*random);
+            in4[j] = sample(*random);
+            pcm16[j] = (int16_t)int32(*random);
+            pcm32[j] = int32(*random);
+        }
+        const float *x = &in[offset];
+
+        kernels.float_to_int8(x, count, &i8_a[offset]);
+        reference.float_to_int8(x, count, &i8_b[offset]);
+        CheckExact(&i8_a[offset], &i8_b[offset], count, &errors.pcm_lsb);
+
+        kernels.float_to_int16(x, count, &i16_a[offset]);
+        reference.float_to_int16(x, count, &i16_b[offset]);
+        CheckExact(&i16_a[offset], &i16_b[offset], count, &errors.pcm_lsb);
+
+        kernels.float_to_int32(x, count, &i32_a[offset]);
+        reference.float_to_int32(x, count, &i32_b[offset]);
+        CheckExact(&i32_a[offset], &i32_b[offset], count, &errors.pcm_lsb);
+
+        // Integer to float is exact at every level, so compare bit for bit.
+        float int_error = 0;
+        kernels.int16_to_float(&pcm16[offset], count, &out_a[offset]);
+        reference.int16_to_float(&pcm16[offset], count, &out_b[offset]);
+        CheckClose(&out_a[offset], &out_b[offset], count, &int_error);
+        kernels.int32_to_float(&pcm32[offset], count, &out_a[offset]);
+        reference.int32_to_float(&pcm32[offset], count, &out_b[offset]);
+        CheckClose(&out_a[offset], &out_b[offset], count, &int_error);
+        if (int_error > 0)
+            errors.pcm_lsb = std::max(errors.pcm_lsb, 1LL);
+
+        std::copy(in2.begin(), in2.end(), out_a.begin());
+        std::copy(in2.begin(), in2.end(), out_b.begin());
+        kernels.mul_add(x, 0.37f, count, &out_a[offset]);
+        reference.mul_add(x, 0.37f, count, &out_b[offset]);
+        CheckClose(&out_a[offset], &out_b[offset], count, &errors.mul_add);
+
+        float magnitude = 0;
+        for (size_t j = 0; j < count; j++)
+            magnitude += fabsf(x[j] * in2[offset + j]);
+        float dot_error = fabsf(kernels.dot(x, &in2[offset], count) - reference.dot(x, &in2[offset], count));
+        if (magnitude > 0)
+            errors.dot = std::max(errors.dot, dot_error / magnitude);
+
+        // Unit twiddles, as the FFT has them.
+        for (size_t j = 0; j < size; j++)
+        {
+            re_a[j] = re_c[j] = in[j];
+            im_a[j] = im_c[j] = in2[j];
+            re_b[j] = re_d[j] = in3[j];
+            im_b[j] = im_d[j] = in4[j];
+            out_a[j] = cosf(in[j] * 3);
+            out_b[j] = -sinf(in[j] * 3);
+        }
+        kernels.butterfly(&re_a[offset], &im_a[offset], &re_b[offset], &im_b[offset], &out_a[offset],
+                          &out_b[offset], count);
+        reference.butterfly(&re_c[offset], &im_c[offset], &re_d[offset], &im_d[offset], &out_a[offset],
+                            &out_b[offset], count);
+        CheckClose(&re_a[offset], &re_c[offset], count, &errors.butterfly);
+        CheckClose(&im_a[offset], &im_c[offset], count, &errors.butterfly);
+        CheckClose(&re_b[offset], &re_d[offset], count, &errors.butterfly);
+        CheckClose(&im_b[offset], &im_d[offset], count, &errors.butterfly);
+
+        errors.peak = std::max(errors.peak, fabsf(kernels.peak(x, count) - reference.peak(x, count)));
+
+        std::copy(in.begin(), in.end(), out_a.begin());
+        std::copy(in.begin(), in.end(), out_b.begin());
+        kernels.ramp(&out_a[offset], count, 0.5f, 1.0f / 4096);
+        reference.ramp(&out_b[offset], count, 0.5f, 1.0f / 4096);
+        CheckClose(&out_a[offset], &out_b[offset], count, &errors.ramp);
+    }
+    return errors;
+}
+
+// Every kernel set the CPU supports must match the scalar kernels: the
+// conversions exactly, the float kernels to within the rounding that
+// evaluation order and fused multiply-adds allow.
+bool CheckSimd()
+{
+    pcm::SetSimdLevel(pcm::kAvx512);
+    pcm::SimdLevel best = pcm::GetSimdLevel();
+    std::mt19937 random(1);
+    bool ok = true;
+    for (int level = pcm::kSse2; level <= best; level++)
+    {
+        pcm::SetSimdLevel((pcm::SimdLevel)level);
+        KernelErrors errors = CompareKernels(pcm::GetKernels(), &random);
+        bool level_ok = errors.pcm_lsb == 0 && errors.mul_add <= 1e-6f && errors.dot <= 1e-5f &&
+                        errors.butterfly <= 1e-5f && errors.peak == 0 && errors.ramp <= 1e-6f;
+        printf("simd %-7s pcm %lld LSB, mul_add %.2g, dot %.2g, butterfly %.2g, peak %.2g, ramp %.2g: %s\n",
+               kSimdLevelNames[level], errors.pcm_lsb, errors.mul_add, errors.dot, errors.butterfly, errors.peak,
+               errors.ramp, level_ok ? "ok" : "FAILED");
+        ok = ok && level_ok;
+    }
+    if (best == pcm::kScalar)
+        printf("simd    no vector kernels on this CPU\n");
+    pcm::SetSimdLevel(best);
+    return ok;
+}
+
+/***************************************************************************
+ * FFT.
+ */
+
+// Fft::Forward() and PowerSpectrum() against a direct DFT in double
+// precision, at every size from 4 to 4096 and every SIMD level. Errors are
+// relative to the norm of the input times the square root of the size,
+// the norm every bin is bounded by; a float FFT stays within a few float
+// epsilons of it times log2 of the size.
+bool CheckFft()
+{
+    const double kPi = 3.14159265358979323846;
+    pcm::SetSimdLevel(pcm::kAvx512);
+    pcm::SimdLevel best = pcm::GetSimdLevel();
+    std::mt19937 random(2);
+    std::uniform_real_distribution<float> sample(-1.0f, 1.0f);
+    bool ok = true;
+    for (size_t size = 4; size <= 4096; size *= 2)
+    {
+        std::vector<float> in(size);
+        double norm = 0;
+        for (size_t t = 0; t < size; t++)
+        {
+            in[t] = sample(random);
+            norm += (double)in[t] * in[t];
+        }
+        double scale = sqrt(norm * size);
+
+        std::vector<std::complex<double>> reference(size / 2 + 1);
+        for (size_t k = 0; k <= size / 2; k++)
+        {
+            std::complex<double> sum = 0;
+            for (size_t t = 0; t < size; t++)
+                sum += (double)in[t] * std::polar(1.0, -2 * kPi * (double)((k * t) % size) / size);
+            reference[k] = sum;
+        }
+
+        double max_error = 0;
+        double max_power_error = 0;
+        for (int level = pcm::kScalar; level <= best; level++)
+        {
+            pcm::SetSimdLevel((pcm::SimdLevel)level);
+            Fft fft;
+            fft.Configure(size);
+            std::vector<std::complex<float>> out(size / 2 + 1);
+            std::vector<float> power(size / 2 + 1);
+            fft.Forward(in.data(), out.data());
+            fft.PowerSpectrum(in.data(), power.data());
+            for (size_t k = 0; k <= size / 2; k++)
+            {
+                max_error = std::max(max_error, std::abs(reference[k] - std::complex<double>(out[k])) / scale);
+                max_power_error =
+                    std::max(max_power_error, fabs(std::norm(reference[k]) - power[k]) / (scale * scale));
+            }
+        }
+        int log2_size = 0;
+        while ((size_t)1 << log2_size < size)
+            log2_size++;
+        bool size_ok = max_error <= 1e-6 * log2_size && max_power_error <= 1e-6 * log2_size;
+        printf("fft %4zu max error %.2g, power %.2g: %s\n", size, max_error, max_power_error,
+               size_ok ? "ok" : "FAILED");
+        ok = ok && size_ok;
+    }
+    pcm::SetSimdLevel(best);
+    return ok;
+}
+
+/***************************************************************************
+ * Lip sync.
+ */
+
+// Peterson and Barney formants of the vowels LipSyncAnalyzer tells apart,
+// in stream_protocol::Vowel order.
+const float kVowelFormants[][2] = {
+    {730.0f, 1090.0f}, // A
+    {530.0f, 1840.0f}, // E
+    {270.0f, 2290.0f}, // I
+    {570.0f, 840.0f},  // O
+    {300.0f, 870.0f},  // U
+};
+const int kNumVowels = sizeof(kVowelFormants) / sizeof(kVowelFormants[0]);
+
+// One second of faint noise, a second of each vowel as a voice at |pitch|
+// whose harmonics are shaped by the vowel's formants, and a second of loud
+// noise, which should come out as a fricative.
+std::vector<float> MakeVowels(int sample_rate, int pitch, std::mt19937 *random)
+{
+    const double kPi = 3.14159265358979323846;
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+    std::vector<float> samples((size_t)sample_rate * (kNumVowels + 2));
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        double t = (double)i / sample_rate;
+        int segment = (int)t;
+        double x = 0.001 * noise(*random);
+        if (segment >= 1 && segment <= kNumVowels)
+        {
+            const float *formants = kVowelFormants[segment - 1];
+            for (int h = 1; h * pitch < 4000; h++)
+            {
+                double f = (double)h * pitch;
+                double gain = 1 / (1 + pow((f - formants[0]) / 80, 2)) + 0.7 / (1 + pow((f - formants[1]) / 120, 2));
+                x += 0.05 * gain * sin(2 * kPi * f * t);
+            }
+        }
+        else if (segment == kNumVowels + 1)
+        {
+            x += 0.2 * noise(*random) * (i % 2 ? 1 : -1);
+        }
+        samples[i] = (float)x;
+    }
+    return samples;
+}
+
+// Runs LipSyncAnalyzer on MakeVowels() at 16 and 48 kHz, for a low and a
+// higher voice, and checks, in every second after the first 300 ms, which
+// hops it calls voice, which vowel it picks most and which viseme leads
+// most. Above about 200 Hz the harmonics are too far apart to place the
+// first formant of o and u.
+bool CheckLipSync()
+{
+    const char *const kVowelNames[] = {"none", "a", "e", "i", "o", "u"};
+    const int kSettleHops = 30;
+    bool ok = true;
+    const int kRuns[][2] = {{16000, 120}, {16000, 180}, {48000, 120}, {48000, 180}};
+    for (const int *run : kRuns)
+    {
+        int sample_rate = run[0];
+        int pitch = run[1];
+        FeatureExtractor extractor;
+        LipSyncAnalyzer analyzer;
+        if (!extractor.Configure(sample_rate) || !analyzer.Configure(extractor))
+        {
+            printf("lipsync %d Hz: cannot configure: FAILED\n", sample_rate);
+            ok = false;
+            continue;
+        }
+        std::mt19937 random(3);
+        std::vector<float> samples = MakeVowels(sample_rate, pitch, &random);
+        size_t hop_size = extractor.GetHopSize();
+        size_t hops_per_second = sample_rate / hop_size;
+
+        for (int segment = 0; segment < kNumVowels + 2; segment++)
+        {
+            int num_voiced = 0;
+            int num_hops = 0;
+            int vowel_counts[kNumVowels + 1] = {};
+            int viseme_counts[stream_protocol::kNumVisemes] = {};
+            for (size_t hop = 0; hop < hops_per_second; hop++)
+            {
+                size_t first = (segment * hops_per_second + hop) * hop_size;
+                stream_protocol::LipSyncFrame frame;
+                analyzer.Analyze(extractor.Analyze(&samples[first], first), &frame);
+                if ((int)hop < kSettleHops)
+                    continue;
+                num_hops++;
+                num_voiced += (frame.vowel & stream_protocol::kLipSyncVoice) != 0;
+                vowel_counts[frame.vowel & 0x0f]++;
+                int leading = 0;
+                for (int v = 1; v < stream_protocol::kNumVisemes; v++)
+                {
+                    if (frame.visemes[v] > frame.visemes[leading])
+                        leading = v;
+                }
+                viseme_counts[leading]++;
+            }
+            int vowel = (int)(std::max_element(vowel_counts, vowel_counts + kNumVowels + 1) - vowel_counts);
+            int viseme = (int)(std::max_element(viseme_counts, viseme_counts + stream_protocol::kNumVisemes) -
+                               viseme_counts);
+
+            const char *what;
+            bool segment_ok;
+            if (segment == 0)
+            {
+                what = "silence";
+                segment_ok = num_voiced == 0 && viseme == stream_protocol::kVisemeRest;
+            }
+            else if (segment <= kNumVowels)
+            {
+                what = kVowelNames[segment];
+                segment_ok = num_voiced == num_hops && vowel == segment &&
+                             viseme == stream_protocol::kVisemeA + segment - 1;
+            }
+            else
+            {
+                what = "noise";
+                segment_ok = viseme == stream_protocol::kVisemeFricative;
+            }
+            printf("lipsync %d Hz, %d Hz voice, %-7s voiced %3d/%d, vowel %s, viseme %d: %s\n", sample_rate, pitch,
+                   what, num_voiced, num_hops, kVowelNames[vowel], viseme, segment_ok ? "ok" : "FAILED");
+            ok = ok && segment_ok;
+        }
+    }
+    return ok;
+}
+
+/***************************************************************************
+ * Gain control.
+ */
+
+// Level in dBFS of channel 0 of |num_frames| interleaved frames.
+double GetLevelDb(const float *frames, size_t num_frames, int channels)
+{
+    double sum = 0;
+    for (size_t i = 0; i < num_frames; i++)
+        sum += (double)frames[i * channels] * frames[i * channels];
+    return 10 * log10(sum / num_frames + 1e-20);
+}
+
+// Runs AutomaticGainControl with the default options on 8 s of 48 kHz
+// stereo: bursts of a tremolo tone, 1 s on and 0.5 s of faint noise off,
+// starting over at about -51 dBFS for 4 s and at -15 dBFS with a
+// full-scale click for another 4. At every SIMD level it checks that
+// - no output sample goes over the ceiling,
+// - the level over 300 ms near the end of each burst after the first at a
+//   level is within 1 dB of the target, as far as the gain range allows,
+// - the gain moves by less than 3 dB over a pause, so the gate holds it,
+// - the output matches the scalar kernels' to within float rounding.
+bool CheckGainControl()
+{
+    const double kPi = 3.14159265358979323846;
+    const int kSampleRate = 48000;
+    const int kChannels = 2;
+    const size_t kChunkFrames = 480;
+    const double kBurstSeconds = 1.0;
+    const double kPeriodSeconds = 1.5;
+    const double kLevelSeconds = 4.0;
+    const double kSeconds = 8.0;
+
+    AutomaticGainControl::Options options;
+    std::mt19937 random(4);
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+    size_t num_frames = (size_t)(kSeconds * kSampleRate);
+    std::vector<float> in(num_frames * kChannels);
+    for (size_t i = 0; i < num_frames; i++)
+    {
+        double t = (double)i / kSampleRate;
+        double amplitude = t < kLevelSeconds ? 0.0056 : 0.35;
+        bool on = fmod(fmod(t, kLevelSeconds), kPeriodSeconds) < kBurstSeconds;
+        double x = on ? amplitude * sin(2 * kPi * 220 * t) * (0.6 + 0.4 * sin(2 * kPi * 3 * t))
+                      : 0.0003 * noise(random);
+        if (i == (size_t)(5.7 * kSampleRate))
+            x = 0.99;
+        for (int c = 0; c < kChannels; c++)
+            in[i * kChannels + c] = (float)(c ? 0.8 * x : x);
+    }
+
+    pcm::SetSimdLevel(pcm::kAvx512);
+    pcm::SimdLevel best = pcm::GetSimdLevel();
+    std::vector<float> scalar_out;
+    float ceiling = powf(10.0f, options.ceiling_db / 20);
+    bool ok = true;
+    for (int level = pcm::kScalar; level <= best; level++)
+    {
+        pcm::SetSimdLevel((pcm::SimdLevel)level);
+        AutomaticGainControl agc;
+        agc.Configure(kSampleRate, kChannels, options);
+        std::vector<float> out(in);
+        std::vector<float> gains_db;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t first = 0; first < num_frames; first += kChunkFrames)
+        {
+            agc.Process(&out[first * kChannels], std::min(kChunkFrames, num_frames - first));
+            gains_db.push_back(agc.GetGainDb());
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        float peak = 0;
+        for (float x : out)
+            peak = std::max(peak, fabsf(x));
+        bool level_ok = peak <= ceiling * 1.0001f;
+        printf("agc %-7s peak %.2f dBFS (ceiling %.1f), %.3f%% of a core: %s\n", kSimdLevelNames[level],
+               20 * log10f(peak), options.ceiling_db, 100 * elapsed / kSeconds, level_ok ? "ok" : "FAILED");
+
+        // Output frame i + delay is input frame i.
+        size_t delay = agc.GetDelayFrames();
+        for (double burst : {1.5, 3.0, 5.5, 7.0})
+        {
+            size_t first = (size_t)((burst + kBurstSeconds - 0.35) * kSampleRate);
+            size_t count = (size_t)(0.3 * kSampleRate);
+            double in_db = GetLevelDb(&in[first * kChannels], count, kChannels);
+            double out_db = GetLevelDb(&out[(first + delay) * kChannels], count, kChannels);
+            double gain_db = std::min<double>(std::max<double>(options.target_db - in_db, options.min_gain_db),
+                                              options.max_gain_db);
+            bool burst_ok = fabs(out_db - (in_db + gain_db)) <= 1;
+            printf("agc %-7s burst at %.1f s: in %.1f dBFS, out %.1f dBFS, expected %.1f: %s\n",
+                   kSimdLevelNames[level], burst, in_db, out_db, in_db + gain_db, burst_ok ? "ok" : "FAILED");
+            level_ok = level_ok && burst_ok;
+        }
+
+        // Gains at the ends of the chunks just before and after each pause.
+        for (double pause : {1.0, 2.5, 5.0, 6.5})
+        {
+            size_t before = (size_t)(pause * kSampleRate + delay) / kChunkFrames;
+            size_t after = (size_t)((pause + kPeriodSeconds - kBurstSeconds) * kSampleRate + delay) / kChunkFrames;
+            if (after >= gains_db.size())
+                break;
+            float drift = gains_db[after - 1] - gains_db[before];
+            bool pause_ok = fabsf(drift) < 3;
+            printf("agc %-7s pause at %.1f s: gain %+.1f dB to %+.1f dB: %s\n", kSimdLevelNames[level], pause,
+                   gains_db[before], gains_db[after - 1], pause_ok ? "ok" : "FAILED");
+            level_ok = level_ok && pause_ok;
+        }
+
+        if (level == pcm::kScalar)
+        {
+            scalar_out = out;
+        }
+        else
+        {
+            float max_error = 0;
+            CheckClose(out.data(), scalar_out.data(), out.size(), &max_error);
+            bool same = max_error <= 1e-5f;
+            printf("agc %-7s max difference from scalar %.2g: %s\n", kSimdLevelNames[level], max_error,
+                   same ? "ok" : "FAILED");
+            level_ok = level_ok && same;
+        }
+        ok = ok && level_ok;
+    }
+    pcm::SetSimdLevel(best);
+    return ok;
+}
+
+/***************************************************************************
+ * Registry.
+ */
+
+struct Check
+{
+    const char *name;
+    const char *description;
+    bool (*run)();
+};
+
+const Check kChecks[] = {
+    {"simd", "every SIMD kernel set against the scalar kernels", CheckSimd},
+    {"fft", "the FFT against a direct DFT at every SIMD level", CheckFft},
+    {"lipsync", "lip-sync vowels and visemes of synthetic vowels", CheckLipSync},
+    {"agc", "gain control levels, ceiling and gate at every SIMD level", CheckGainControl},
+};
+
+}
+
+namespace checks {
+
+bool Run(const std::string &name)
+{
+    bool found = false;
+    bool ok = true;
+    for (const Check &check : kChecks)
+    {
+        if (name != "all" && name != check.name)
+            continue;
+        found = true;
+        ok = check.run() && ok;
+    }
+    if (!found)
+    {
+        fprintf(stderr, "unknown check %s\n", name.c_str());
+        return false;
+    }
+    return ok;
+}
+
+void PrintNames()
+{
+    for (const Check &check : kChecks)
+        fprintf(stderr, "  %-10s %s\n", check.name, check.description);
+    fprintf(stderr, "  %-10s all of them\n", "all");
+}
+
+}
@@ -0,0 +1,20 @@
+#ifndef CHECKS_H
+#define CHECKS_H
+
+#include <string>
+
+// Cross-checks of the signal processing against references that are too
+// slow or too simple for the pipeline itself, run by capture_driver check.
+namespace checks {
+
+// Runs the check |name|, or every check for "all". Prints what each one
+// measured on stdout and returns false if any is out of tolerance or the
+// name is unknown.
+bool Run(const std::string &name);
+
+// Lists the checks on stderr, for the usage message.
+void PrintNames();
+
+}
+
+#endif
@@ -0,0 +1,41 @@
+#include "../logger.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+// logger for the console driver: one line per message on stderr. Converts
+// to the locale's multibyte encoding, so stderr stays a byte stream the
+// driver's own fprintf() calls can share.
+namespace logger {
+
+void Log(const wchar_t* fmt, ...)
+{
+    wchar_t buf[512] = { 0 };
+    va_list arg;
+    va_start(arg, fmt);
+    vswprintf(buf, sizeof(buf) / sizeof(buf[0]), fmt, arg);
+    va_end(arg);
+
+    char line[4 * sizeof(buf) / sizeof(buf[0])];
+    size_t n = wcstombs(line, buf, sizeof(line) - 1);
+    if (n == (size_t)-1)
+        n = 0;
+    line[n] = '\0';
+    size_t length = n;
+    while (length > 0 && line[length - 1] == '\n')
+        length--;
+    fprintf(stderr, "%.*s\n", (int)length, line);
+}
+
+std::wstring FromUtf8(const std::string &str)
+{
+    std::wstring wide(str.size(), L'\0');
+    size_t n = mbstowcs(&wide[0], str.c_str(), wide.size());
+    if (n == (size_t)-1)
+        return std::wstring(str.begin(), str.end());
+    wide.resize(n);
+    return wide;
+}
+
+}
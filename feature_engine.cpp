@@ -0,0 +1,143 @@
+#include "feature_engine.h"
+#include <string.h>
+#include "logger.h"
+
+FeatureEngine::FeatureEngine()
+{
+    recorder_ = nullptr;
+    hop_fill_ = 0;
+    hop_position_ = 0;
+    running_ = false;
+
+    // Readers may subscribe before the first Start(), so the ring exists
+    // from the start, sized for the default options.
+    InitializeRecords(options_);
+}
+
+bool FeatureEngine::InitializeRecords(const FeatureExtractor::Options &options)
+{
+    // About ten seconds of records at the default hop. Initialized again
+    // only when the record size changes, so readers keep their place
+    // across Stop() and Start().
+    size_t record_size = sizeof(Record) + (options.num_mels + options.num_mfccs) * sizeof(float);
+    if (record_.size() == record_size)
+    {
+        return true;
+    }
+    record_.assign(record_size, 0);
+    if (-1 == records_.Initialize((ring_buffer_size_t)record_size, 1024))
+    {
+        logger::Log(L"Initialize feature ring buffer failed.");
+        record_.clear();
+        return false;
+    }
+    return true;
+}
+
+FeatureEngine::~FeatureEngine()
+{
+    Stop();
+}
+
+bool FeatureEngine::Start(Recorder *recorder)
+{
+    Stop();
+    recorder_ = recorder;
+    if (!extractor_.Configure(recorder->GetSampleRate(), options_))
+    {
+        logger::Log(L"Cannot compute features at %d Hz.", recorder->GetSampleRate());
+        return false;
+    }
+
+    active_stages_.clear();
+    for (size_t i = 0; i < stages_.size(); i++)
+    {
+        if (stages_[i]->Configure(extractor_))
+            active_stages_.push_back(stages_[i]);
+    }
+
+    if (!InitializeRecords(extractor_.GetOptions()))
+    {
+        return false;
+    }
+
+    // The extractor wants mono floats, whatever the wire format is.
+    pcm::StreamFormat format;
+    format.sample_format = pcm::kFloat32;
+    format.channels = 1;
+    format.layout = pcm::kInterleaved;
+    reader_.SetFormat(format);
+    recorder_->Subscribe(&reader_);
+    hop_.resize(extractor_.GetHopSize());
+    hop_fill_ = 0;
+    hop_position_ = reader_.GetPosition();
+
+    running_ = true;
+    thread_ = std::thread(&FeatureEngine::ThreadMain, this);
+    return true;
+}
+
+void FeatureEngine::Stop()
+{
+    running_ = false;
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+void FeatureEngine::ThreadMain()
+{
+    std::vector<unsigned char> data;
+    Recorder::CaptureInfo info;
+    while (running_)
+    {
+        recorder_->Read(&reader_, &data, &info);
+        if (data.empty())
+            continue;
+
+        // Starts over after samples were skipped, so no window spans a gap.
+        if (info.first_sample != hop_position_ + (ring_buffer_pos_t)hop_fill_)
+        {
+            extractor_.Reset();
+            for (size_t i = 0; i < active_stages_.size(); i++)
+                active_stages_[i]->Reset();
+            hop_fill_ = 0;
+            hop_position_ = info.first_sample;
+        }
+
+        const float *samples = (const float *)data.data();
+        size_t count = data.size() / sizeof(float);
+        while (count > 0)
+        {
+            size_t n = hop_.size() - hop_fill_;
+            if (n > count)
+                n = count;
+            memcpy(&hop_[hop_fill_], samples, n * sizeof(float));
+            hop_fill_ += n;
+            samples += n;
+            count -= n;
+            if (hop_fill_ < hop_.size())
+                break;
+
+            ProcessHop();
+            hop_position_ += hop_.size();
+            hop_fill_ = 0;
+        }
+    }
+}
+
+void FeatureEngine::ProcessHop()
+{
+    const FeatureFrame &frame = extractor_.Analyze(hop_.data(), hop_position_);
+    for (size_t i = 0; i < active_stages_.size(); i++)
+        active_stages_[i]->Process(frame);
+
+    Record *record = (Record *)record_.data();
+    record->first_sample = frame.first_sample;
+    record->energy_db = frame.energy_db;
+    float *features = (float *)(record + 1);
+    memcpy(features, frame.log_mel, frame.num_mels * sizeof(float));
+    memcpy(features + frame.num_mels, frame.mfcc, frame.num_mfccs * sizeof(float));
+    records_.Write(record_.data(), 1);
+}
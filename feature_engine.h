@@ -0,0 +1,93 @@
+#ifndef FEATURE_ENGINE_H
+#define FEATURE_ENGINE_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "broadcast_ring_buffer.h"
+#include "feature_extractor.h"
+#include "recorder.h"
+
+// Computes spectral features once per hop from a Recorder's stream, on its
+// own thread, and shares them. Stages get every FeatureFrame on that thread
+// as soon as it is computed; readers get the log-mel energies and MFCCs of
+// each hop as Records from a broadcast ring.
+class FeatureEngine
+{
+public:
+    // Consumer of every hop. Called on the engine's thread.
+    class Stage
+    {
+    public:
+        virtual ~Stage() {}
+
+        // Called by Start() with the extractor set up for the stream. A
+        // stage that returns false gets no hops until the next Start().
+        virtual bool Configure(const FeatureExtractor &extractor) = 0;
+
+        // Called when the stream skipped samples, before the next hop.
+        virtual void Reset() = 0;
+
+        virtual void Process(const FeatureFrame &frame) = 0;
+    };
+
+    // Head of each published element, followed by num_mels log-mel
+    // energies and num_mfccs MFCCs as floats.
+    struct Record
+    {
+        ring_buffer_pos_t first_sample;
+        float energy_db;
+    };
+
+    FeatureEngine();
+    ~FeatureEngine();
+
+    // Features to compute from the next Start() on.
+    void SetOptions(const FeatureExtractor::Options &options) { options_ = options; }
+
+    // Adds |stage|, which must outlive the engine. Only while stopped.
+    void AddStage(Stage *stage) { stages_.push_back(stage); }
+
+    // Starts analyzing |recorder|, which must be open, from its newest
+    // sample on.
+    bool Start(Recorder *recorder);
+    void Stop();
+
+    // Starts |reader| at the newest Record. Elements are GetRecordSize()
+    // bytes; a Start() with options that change it starts the ring over,
+    // and readers skip to the records of the new size.
+    void Subscribe(BroadcastRingBuffer::Reader *reader) { reader->Attach(&records_); }
+    size_t GetRecordSize() const { return record_.size(); }
+
+    const FeatureExtractor &GetExtractor() const { return extractor_; }
+
+private:
+    // Sizes records_ for |options|, keeping it if the size is unchanged.
+    bool InitializeRecords(const FeatureExtractor::Options &options);
+
+    void ThreadMain();
+
+    // Runs the extractor and every stage on the full hop_.
+    void ProcessHop();
+
+    FeatureExtractor::Options options_;
+    FeatureExtractor extractor_;
+    std::vector<Stage *> stages_;
+    std::vector<Stage *> active_stages_;
+
+    Recorder *recorder_;
+    Recorder::Reader reader_;
+
+    // Samples of the hop being filled, and the absolute index of its first.
+    std::vector<float> hop_;
+    size_t hop_fill_;
+    ring_buffer_pos_t hop_position_;
+
+    BroadcastRingBuffer records_;
+    std::vector<unsigned char> record_;
+
+    std::thread thread_;
+    std::atomic<bool> running_;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "feature_extractor.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "pcm_kernels.h"
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+
+// Keeps silent bands and hops finite in the logs.
+const float kMinPower = 1e-10f;
+
+double HzToMel(double hz)
+{
+    return 2595.0 * log10(1.0 + hz / 700.0);
+}
+
+double MelToHz(double mel)
+{
+    return 700.0 * (pow(10.0, mel / 2595.0) - 1.0);
+}
+
+}
+
+FeatureExtractor::FeatureExtractor()
+{
+    sample_rate_ = 0;
+    hop_size_ = 0;
+    window_size_ = 0;
+    memset(&frame_, 0, sizeof(frame_));
+}
+
+bool FeatureExtractor::Configure(int sample_rate, const Options &options)
+{
+    if (sample_rate < 1000 || options.hop_ms <= 0 || options.window_ms < options.hop_ms || options.num_mels < 1 ||
+        options.num_mfccs < 0 || options.num_mfccs > options.num_mels)
+        return false;
+    float nyquist = sample_rate / 2.0f;
+    float mel_high_hz = options.mel_high_hz > 0 ? std::min(options.mel_high_hz, nyquist) : nyquist;
+    if (options.mel_low_hz < 0 || options.mel_low_hz >= mel_high_hz)
+        return false;
+
+    options_ = options;
+    options_.mel_high_hz = mel_high_hz;
+    sample_rate_ = sample_rate;
+    hop_size_ = (size_t)sample_rate * options.hop_ms / 1000;
+    window_size_ = (size_t)sample_rate * options.window_ms / 1000;
+    size_t fft_size = 4;
+    while (fft_size < window_size_)
+        fft_size *= 2;
+    fft_.Configure(fft_size);
+
+    // Periodic windows, so overlapping hops add up evenly.
+    window_.resize(window_size_);
+    for (size_t i = 0; i < window_size_; i++)
+    {
+        double phase = 2 * kPi * i / window_size_;
+        if (options.window_type == kWindowHann)
+            window_[i] = (float)(0.5 - 0.5 * cos(phase));
+        else if (options.window_type == kWindowHamming)
+            window_[i] = (float)(0.54 - 0.46 * cos(phase));
+        else
+            window_[i] = 1.0f;
+    }
+    windowed_.assign(fft_size, 0.0f);
+    power_.resize(fft_size / 2 + 1);
+    history_.resize(window_size_);
+    ConfigureMelFilters();
+
+    // Orthonormal DCT-II of the log-mel energies.
+    size_t num_mels = options.num_mels;
+    size_t num_mfccs = options.num_mfccs;
+    dct_.resize(num_mfccs * num_mels);
+    for (size_t c = 0; c < num_mfccs; c++)
+    {
+        double scale = sqrt((c == 0 ? 1.0 : 2.0) / num_mels);
+        for (size_t m = 0; m < num_mels; m++)
+            dct_[c * num_mels + m] = (float)(scale * cos(kPi * c * (m + 0.5) / num_mels));
+    }
+    log_mel_.resize(num_mels);
+    mfcc_.resize(num_mfccs);
+
+    frame_.hop_size = hop_size_;
+    frame_.power = power_.data();
+    frame_.num_bins = power_.size();
+    frame_.bin_hz = (float)sample_rate / fft_size;
+    frame_.log_mel = log_mel_.data();
+    frame_.num_mels = num_mels;
+    frame_.mfcc = mfcc_.data();
+    frame_.num_mfccs = num_mfccs;
+    Reset();
+    return true;
+}
+
+void FeatureExtractor::ConfigureMelFilters()
+{
+    // Triangles between band edges evenly spaced in mel, each rising from
+    // the edge below it to its center and falling to the edge above.
+    size_t num_mels = options_.num_mels;
+    double mel_low = HzToMel(options_.mel_low_hz);
+    double mel_high = HzToMel(options_.mel_high_hz);
+    std::vector<double> edges(num_mels + 2);
+    for (size_t i = 0; i < edges.size(); i++)
+        edges[i] = MelToHz(mel_low + (mel_high - mel_low) * i / (num_mels + 1));
+
+    double bin_hz = (double)sample_rate_ / fft_.GetSize();
+    mel_weights_.clear();
+    mel_offsets_.resize(num_mels);
+    mel_first_bins_.resize(num_mels);
+    mel_lengths_.resize(num_mels);
+    for (size_t m = 0; m < num_mels; m++)
+    {
+        mel_offsets_[m] = mel_weights_.size();
+        mel_first_bins_[m] = 0;
+        for (size_t k = 0; k < power_.size(); k++)
+        {
+            double hz = k * bin_hz;
+            double weight = 0;
+            if (hz > edges[m] && hz <= edges[m + 1])
+                weight = (hz - edges[m]) / (edges[m + 1] - edges[m]);
+            else if (hz > edges[m + 1] && hz < edges[m + 2])
+                weight = (edges[m + 2] - hz) / (edges[m + 2] - edges[m + 1]);
+            if (weight <= 0)
+                continue;
+            if (mel_weights_.size() == mel_offsets_[m])
+                mel_first_bins_[m] = k;
+            mel_weights_.push_back((float)weight);
+        }
+        mel_lengths_[m] = mel_weights_.size() - mel_offsets_[m];
+    }
+}
+
+void FeatureExtractor::Reset()
+{
+    std::fill(history_.begin(), history_.end(), 0.0f);
+}
+
+const FeatureFrame &FeatureExtractor::Analyze(const float *hop, ring_buffer_pos_t first_sample)
+{
+    const pcm::Kernels &kernels = pcm::GetKernels();
+    if (window_size_ > hop_size_)
+        memmove(history_.data(), history_.data() + hop_size_, (window_size_ - hop_size_) * sizeof(float));
+    memcpy(history_.data() + window_size_ - hop_size_, hop, hop_size_ * sizeof(float));
+
+    for (size_t i = 0; i < window_size_; i++)
+        windowed_[i] = history_[i] * window_[i];
+    fft_.PowerSpectrum(windowed_.data(), power_.data());
+
+    for (size_t m = 0; m < log_mel_.size(); m++)
+    {
+        float energy = kernels.dot(power_.data() + mel_first_bins_[m], mel_weights_.data() + mel_offsets_[m],
+                                   mel_lengths_[m]);
+        log_mel_[m] = logf(energy + kMinPower);
+    }
+    for (size_t c = 0; c < mfcc_.size(); c++)
+        mfcc_[c] = kernels.dot(&dct_[c * log_mel_.size()], log_mel_.data(), log_mel_.size());
+
+    frame_.first_sample = first_sample;
+    frame_.hop = hop;
+    frame_.energy_db = 10 * log10f(kernels.dot(hop, hop, hop_size_) / hop_size_ + 1e-12f);
+    return frame_;
+}
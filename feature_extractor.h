@@ -0,0 +1,123 @@
+#ifndef FEATURE_EXTRACTOR_H
+#define FEATURE_EXTRACTOR_H
+
+#include <vector>
+#include "fft.h"
+#include "ring_buffer.h"
+
+// Window applied to each analysis frame before its FFT.
+enum WindowType
+{
+    kWindowHann,
+    kWindowHamming,
+    kWindowRectangular
+};
+
+// Features of one hop. The pointers stay valid until the next Analyze().
+struct FeatureFrame
+{
+    // Absolute index of the hop's first sample in the stream.
+    ring_buffer_pos_t first_sample;
+
+    // The hop itself, mono.
+    const float *hop;
+    size_t hop_size;
+
+    // Power of FFT bins 0 to fft size / 2, of the window ending with the
+    // hop, |bin_hz| apart.
+    const float *power;
+    size_t num_bins;
+    float bin_hz;
+
+    // Natural log of each mel band's energy, and the MFCCs taken from them.
+    const float *log_mel;
+    size_t num_mels;
+    const float *mfcc;
+    size_t num_mfccs;
+
+    // RMS level of the hop in dBFS.
+    float energy_db;
+};
+
+// Computes the spectral features of mono float audio, one FeatureFrame per
+// hop over a window ending with it: the power spectrum, log energies of a
+// mel filterbank and MFCCs. Window, twiddles, filterbank and DCT are
+// computed once by Configure(); the filterbank and DCT run on the dot
+// kernel, so hops do not allocate.
+class FeatureExtractor
+{
+public:
+    struct Options
+    {
+        // Analysis window and hop. The window is zero-padded to a power of
+        // two for the FFT.
+        int window_ms;
+        int hop_ms;
+        WindowType window_type;
+
+        // Mel bands between |mel_low_hz| and |mel_high_hz|, 0 for Nyquist,
+        // and how many MFCCs, at most |num_mels|, are taken from them.
+        int num_mels;
+        float mel_low_hz;
+        float mel_high_hz;
+        int num_mfccs;
+
+        Options()
+            : window_ms(20), hop_ms(10), window_type(kWindowHann), num_mels(40), mel_low_hz(20.0f),
+              mel_high_hz(0.0f), num_mfccs(13)
+        {
+        }
+    };
+
+    FeatureExtractor();
+
+    // Analyzes audio at |sample_rate|. Returns false if |options| do not
+    // fit it.
+    bool Configure(int sample_rate, const Options &options = Options());
+
+    // Forgets the window history, e.g. after a gap in the input.
+    void Reset();
+
+    int GetSampleRate() const { return sample_rate_; }
+    const Options &GetOptions() const { return options_; }
+
+    // Samples per hop, which Analyze() takes at a time.
+    size_t GetHopSize() const { return hop_size_; }
+    size_t GetFftSize() const { return fft_.GetSize(); }
+
+    // Analyzes the next GetHopSize() samples, the first of which is
+    // |first_sample| in the stream.
+    const FeatureFrame &Analyze(const float *hop, ring_buffer_pos_t first_sample);
+
+private:
+    void ConfigureMelFilters();
+
+    Options options_;
+    int sample_rate_;
+    size_t hop_size_;
+    size_t window_size_;
+
+    // The last window_size_ samples, oldest first.
+    std::vector<float> history_;
+
+    std::vector<float> window_;
+    std::vector<float> windowed_;
+    std::vector<float> power_;
+    Fft fft_;
+
+    // Nonzero weights of each triangular mel filter, back to back, and
+    // where each one starts among them and among the bins.
+    std::vector<float> mel_weights_;
+    std::vector<size_t> mel_offsets_;
+    std::vector<size_t> mel_first_bins_;
+    std::vector<size_t> mel_lengths_;
+
+    // DCT-II, one row of num_mels per MFCC.
+    std::vector<float> dct_;
+
+    std::vector<float> log_mel_;
+    std::vector<float> mfcc_;
+    FeatureFrame frame_;
+};
+
+#endif
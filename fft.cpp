@@ -0,0 +1,121 @@
+#include "fft.h"
+#include <math.h>
+#include "pcm_kernels.h"
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+
+// Stages with butterflies closer than this are done here; the kernels only
+// pay off once they have a few butterflies to run at a time.
+const size_t kMinKernelSpan = 4;
+
+}
+
+Fft::Fft()
+{
+    size_ = 0;
+    half_ = 0;
+}
+
+bool Fft::Configure(size_t size)
+{
+    if (size < 4 || (size & (size - 1)) != 0)
+        return false;
+    size_ = size;
+    half_ = size / 2;
+
+    size_t bits = 0;
+    while (((size_t)1 << bits) < half_)
+        bits++;
+    bit_reversed_.resize(half_);
+    for (size_t i = 0; i < half_; i++)
+    {
+        size_t reversed = 0;
+        for (size_t b = 0; b < bits; b++)
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        bit_reversed_[i] = reversed;
+    }
+
+    twiddles_re_.resize(half_);
+    twiddles_im_.resize(half_);
+    for (size_t h = 1; h < half_; h *= 2)
+    {
+        for (size_t k = 0; k < h; k++)
+        {
+            twiddles_re_[h - 1 + k] = (float)cos(kPi * k / h);
+            twiddles_im_[h - 1 + k] = (float)-sin(kPi * k / h);
+        }
+    }
+
+    untangle_.resize(half_ + 1);
+    for (size_t k = 0; k <= half_; k++)
+        untangle_[k] = std::complex<float>((float)cos(2 * kPi * k / size), (float)-sin(2 * kPi * k / size));
+
+    re_.resize(half_);
+    im_.resize(half_);
+    return true;
+}
+
+void Fft::Transform(const float *in)
+{
+    // Bit-reversed copy of the packed pairs, then butterflies of growing span.
+    for (size_t i = 0; i < half_; i++)
+    {
+        re_[bit_reversed_[i]] = in[2 * i];
+        im_[bit_reversed_[i]] = in[2 * i + 1];
+    }
+
+    const pcm::Kernels &kernels = pcm::GetKernels();
+    float *re = re_.data();
+    float *im = im_.data();
+    for (size_t h = 1; h < half_; h *= 2)
+    {
+        const float *w_re = &twiddles_re_[h - 1];
+        const float *w_im = &twiddles_im_[h - 1];
+        for (size_t first = 0; first < half_; first += 2 * h)
+        {
+            if (h >= kMinKernelSpan)
+            {
+                kernels.butterfly(re + first, im + first, re + first + h, im + first + h, w_re, w_im, h);
+                continue;
+            }
+            for (size_t k = first; k < first + h; k++)
+            {
+                float t_re = w_re[k - first] * re[k + h] - w_im[k - first] * im[k + h];
+                float t_im = w_re[k - first] * im[k + h] + w_im[k - first] * re[k + h];
+                re[k + h] = re[k] - t_re;
+                im[k + h] = im[k] - t_im;
+                re[k] += t_re;
+                im[k] += t_im;
+            }
+        }
+    }
+}
+
+std::complex<float> Fft::GetBin(size_t k) const
+{
+    // Even and odd samples' spectra from bins k and half - k of the packed
+    // one, then combined as in one more butterfly.
+    size_t j = k == 0 ? 0 : half_ - k;
+    size_t i = k == half_ ? 0 : k;
+    std::complex<float> z(re_[i], im_[i]);
+    std::complex<float> mirror(re_[j], -im_[j]);
+    std::complex<float> even = 0.5f * (z + mirror);
+    std::complex<float> odd = std::complex<float>(0.0f, -0.5f) * (z - mirror);
+    return even + untangle_[k] * odd;
+}
+
+void Fft::Forward(const float *in, std::complex<float> *out)
+{
+    Transform(in);
+    for (size_t k = 0; k <= half_; k++)
+        out[k] = GetBin(k);
+}
+
+void Fft::PowerSpectrum(const float *in, float *power)
+{
+    Transform(in);
+    for (size_t k = 0; k <= half_; k++)
+        power[k] = std::norm(GetBin(k));
+}
@@ -0,0 +1,54 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <stddef.h>
+#include <complex>
+#include <vector>
+
+// FFT of real frames for the analysis stages. A frame of size real samples
+// is transformed as size / 2 complex ones, even samples real and odd ones
+// imaginary, and the spectrum is untangled from that. The butterflies run
+// on split real and imaginary arrays through the pcm kernels, so they use
+// the widest vectors the CPU has. Bit reversal and all twiddles are
+// computed once by Configure(), so transforms do not allocate.
+class Fft
+{
+public:
+    Fft();
+
+    // Sets the transform size, a power of two of at least 4. Returns false
+    // otherwise.
+    bool Configure(size_t size);
+
+    size_t GetSize() const { return size_; }
+
+    // Transforms |size| real samples. |out| receives bins 0 to size / 2.
+    void Forward(const float *in, std::complex<float> *out);
+
+    // Power of bins 0 to size / 2 of |size| real samples.
+    void PowerSpectrum(const float *in, float *power);
+
+private:
+    // Leaves the complex spectrum of |in| as packed pairs in re_ and im_.
+    void Transform(const float *in);
+
+    // Bin |k| of the real spectrum, from the packed one in re_ and im_.
+    std::complex<float> GetBin(size_t k) const;
+
+    size_t size_;
+    size_t half_;
+    std::vector<size_t> bit_reversed_;
+
+    // Twiddles of every butterfly stage back to back; the stage with
+    // butterflies |h| apart starts at h - 1.
+    std::vector<float> twiddles_re_;
+    std::vector<float> twiddles_im_;
+
+    // Twiddles that untangle the real spectrum, bins 0 to size / 2.
+    std::vector<std::complex<float>> untangle_;
+
+    std::vector<float> re_;
+    std::vector<float> im_;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "file_capture_source.h"
+#include "pcm_convert.h"
+#include <stdint.h>
+#include <string.h>
+
+namespace {
+
+const uint16_t kWaveFormatPcm = 1;
+const uint16_t kWaveFormatIeeeFloat = 3;
+const uint16_t kWaveFormatExtensible = 0xFFFE;
+
+uint32_t ReadLe32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint16_t ReadLe16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+}
+
+FileCaptureSource::FileCaptureSource(const std::string &path, bool loop, double speed)
+    : GeneratedCaptureSource(speed)
+{
+    path_ = path;
+    loop_ = loop;
+    file_ = nullptr;
+    data_offset_ = 0;
+    data_bytes_ = 0;
+    remaining_bytes_ = 0;
+}
+
+FileCaptureSource::~FileCaptureSource()
+{
+    Stop();
+    if (file_)
+    {
+        fclose(file_);
+    }
+}
+
+bool FileCaptureSource::Prepare(const CaptureFormat &format)
+{
+    if (!pcm::IsSupportedBits(format.bits_per_sample))
+    {
+        error_ = "Unsupported bits per sample.";
+        return false;
+    }
+    if (file_)
+    {
+        fclose(file_);
+    }
+    file_ = fopen(path_.c_str(), "rb");
+    if (!file_)
+    {
+        error_ = "Cannot open " + path_ + ".";
+        return false;
+    }
+
+    unsigned char magic[4] = {0};
+    if (fread(magic, 1, sizeof(magic), file_) == sizeof(magic) && memcmp(magic, "RIFF", 4) == 0)
+    {
+        return ReadWavHeader(format);
+    }
+
+    // Raw PCM: the whole file is samples.
+    fseek(file_, 0, SEEK_END);
+    data_offset_ = 0;
+    data_bytes_ = ftell(file_);
+    fseek(file_, 0, SEEK_SET);
+    data_bytes_ -= data_bytes_ % format.GetBytesPerFrame();
+    remaining_bytes_ = data_bytes_;
+    if (data_bytes_ == 0)
+    {
+        error_ = path_ + " holds no samples.";
+        return false;
+    }
+    return true;
+}
+
+bool FileCaptureSource::ReadWavHeader(const CaptureFormat &format)
+{
+    unsigned char header[8];
+    if (fseek(file_, 12, SEEK_SET) != 0)
+    {
+        error_ = path_ + " is not a WAV file.";
+        return false;
+    }
+
+    bool have_format = false;
+    while (fread(header, 1, sizeof(header), file_) == sizeof(header))
+    {
+        uint32_t chunk_bytes = ReadLe32(header + 4);
+        if (memcmp(header, "fmt ", 4) == 0)
+        {
+            unsigned char fmt[16];
+            if (chunk_bytes < sizeof(fmt) || fread(fmt, 1, sizeof(fmt), file_) != sizeof(fmt))
+                break;
+            uint16_t tag = ReadLe16(fmt);
+            uint16_t sample_tag = format.float_samples ? kWaveFormatIeeeFloat : kWaveFormatPcm;
+            if ((tag != sample_tag && tag != kWaveFormatExtensible) ||
+                ReadLe16(fmt + 2) != format.channels ||
+                (int)ReadLe32(fmt + 4) != format.sample_rate ||
+                ReadLe16(fmt + 14) != format.bits_per_sample)
+            {
+                error_ = path_ + " does not match the capture format.";
+                return false;
+            }
+            have_format = true;
+            chunk_bytes -= sizeof(fmt);
+        }
+        else if (memcmp(header, "data", 4) == 0)
+        {
+            if (!have_format)
+                break;
+            data_offset_ = ftell(file_);
+            data_bytes_ = chunk_bytes - chunk_bytes % format.GetBytesPerFrame();
+            remaining_bytes_ = data_bytes_;
+            if (data_bytes_ == 0)
+            {
+                error_ = path_ + " holds no samples.";
+                return false;
+            }
+            return true;
+        }
+        // Chunks are padded to an even size.
+        if (fseek(file_, chunk_bytes + (chunk_bytes & 1), SEEK_CUR) != 0)
+            break;
+    }
+    error_ = path_ + " is not a PCM WAV file.";
+    return false;
+}
+
+unsigned long FileCaptureSource::Generate(void *frames, unsigned long frame_count)
+{
+    int bytes_per_frame = format().GetBytesPerFrame();
+    if (remaining_bytes_ == 0 && loop_)
+    {
+        fseek(file_, data_offset_, SEEK_SET);
+        remaining_bytes_ = data_bytes_;
+    }
+    if ((long long)frame_count * bytes_per_frame > remaining_bytes_)
+    {
+        frame_count = (unsigned long)(remaining_bytes_ / bytes_per_frame);
+    }
+    unsigned long n = (unsigned long)fread(frames, bytes_per_frame, frame_count, file_);
+    remaining_bytes_ -= (long long)n * bytes_per_frame;
+    if (n < frame_count)
+    {
+        // Truncated file: treat what we got as the end.
+        remaining_bytes_ = 0;
+    }
+    return n;
+}
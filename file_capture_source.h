@@ -0,0 +1,37 @@
+#ifndef FILE_CAPTURE_SOURCE_H
+#define FILE_CAPTURE_SOURCE_H
+
+#include "capture_source.h"
+#include <stdio.h>
+#include <string>
+
+// Replays a WAV file (integer PCM, or IEEE float in float capture mode) or a
+// raw PCM file. A WAV file must match the format Recorder asks for; a raw
+// file is taken to be in it.
+class FileCaptureSource : public GeneratedCaptureSource
+{
+public:
+    // With |loop| the file starts over at its end instead of ending the stream.
+    FileCaptureSource(const std::string &path, bool loop = true, double speed = 1.0);
+    ~FileCaptureSource() override;
+
+protected:
+    bool Prepare(const CaptureFormat &format) override;
+    unsigned long Generate(void *frames, unsigned long frame_count) override;
+
+private:
+    // Finds the "fmt " and "data" chunks and checks the format. Leaves the
+    // file at the first sample.
+    bool ReadWavHeader(const CaptureFormat &format);
+
+    std::string path_;
+    bool loop_;
+    FILE *file_;
+
+    // Where the samples start, and how many bytes of them are left.
+    long data_offset_;
+    long long data_bytes_;
+    long long remaining_bytes_;
+};
+
+#endif
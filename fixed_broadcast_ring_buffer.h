@@ -0,0 +1,214 @@
+#ifndef FIXED_BROADCAST_RING_BUFFER_H
+#define FIXED_BROADCAST_RING_BUFFER_H
+
+/** @file
+ @brief Single-writer multi-reader lock-free broadcast ring buffer of a fixed
+ element type and capacity.
+
+ FixedBroadcastRingBuffer<T, Capacity> follows the same protocol as
+ BroadcastRingBuffer (absolute 64-bit positions, the oldest intact position
+ announced before the writer overwrites anything, readers that detect being
+ lapped and skip ahead), but the element type and count are template
+ parameters. The storage is an inline array that exists for the lifetime of
+ the object, so there is no Initialize() that could pull it from under a
+ reader, and no Resize(). The mask is a compile-time constant and every copy
+ is sized in whole T's. Use BroadcastRingBuffer when the format is only known
+ at runtime or the buffer must grow.
+*/
+
+#include "ring_buffer.h"
+#include <string.h>
+#include <type_traits>
+
+template <typename T, ring_buffer_size_t Capacity>
+class FixedBroadcastRingBuffer
+{
+    static_assert(Capacity > 0 && ((Capacity - 1) & Capacity) == 0,
+                  "FixedBroadcastRingBuffer capacity must be a power of two");
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "FixedBroadcastRingBuffer elements are copied with memcpy");
+
+    static constexpr ring_buffer_size_t kSmallMask = Capacity - 1;     /**< Fits positions to the buffer. */
+
+    /* Writer side. Readers load these, the writer alone stores them. */
+    std::atomic<ring_buffer_pos_t> writePosition_;  /**< Number of elements published. */
+    std::atomic<ring_buffer_pos_t> oldestPosition_; /**< Oldest element the writer has not started to overwrite. */
+    char pad0_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Blocking reads. The writer only loads from here unless a reader is waiting. */
+    mutable RingWaitGate waitGate_;                  /**< Progress is writePosition_. */
+    char pad1_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    T buffer_[Capacity];
+
+public:
+    /** A read cursor into a FixedBroadcastRingBuffer. Each reader thread owns one. */
+    class Reader
+    {
+        const FixedBroadcastRingBuffer *ring_;
+        ring_buffer_pos_t position_;            /**< Position of the next element to read. */
+        ring_buffer_pos_t lostCount_;           /**< Elements overwritten before they were read. */
+
+    public:
+        Reader() : ring_(nullptr), position_(0), lostCount_(0) {}
+
+        /** Start reading from ring at its current write position. */
+        void Attach(const FixedBroadcastRingBuffer *ring)
+        {
+            ring_ = ring;
+            position_ = ring->GetWritePosition();
+            lostCount_ = 0;
+        }
+
+        /** Continue reading from an absolute position. Positions the writer
+         has already overwritten are skipped up to the oldest intact element
+         and counted as lost; positions past the write position stop there.
+         @return true if reading continues exactly at position.
+        */
+        bool Seek(ring_buffer_pos_t position)
+        {
+            ring_buffer_pos_t writePosition = ring_->GetWritePosition();
+            position_ = position < writePosition ? position : writePosition;
+            CheckOverrun();
+            return position_ == position;
+        }
+
+        /** Retrieve the number of elements available for reading. Skips ahead
+         first if the writer has lapped this reader.
+        */
+        ring_buffer_size_t GetReadAvailable()
+        {
+            /* Check for overrun first: the write position loaded afterwards is
+               then never behind the position we may have skipped to. */
+            CheckOverrun();
+            return (ring_buffer_size_t)(ring_->GetWritePosition() - position_);
+        }
+
+        /** Wait until at least elementCount elements are available for reading.
+         @param elementCount The number of elements needed, limited to Capacity.
+         @param timeoutMs The longest time to wait, 0 to only spin, or RING_WAIT_INFINITE.
+         @return The number of elements available for reading, less than
+                 elementCount if the wait timed out.
+        */
+        ring_buffer_size_t WaitReadable(ring_buffer_size_t elementCount, int timeoutMs)
+        {
+            if (elementCount > Capacity)
+                elementCount = Capacity;
+            return ring_wait::WaitReadable(ring_->waitGate_, elementCount, timeoutMs,
+                                           [this, elementCount](int64_t *threshold) {
+                                               ring_buffer_size_t available = GetReadAvailable();
+                                               *threshold = position_ + elementCount;
+                                               return available;
+                                           });
+        }
+
+        /** Read data from the ring buffer. Retries if the writer overwrites the
+         data while it is being copied.
+         @return The number of elements read.
+        */
+        ring_buffer_size_t Read(T *data, ring_buffer_size_t elementCount)
+        {
+            while (true)
+            {
+                ring_buffer_size_t count = GetReadAvailable();
+                if (count > elementCount)
+                    count = elementCount;
+                if (count > Capacity)
+                    count = Capacity;
+
+                ring_buffer_size_t index = (ring_buffer_size_t)(position_ & kSmallMask);
+                ring_buffer_size_t size1 = count;
+                if (index + count > Capacity)
+                    size1 = Capacity - index;
+                memcpy(data, &ring_->buffer_[index], size1 * sizeof(T));
+                if (count > size1)
+                    memcpy(data + size1, &ring_->buffer_[0], (count - size1) * sizeof(T));
+
+                /* Our loads of the elements must complete before we look at how
+                   far the writer has got; pairs with the release fence in Write(). */
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (position_ >= ring_->oldestPosition_.load(std::memory_order_acquire))
+                {
+                    position_ += count;
+                    return count;
+                }
+            }
+        }
+
+        /** Retrieve the position of the next element this reader will read. */
+        ring_buffer_pos_t GetPosition() const { return position_; }
+
+        /** Retrieve the total number of elements this reader has lost to overruns. */
+        ring_buffer_pos_t GetLostCount() const { return lostCount_; }
+
+    private:
+        /** Skip ahead to the oldest intact element if the writer has lapped us. */
+        void CheckOverrun()
+        {
+            ring_buffer_pos_t oldest = ring_->oldestPosition_.load(std::memory_order_acquire);
+            if (position_ < oldest)
+            {
+                lostCount_ += oldest - position_;
+                position_ = oldest;
+            }
+        }
+    };
+
+    FixedBroadcastRingBuffer()
+    {
+        writePosition_.store(0, std::memory_order_relaxed);
+        oldestPosition_.store(0, std::memory_order_relaxed);
+    }
+
+    /** Retrieve the number of elements the ring buffer holds. */
+    static constexpr ring_buffer_size_t GetBufferSize()
+    {
+        return Capacity;
+    }
+
+    /** Retrieve the number of elements published so far. */
+    ring_buffer_pos_t GetWritePosition() const
+    {
+        return writePosition_.load(std::memory_order_acquire);
+    }
+
+    /** Write data to the ring buffer. Always succeeds, overwriting the oldest
+     elements.
+     @return The number of elements written, elementCount limited to Capacity.
+    */
+    ring_buffer_size_t Write(const T *data, ring_buffer_size_t elementCount)
+    {
+        if (elementCount > Capacity)
+        {
+            data += elementCount - Capacity;
+            elementCount = Capacity;
+        }
+
+        /* Announce the span before touching it, so a reader still copying the
+           elements we are about to overwrite can tell afterwards. */
+        ring_buffer_pos_t writePosition = writePosition_.load(std::memory_order_relaxed);
+        ring_buffer_pos_t oldestPosition = writePosition + elementCount - Capacity;
+        if (oldestPosition > oldestPosition_.load(std::memory_order_relaxed))
+        {
+            oldestPosition_.store(oldestPosition, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        ring_buffer_size_t index = (ring_buffer_size_t)(writePosition & kSmallMask);
+        ring_buffer_size_t size1 = elementCount;
+        if (index + elementCount > Capacity)
+            size1 = Capacity - index;
+        memcpy(&buffer_[index], data, size1 * sizeof(T));
+        if (elementCount > size1)
+            memcpy(&buffer_[0], data + size1, (elementCount - size1) * sizeof(T));
+
+        /* release pairs with the acquire in Reader::GetReadAvailable */
+        writePosition += elementCount;
+        writePosition_.store(writePosition, std::memory_order_release);
+        if (waitGate_.HasWaiters())
+            waitGate_.Notify(writePosition);
+        return elementCount;
+    }
+};
+
+#endif /* FIXED_BROADCAST_RING_BUFFER_H */
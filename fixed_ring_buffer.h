@@ -0,0 +1,196 @@
+#ifndef FIXED_RING_BUFFER_H
+#define FIXED_RING_BUFFER_H
+
+/** @file
+ @brief Single-reader single-writer lock-free ring buffer of a fixed element
+ type and capacity.
+
+ FixedRingBuffer<T, Capacity> follows the same protocol as RingBuffer (atomic
+ release/acquire 64-bit positions on separate cache lines, cached copies of the
+ other side's position), but the element type and count are template parameters. The
+ mask is a compile-time constant, the storage is an inline array, and every
+ copy is sized in whole T's, so the hot paths inline and vectorize. Use
+ RingBuffer when the format is only known at runtime.
+*/
+
+#include "ring_buffer.h"
+#include <string.h>
+#include <type_traits>
+
+template <typename T, ring_buffer_size_t Capacity>
+class FixedRingBuffer
+{
+    static_assert(Capacity > 0 && ((Capacity - 1) & Capacity) == 0,
+                  "FixedRingBuffer capacity must be a power of two");
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "FixedRingBuffer elements are copied with memcpy");
+
+    static constexpr ring_buffer_size_t kSmallMask = Capacity - 1;     /**< Fits positions to the buffer. */
+
+    /* Writer side. */
+    std::atomic<ring_buffer_pos_t> writePosition_; /**< Position of next writable element. */
+    ring_buffer_pos_t cachedReadPosition_;         /**< Writer's last seen readPosition_. */
+    char pad0_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Reader side. */
+    std::atomic<ring_buffer_pos_t> readPosition_;  /**< Position of next readable element. */
+    ring_buffer_pos_t cachedWritePosition_;        /**< Reader's last seen writePosition_. */
+    char pad1_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    T buffer_[Capacity];
+
+public:
+    /** Up to two typed regions returned by Reserve() and Peek(). */
+    struct Regions
+    {
+        T *data1;
+        ring_buffer_size_t size1;
+        T *data2;
+        ring_buffer_size_t size2;
+    };
+
+    FixedRingBuffer()
+    {
+        writePosition_.store(0, std::memory_order_relaxed);
+        Flush();
+    }
+
+    /** Retrieve the number of elements the ring buffer holds. */
+    static constexpr ring_buffer_size_t GetBufferSize()
+    {
+        return Capacity;
+    }
+
+    /** Reset buffer to empty. Should only be called when buffer is NOT being read or written.
+     The positions are kept: the read position moves up to the write position. */
+    void Flush()
+    {
+        ring_buffer_pos_t writePosition = writePosition_.load(std::memory_order_relaxed);
+        readPosition_.store(writePosition, std::memory_order_relaxed);
+        cachedReadPosition_ = cachedWritePosition_ = writePosition;
+    }
+
+    /** Retrieve the absolute position of the next element the writer will write. */
+    ring_buffer_pos_t GetWritePosition() const
+    {
+        return writePosition_.load(std::memory_order_acquire);
+    }
+
+    /** Retrieve the absolute position of the next element the reader will read. */
+    ring_buffer_pos_t GetReadPosition() const
+    {
+        return readPosition_.load(std::memory_order_acquire);
+    }
+
+    /** Retrieve the number of elements available in the ring buffer for reading. */
+    ring_buffer_size_t GetReadAvailable() const
+    {
+        return (ring_buffer_size_t)(writePosition_.load(std::memory_order_acquire) -
+                                    readPosition_.load(std::memory_order_acquire));
+    }
+
+    /** Retrieve the number of elements available in the ring buffer for writing. */
+    ring_buffer_size_t GetWriteAvailable() const
+    {
+        return Capacity - GetReadAvailable();
+    }
+
+    /** Reserve space so the writer can fill the ring buffer in place.
+     @return The number of elements reserved, which may be less than elementCount.
+    */
+    ring_buffer_size_t Reserve(ring_buffer_size_t elementCount, Regions *regions)
+    {
+        ring_buffer_pos_t writePosition = writePosition_.load(std::memory_order_relaxed);
+        ring_buffer_size_t available = Capacity - (ring_buffer_size_t)(writePosition - cachedReadPosition_);
+        if (elementCount > available)
+        {
+            cachedReadPosition_ = readPosition_.load(std::memory_order_acquire);
+            available = Capacity - (ring_buffer_size_t)(writePosition - cachedReadPosition_);
+            if (elementCount > available)
+                elementCount = available;
+        }
+        Split(writePosition, elementCount, regions);
+        return elementCount;
+    }
+
+    /** Publish elements previously filled through Reserve() to the reader. */
+    void Commit(ring_buffer_size_t elementCount)
+    {
+        writePosition_.store(writePosition_.load(std::memory_order_relaxed) + elementCount,
+                             std::memory_order_release);
+    }
+
+    /** Get the readable region(s) without copying them out of the ring buffer.
+     @return The number of elements available, which may be less than elementCount.
+    */
+    ring_buffer_size_t Peek(ring_buffer_size_t elementCount, Regions *regions)
+    {
+        ring_buffer_pos_t readPosition = readPosition_.load(std::memory_order_relaxed);
+        ring_buffer_size_t available = (ring_buffer_size_t)(cachedWritePosition_ - readPosition);
+        if (elementCount > available)
+        {
+            cachedWritePosition_ = writePosition_.load(std::memory_order_acquire);
+            available = (ring_buffer_size_t)(cachedWritePosition_ - readPosition);
+            if (elementCount > available)
+                elementCount = available;
+        }
+        Split(readPosition, elementCount, regions);
+        return elementCount;
+    }
+
+    /** Release elements previously obtained through Peek() back to the writer. */
+    void Consume(ring_buffer_size_t elementCount)
+    {
+        readPosition_.store(readPosition_.load(std::memory_order_relaxed) + elementCount,
+                            std::memory_order_release);
+    }
+
+    /** Write data to the ring buffer.
+     @return The number of elements written.
+    */
+    ring_buffer_size_t Write(const T *data, ring_buffer_size_t elementCount)
+    {
+        Regions regions;
+        ring_buffer_size_t numWritten = Reserve(elementCount, &regions);
+        memcpy(regions.data1, data, regions.size1 * sizeof(T));
+        if (regions.size2 > 0)
+            memcpy(regions.data2, data + regions.size1, regions.size2 * sizeof(T));
+        Commit(numWritten);
+        return numWritten;
+    }
+
+    /** Read data from the ring buffer.
+     @return The number of elements read.
+    */
+    ring_buffer_size_t Read(T *data, ring_buffer_size_t elementCount)
+    {
+        Regions regions;
+        ring_buffer_size_t numRead = Peek(elementCount, &regions);
+        memcpy(data, regions.data1, regions.size1 * sizeof(T));
+        if (regions.size2 > 0)
+            memcpy(data + regions.size1, regions.data2, regions.size2 * sizeof(T));
+        Consume(numRead);
+        return numRead;
+    }
+
+private:
+    void Split(ring_buffer_pos_t position, ring_buffer_size_t elementCount, Regions *regions)
+    {
+        ring_buffer_size_t index = (ring_buffer_size_t)(position & kSmallMask);
+        regions->data1 = &buffer_[index];
+        if (index + elementCount > Capacity)
+        {
+            regions->size1 = Capacity - index;
+            regions->data2 = &buffer_[0];
+            regions->size2 = elementCount - regions->size1;
+        }
+        else
+        {
+            regions->size1 = elementCount;
+            regions->data2 = NULL;
+            regions->size2 = 0;
+        }
+    }
+};
+
+#endif /* FIXED_RING_BUFFER_H */
@@ -0,0 +1,179 @@
+#include "lip_sync_analyzer.h"
+#include <math.h>
+
+namespace {
+
+// Loudness range of LipSyncFrame::loudness.
+const float kMinLoudnessDb = -80.0f;
+
+// Formant search ranges, and the width the spectrum is smoothed over so
+// single harmonics do not pass for formants.
+const float kF1LowHz = 250.0f;
+const float kF1HighHz = 1000.0f;
+const float kF2LowHz = 700.0f;
+const float kF2HighHz = 2800.0f;
+const float kMinFormantGapHz = 200.0f;
+const float kSmoothingHz = 200.0f;
+
+// Centroid range that is ignored, and the range over which a frame turns
+// from vowel to fricative.
+const float kMaxCentroidHz = 8000.0f;
+const float kFricativeLowHz = 2500.0f;
+const float kFricativeHighHz = 5000.0f;
+
+// Loudness above the noise floor at which the mouth is fully open.
+const float kFullOpenDb = 30.0f;
+
+// Typical formants of each vowel (Peterson and Barney), and how far a
+// measurement may stray from them.
+struct VowelFormants
+{
+    float f1;
+    float f2;
+};
+
+const VowelFormants kVowels[] = {
+    {730.0f, 1090.0f}, // A
+    {530.0f, 1840.0f}, // E
+    {270.0f, 2290.0f}, // I
+    {570.0f, 840.0f},  // O
+    {300.0f, 870.0f},  // U
+};
+const int kNumVowels = sizeof(kVowels) / sizeof(kVowels[0]);
+const float kF1Spread = 120.0f;
+const float kF2Spread = 350.0f;
+
+float Clamp01(float x)
+{
+    return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+}
+
+}
+
+LipSyncAnalyzer::LipSyncAnalyzer()
+{
+    bin_hz_ = 0;
+    f1_ = f2_ = 0;
+}
+
+bool LipSyncAnalyzer::Configure(const FeatureExtractor &extractor)
+{
+    int sample_rate = extractor.GetSampleRate();
+    if (sample_rate < 8000 || extractor.GetOptions().hop_ms != stream_protocol::kLipSyncFrameMs)
+        return false;
+    bin_hz_ = (float)sample_rate / extractor.GetFftSize();
+    smoothed_.resize(extractor.GetFftSize() / 2 + 1);
+    if (!vad_.Configure(sample_rate, 1, pcm::kFloat32))
+        return false;
+    Reset();
+    return true;
+}
+
+void LipSyncAnalyzer::Reset()
+{
+    vad_.Reset();
+    f1_ = f2_ = 0;
+}
+
+float LipSyncAnalyzer::FindPeak(float low_hz, float high_hz) const
+{
+    size_t low = (size_t)(low_hz / bin_hz_);
+    size_t high = (size_t)(high_hz / bin_hz_);
+    if (high >= smoothed_.size())
+        high = smoothed_.size() - 1;
+    size_t best = low;
+    for (size_t k = low; k <= high; k++)
+    {
+        if (smoothed_[k] > smoothed_[best])
+            best = k;
+    }
+    return smoothed_[best] > 0 ? best * bin_hz_ : 0.0f;
+}
+
+void LipSyncAnalyzer::Analyze(const FeatureFrame &features, stream_protocol::LipSyncFrame *frame)
+{
+    // Voice and the noise floor come from the spectrum the extractor has
+    // already taken.
+    bool voice = vad_.ProcessFrame(features.hop, features.hop_size, features.power, features.num_bins,
+                                   features.bin_hz);
+
+    // Loudness of the hop itself, for the sharpest timing.
+    float energy_db = features.energy_db;
+
+    // Centroid, up to where speech still has energy worth weighing.
+    const float *power = features.power;
+    size_t num_bins = features.num_bins;
+    float weighted = 0;
+    float total = 0;
+    for (size_t k = 1; k < num_bins && k * bin_hz_ < kMaxCentroidHz; k++)
+    {
+        weighted += k * bin_hz_ * power[k];
+        total += power[k];
+    }
+    float centroid = total > 0 ? weighted / total : 0.0f;
+
+    // Moving average over kSmoothingHz, from running sums.
+    size_t half_width = (size_t)(kSmoothingHz / 2 / bin_hz_);
+    if (half_width < 1)
+        half_width = 1;
+    float sum = 0;
+    for (size_t k = 0; k < half_width && k < num_bins; k++)
+        sum += power[k];
+    for (size_t k = 0; k < num_bins; k++)
+    {
+        if (k + half_width < num_bins)
+            sum += power[k + half_width];
+        if (k > half_width)
+            sum -= power[k - half_width - 1];
+        smoothed_[k] = sum;
+    }
+    f1_ = FindPeak(kF1LowHz, kF1HighHz);
+    float f2_low = f1_ + kMinFormantGapHz > kF2LowHz ? f1_ + kMinFormantGapHz : kF2LowHz;
+    f2_ = FindPeak(f2_low, kF2HighHz);
+
+    // Soft match against every vowel.
+    float vowel_weights[kNumVowels];
+    float vowel_total = 0;
+    int vowel = stream_protocol::kVowelNone;
+    for (int v = 0; v < kNumVowels; v++)
+    {
+        float d1 = (f1_ - kVowels[v].f1) / kF1Spread;
+        float d2 = (f2_ - kVowels[v].f2) / kF2Spread;
+        vowel_weights[v] = expf(-0.5f * (d1 * d1 + d2 * d2));
+        vowel_total += vowel_weights[v];
+        if (vowel == stream_protocol::kVowelNone || vowel_weights[v] > vowel_weights[vowel - 1])
+            vowel = v + 1;
+    }
+    if (!voice || vowel_total < 1e-6f)
+        vowel = stream_protocol::kVowelNone;
+
+    // How open the mouth is, and how much of that is a fricative.
+    float openness = voice ? Clamp01((energy_db - vad_.GetFeatures().noise_db) / kFullOpenDb) : 0.0f;
+    float fricative = Clamp01((centroid - kFricativeLowHz) / (kFricativeHighHz - kFricativeLowHz));
+
+    float visemes[stream_protocol::kNumVisemes];
+    visemes[stream_protocol::kVisemeFricative] = openness * fricative;
+    for (int v = 0; v < kNumVowels; v++)
+    {
+        float share = vowel_total >= 1e-6f ? vowel_weights[v] / vowel_total : 0.0f;
+        visemes[stream_protocol::kVisemeA + v] = openness * (1 - fricative) * share;
+    }
+
+    // Rest takes what the rounding of the others leaves, so they sum to 255.
+    int rest = 255;
+    for (int i = stream_protocol::kVisemeA; i < stream_protocol::kNumVisemes; i++)
+    {
+        int weight = (int)(visemes[i] * 255 + 0.5f);
+        if (weight > rest)
+            weight = rest;
+        frame->visemes[i] = (uint8_t)weight;
+        rest -= weight;
+    }
+    frame->visemes[stream_protocol::kVisemeRest] = (uint8_t)rest;
+
+    float loudness = Clamp01((energy_db - kMinLoudnessDb) / -kMinLoudnessDb);
+    frame->loudness = (uint8_t)(loudness * 255 + 0.5f);
+    float centroid_units = centroid / 32 + 0.5f;
+    frame->centroid = (uint8_t)(centroid_units > 255 ? 255 : centroid_units);
+    frame->vowel = (uint8_t)(vowel | (voice ? stream_protocol::kLipSyncVoice : 0));
+}
@@ -0,0 +1,51 @@
+#ifndef LIP_SYNC_ANALYZER_H
+#define LIP_SYNC_ANALYZER_H
+
+#include <vector>
+#include "feature_extractor.h"
+#include "stream_protocol.h"
+#include "voice_activity_detector.h"
+
+// Turns the FeatureFrame of each 10 ms hop into a
+// stream_protocol::LipSyncFrame: RMS loudness, spectral centroid, and the
+// first two formants as the peaks of the smoothed spectrum in their usual
+// ranges. The formants pick the nearest vowel, and soft distances to all
+// vowels, weighted by how open the mouth is for the loudness, make up the
+// viseme weights.
+class LipSyncAnalyzer
+{
+public:
+    LipSyncAnalyzer();
+
+    // Analyzes the frames of |extractor|. Returns false unless its hop is
+    // kLipSyncFrameMs, or below 8 kHz, where the formant ranges no longer
+    // fit.
+    bool Configure(const FeatureExtractor &extractor);
+
+    // Forgets the voice detector's state, e.g. after a gap in the input.
+    void Reset();
+
+    // Analyzes the next hop.
+    void Analyze(const FeatureFrame &features, stream_protocol::LipSyncFrame *frame);
+
+    // Formants of the last hop in Hz, 0 if none were found.
+    float GetF1() const { return f1_; }
+    float GetF2() const { return f2_; }
+
+private:
+    // Strongest bin of smoothed_ between |low_hz| and |high_hz|, in Hz.
+    float FindPeak(float low_hz, float high_hz) const;
+
+    float bin_hz_;
+
+    // Power spectrum of the hop, smoothed over kSmoothingHz.
+    std::vector<float> smoothed_;
+
+    // Decides whether a hop holds voice at all, on the hop's spectrum.
+    VoiceActivityDetector vad_;
+
+    float f1_;
+    float f2_;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#include "lip_sync_stream.h"
+#include "logger.h"
+
+LipSyncStream::LipSyncStream()
+{
+    sample_rate_ = 0;
+}
+
+bool LipSyncStream::Configure(const FeatureExtractor &extractor)
+{
+    sample_rate_ = extractor.GetSampleRate();
+    if (!analyzer_.Configure(extractor))
+    {
+        logger::Log(L"Cannot analyze lip sync at %d Hz with a %d ms hop.", sample_rate_,
+                    extractor.GetOptions().hop_ms);
+        return false;
+    }
+    return true;
+}
+
+void LipSyncStream::Reset()
+{
+    analyzer_.Reset();
+}
+
+void LipSyncStream::Process(const FeatureFrame &features)
+{
+    Entry entry;
+    entry.first_sample = features.first_sample;
+    analyzer_.Analyze(features, &entry.frame);
+    frames_.Write(&entry, 1);
+}
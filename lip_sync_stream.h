@@ -0,0 +1,46 @@
+#ifndef LIP_SYNC_STREAM_H
+#define LIP_SYNC_STREAM_H
+
+#include "feature_engine.h"
+#include "fixed_broadcast_ring_buffer.h"
+#include "lip_sync_analyzer.h"
+
+// Turns the features of a FeatureEngine into lip-sync frames, once for the
+// stream, and publishes them to any number of readers. Clients that only
+// animate a mouth read these instead of the audio.
+class LipSyncStream : public FeatureEngine::Stage
+{
+public:
+    // One published frame and the absolute index of its first sample in the
+    // Recorder's stream.
+    struct Entry
+    {
+        ring_buffer_pos_t first_sample;
+        stream_protocol::LipSyncFrame frame;
+    };
+
+    LipSyncStream();
+
+    bool Configure(const FeatureExtractor &extractor) override;
+    void Reset() override;
+    void Process(const FeatureFrame &features) override;
+
+    // About ten seconds of frames. The ring lives as long as the stream,
+    // so readers can subscribe before the engine starts and stay attached
+    // across restarts.
+    typedef FixedBroadcastRingBuffer<Entry, 1024> Ring;
+    typedef Ring::Reader Reader;
+
+    // Starts |reader| at the newest frame. Read it with WaitReadable() and
+    // Read().
+    void Subscribe(Reader *reader) { reader->Attach(&frames_); }
+
+    int GetSampleRate() const { return sample_rate_; }
+
+private:
+    int sample_rate_;
+    LipSyncAnalyzer analyzer_;
+    Ring frames_;
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <string>
+
+// Logging for the capture pipeline, which builds without Windows headers.
+// The server sends it to the debugger (Misc.cpp); the console driver
+// prints it (driver/console_logger.cpp).
+namespace logger {
+
+void Log(const wchar_t* fmt, ...);
+
+// Converts UTF-8 |str|, e.g. an error from a CaptureSource, for a %ls
+// argument to Log().
+std::wstring FromUtf8(const std::string &str);
+
+}
+
+#endif
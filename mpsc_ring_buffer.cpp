@@ -0,0 +1,288 @@
+#include "mpsc_ring_buffer.h"
+#include "ring_storage.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Low bit of BlockHeader::sequence. Block positions are multiples of the
+   header size, so the bit is free. */
+static const uint64_t kCommitted = 1;
+
+MpscRingBuffer::MpscRingBuffer()
+{
+    bufferBytes_ = 0;
+    smallMask_ = 0;
+    elementSizeBytes_ = 0;
+    buffer_ = nullptr;
+    mirrored_ = false;
+    reservePosition_.store(0, std::memory_order_relaxed);
+    droppedCount_.store(0, std::memory_order_relaxed);
+    readPosition_.store(0, std::memory_order_relaxed);
+    peekEndPosition_ = -1;
+}
+
+MpscRingBuffer::~MpscRingBuffer()
+{
+    FreeBuffer();
+}
+
+void MpscRingBuffer::FreeBuffer()
+{
+    ring_storage::Free(&storage_);
+    buffer_ = nullptr;
+    mirrored_ = false;
+    bufferBytes_ = 0;
+}
+
+/***************************************************************************
+ * Initialize FIFO.
+ * bufferBytes must be power of 2, returns -1 if not.
+ */
+int MpscRingBuffer::Initialize(ring_buffer_size_t elementSizeBytes, ring_buffer_size_t bufferBytes,
+                               RingBufferStorage storage, const ring_storage::Options &options)
+{
+    FreeBuffer();
+
+    if (((bufferBytes - 1) & bufferBytes) != 0 || bufferBytes < 4 * (ring_buffer_size_t)sizeof(BlockHeader))
+        return -1; /* Not Power of two, or too small to hold a block. */
+
+    bool mirrored = storage == kRingBufferMirrored;
+    if (mirrored)
+    {
+        size_t granularity = ring_storage::GetMirrorGranularity();
+        while ((size_t)bufferBytes % granularity != 0)
+            bufferBytes *= 2;
+    }
+    if (!ring_storage::Allocate((size_t)bufferBytes, mirrored, options, &storage_))
+        return -1;
+    buffer_ = (char *)storage_.data;
+    mirrored_ = mirrored;
+
+    /* Positions restart at zero and a zeroed sequence never matches one.
+       From here on the reader clears every header slot it hands back, see
+       ClearHeaders(). */
+    memset(buffer_, 0, bufferBytes);
+    bufferBytes_ = bufferBytes;
+    smallMask_ = bufferBytes - 1;
+    elementSizeBytes_ = elementSizeBytes;
+    reservePosition_.store(0, std::memory_order_relaxed);
+    droppedCount_.store(0, std::memory_order_relaxed);
+    readPosition_.store(0, std::memory_order_relaxed);
+    peekEndPosition_ = -1;
+    return 0;
+}
+
+/***************************************************************************
+ */
+ring_buffer_size_t MpscRingBuffer::GetBlockBytes(ring_buffer_size_t elementCount) const
+{
+    const ring_buffer_size_t headerBytes = sizeof(BlockHeader);
+    return (headerBytes + elementCount * elementSizeBytes_ + headerBytes - 1) & ~(headerBytes - 1);
+}
+
+/***************************************************************************
+ */
+MpscRingBuffer::BlockHeader *MpscRingBuffer::GetHeader(ring_buffer_pos_t position) const
+{
+    return (BlockHeader *)&buffer_[position & smallMask_];
+}
+
+/***************************************************************************
+ * Zero the sequence word of every header slot in [begin, end).
+ * Elements of an earlier lap can sit where a later block's header goes, and
+ * until that block is committed they would be read as its sequence. Any
+ * 16 bytes of samples may equal position | kCommitted, so rather than rely
+ * on the bytes never matching, the reader clears the slots before handing
+ * the space back, and a reserved header always reads 0 until Commit().
+ */
+void MpscRingBuffer::ClearHeaders(ring_buffer_pos_t begin, ring_buffer_pos_t end)
+{
+    for (ring_buffer_pos_t position = begin; position < end; position += sizeof(BlockHeader))
+        GetHeader(position)->sequence.store(0, std::memory_order_relaxed);
+}
+
+/***************************************************************************
+** Return elements reserved. */
+ring_buffer_size_t MpscRingBuffer::Reserve(ring_buffer_size_t elementCount, uint32_t tag,
+                                           Reservation *reservation)
+{
+    const ring_buffer_size_t headerBytes = sizeof(BlockHeader);
+    ring_buffer_pos_t position = reservePosition_.load(std::memory_order_relaxed);
+    ring_buffer_size_t count = 0;
+    ring_buffer_size_t skipBytes = 0;
+    ring_buffer_size_t blockBytes = 0;
+    while (elementCount > 0)
+    {
+        /* acquire pairs with the release in Consume(): the reader is done with
+           the space we are about to claim. */
+        ring_buffer_pos_t readPosition = readPosition_.load(std::memory_order_acquire);
+        ring_buffer_size_t freeBytes = bufferBytes_ - (ring_buffer_size_t)(position - readPosition);
+        ring_buffer_size_t roomBytes = freeBytes;
+        skipBytes = 0;
+        if (!mirrored_)
+        {
+            /* A heap block must not wrap. Put it before the end if it fits
+               there, otherwise pad up to the end and start it at the front. */
+            ring_buffer_size_t tailBytes = bufferBytes_ - (ring_buffer_size_t)(position & smallMask_);
+            if (freeBytes > tailBytes)
+            {
+                roomBytes = tailBytes;
+                if (GetBlockBytes(elementCount) > tailBytes && freeBytes - tailBytes > tailBytes)
+                {
+                    skipBytes = tailBytes;
+                    roomBytes = freeBytes - tailBytes;
+                }
+            }
+        }
+
+        count = 0;
+        if (roomBytes > headerBytes)
+            count = (roomBytes - headerBytes) / elementSizeBytes_;
+        if (count > elementCount)
+            count = elementCount;
+        if (count == 0)
+            break;
+
+        /* Other writers move reservePosition_ too; on failure position is
+           reloaded and we size the block again. */
+        blockBytes = GetBlockBytes(count);
+        if (reservePosition_.compare_exchange_weak(position, position + skipBytes + blockBytes,
+                                                   std::memory_order_relaxed, std::memory_order_relaxed))
+            break;
+    }
+
+    if (count < elementCount)
+        droppedCount_.fetch_add(elementCount - count, std::memory_order_relaxed);
+    if (count == 0)
+    {
+        reservation->data = NULL;
+        reservation->elementCount = 0;
+        reservation->header = NULL;
+        reservation->position = -1;
+        return 0;
+    }
+
+    if (skipBytes > 0)
+    {
+        /* The padding has nothing to fill, so it is committed right away. */
+        BlockHeader *padding = GetHeader(position);
+        padding->elementCount = 0;
+        padding->tag = 0;
+        padding->sequence.store((uint64_t)position | kCommitted, std::memory_order_release);
+        position += skipBytes;
+    }
+
+    BlockHeader *header = GetHeader(position);
+    header->elementCount = (uint32_t)count;
+    header->tag = tag;
+    reservation->data = header + 1;
+    reservation->elementCount = count;
+    reservation->header = header;
+    reservation->position = position;
+    return count;
+}
+
+/***************************************************************************
+ */
+void MpscRingBuffer::Commit(const Reservation &reservation)
+{
+    if (reservation.header == NULL)
+        return;
+
+    /* release pairs with the acquire in FindBlock(): the elements and the
+       rest of the header are visible once the sequence is. */
+    reservation.header->sequence.store((uint64_t)reservation.position | kCommitted,
+                                       std::memory_order_release);
+
+    if (waitGate_.HasWaiters())
+        waitGate_.Notify(reservation.position + GetBlockBytes(reservation.elementCount));
+}
+
+/***************************************************************************
+** Return elements written. */
+ring_buffer_size_t MpscRingBuffer::Write(const void *data, ring_buffer_size_t elementCount, uint32_t tag)
+{
+    Reservation reservation;
+    ring_buffer_size_t numWritten = Reserve(elementCount, tag, &reservation);
+    if (numWritten > 0)
+    {
+        memcpy(reservation.data, data, numWritten * elementSizeBytes_);
+        Commit(reservation);
+    }
+    return numWritten;
+}
+
+/***************************************************************************
+ */
+bool MpscRingBuffer::FindBlock(Block *block)
+{
+    ring_buffer_pos_t position = readPosition_.load(std::memory_order_relaxed);
+    while (true)
+    {
+        BlockHeader *header = GetHeader(position);
+        if (header->sequence.load(std::memory_order_acquire) != ((uint64_t)position | kCommitted))
+            return false;
+
+        if (header->elementCount == 0)
+        {
+            /* Padding up to the end of the buffer; hand the space back at once. */
+            ring_buffer_pos_t end = position + bufferBytes_ - (ring_buffer_size_t)(position & smallMask_);
+            ClearHeaders(position, end);
+            position = end;
+            readPosition_.store(position, std::memory_order_release);
+            continue;
+        }
+
+        block->data = header + 1;
+        block->elementCount = header->elementCount;
+        block->tag = header->tag;
+        peekEndPosition_ = position + GetBlockBytes(header->elementCount);
+        return true;
+    }
+}
+
+/***************************************************************************
+ */
+bool MpscRingBuffer::Peek(Block *block)
+{
+    if (FindBlock(block))
+        return true;
+    block->data = NULL;
+    block->elementCount = 0;
+    block->tag = 0;
+    return false;
+}
+
+/***************************************************************************
+ */
+void MpscRingBuffer::Consume()
+{
+    if (peekEndPosition_ < 0)
+        return;
+
+    ClearHeaders(readPosition_.load(std::memory_order_relaxed), peekEndPosition_);
+    /* release: our reads of the block, and the cleared headers, are done
+       before a writer reuses the space. */
+    readPosition_.store(peekEndPosition_, std::memory_order_release);
+    peekEndPosition_ = -1;
+}
+
+/***************************************************************************
+ */
+bool MpscRingBuffer::WaitReadable(int timeoutMs)
+{
+    /* Any commit ending past the read position may be the block we need;
+       a commit further ahead wakes us early and we wait again. */
+    Block block;
+    return ring_wait::WaitReadable(waitGate_, 1, timeoutMs,
+                                   [this, &block](int64_t *threshold) {
+                                       *threshold = readPosition_.load(std::memory_order_relaxed) + 1;
+                                       return FindBlock(&block) ? 1 : 0;
+                                   }) > 0;
+}
+
+/***************************************************************************
+ */
+ring_buffer_pos_t MpscRingBuffer::GetDroppedCount() const
+{
+    return droppedCount_.load(std::memory_order_relaxed);
+}
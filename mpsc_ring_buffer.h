@@ -0,0 +1,177 @@
+#ifndef MPSC_RING_BUFFER_H
+#define MPSC_RING_BUFFER_H
+
+/** @file
+ @brief Multi-writer single-reader lock-free ring buffer of blocks
+
+ MpscRingBuffer lets several writers, for example one capture callback per
+ microphone, feed one reader without a lock. Writers reserve whole blocks of
+ elements, fill them in place and commit them; the reader takes the blocks
+ out in reservation order, each tagged with the writer's tag.
+
+ Every block starts with a header whose sequence word is the block's
+ absolute byte position, stored last with release ordering when the block
+ is committed. The reader only hands out a block once it finds the expected
+ sequence there, so it never sees a block that is still being filled. Before
+ handing consumed space back to the writers the reader zeroes the sequence
+ word of every header slot in it, so neither an old header nor old elements
+ that happen to land where a new header goes can pass for a committed block.
+ A writer that is slow to commit holds back the blocks reserved after its
+ own, but never corrupts them.
+
+ Writers claim space by moving a shared reservation position forward with a
+ compare-and-swap, checked against the read position, so they never wait for
+ each other and never overwrite unread blocks. A block that does not fit
+ before the end of a heap buffer is preceded by a padding block up to the
+ end; with mirrored storage blocks simply run across the end.
+*/
+
+#include "ring_buffer.h"
+
+class MpscRingBuffer
+{
+    /** Precedes each block in the buffer. Blocks start on multiples of its size. */
+    struct BlockHeader
+    {
+        std::atomic<uint64_t> sequence; /**< Block position | kCommitted, stored when committed. */
+        uint32_t elementCount;          /**< Elements in the block; 0 for padding. */
+        uint32_t tag;                   /**< Passed to Reserve() by the writer. */
+    };
+
+    /* Set by Initialize() and read-only afterwards. */
+    ring_buffer_size_t bufferBytes_;         /**< Size of the buffer in bytes. Power of 2. */
+    ring_buffer_size_t smallMask_;           /**< Used for fitting positions to buffer. */
+    ring_buffer_size_t elementSizeBytes_;    /**< Number of bytes per element. */
+    char *buffer_;                           /**< Pointer to the buffer containing headers and data. */
+    bool mirrored_;                          /**< True if buffer_ is followed by a mirror of itself. */
+    ring_storage::Block storage_;            /**< How buffer_ was allocated. */
+    char pad0_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Writer side, shared by all writers. */
+    std::atomic<ring_buffer_pos_t> reservePosition_; /**< Byte position of the next block to reserve. */
+    std::atomic<ring_buffer_pos_t> droppedCount_;    /**< Elements writers could not reserve room for. */
+    char pad1_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Reader side. Writers load readPosition_ to see how much room there is. */
+    std::atomic<ring_buffer_pos_t> readPosition_;  /**< Byte position of the next block to read. */
+    ring_buffer_pos_t peekEndPosition_;            /**< End of the block returned by the last Peek(), or -1. */
+    char pad2_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Blocking reads. Writers only load from here unless the reader is waiting. */
+    RingWaitGate waitGate_;                        /**< Progress is the end of the committed block. */
+    char pad3_[RING_BUFFER_CACHE_LINE_SIZE];
+
+public:
+    /** A block reserved by Reserve(), to be filled and passed to Commit(). */
+    struct Reservation
+    {
+        void *data;                      /**< Where to write the elements. */
+        ring_buffer_size_t elementCount; /**< Number of elements reserved. */
+        BlockHeader *header;             /**< Used by Commit(). */
+        ring_buffer_pos_t position;      /**< Used by Commit(). */
+    };
+
+    /** A committed block returned by Peek(). */
+    struct Block
+    {
+        const void *data;                /**< The elements, contiguous. */
+        ring_buffer_size_t elementCount; /**< Number of elements in the block. */
+        uint32_t tag;                    /**< The tag the writer reserved the block with. */
+    };
+
+    MpscRingBuffer();
+    ~MpscRingBuffer();
+
+    /** Initialize the ring buffer to empty state ready to have blocks written to it.
+     Should not be called while the ring buffer is being read or written.
+     With kRingBufferMirrored, bufferBytes is doubled until it is a whole number
+     of mapping granules.
+     @param elementSizeBytes The size of a single data element in bytes.
+     @param bufferBytes The size of the buffer in bytes, including a 16-byte
+            header per block (must be a power of 2, at least 64).
+     @param storage How the buffer memory is allocated.
+     @param options Alignment, prefaulting, locking and NUMA placement of the buffer memory.
+     @return -1 if bufferBytes is not a power of 2 or the storage could not be allocated, otherwise 0.
+    */
+    int Initialize(ring_buffer_size_t elementSizeBytes, ring_buffer_size_t bufferBytes,
+                   RingBufferStorage storage = kRingBufferHeap,
+                   const ring_storage::Options &options = ring_storage::Options());
+
+    /** Reserve a contiguous block of elements. Safe to call from any number of
+     writers at once. Must be followed by Commit() once the block is filled;
+     blocks reserved later by other writers are not readable until then.
+     @param elementCount The number of elements desired.
+     @param tag Handed to the reader with the block, e.g. the index of the device.
+     @param reservation Receives the block to fill.
+     @return The number of elements reserved, which may be less than elementCount
+             if the ring is nearly full, or 0 if there is no room at all. The
+             rest is counted in GetDroppedCount().
+    */
+    ring_buffer_size_t Reserve(ring_buffer_size_t elementCount, uint32_t tag, Reservation *reservation);
+
+    /** Publish a block previously filled through Reserve() to the reader.
+     The whole reservation is published.
+    */
+    void Commit(const Reservation &reservation);
+
+    /** Write a block to the ring buffer. Elements that do not fit are dropped.
+     @param data The address of new data to write to the buffer.
+     @param elementCount The number of elements to be written.
+     @param tag Handed to the reader with the block.
+     @return The number of elements written.
+    */
+    ring_buffer_size_t Write(const void *data, ring_buffer_size_t elementCount, uint32_t tag);
+
+    /** Get the oldest committed block without copying it out of the ring buffer.
+     Only the reader may call this. The block stays valid until Consume().
+     @param block Receives the block.
+     @return false if the next block is not committed yet.
+    */
+    bool Peek(Block *block);
+
+    /** Release the block returned by the last Peek() back to the writers.
+    */
+    void Consume();
+
+    /** Wait until the next block is committed.
+     @param timeoutMs The longest time to wait, 0 to only spin, or RING_WAIT_INFINITE.
+     @return true if a block can be peeked.
+    */
+    bool WaitReadable(int timeoutMs);
+
+    /** Retrieve the number of elements Reserve() found no room for.
+    */
+    ring_buffer_pos_t GetDroppedCount() const;
+
+    /** Retrieve the size of a single element in bytes.
+    */
+    ring_buffer_size_t GetElementSize() const { return elementSizeBytes_; }
+
+    /** Retrieve the size of the buffer in bytes.
+    */
+    ring_buffer_size_t GetBufferBytes() const { return bufferBytes_; }
+
+    /** Return true if the buffer memory was locked as requested through
+     ring_storage::Options::lock.
+    */
+    bool IsLocked() const { return storage_.locked; }
+
+private:
+    /** Release the buffer storage, if any. */
+    void FreeBuffer();
+
+    /** Bytes taken by a block of elementCount elements, header included. */
+    ring_buffer_size_t GetBlockBytes(ring_buffer_size_t elementCount) const;
+
+    /** Header of the block at position. */
+    BlockHeader *GetHeader(ring_buffer_pos_t position) const;
+
+    /** Zero the sequence of every header slot from begin up to end. Reader only. */
+    void ClearHeaders(ring_buffer_pos_t begin, ring_buffer_pos_t end);
+
+    /** Return true and fill block if the block at readPosition_ is committed,
+     stepping over padding. Reader only. */
+    bool FindBlock(Block *block);
+};
+
+#endif /* MPSC_RING_BUFFER_H */
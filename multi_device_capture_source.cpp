@@ -0,0 +1,452 @@
+#include "multi_device_capture_source.h"
+#include <string.h>
+
+// How long the merge thread waits for a block before checking running_.
+static const int kWaitMs = 100;
+
+// Merged block size when CaptureFormat::frames_per_block leaves it open.
+static const int kDefaultBlockMs = 10;
+
+// The backlog average follows new blocks with this weight, and the
+// backlog target is taken once it has had this long to settle.
+static const double kBacklogSmoothing = 1.0 / 64;
+static const int kSettleMs = 1000;
+
+// Corrections are one frame at a time, at most this often per device;
+// every 20 ms at 16 kHz covers 3000 ppm of drift.
+static const int kCorrectionIntervalMs = 20;
+
+// Backlog the other devices are started with, in merged blocks: one to
+// merge, one for when a slower clock's callback slips past one of the
+// master's, and half for callbacks that come late.
+static const double kMinBacklogBlocks = 2.5;
+
+// A device whose backlog grows past this, e.g. because the master
+// stopped, loses its oldest frames.
+static const int kMaxBacklogMs = 1000;
+
+MultiDeviceCaptureSource::Device::Device(MultiDeviceCaptureSource *owner, uint32_t index,
+                                         std::unique_ptr<CaptureSource> source)
+    : source_(std::move(source))
+{
+    owner_ = owner;
+    index_ = index;
+    bytes_per_frame_ = 0;
+    pending_start_ = 0;
+    pending_time_ = 0;
+    has_data_ = false;
+    backlog_average_ = 0;
+    backlog_target_ = -1;
+    blocks_merged_ = 0;
+    blocks_since_correction_ = 0;
+}
+
+void MultiDeviceCaptureSource::Device::OnCapture(const void *frames, unsigned long frame_count,
+                                                 PaTime capture_time, PaStreamCallbackFlags status_flags)
+{
+    owner_->OnDeviceCapture(index_, frames, frame_count, capture_time, status_flags);
+}
+
+unsigned long MultiDeviceCaptureSource::Device::GetPendingFrames() const
+{
+    return (unsigned long)((pending_.size() - pending_start_) / bytes_per_frame_);
+}
+
+bool MultiDeviceCaptureSource::Device::TakeFrame(unsigned char *out)
+{
+    if (pending_start_ == pending_.size())
+    {
+        memcpy(out, last_frame_.data(), bytes_per_frame_);
+        return false;
+    }
+    memcpy(last_frame_.data(), &pending_[pending_start_], bytes_per_frame_);
+    memcpy(out, last_frame_.data(), bytes_per_frame_);
+    pending_start_ += bytes_per_frame_;
+    return true;
+}
+
+void MultiDeviceCaptureSource::Device::DropFrame()
+{
+    if (pending_start_ < pending_.size())
+    {
+        pending_start_ += bytes_per_frame_;
+    }
+}
+
+void MultiDeviceCaptureSource::Device::RepeatFrame()
+{
+    if (pending_start_ == pending_.size())
+    {
+        return;
+    }
+    // Usually there is room before the pending frames, left by the frames
+    // already taken.
+    if (pending_start_ >= (size_t)bytes_per_frame_)
+    {
+        pending_start_ -= bytes_per_frame_;
+        memmove(&pending_[pending_start_], &pending_[pending_start_ + bytes_per_frame_], bytes_per_frame_);
+    }
+    else
+    {
+        std::vector<unsigned char> frame(pending_.begin() + pending_start_,
+                                         pending_.begin() + pending_start_ + bytes_per_frame_);
+        pending_.insert(pending_.begin() + pending_start_, frame.begin(), frame.end());
+    }
+}
+
+MultiDeviceCaptureSource::MultiDeviceCaptureSource(std::vector<std::unique_ptr<CaptureSource>> sources)
+{
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        devices_.emplace_back(new Device(this, (uint32_t)i, std::move(sources[i])));
+    }
+    memset(&format_, 0, sizeof(format_));
+    sink_ = nullptr;
+    frames_per_block_ = 0;
+    running_ = false;
+    pending_flags_ = 0;
+}
+
+MultiDeviceCaptureSource::~MultiDeviceCaptureSource()
+{
+    Close();
+}
+
+bool MultiDeviceCaptureSource::Open(const CaptureFormat &format, Sink *sink)
+{
+    Close();
+    error_.clear();
+    if (!sink)
+    {
+        error_ = "Multi-device capture needs a sink.";
+        return false;
+    }
+    if (devices_.empty() || format.channels % (int)devices_.size() != 0)
+    {
+        error_ = "Channels must be split evenly between the devices.";
+        return false;
+    }
+    format_ = format;
+    sink_ = sink;
+
+    frames_per_block_ = format.frames_per_block;
+    if (frames_per_block_ == 0)
+    {
+        frames_per_block_ = (unsigned long)((long long)format.sample_rate * kDefaultBlockMs / 1000);
+    }
+    if (frames_per_block_ == 0)
+    {
+        frames_per_block_ = 1;
+    }
+
+    CaptureFormat device_format = format;
+    device_format.channels = format.channels / (int)devices_.size();
+    for (size_t i = 0; i < devices_.size(); i++)
+    {
+        Device *device = devices_[i].get();
+        if (!device->source_->Open(device_format, device))
+        {
+            error_ = "Device " + std::to_string(i) + ": " + device->source_->GetError();
+            Close();
+            return false;
+        }
+        device->bytes_per_frame_ = device_format.GetBytesPerFrame();
+    }
+
+    // Half a second of every device, with room for the block headers.
+    ring_buffer_size_t ring_bytes = 65536;
+    while (ring_bytes < (long long)format.sample_rate * format.GetBytesPerFrame() / 2)
+    {
+        ring_bytes *= 2;
+    }
+    if (-1 == blocks_.Initialize(1, ring_bytes))
+    {
+        error_ = "Could not allocate the merge buffer.";
+        Close();
+        return false;
+    }
+    merged_.resize(frames_per_block_ * format.GetBytesPerFrame());
+    return true;
+}
+
+bool MultiDeviceCaptureSource::Start()
+{
+    if (running_)
+    {
+        return true;
+    }
+
+    // Blocks the devices delivered after the thread last looked, before
+    // Stop(), would otherwise be merged as the first audio of this run.
+    // The devices are stopped, so nothing writes to blocks_ meanwhile.
+    MpscRingBuffer::Block block;
+    while (blocks_.Peek(&block))
+    {
+        blocks_.Consume();
+    }
+    for (size_t i = 0; i < devices_.size(); i++)
+    {
+        Device *device = devices_[i].get();
+        device->pending_.clear();
+        device->pending_start_ = 0;
+        device->last_frame_.assign(device->bytes_per_frame_, 0);
+        device->has_data_ = false;
+        device->backlog_average_ = 0;
+        device->backlog_target_ = -1;
+        device->blocks_merged_ = 0;
+        device->blocks_since_correction_ = 0;
+    }
+    pending_flags_ = 0;
+    running_ = true;
+    thread_ = std::thread(&MultiDeviceCaptureSource::ThreadMain, this);
+
+    // Starting them back to back keeps the initial offsets between the
+    // devices small; drift compensation then holds them where they settle.
+    for (size_t i = 0; i < devices_.size(); i++)
+    {
+        if (!devices_[i]->source_->Start())
+        {
+            error_ = "Device " + std::to_string(i) + ": " + devices_[i]->source_->GetError();
+            Stop();
+            return false;
+        }
+    }
+    return true;
+}
+
+void MultiDeviceCaptureSource::Stop()
+{
+    for (size_t i = 0; i < devices_.size(); i++)
+    {
+        devices_[i]->source_->Stop();
+    }
+    running_ = false;
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+void MultiDeviceCaptureSource::Close()
+{
+    Stop();
+    for (size_t i = 0; i < devices_.size(); i++)
+    {
+        devices_[i]->source_->Close();
+    }
+    sink_ = nullptr;
+}
+
+unsigned long MultiDeviceCaptureSource::Read(void *frames, unsigned long frame_count, PaStreamCallbackFlags *status_flags)
+{
+    (void)frames;
+    (void)frame_count;
+    *status_flags = 0;
+    return 0;
+}
+
+PaTime MultiDeviceCaptureSource::GetTime()
+{
+    return devices_[0]->source_->GetTime();
+}
+
+PaTime MultiDeviceCaptureSource::GetInputLatency()
+{
+    // Frames also wait for the master to complete a block and hold back
+    // another.
+    PaTime latency = 0;
+    for (size_t i = 0; i < devices_.size(); i++)
+    {
+        PaTime device_latency = devices_[i]->source_->GetInputLatency();
+        if (device_latency > latency)
+        {
+            latency = device_latency;
+        }
+    }
+    return latency + 2.0 * frames_per_block_ / format_.sample_rate;
+}
+
+void MultiDeviceCaptureSource::OnDeviceCapture(uint32_t index, const void *frames, unsigned long frame_count,
+                                               PaTime capture_time, PaStreamCallbackFlags status_flags)
+{
+    ring_buffer_size_t bytes_per_frame = devices_[index]->bytes_per_frame_;
+    MpscRingBuffer::Reservation reservation;
+    ring_buffer_size_t num_bytes = blocks_.Reserve((ring_buffer_size_t)sizeof(BlockInfo) + frame_count * bytes_per_frame,
+                                                   index, &reservation);
+    if (num_bytes == 0)
+    {
+        return;
+    }
+
+    // A nearly full ring may cut the block short; the reader sees the rest
+    // as an overflow, or skips the block if not even the info fit.
+    if (num_bytes >= (ring_buffer_size_t)sizeof(BlockInfo))
+    {
+        BlockInfo info;
+        info.capture_time = capture_time;
+        info.frame_count = (unsigned long)((num_bytes - sizeof(BlockInfo)) / bytes_per_frame);
+        info.status_flags = status_flags;
+        if (info.frame_count < frame_count)
+        {
+            info.status_flags |= paInputOverflow;
+        }
+        memcpy(reservation.data, &info, sizeof(info));
+        memcpy((char *)reservation.data + sizeof(info), frames, info.frame_count * bytes_per_frame);
+    }
+    blocks_.Commit(reservation);
+}
+
+void MultiDeviceCaptureSource::ThreadMain()
+{
+    while (running_)
+    {
+        if (!blocks_.WaitReadable(kWaitMs))
+        {
+            continue;
+        }
+        MpscRingBuffer::Block block;
+        while (blocks_.Peek(&block))
+        {
+            AddBlock(block);
+            blocks_.Consume();
+        }
+        MergeBlocks();
+    }
+}
+
+void MultiDeviceCaptureSource::AddBlock(const MpscRingBuffer::Block &block)
+{
+    if (block.elementCount < (ring_buffer_size_t)sizeof(BlockInfo) || block.tag >= devices_.size())
+    {
+        pending_flags_ |= paInputOverflow;
+        return;
+    }
+    BlockInfo info;
+    memcpy(&info, block.data, sizeof(info));
+    pending_flags_ |= info.status_flags;
+
+    Device *device = devices_[block.tag].get();
+    if (device->pending_start_ == device->pending_.size())
+    {
+        device->pending_.clear();
+        device->pending_start_ = 0;
+        device->pending_time_ = info.capture_time;
+    }
+    else if (device->pending_start_ > device->pending_.size() / 2)
+    {
+        device->pending_.erase(device->pending_.begin(), device->pending_.begin() + device->pending_start_);
+        device->pending_start_ = 0;
+    }
+    if (!device->has_data_ && block.tag != 0)
+    {
+        // Starts the other devices with a backlog of kMinBacklogBlocks, the
+        // front of it silence.
+        size_t backlog_bytes = (size_t)(kMinBacklogBlocks * frames_per_block_) * device->bytes_per_frame_;
+        size_t block_bytes = info.frame_count * device->bytes_per_frame_;
+        if (block_bytes < backlog_bytes)
+        {
+            device->pending_.assign(backlog_bytes - block_bytes, 0);
+        }
+    }
+    const unsigned char *frames = (const unsigned char *)block.data + sizeof(info);
+    device->pending_.insert(device->pending_.end(), frames, frames + info.frame_count * device->bytes_per_frame_);
+    device->has_data_ = true;
+
+    unsigned long max_backlog = (unsigned long)((long long)format_.sample_rate * kMaxBacklogMs / 1000);
+    unsigned long backlog = device->GetPendingFrames();
+    if (backlog > max_backlog)
+    {
+        device->pending_start_ += (backlog - max_backlog) * device->bytes_per_frame_;
+        device->pending_time_ += (PaTime)(backlog - max_backlog) / format_.sample_rate;
+        pending_flags_ |= paInputOverflow;
+    }
+}
+
+void MultiDeviceCaptureSource::MergeBlocks()
+{
+    // The master keeps a block in reserve, so the other devices have a
+    // block's time to deliver theirs when their callbacks come a little
+    // later than its own.
+    Device *master = devices_[0].get();
+    while (master->GetPendingFrames() >= 2 * frames_per_block_)
+    {
+        PaTime capture_time = master->pending_time_;
+        for (size_t i = 1; i < devices_.size(); i++)
+        {
+            CompensateDrift(devices_[i].get());
+        }
+
+        // Devices that have not delivered yet contribute silence; one that
+        // runs dry repeats its last frame.
+        unsigned char *out = merged_.data();
+        for (unsigned long frame = 0; frame < frames_per_block_; frame++)
+        {
+            for (size_t i = 0; i < devices_.size(); i++)
+            {
+                Device *device = devices_[i].get();
+                if (!device->TakeFrame(out) && device->has_data_)
+                {
+                    pending_flags_ |= paInputUnderflow;
+                }
+                out += device->bytes_per_frame_;
+            }
+        }
+        master->pending_time_ += (PaTime)frames_per_block_ / format_.sample_rate;
+
+        sink_->OnCapture(merged_.data(), frames_per_block_, capture_time, pending_flags_);
+        pending_flags_ = 0;
+    }
+}
+
+void MultiDeviceCaptureSource::CompensateDrift(Device *device)
+{
+    if (!device->has_data_)
+    {
+        return;
+    }
+    double backlog = device->GetPendingFrames();
+    if (device->blocks_merged_ == 0)
+    {
+        device->backlog_average_ = backlog;
+    }
+    else
+    {
+        device->backlog_average_ += (backlog - device->backlog_average_) * kBacklogSmoothing;
+    }
+    device->blocks_merged_++;
+    device->blocks_since_correction_++;
+
+    long long settle_blocks = (long long)format_.sample_rate * kSettleMs / 1000 / frames_per_block_;
+    if (device->backlog_target_ < 0)
+    {
+        if (device->blocks_merged_ >= settle_blocks)
+        {
+            device->backlog_target_ = device->backlog_average_;
+        }
+        return;
+    }
+
+    // A quarter block of tolerance keeps callback jitter from triggering
+    // corrections. The average is moved along with each correction, so it
+    // does not keep asking for more while it catches up.
+    long long interval_blocks = (long long)format_.sample_rate * kCorrectionIntervalMs / 1000 / frames_per_block_;
+    if (device->blocks_since_correction_ < interval_blocks)
+    {
+        return;
+    }
+    double tolerance = frames_per_block_ / 4.0;
+    if (device->backlog_average_ > device->backlog_target_ + tolerance)
+    {
+        // Its clock runs fast: skip a frame.
+        device->DropFrame();
+        device->backlog_average_ -= 1;
+        device->blocks_since_correction_ = 0;
+    }
+    else if (device->backlog_average_ < device->backlog_target_ - tolerance && device->GetPendingFrames() > 0)
+    {
+        // Its clock runs slow: repeat a frame.
+        device->RepeatFrame();
+        device->backlog_average_ += 1;
+        device->blocks_since_correction_ = 0;
+    }
+}
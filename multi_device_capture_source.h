@@ -0,0 +1,119 @@
+#ifndef MULTI_DEVICE_CAPTURE_SOURCE_H
+#define MULTI_DEVICE_CAPTURE_SOURCE_H
+
+#include "capture_source.h"
+#include "mpsc_ring_buffer.h"
+#include <vector>
+
+// Captures from several sources at once and interleaves them into one
+// multichannel stream: the channels of the first source, then those of the
+// second, and so on, each source getting an equal share of the channels.
+//
+// Every source's callback writes its blocks to one MpscRingBuffer, tagged
+// with the source's index, and a merge thread hands the interleaved blocks
+// to the sink. The first source is the clock master: merged blocks carry its
+// capture times and follow its pace. The other sources' clocks drift from it
+// by up to a few hundred ppm, so each keeps a backlog of frames waiting to be
+// merged; when that backlog moves away from where it settled, a frame is
+// dropped or repeated to bring it back.
+//
+// Callback mode only; Open() fails without a sink.
+class MultiDeviceCaptureSource : public CaptureSource
+{
+public:
+    explicit MultiDeviceCaptureSource(std::vector<std::unique_ptr<CaptureSource>> sources);
+    ~MultiDeviceCaptureSource() override;
+
+    bool Open(const CaptureFormat &format, Sink *sink) override;
+    bool Start() override;
+    void Stop() override;
+    void Close() override;
+    unsigned long Read(void *frames, unsigned long frame_count, PaStreamCallbackFlags *status_flags) override;
+    unsigned long GetReadAvailable() override { return 0; }
+    PaTime GetTime() override;
+    PaTime GetInputLatency() override;
+
+private:
+    // One of the merged sources, and the frames it captured that are not
+    // merged yet.
+    class Device : public Sink
+    {
+    public:
+        Device(MultiDeviceCaptureSource *owner, uint32_t index, std::unique_ptr<CaptureSource> source);
+
+        void OnCapture(const void *frames, unsigned long frame_count,
+                       PaTime capture_time, PaStreamCallbackFlags status_flags) override;
+
+        unsigned long GetPendingFrames() const;
+
+        // Copies the next frame to |out|, or repeats the last one if none
+        // is pending. Returns false when it had to repeat.
+        bool TakeFrame(unsigned char *out);
+
+        // Skips the next pending frame, or makes it pending twice.
+        void DropFrame();
+        void RepeatFrame();
+
+        MultiDeviceCaptureSource *owner_;
+        uint32_t index_;
+        std::unique_ptr<CaptureSource> source_;
+        int bytes_per_frame_;
+
+        // Frames waiting to be merged start at pending_[pending_start_].
+        std::vector<unsigned char> pending_;
+        size_t pending_start_;
+        std::vector<unsigned char> last_frame_;
+
+        // Capture time of the first pending frame. Master only.
+        PaTime pending_time_;
+
+        // Drift tracking: the backlog averaged over recent blocks, where it
+        // settled after the first second, and blocks since the last
+        // correction. Unused for the master.
+        bool has_data_;
+        double backlog_average_;
+        double backlog_target_;
+        long long blocks_merged_;
+        long long blocks_since_correction_;
+    };
+
+    // Prefixes each block in blocks_.
+    struct BlockInfo
+    {
+        PaTime capture_time;
+        unsigned long frame_count;
+        PaStreamCallbackFlags status_flags;
+    };
+
+    // Called from the sources' callbacks.
+    void OnDeviceCapture(uint32_t index, const void *frames, unsigned long frame_count,
+                         PaTime capture_time, PaStreamCallbackFlags status_flags);
+
+    void ThreadMain();
+
+    // Moves a block from blocks_ to its device's pending frames.
+    void AddBlock(const MpscRingBuffer::Block &block);
+
+    // Merges and delivers blocks while the master has a whole one pending
+    // besides the one it holds back.
+    void MergeBlocks();
+
+    // Keeps device |device|'s backlog where it settled; called once per
+    // merged block, before its frames are taken.
+    void CompensateDrift(Device *device);
+
+    std::vector<std::unique_ptr<Device>> devices_;
+    CaptureFormat format_;
+    Sink *sink_;
+    unsigned long frames_per_block_;
+
+    MpscRingBuffer blocks_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+
+    // Merge thread only.
+    std::vector<unsigned char> merged_;
+    PaStreamCallbackFlags pending_flags_;
+};
+
+#endif
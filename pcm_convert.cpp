@@ -0,0 +1,525 @@
+#include "pcm_convert.h"
+#include "pcm_kernels.h"
+#include <math.h>
+#include <atomic>
+
+#if PCM_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace pcm {
+
+// Frames converted at a time through the float planes.
+static const size_t kChunkFrames = 256;
+const float kScale24 = 8388607.0f;
+
+/***************************************************************************
+ * Scalar kernels.
+ */
+namespace scalar {
+
+static inline float Clip(float sample)
+{
+    return sample > 1.0f ? 1.0f : (sample < -1.0f ? -1.0f : sample);
+}
+
+void FloatToInt8(const float *in, size_t count, int8_t *out)
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = (int8_t)lrintf(Clip(in[i]) * kScale8);
+}
+
+void FloatToInt16(const float *in, size_t count, int16_t *out)
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = (int16_t)lrintf(Clip(in[i]) * kScale16);
+}
+
+void FloatToInt32(const float *in, size_t count, int32_t *out)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        float scaled = Clip(in[i]) * kScale32;
+        out[i] = (int32_t)lrintf(scaled > kMax32 ? kMax32 : scaled);
+    }
+}
+
+void Int16ToFloat(const int16_t *in, size_t count, float *out)
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = in[i] * (1.0f / kScale16);
+}
+
+void Int32ToFloat(const int32_t *in, size_t count, float *out)
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = (float)in[i] * (1.0f / kScale32);
+}
+
+void MulAdd(const float *in, float gain, size_t count, float *out)
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] += gain * in[i];
+}
+
+float Dot(const float *a, const float *b, size_t count)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+void Butterfly(float *a_re, float *a_im, float *b_re, float *b_im, const float *w_re, const float *w_im, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        float t_re = w_re[i] * b_re[i] - w_im[i] * b_im[i];
+        float t_im = w_re[i] * b_im[i] + w_im[i] * b_re[i];
+        b_re[i] = a_re[i] - t_re;
+        b_im[i] = a_im[i] - t_im;
+        a_re[i] += t_re;
+        a_im[i] += t_im;
+    }
+}
+
+float Peak(const float *in, size_t count)
+{
+    float peak = 0.0f;
+    for (size_t i = 0; i < count; i++)
+    {
+        float x = fabsf(in[i]);
+        if (x > peak)
+            peak = x;
+    }
+    return peak;
+}
+
+void Ramp(float *data, size_t count, float gain, float step)
+{
+    for (size_t i = 0; i < count; i++)
+        data[i] *= gain + i * step;
+}
+
+const Kernels kKernels = {FloatToInt8, FloatToInt16, FloatToInt32, Int16ToFloat, Int32ToFloat, MulAdd, Dot, Butterfly,
+                            Peak, Ramp};
+
+}
+
+/***************************************************************************
+ * Dispatch.
+ */
+static SimdLevel DetectSimdLevel()
+{
+#if PCM_X86
+    unsigned int regs[4] = {0};
+    unsigned int max_leaf = 0;
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    max_leaf = (unsigned int)info[0];
+    __cpuid(info, 1);
+    regs[2] = (unsigned int)info[2];
+    regs[3] = (unsigned int)info[3];
+#else
+    max_leaf = __get_cpuid_max(0, nullptr);
+    __cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    if (!(regs[3] & (1u << 26)))
+        return kScalar;
+
+    // AVX state must also be enabled by the OS, as XGETBV reports.
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    if (!osxsave || max_leaf < 7)
+        return kSse2;
+#if defined(_MSC_VER)
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    unsigned int ebx7 = (unsigned int)info[1];
+#else
+    unsigned int xcr0_lo = 0, xcr0_hi = 0;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    unsigned long long xcr0 = ((unsigned long long)xcr0_hi << 32) | xcr0_lo;
+    unsigned int eax7 = 0, ebx7 = 0, ecx7 = 0, edx7 = 0;
+    __cpuid_count(7, 0, eax7, ebx7, ecx7, edx7);
+#endif
+    bool avx_state = (xcr0 & 0x6) == 0x6;
+    bool avx512_state = (xcr0 & 0xe6) == 0xe6;
+    bool avx2 = (ebx7 & (1u << 5)) != 0 && (regs[2] & (1u << 12)) != 0; // AVX2 and FMA
+    bool avx512 = (ebx7 & (1u << 16)) != 0; // AVX-512 F
+    if (avx512 && avx2 && avx512_state)
+        return kAvx512;
+    if (avx2 && avx_state)
+        return kAvx2;
+    return kSse2;
+#else
+    return kScalar;
+#endif
+}
+
+static SimdLevel GetSupportedSimdLevel()
+{
+    static const SimdLevel level = DetectSimdLevel();
+    return level;
+}
+
+static std::atomic<int> g_simd_level(-1);
+
+SimdLevel GetSimdLevel()
+{
+    int level = g_simd_level.load(std::memory_order_relaxed);
+    if (level < 0)
+    {
+        level = GetSupportedSimdLevel();
+        g_simd_level.store(level, std::memory_order_relaxed);
+    }
+    return (SimdLevel)level;
+}
+
+void SetSimdLevel(SimdLevel level)
+{
+    SimdLevel supported = GetSupportedSimdLevel();
+    g_simd_level.store(level < supported ? level : supported, std::memory_order_relaxed);
+}
+
+const Kernels &GetKernels()
+{
+#if PCM_X86
+    switch (GetSimdLevel())
+    {
+    case kAvx512:
+        return avx512::kKernels;
+    case kAvx2:
+        return avx2::kKernels;
+    case kSse2:
+        return sse2::kKernels;
+    default:
+        break;
+    }
+#endif
+    return scalar::kKernels;
+}
+
+/***************************************************************************
+ * Formats.
+ */
+int GetSampleBytes(SampleFormat format)
+{
+    switch (format)
+    {
+    case kInt8:
+        return 1;
+    case kInt16:
+        return 2;
+    case kInt24:
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+SampleFormat GetSampleFormat(int bits_per_sample, bool float_samples)
+{
+    if (float_samples)
+        return kFloat32;
+    switch (bits_per_sample)
+    {
+    case 8:
+        return kInt8;
+    case 24:
+        return kInt24;
+    case 32:
+        return kInt32;
+    default:
+        return kInt16;
+    }
+}
+
+void ToFloat(const void *in, SampleFormat format, size_t count, float *out)
+{
+    const Kernels &kernels = GetKernels();
+    switch (format)
+    {
+    case kInt8:
+        for (size_t i = 0; i < count; i++)
+            out[i] = ((const int8_t *)in)[i] * (1.0f / kScale8);
+        break;
+    case kInt16:
+        kernels.int16_to_float((const int16_t *)in, count, out);
+        break;
+    case kInt24:
+        for (size_t i = 0; i < count; i++)
+        {
+            const unsigned char *p = (const unsigned char *)in + i * 3;
+            int32_t value = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+            out[i] = value * (1.0f / kScale24);
+        }
+        break;
+    case kInt32:
+        kernels.int32_to_float((const int32_t *)in, count, out);
+        break;
+    case kFloat32:
+        if (out != in)
+            memcpy(out, in, count * sizeof(float));
+        break;
+    }
+}
+
+// Converts without dither. May run in place.
+static void FromFloatNoDither(const Kernels &kernels, const float *in, size_t count, SampleFormat format, void *out)
+{
+    switch (format)
+    {
+    case kInt8:
+        kernels.float_to_int8(in, count, (int8_t *)out);
+        break;
+    case kInt16:
+        kernels.float_to_int16(in, count, (int16_t *)out);
+        break;
+    case kInt24:
+        for (size_t i = 0; i < count; i++)
+        {
+            float sample = in[i] > 1.0f ? 1.0f : (in[i] < -1.0f ? -1.0f : in[i]);
+            int32_t value = (int32_t)lrintf(sample * kScale24);
+            unsigned char *p = (unsigned char *)out + i * 3;
+            p[0] = (unsigned char)value;
+            p[1] = (unsigned char)(value >> 8);
+            p[2] = (unsigned char)(value >> 16);
+        }
+        break;
+    case kInt32:
+        kernels.float_to_int32(in, count, (int32_t *)out);
+        break;
+    case kFloat32:
+        if (out != in)
+            memmove(out, in, count * sizeof(float));
+        break;
+    }
+}
+
+void FromFloat(const float *in, size_t count, SampleFormat format, void *out, Dither *dither)
+{
+    const Kernels &kernels = GetKernels();
+    if (!dither || format == kInt32 || format == kFloat32)
+    {
+        FromFloatNoDither(kernels, in, count, format, out);
+        return;
+    }
+
+    // Adds the noise to a copy of each chunk; the copy is converted before
+    // the next chunk is read, so this still works in place.
+    float scale = format == kInt8 ? kScale8 : (format == kInt16 ? kScale16 : kScale24);
+    float noise_gain = 1.0f / (scale * 4294967296.0f);
+    float noise[kChunkFrames];
+    float chunk[kChunkFrames];
+    int bytes = GetSampleBytes(format);
+    for (size_t first = 0; first < count; first += kChunkFrames)
+    {
+        size_t n = count - first < kChunkFrames ? count - first : kChunkFrames;
+        uint32_t state = dither->state;
+        for (size_t i = 0; i < n; i++)
+        {
+            // Difference of two uniform values: triangular over +-1 LSB.
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            uint32_t a = state;
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            noise[i] = ((float)a - (float)state) * noise_gain;
+        }
+        dither->state = state;
+        memcpy(chunk, in + first, n * sizeof(float));
+        kernels.mul_add(noise, 1.0f, n, chunk);
+        FromFloatNoDither(kernels, chunk, n, format, (unsigned char *)out + first * bytes);
+    }
+}
+
+/***************************************************************************
+ * Channel mixing and Converter.
+ */
+void GetDefaultMixMatrix(int in_channels, int out_channels, float *matrix)
+{
+    memset(matrix, 0, sizeof(float) * in_channels * out_channels);
+    if (out_channels == 1)
+    {
+        for (int i = 0; i < in_channels; i++)
+            matrix[i] = 1.0f / in_channels;
+        return;
+    }
+    if (in_channels <= out_channels)
+    {
+        for (int o = 0; o < out_channels; o++)
+            matrix[o * in_channels + o % in_channels] = 1.0f;
+        return;
+    }
+    for (int o = 0; o < out_channels; o++)
+    {
+        int num_inputs = 0;
+        for (int i = o; i < in_channels; i += out_channels)
+            num_inputs++;
+        for (int i = o; i < in_channels; i += out_channels)
+            matrix[o * in_channels + i] = 1.0f / num_inputs;
+    }
+}
+
+Converter::Converter()
+{
+    in_.sample_format = out_.sample_format = kInt16;
+    in_.channels = out_.channels = 1;
+    in_.layout = out_.layout = kInterleaved;
+    dither_enabled_ = false;
+    matrix_.assign(1, 1.0f);
+    unity_mix_ = true;
+}
+
+bool Converter::Configure(const StreamFormat &in, const StreamFormat &out, bool dither)
+{
+    if (in.channels < 1 || out.channels < 1)
+        return false;
+    in_ = in;
+    out_ = out;
+    dither_enabled_ = dither;
+    matrix_.resize(in.channels * out.channels);
+    GetDefaultMixMatrix(in.channels, out.channels, matrix_.data());
+    unity_mix_ = in.channels == out.channels;
+    in_planes_.resize(kChunkFrames * in.channels);
+    out_planes_.resize(kChunkFrames * out.channels);
+    interleaved_.resize(kChunkFrames * (in.channels > out.channels ? in.channels : out.channels));
+    return true;
+}
+
+void Converter::SetMixMatrix(const float *matrix)
+{
+    memcpy(matrix_.data(), matrix, matrix_.size() * sizeof(float));
+    unity_mix_ = in_.channels == out_.channels;
+    for (int o = 0; o < out_.channels && unity_mix_; o++)
+    {
+        for (int i = 0; i < in_.channels; i++)
+        {
+            if (matrix_[o * in_.channels + i] != (i == o ? 1.0f : 0.0f))
+            {
+                unity_mix_ = false;
+                break;
+            }
+        }
+    }
+}
+
+bool Converter::IsIdentity() const
+{
+    return in_.sample_format == out_.sample_format && unity_mix_ &&
+           (in_.layout == out_.layout || in_.channels == 1);
+}
+
+void Converter::Process(const void *in, size_t frames, void *out)
+{
+    if (IsIdentity())
+    {
+        memcpy(out, in, frames * in_.GetBytesPerFrame());
+        return;
+    }
+
+    // Same channels and layout: only the sample format changes, which
+    // needs no planes.
+    if (unity_mix_ && (in_.layout == out_.layout || in_.channels == 1))
+    {
+        Dither *dither = dither_enabled_ ? &dither_ : nullptr;
+        size_t count = frames * in_.channels;
+        if (in_.sample_format == kFloat32)
+        {
+            FromFloat((const float *)in, count, out_.sample_format, out, dither);
+            return;
+        }
+        int in_bytes = GetSampleBytes(in_.sample_format);
+        int out_bytes = GetSampleBytes(out_.sample_format);
+        size_t chunk = interleaved_.size();
+        for (size_t first = 0; first < count; first += chunk)
+        {
+            size_t n = count - first < chunk ? count - first : chunk;
+            ToFloat((const unsigned char *)in + first * in_bytes, in_.sample_format, n, interleaved_.data());
+            FromFloat(interleaved_.data(), n, out_.sample_format, (unsigned char *)out + first * out_bytes, dither);
+        }
+        return;
+    }
+
+    for (size_t first = 0; first < frames; first += kChunkFrames)
+    {
+        size_t count = frames - first < kChunkFrames ? frames - first : kChunkFrames;
+        ProcessChunk((const unsigned char *)in, frames, first, count, (unsigned char *)out);
+    }
+}
+
+void Converter::ProcessChunk(const unsigned char *in, size_t frames, size_t first, size_t count, unsigned char *out)
+{
+    const Kernels &kernels = GetKernels();
+    int in_bytes = GetSampleBytes(in_.sample_format);
+    int out_bytes = GetSampleBytes(out_.sample_format);
+
+    // Input to one float plane per channel.
+    if (in_.layout == kPlanar)
+    {
+        for (int c = 0; c < in_.channels; c++)
+        {
+            ToFloat(in + (c * frames + first) * in_bytes, in_.sample_format, count, &in_planes_[c * kChunkFrames]);
+        }
+    }
+    else
+    {
+        ToFloat(in + first * in_.channels * in_bytes, in_.sample_format, count * in_.channels, interleaved_.data());
+        for (int c = 0; c < in_.channels; c++)
+        {
+            float *plane = &in_planes_[c * kChunkFrames];
+            for (size_t i = 0; i < count; i++)
+                plane[i] = interleaved_[i * in_.channels + c];
+        }
+    }
+
+    // Each output plane is a weighted sum of the input planes.
+    const float *out_planes = in_planes_.data();
+    if (!unity_mix_)
+    {
+        for (int o = 0; o < out_.channels; o++)
+        {
+            float *plane = &out_planes_[o * kChunkFrames];
+            memset(plane, 0, count * sizeof(float));
+            for (int i = 0; i < in_.channels; i++)
+            {
+                float gain = matrix_[o * in_.channels + i];
+                if (gain != 0.0f)
+                    kernels.mul_add(&in_planes_[i * kChunkFrames], gain, count, plane);
+            }
+        }
+        out_planes = out_planes_.data();
+    }
+
+    // Float planes to output.
+    Dither *dither = dither_enabled_ ? &dither_ : nullptr;
+    if (out_.layout == kPlanar)
+    {
+        for (int c = 0; c < out_.channels; c++)
+        {
+            FromFloat(&out_planes[c * kChunkFrames], count, out_.sample_format,
+                      out + (c * frames + first) * out_bytes, dither);
+        }
+    }
+    else
+    {
+        for (int c = 0; c < out_.channels; c++)
+        {
+            const float *plane = &out_planes[c * kChunkFrames];
+            for (size_t i = 0; i < count; i++)
+                interleaved_[i * out_.channels + c] = plane[i];
+        }
+        FromFloat(interleaved_.data(), count * out_.channels, out_.sample_format,
+                  out + first * out_.channels * out_bytes, dither);
+    }
+}
+
+}
@@ -0,0 +1,141 @@
+#ifndef PCM_CONVERT_H
+#define PCM_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Conversions between floating point samples in [-1, 1] and the integer PCM
+// formats Recorder serves: signed 8 bit (paInt8), packed 24 bit (paInt24),
+// and 16 and 32 bit in native byte order.
+namespace pcm {
+
+inline bool IsSupportedBits(int bits_per_sample)
+{
+    return bits_per_sample == 8 || bits_per_sample == 16 || bits_per_sample == 24 || bits_per_sample == 32;
+}
+
+enum SampleFormat
+{
+    kInt8,
+    kInt16,
+    kInt24,
+    kInt32,
+    kFloat32
+};
+
+// Bytes one sample of |format| takes.
+int GetSampleBytes(SampleFormat format);
+
+// The format of a CaptureFormat with |bits_per_sample| and |float_samples|.
+SampleFormat GetSampleFormat(int bits_per_sample, bool float_samples);
+
+// Instruction sets the kernels below are dispatched to. The best one the
+// CPU and OS support is picked on first use.
+enum SimdLevel
+{
+    kScalar,
+    kSse2,
+    kAvx2,
+    kAvx512
+};
+
+SimdLevel GetSimdLevel();
+
+// Limits the kernels to |level|, or to what the CPU supports if that is
+// less. For benchmarks and for checking the kernels against each other.
+void SetSimdLevel(SimdLevel level);
+
+// Triangular (TPDF) dither of one LSB of the target format, added before
+// rounding when reducing floats to 8, 16 or 24 bits. Keeps the state of its
+// random generator between calls.
+struct Dither
+{
+    uint32_t state;
+
+    Dither() : state(0x9e3779b9u) {}
+};
+
+// Converts |count| samples of |format| to floats in [-1, 1]. 16 and 32 bit
+// go through the SIMD kernels; 8 bit and packed 24 bit, which devices
+// rarely deliver, are converted by plain loops.
+void ToFloat(const void *in, SampleFormat format, size_t count, float *out);
+
+// Converts |count| floats to |format|, rounded to nearest and clipped to
+// full scale, with |dither| if given. |out| may be |in|, to convert in place.
+// 8, 16 and 32 bit go through the SIMD kernels, packed 24 bit through a
+// plain loop.
+void FromFloat(const float *in, size_t count, SampleFormat format, void *out, Dither *dither = nullptr);
+
+// Interleaved frames, or planar: all samples of channel 0, then all of
+// channel 1, and so on.
+enum Layout
+{
+    kInterleaved,
+    kPlanar
+};
+
+struct StreamFormat
+{
+    SampleFormat sample_format;
+    int channels;
+    Layout layout;
+
+    int GetBytesPerFrame() const { return channels * GetSampleBytes(sample_format); }
+};
+
+// Fills |matrix|, |out_channels| rows of |in_channels| gains, with the
+// default mix: channels map one to one, mono is copied to every output,
+// a mono output averages all inputs, and otherwise extra inputs fold into
+// output (input % out_channels), averaged, and extra outputs repeat input
+// (output % in_channels).
+void GetDefaultMixMatrix(int in_channels, int out_channels, float *matrix);
+
+// Converts a stream between sample formats, channel counts and layouts,
+// going through floats in short chunks. Holds scratch buffers and dither
+// state, so each thread needs its own.
+class Converter
+{
+public:
+    Converter();
+
+    // Converts from |in| to |out| with the default mix matrix. Returns false
+    // for channel counts below 1.
+    bool Configure(const StreamFormat &in, const StreamFormat &out, bool dither = false);
+
+    // Replaces the mix matrix: out.channels rows of in.channels gains.
+    void SetMixMatrix(const float *matrix);
+
+    // Converts |frames| frames from |in| to |out|. For planar data each
+    // channel holds |frames| samples. |out| must not overlap |in|.
+    void Process(const void *in, size_t frames, void *out);
+
+    const StreamFormat &GetInputFormat() const { return in_; }
+    const StreamFormat &GetOutputFormat() const { return out_; }
+
+    // True if output equals input, so there is nothing to convert.
+    bool IsIdentity() const;
+
+private:
+    // Converts frames |first| to |first| + |count| through the float planes.
+    void ProcessChunk(const unsigned char *in, size_t frames, size_t first, size_t count, unsigned char *out);
+
+    StreamFormat in_;
+    StreamFormat out_;
+    bool dither_enabled_;
+    Dither dither_;
+
+    // out_.channels x in_.channels, and whether it is the identity, in
+    // which case the input planes are used as the output planes.
+    std::vector<float> matrix_;
+    bool unity_mix_;
+
+    std::vector<float> in_planes_;
+    std::vector<float> out_planes_;
+    std::vector<float> interleaved_;
+};
+
+}
+
+#endif
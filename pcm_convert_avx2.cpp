@@ -0,0 +1,192 @@
+#include "pcm_kernels.h"
+
+#if PCM_X86
+#include <immintrin.h>
+
+// Built with AVX2 and FMA enabled; only called once the CPU is known to
+// have them.
+namespace pcm {
+namespace avx2 {
+
+// Scales and clips 8 floats, then rounds them to int32.
+static inline __m256i ScaleRound(const float *in, __m256 scale, __m256 max, __m256 min)
+{
+    return _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(in), scale), max), min));
+}
+
+/* The 256-bit packs work within each 128-bit lane, so their results are
+   permuted back into order. As with SSE2, every step loads before it
+   stores and stores no further than it loaded. */
+
+static void FloatToInt8(const float *in, size_t count, int8_t *out)
+{
+    const __m256 scale = _mm256_set1_ps(kScale8);
+    const __m256 min = _mm256_set1_ps(-kScale8);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i a = ScaleRound(in + i, scale, scale, min);
+        __m256i b = ScaleRound(in + i + 8, scale, scale, min);
+        __m256i c = ScaleRound(in + i + 16, scale, scale, min);
+        __m256i d = ScaleRound(in + i + 24, scale, scale, min);
+        __m256i packed = _mm256_packs_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_permutevar8x32_epi32(packed, order));
+    }
+    scalar::FloatToInt8(in + i, count - i, out + i);
+}
+
+static void FloatToInt16(const float *in, size_t count, int16_t *out)
+{
+    const __m256 scale = _mm256_set1_ps(kScale16);
+    const __m256 min = _mm256_set1_ps(-kScale16);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i a = ScaleRound(in + i, scale, scale, min);
+        __m256i b = ScaleRound(in + i + 8, scale, scale, min);
+        __m256i c = ScaleRound(in + i + 16, scale, scale, min);
+        __m256i d = ScaleRound(in + i + 24, scale, scale, min);
+        __m256i ab = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+        __m256i cd = _mm256_permute4x64_epi64(_mm256_packs_epi32(c, d), 0xd8);
+        _mm256_storeu_si256((__m256i *)(out + i), ab);
+        _mm256_storeu_si256((__m256i *)(out + i + 16), cd);
+    }
+    scalar::FloatToInt16(in + i, count - i, out + i);
+}
+
+static void FloatToInt32(const float *in, size_t count, int32_t *out)
+{
+    const __m256 scale = _mm256_set1_ps(kScale32);
+    const __m256 max = _mm256_set1_ps(kMax32);
+    const __m256 min = _mm256_set1_ps(-kScale32);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i a = ScaleRound(in + i, scale, max, min);
+        __m256i b = ScaleRound(in + i + 8, scale, max, min);
+        _mm256_storeu_si256((__m256i *)(out + i), a);
+        _mm256_storeu_si256((__m256i *)(out + i + 8), b);
+    }
+    scalar::FloatToInt32(in + i, count - i, out + i);
+}
+
+static void Int16ToFloat(const int16_t *in, size_t count, float *out)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / kScale16);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i + 8)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+        _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+    }
+    scalar::Int16ToFloat(in + i, count - i, out + i);
+}
+
+static void Int32ToFloat(const int32_t *in, size_t count, float *out)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / kScale32);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    scalar::Int32ToFloat(in + i, count - i, out + i);
+}
+
+static void MulAdd(const float *in, float gain, size_t count, float *out)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256 a = _mm256_fmadd_ps(_mm256_loadu_ps(in + i), g, _mm256_loadu_ps(out + i));
+        __m256 b = _mm256_fmadd_ps(_mm256_loadu_ps(in + i + 8), g, _mm256_loadu_ps(out + i + 8));
+        _mm256_storeu_ps(out + i, a);
+        _mm256_storeu_ps(out + i + 8, b);
+    }
+    scalar::MulAdd(in + i, gain, count - i, out + i);
+}
+
+static float Dot(const float *a, const float *b, size_t count)
+{
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+    }
+    __m256 sum8 = _mm256_add_ps(sum0, sum1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum) + scalar::Dot(a + i, b + i, count - i);
+}
+
+static void Butterfly(float *a_re, float *a_im, float *b_re, float *b_im, const float *w_re, const float *w_im,
+                      size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 wr = _mm256_loadu_ps(w_re + i);
+        __m256 wi = _mm256_loadu_ps(w_im + i);
+        __m256 br = _mm256_loadu_ps(b_re + i);
+        __m256 bi = _mm256_loadu_ps(b_im + i);
+        __m256 tr = _mm256_fmsub_ps(wr, br, _mm256_mul_ps(wi, bi));
+        __m256 ti = _mm256_fmadd_ps(wr, bi, _mm256_mul_ps(wi, br));
+        __m256 ar = _mm256_loadu_ps(a_re + i);
+        __m256 ai = _mm256_loadu_ps(a_im + i);
+        _mm256_storeu_ps(b_re + i, _mm256_sub_ps(ar, tr));
+        _mm256_storeu_ps(b_im + i, _mm256_sub_ps(ai, ti));
+        _mm256_storeu_ps(a_re + i, _mm256_add_ps(ar, tr));
+        _mm256_storeu_ps(a_im + i, _mm256_add_ps(ai, ti));
+    }
+    scalar::Butterfly(a_re + i, a_im + i, b_re + i, b_im + i, w_re + i, w_im + i, count - i);
+}
+
+static float Peak(const float *in, size_t count)
+{
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 peak0 = _mm256_setzero_ps();
+    __m256 peak1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        peak0 = _mm256_max_ps(peak0, _mm256_and_ps(_mm256_loadu_ps(in + i), abs_mask));
+        peak1 = _mm256_max_ps(peak1, _mm256_and_ps(_mm256_loadu_ps(in + i + 8), abs_mask));
+    }
+    __m256 peak8 = _mm256_max_ps(peak0, peak1);
+    __m128 peak = _mm_max_ps(_mm256_castps256_ps128(peak8), _mm256_extractf128_ps(peak8, 1));
+    peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+    peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, 1));
+    float rest = scalar::Peak(in + i, count - i);
+    float head = _mm_cvtss_f32(peak);
+    return head > rest ? head : rest;
+}
+
+static void Ramp(float *data, size_t count, float gain, float step)
+{
+    const __m256 offsets = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    const __m256 s = _mm256_set1_ps(step);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 g = _mm256_fmadd_ps(offsets, s, _mm256_set1_ps(gain + i * step));
+        _mm256_storeu_ps(data + i, _mm256_mul_ps(_mm256_loadu_ps(data + i), g));
+    }
+    scalar::Ramp(data + i, count - i, gain + i * step, step);
+}
+
+const Kernels kKernels = {FloatToInt8, FloatToInt16, FloatToInt32, Int16ToFloat, Int32ToFloat, MulAdd, Dot, Butterfly,
+                            Peak, Ramp};
+
+}
+}
+
+#endif
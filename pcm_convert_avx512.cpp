@@ -0,0 +1,205 @@
+#include "pcm_kernels.h"
+
+#if PCM_X86
+#include <immintrin.h>
+
+// Built with AVX-512 enabled; only called once the CPU is known to have
+// AVX-512F. The saturating down-converts keep their results in order, so
+// unlike AVX2 nothing needs permuting.
+//
+// Conversions, min/max, abs and extracts go through their masked forms with
+// every lane selected and zero as the merge source. The plain forms, and the
+// _mm512_reduce_* helpers built on them, pass an undefined vector there,
+// which GCC 12 reports as uninitialized; the results are the same.
+namespace pcm {
+namespace avx512 {
+
+static const __mmask16 kAll = 0xFFFF;
+
+// Lanes 0 to 7 and 8 to 15 of |x|. GCC builds _mm512_castps512_ps256()
+// on the plain extract, so the lower half is extracted too.
+static inline __m256 LowerHalf(__m512 x)
+{
+    return _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, _mm512_castps_pd(x), 0));
+}
+
+static inline __m256 UpperHalf(__m512 x)
+{
+    return _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, _mm512_castps_pd(x), 1));
+}
+
+// Scales and clips 16 floats, then rounds them to int32.
+static inline __m512i ScaleRound(const float *in, __m512 scale, __m512 max, __m512 min)
+{
+    __m512 x = _mm512_mul_ps(_mm512_loadu_ps(in), scale);
+    return _mm512_maskz_cvtps_epi32(kAll, _mm512_maskz_max_ps(kAll, _mm512_maskz_min_ps(kAll, x, max), min));
+}
+
+static void FloatToInt8(const float *in, size_t count, int8_t *out)
+{
+    const __m512 scale = _mm512_set1_ps(kScale8);
+    const __m512 min = _mm512_set1_ps(-kScale8);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m512i a = ScaleRound(in + i, scale, scale, min);
+        __m512i b = ScaleRound(in + i + 16, scale, scale, min);
+        _mm_storeu_si128((__m128i *)(out + i), _mm512_maskz_cvtsepi32_epi8(kAll, a));
+        _mm_storeu_si128((__m128i *)(out + i + 16), _mm512_maskz_cvtsepi32_epi8(kAll, b));
+    }
+    scalar::FloatToInt8(in + i, count - i, out + i);
+}
+
+static void FloatToInt16(const float *in, size_t count, int16_t *out)
+{
+    const __m512 scale = _mm512_set1_ps(kScale16);
+    const __m512 min = _mm512_set1_ps(-kScale16);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m512i a = ScaleRound(in + i, scale, scale, min);
+        __m512i b = ScaleRound(in + i + 16, scale, scale, min);
+        _mm256_storeu_si256((__m256i *)(out + i), _mm512_maskz_cvtsepi32_epi16(kAll, a));
+        _mm256_storeu_si256((__m256i *)(out + i + 16), _mm512_maskz_cvtsepi32_epi16(kAll, b));
+    }
+    scalar::FloatToInt16(in + i, count - i, out + i);
+}
+
+static void FloatToInt32(const float *in, size_t count, int32_t *out)
+{
+    const __m512 scale = _mm512_set1_ps(kScale32);
+    const __m512 max = _mm512_set1_ps(kMax32);
+    const __m512 min = _mm512_set1_ps(-kScale32);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m512i a = ScaleRound(in + i, scale, max, min);
+        __m512i b = ScaleRound(in + i + 16, scale, max, min);
+        _mm512_storeu_si512((void *)(out + i), a);
+        _mm512_storeu_si512((void *)(out + i + 16), b);
+    }
+    scalar::FloatToInt32(in + i, count - i, out + i);
+}
+
+static void Int16ToFloat(const int16_t *in, size_t count, float *out)
+{
+    const __m512 scale = _mm512_set1_ps(1.0f / kScale16);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m512i lo = _mm512_maskz_cvtepi16_epi32(kAll, _mm256_loadu_si256((const __m256i *)(in + i)));
+        __m512i hi = _mm512_maskz_cvtepi16_epi32(kAll, _mm256_loadu_si256((const __m256i *)(in + i + 16)));
+        _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_maskz_cvtepi32_ps(kAll, lo), scale));
+        _mm512_storeu_ps(out + i + 16, _mm512_mul_ps(_mm512_maskz_cvtepi32_ps(kAll, hi), scale));
+    }
+    scalar::Int16ToFloat(in + i, count - i, out + i);
+}
+
+static void Int32ToFloat(const int32_t *in, size_t count, float *out)
+{
+    const __m512 scale = _mm512_set1_ps(1.0f / kScale32);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m512i x = _mm512_loadu_si512((const void *)(in + i));
+        _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_maskz_cvtepi32_ps(kAll, x), scale));
+    }
+    scalar::Int32ToFloat(in + i, count - i, out + i);
+}
+
+static void MulAdd(const float *in, float gain, size_t count, float *out)
+{
+    const __m512 g = _mm512_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m512 a = _mm512_fmadd_ps(_mm512_loadu_ps(in + i), g, _mm512_loadu_ps(out + i));
+        __m512 b = _mm512_fmadd_ps(_mm512_loadu_ps(in + i + 16), g, _mm512_loadu_ps(out + i + 16));
+        _mm512_storeu_ps(out + i, a);
+        _mm512_storeu_ps(out + i + 16, b);
+    }
+    scalar::MulAdd(in + i, gain, count - i, out + i);
+}
+
+static float Dot(const float *a, const float *b, size_t count)
+{
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum0);
+        sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), sum1);
+    }
+    __m512 sum16 = _mm512_add_ps(sum0, sum1);
+    __m256 sum8 = _mm256_add_ps(LowerHalf(sum16), UpperHalf(sum16));
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum) + scalar::Dot(a + i, b + i, count - i);
+}
+
+static void Butterfly(float *a_re, float *a_im, float *b_re, float *b_im, const float *w_re, const float *w_im,
+                      size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m512 wr = _mm512_loadu_ps(w_re + i);
+        __m512 wi = _mm512_loadu_ps(w_im + i);
+        __m512 br = _mm512_loadu_ps(b_re + i);
+        __m512 bi = _mm512_loadu_ps(b_im + i);
+        __m512 tr = _mm512_fmsub_ps(wr, br, _mm512_mul_ps(wi, bi));
+        __m512 ti = _mm512_fmadd_ps(wr, bi, _mm512_mul_ps(wi, br));
+        __m512 ar = _mm512_loadu_ps(a_re + i);
+        __m512 ai = _mm512_loadu_ps(a_im + i);
+        _mm512_storeu_ps(b_re + i, _mm512_sub_ps(ar, tr));
+        _mm512_storeu_ps(b_im + i, _mm512_sub_ps(ai, ti));
+        _mm512_storeu_ps(a_re + i, _mm512_add_ps(ar, tr));
+        _mm512_storeu_ps(a_im + i, _mm512_add_ps(ai, ti));
+    }
+    scalar::Butterfly(a_re + i, a_im + i, b_re + i, b_im + i, w_re + i, w_im + i, count - i);
+}
+
+static float Peak(const float *in, size_t count)
+{
+    const __m512 zero = _mm512_setzero_ps();
+    __m512 peak0 = zero;
+    __m512 peak1 = zero;
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        peak0 = _mm512_maskz_max_ps(kAll, peak0, _mm512_mask_abs_ps(zero, kAll, _mm512_loadu_ps(in + i)));
+        peak1 = _mm512_maskz_max_ps(kAll, peak1, _mm512_mask_abs_ps(zero, kAll, _mm512_loadu_ps(in + i + 16)));
+    }
+    __m512 peak16 = _mm512_maskz_max_ps(kAll, peak0, peak1);
+    __m256 peak8 = _mm256_max_ps(LowerHalf(peak16), UpperHalf(peak16));
+    __m128 peak = _mm_max_ps(_mm256_castps256_ps128(peak8), _mm256_extractf128_ps(peak8, 1));
+    peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+    peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, 1));
+    float rest = scalar::Peak(in + i, count - i);
+    float head = _mm_cvtss_f32(peak);
+    return head > rest ? head : rest;
+}
+
+static void Ramp(float *data, size_t count, float gain, float step)
+{
+    const __m512 offsets = _mm512_set_ps(15.0f, 14.0f, 13.0f, 12.0f, 11.0f, 10.0f, 9.0f, 8.0f,
+                                         7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    const __m512 s = _mm512_set1_ps(step);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m512 g = _mm512_fmadd_ps(offsets, s, _mm512_set1_ps(gain + i * step));
+        _mm512_storeu_ps(data + i, _mm512_mul_ps(_mm512_loadu_ps(data + i), g));
+    }
+    scalar::Ramp(data + i, count - i, gain + i * step, step);
+}
+
+const Kernels kKernels = {FloatToInt8, FloatToInt16, FloatToInt32, Int16ToFloat, Int32ToFloat, MulAdd, Dot, Butterfly,
+                            Peak, Ramp};
+
+}
+}
+
+#endif
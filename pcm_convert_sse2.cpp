@@ -0,0 +1,187 @@
+#include "pcm_kernels.h"
+
+#if PCM_X86
+#include <emmintrin.h>
+
+namespace pcm {
+namespace sse2 {
+
+// Scales and clips 4 floats, then rounds them to int32. Clipping comes
+// after scaling, since cvtps2dq does not saturate; the packs to 8 and 16
+// bit then cannot overflow either.
+static inline __m128i ScaleRound(const float *in, __m128 scale, __m128 max, __m128 min)
+{
+    return _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in), scale), max), min));
+}
+
+/* Each step loads all its floats before storing anything, and stores no
+   further than it loaded, so the narrowing kernels run in place. */
+
+static void FloatToInt8(const float *in, size_t count, int8_t *out)
+{
+    const __m128 scale = _mm_set1_ps(kScale8);
+    const __m128 min = _mm_set1_ps(-kScale8);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i a = ScaleRound(in + i, scale, scale, min);
+        __m128i b = ScaleRound(in + i + 4, scale, scale, min);
+        __m128i c = ScaleRound(in + i + 8, scale, scale, min);
+        __m128i d = ScaleRound(in + i + 12, scale, scale, min);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+    scalar::FloatToInt8(in + i, count - i, out + i);
+}
+
+static void FloatToInt16(const float *in, size_t count, int16_t *out)
+{
+    const __m128 scale = _mm_set1_ps(kScale16);
+    const __m128 min = _mm_set1_ps(-kScale16);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i a = ScaleRound(in + i, scale, scale, min);
+        __m128i b = ScaleRound(in + i + 4, scale, scale, min);
+        __m128i c = ScaleRound(in + i + 8, scale, scale, min);
+        __m128i d = ScaleRound(in + i + 12, scale, scale, min);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+        _mm_storeu_si128((__m128i *)(out + i + 8), _mm_packs_epi32(c, d));
+    }
+    scalar::FloatToInt16(in + i, count - i, out + i);
+}
+
+static void FloatToInt32(const float *in, size_t count, int32_t *out)
+{
+    const __m128 scale = _mm_set1_ps(kScale32);
+    const __m128 max = _mm_set1_ps(kMax32);
+    const __m128 min = _mm_set1_ps(-kScale32);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i a = ScaleRound(in + i, scale, max, min);
+        __m128i b = ScaleRound(in + i + 4, scale, max, min);
+        _mm_storeu_si128((__m128i *)(out + i), a);
+        _mm_storeu_si128((__m128i *)(out + i + 4), b);
+    }
+    scalar::FloatToInt32(in + i, count - i, out + i);
+}
+
+static void Int16ToFloat(const int16_t *in, size_t count, float *out)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / kScale16);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        // Unpacking a value with itself and shifting right sign-extends it.
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    scalar::Int16ToFloat(in + i, count - i, out + i);
+}
+
+static void Int32ToFloat(const int32_t *in, size_t count, float *out)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / kScale32);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+    }
+    scalar::Int32ToFloat(in + i, count - i, out + i);
+}
+
+static void MulAdd(const float *in, float gain, size_t count, float *out)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128 a = _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), g));
+        __m128 b = _mm_add_ps(_mm_loadu_ps(out + i + 4), _mm_mul_ps(_mm_loadu_ps(in + i + 4), g));
+        _mm_storeu_ps(out + i, a);
+        _mm_storeu_ps(out + i + 4, b);
+    }
+    scalar::MulAdd(in + i, gain, count - i, out + i);
+}
+
+static float Dot(const float *a, const float *b, size_t count)
+{
+    // Two accumulators hide the latency of the adds.
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    __m128 sum = _mm_add_ps(sum0, sum1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum) + scalar::Dot(a + i, b + i, count - i);
+}
+
+static void Butterfly(float *a_re, float *a_im, float *b_re, float *b_im, const float *w_re, const float *w_im,
+                      size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 wr = _mm_loadu_ps(w_re + i);
+        __m128 wi = _mm_loadu_ps(w_im + i);
+        __m128 br = _mm_loadu_ps(b_re + i);
+        __m128 bi = _mm_loadu_ps(b_im + i);
+        __m128 tr = _mm_sub_ps(_mm_mul_ps(wr, br), _mm_mul_ps(wi, bi));
+        __m128 ti = _mm_add_ps(_mm_mul_ps(wr, bi), _mm_mul_ps(wi, br));
+        __m128 ar = _mm_loadu_ps(a_re + i);
+        __m128 ai = _mm_loadu_ps(a_im + i);
+        _mm_storeu_ps(b_re + i, _mm_sub_ps(ar, tr));
+        _mm_storeu_ps(b_im + i, _mm_sub_ps(ai, ti));
+        _mm_storeu_ps(a_re + i, _mm_add_ps(ar, tr));
+        _mm_storeu_ps(a_im + i, _mm_add_ps(ai, ti));
+    }
+    scalar::Butterfly(a_re + i, a_im + i, b_re + i, b_im + i, w_re + i, w_im + i, count - i);
+}
+
+static float Peak(const float *in, size_t count)
+{
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 peak0 = _mm_setzero_ps();
+    __m128 peak1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        peak0 = _mm_max_ps(peak0, _mm_and_ps(_mm_loadu_ps(in + i), abs_mask));
+        peak1 = _mm_max_ps(peak1, _mm_and_ps(_mm_loadu_ps(in + i + 4), abs_mask));
+    }
+    __m128 peak = _mm_max_ps(peak0, peak1);
+    peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+    peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, 1));
+    float rest = scalar::Peak(in + i, count - i);
+    float head = _mm_cvtss_f32(peak);
+    return head > rest ? head : rest;
+}
+
+static void Ramp(float *data, size_t count, float gain, float step)
+{
+    const __m128 offsets = _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(step));
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 g = _mm_add_ps(_mm_set1_ps(gain + i * step), offsets);
+        _mm_storeu_ps(data + i, _mm_mul_ps(_mm_loadu_ps(data + i), g));
+    }
+    scalar::Ramp(data + i, count - i, gain + i * step, step);
+}
+
+const Kernels kKernels = {FloatToInt8, FloatToInt16, FloatToInt32, Int16ToFloat, Int32ToFloat, MulAdd, Dot, Butterfly,
+                            Peak, Ramp};
+
+}
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef PCM_KERNELS_H
+#define PCM_KERNELS_H
+
+#include "pcm_convert.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PCM_X86 1
+#endif
+
+// The inner loops of pcm_convert.cpp, one set per instruction set. Each
+// vector kernel handles whole vectors and finishes the rest with the scalar
+// kernel. Kernels that narrow samples may run in place. There are none for
+// 8-bit input or packed 24-bit samples; ToFloat() and FromFloat() convert
+// those with plain loops.
+namespace pcm {
+
+struct Kernels
+{
+    void (*float_to_int8)(const float *in, size_t count, int8_t *out);
+    void (*float_to_int16)(const float *in, size_t count, int16_t *out);
+    void (*float_to_int32)(const float *in, size_t count, int32_t *out);
+    void (*int16_to_float)(const int16_t *in, size_t count, float *out);
+    void (*int32_to_float)(const int32_t *in, size_t count, float *out);
+
+    // out[i] += gain * in[i]
+    void (*mul_add)(const float *in, float gain, size_t count, float *out);
+
+    // Sum of a[i] * b[i], for FIR filters.
+    float (*dot)(const float *a, const float *b, size_t count);
+
+    // Radix-2 FFT butterflies on split complex arrays: t = w[i] * b[i],
+    // then b[i] = a[i] - t and a[i] += t.
+    void (*butterfly)(float *a_re, float *a_im, float *b_re, float *b_im, const float *w_re, const float *w_im,
+                      size_t count);
+
+    // Largest |in[i]|, for peak meters and limiters.
+    float (*peak)(const float *in, size_t count);
+
+    // data[i] *= gain + i * step, for gain changes without zipper noise.
+    void (*ramp)(float *data, size_t count, float gain, float step);
+};
+
+// The kernels for the level GetSimdLevel() returns.
+const Kernels &GetKernels();
+
+namespace scalar {
+void FloatToInt8(const float *in, size_t count, int8_t *out);
+void FloatToInt16(const float *in, size_t count, int16_t *out);
+void FloatToInt32(const float *in, size_t count, int32_t *out);
+void Int16ToFloat(const int16_t *in, size_t count, float *out);
+void Int32ToFloat(const int32_t *in, size_t count, float *out);
+void MulAdd(const float *in, float gain, size_t count, float *out);
+float Dot(const float *a, const float *b, size_t count);
+void Butterfly(float *a_re, float *a_im, float *b_re, float *b_im, const float *w_re, const float *w_im, size_t count);
+float Peak(const float *in, size_t count);
+void Ramp(float *data, size_t count, float gain, float step);
+extern const Kernels kKernels;
+}
+
+#if PCM_X86
+// Each in its own file, built for its instruction set.
+namespace sse2 {
+extern const Kernels kKernels;
+}
+
+namespace avx2 {
+extern const Kernels kKernels;
+}
+
+namespace avx512 {
+extern const Kernels kKernels;
+}
+#endif
+
+// Full scale of each integer format. Int32 stops at the largest float
+// below 2^31, which still converts without overflowing.
+const float kScale8 = 127.0f;
+const float kScale16 = 32767.0f;
+const float kScale32 = 2147483648.0f;
+const float kMax32 = 2147483520.0f;
+
+}
+
+#endif
@@ -0,0 +1,37 @@
+#include "pipe_capture_source.h"
+#include "pcm_convert.h"
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+PipeCaptureSource::PipeCaptureSource(FILE *input)
+    : GeneratedCaptureSource(0)
+{
+    input_ = input;
+}
+
+PipeCaptureSource::~PipeCaptureSource()
+{
+    Stop();
+}
+
+bool PipeCaptureSource::Prepare(const CaptureFormat &format)
+{
+    if (!pcm::IsSupportedBits(format.bits_per_sample))
+    {
+        error_ = "Unsupported bits per sample.";
+        return false;
+    }
+#if defined(_WIN32)
+    // Text mode would mangle CR/LF bytes in the samples.
+    _setmode(_fileno(input_), _O_BINARY);
+#endif
+    return true;
+}
+
+unsigned long PipeCaptureSource::Generate(void *frames, unsigned long frame_count)
+{
+    // Blocks until the writer has sent the whole block or closed the pipe.
+    return (unsigned long)fread(frames, format().GetBytesPerFrame(), frame_count, input_);
+}
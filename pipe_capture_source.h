@@ -0,0 +1,23 @@
+#ifndef PIPE_CAPTURE_SOURCE_H
+#define PIPE_CAPTURE_SOURCE_H
+
+#include "capture_source.h"
+#include <stdio.h>
+
+// Reads raw PCM in the capture format from a pipe, stdin by default, e.g.
+// from "sox ... -t raw - | AvatarServer". Not paced: the writer sets the
+// rate, and the stream ends with the input.
+class PipeCaptureSource : public GeneratedCaptureSource
+{
+    FILE *input_;
+
+public:
+    explicit PipeCaptureSource(FILE *input);
+    ~PipeCaptureSource() override;
+
+protected:
+    bool Prepare(const CaptureFormat &format) override;
+    unsigned long Generate(void *frames, unsigned long frame_count) override;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "portaudio_capture_source.h"
+
+PortAudioCaptureSource::PortAudioCaptureSource(int device_id)
+{
+    device_id_ = device_id;
+    pa_stream_ = nullptr;
+    sink_ = nullptr;
+}
+
+PortAudioCaptureSource::~PortAudioCaptureSource()
+{
+    Close();
+}
+
+bool PortAudioCaptureSource::Open(const CaptureFormat &format, Sink *sink)
+{
+    Close();
+    error_.clear();
+    sink_ = sink;
+
+    const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(device_id_);
+    if (!deviceInfo)
+    {
+        error_ = "No such device.";
+        return false;
+    }
+
+    PaSampleFormat sampleFormat = 0;
+    if (format.float_samples)
+        sampleFormat = paFloat32;
+    else if (format.bits_per_sample == 8)
+        sampleFormat = paInt8;
+    else if (format.bits_per_sample == 16)
+        sampleFormat = paInt16;
+    else if (format.bits_per_sample == 24)
+        sampleFormat = paInt24;
+    else if (format.bits_per_sample == 32)
+        sampleFormat = paInt32;
+    else
+    {
+        error_ = "Unsupported bits per sample.";
+        return false;
+    }
+
+    PaStreamParameters inputParameters = {0};
+    inputParameters.device = device_id_;
+    inputParameters.channelCount = format.channels;
+    inputParameters.sampleFormat = sampleFormat;
+    inputParameters.suggestedLatency = deviceInfo->defaultLowInputLatency;
+
+    // Without a fixed block size the host buffer follows the low input
+    // latency, which Read() benefits from as much as the callback does.
+    unsigned long framesPerBuffer = format.frames_per_block ? format.frames_per_block : paFramesPerBufferUnspecified;
+    PaError err = paNoError;
+    if (sink_)
+        err = Pa_OpenStream(&pa_stream_, &inputParameters, nullptr, format.sample_rate, framesPerBuffer, paNoFlag, PortAudioCallback, this);
+    else
+        err = Pa_OpenStream(&pa_stream_, &inputParameters, nullptr, format.sample_rate, framesPerBuffer, paNoFlag, nullptr, nullptr);
+    if (err)
+    {
+        error_ = Pa_GetErrorText(err);
+        pa_stream_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool PortAudioCaptureSource::Start()
+{
+    PaError err = Pa_StartStream(pa_stream_);
+    if (err)
+    {
+        error_ = Pa_GetErrorText(err);
+        return false;
+    }
+    return true;
+}
+
+void PortAudioCaptureSource::Stop()
+{
+    if (pa_stream_)
+    {
+        Pa_StopStream(pa_stream_);
+    }
+}
+
+void PortAudioCaptureSource::Close()
+{
+    if (pa_stream_)
+    {
+        Pa_StopStream(pa_stream_);
+        Pa_CloseStream(pa_stream_);
+        pa_stream_ = nullptr;
+    }
+}
+
+unsigned long PortAudioCaptureSource::Read(void *frames, unsigned long frame_count, PaStreamCallbackFlags *status_flags)
+{
+    // An overflow means input was dropped before these frames; the frames
+    // themselves are still good.
+    PaError err = Pa_ReadStream(pa_stream_, frames, frame_count);
+    *status_flags = err == paInputOverflowed ? paInputOverflow : 0;
+    if (err != paNoError && err != paInputOverflowed)
+    {
+        error_ = Pa_GetErrorText(err);
+        return 0;
+    }
+    return frame_count;
+}
+
+unsigned long PortAudioCaptureSource::GetReadAvailable()
+{
+    signed long available = Pa_GetStreamReadAvailable(pa_stream_);
+    return available > 0 ? (unsigned long)available : 0;
+}
+
+PaTime PortAudioCaptureSource::GetTime()
+{
+    return Pa_GetStreamTime(pa_stream_);
+}
+
+PaTime PortAudioCaptureSource::GetInputLatency()
+{
+    const PaStreamInfo *stream_info = Pa_GetStreamInfo(pa_stream_);
+    return stream_info ? stream_info->inputLatency : 0;
+}
+
+int PortAudioCaptureSource::PortAudioCallback(const void *input,
+                                              void *output,
+                                              unsigned long frame_count,
+                                              const PaStreamCallbackTimeInfo *time_info,
+                                              PaStreamCallbackFlags status_flags,
+                                              void *user_data)
+{
+    PortAudioCaptureSource *self = reinterpret_cast<PortAudioCaptureSource *>(user_data);
+    self->sink_->OnCapture(input, frame_count, time_info->inputBufferAdcTime, status_flags);
+    return paContinue;
+}
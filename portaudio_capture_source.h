@@ -0,0 +1,35 @@
+#ifndef PORTAUDIO_CAPTURE_SOURCE_H
+#define PORTAUDIO_CAPTURE_SOURCE_H
+
+#include "capture_source.h"
+
+// Captures from a PortAudio input device.
+class PortAudioCaptureSource : public CaptureSource
+{
+    int device_id_;
+    PaStream *pa_stream_;
+    Sink *sink_;
+
+public:
+    explicit PortAudioCaptureSource(int device_id);
+    ~PortAudioCaptureSource() override;
+
+    bool Open(const CaptureFormat &format, Sink *sink) override;
+    bool Start() override;
+    void Stop() override;
+    void Close() override;
+    unsigned long Read(void *frames, unsigned long frame_count, PaStreamCallbackFlags *status_flags) override;
+    unsigned long GetReadAvailable() override;
+    PaTime GetTime() override;
+    PaTime GetInputLatency() override;
+
+private:
+    static int PortAudioCallback(const void *input,
+                                 void *output,
+                                 unsigned long frame_count,
+                                 const PaStreamCallbackTimeInfo *time_info,
+                                 PaStreamCallbackFlags status_flags,
+                                 void *user_data);
+};
+
+#endif
@@ -1,81 +1,172 @@
 #include "recorder.h"
-#include "Misc.h"
-#include "StringUtil.h"
+#include "pcm_convert.h"
+#include "logger.h"
+#if !defined(CAPTURE_NO_PORTAUDIO)
+#include "portaudio_capture_source.h"
+#endif
 #include <string.h>
 
 Recorder::Recorder(bool use_ringbuffer)
 {
     use_ringbuffer_ = use_ringbuffer;
-    num_lost_samples_ = 0;
     min_read_samples_ = 0;
-    num_lost_samples_ = 0;
-    pa_stream_ = nullptr;
+    frame_ms_ = 0;
+    frame_samples_ = 0;
+    bytes_per_frame_ = 0;
+    float_capture_ = false;
+    float_samples_ = false;
+    wire_bits_per_sample_ = 0;
+    capture_bits_per_sample_ = 0;
+    dither_ = false;
+    capture_format_.sample_format = wire_format_.sample_format = pcm::kInt16;
+    capture_format_.channels = wire_format_.channels = 1;
+    capture_format_.layout = wire_format_.layout = pcm::kInterleaved;
+    capture_sample_rate_ = 0;
+    resampler_quality_ = pcm::kResampleDefault;
+    resampling_ = false;
+    gain_control_ = false;
+    gain_control_active_ = false;
+    voice_detection_ = false;
+    voice_detection_active_ = false;
+    max_read_latency_ms_ = 500;
+    max_lag_samples_ = 0;
+    sample_rate_ = 0;
+    num_blocking_samples_ = 0;
+    initial_ringbuffer_size_ = 0;
 }
 
 Recorder::~Recorder()
 {
-    if (pa_stream_)
-    {
-        Pa_StopStream(pa_stream_);
-        Pa_CloseStream(pa_stream_);
-        pa_stream_ = nullptr;
-    }
+    Close();
 }
 
 bool Recorder::Open(int id, int sample_rate, int channels, int bits_per_sample)
 {
-    num_lost_samples_ = 0;
-    min_read_samples_ = sample_rate * 0.1;
+#if defined(CAPTURE_NO_PORTAUDIO)
+    (void)sample_rate;
+    (void)channels;
+    (void)bits_per_sample;
+    logger::Log(L"Built without PortAudio, cannot open device %d.", id);
+    return false;
+#else
+    return Open(std::unique_ptr<CaptureSource>(new PortAudioCaptureSource(id)),
+                sample_rate, channels, bits_per_sample);
+#endif
+}
+
+bool Recorder::Open(std::unique_ptr<CaptureSource> source, int sample_rate, int channels, int bits_per_sample)
+{
+    Close();
+    int capture_bits = capture_bits_per_sample_ > 0 ? capture_bits_per_sample_ : bits_per_sample;
+    if (!pcm::IsSupportedBits(bits_per_sample) || !pcm::IsSupportedBits(capture_bits))
+    {
+        logger::Log(L"Unsupported BitsPerSample: %d", pcm::IsSupportedBits(bits_per_sample) ? capture_bits : bits_per_sample);
+        return false;
+    }
+
+    frame_samples_ = (int)((long long)sample_rate * frame_ms_ / 1000);
+    min_read_samples_ = frame_samples_ > 0 ? frame_samples_ : sample_rate * 0.1;
+    float_samples_ = float_capture_;
+    wire_bits_per_sample_ = bits_per_sample;
+    capture_format_.sample_format = pcm::GetSampleFormat(capture_bits, float_samples_);
+    capture_format_.channels = channels;
+    wire_format_.sample_format = pcm::GetSampleFormat(bits_per_sample, false);
+    wire_format_.channels = channels;
+    bytes_per_frame_ = capture_format_.GetBytesPerFrame();
+
+    int capture_rate = capture_sample_rate_ > 0 ? capture_sample_rate_ : sample_rate;
+    resampling_ = capture_rate != sample_rate;
+    if (resampling_)
+    {
+        if (!resampler_.Configure(capture_rate, sample_rate, channels, resampler_quality_))
+        {
+            logger::Log(L"Cannot resample from %d Hz to %d Hz.", capture_rate, sample_rate);
+            return false;
+        }
+        logger::Log(L"Resampling from %d Hz to %d Hz, %.2f ms delay.",
+            capture_rate, sample_rate, resampler_.GetDelay() * 1000);
+    }
+    gain_control_active_ = gain_control_;
+    if (gain_control_active_ && !agc_.Configure(sample_rate, channels, agc_options_))
+    {
+        logger::Log(L"Cannot control gain at %d Hz.", sample_rate);
+        return false;
+    }
+    if (resampling_ || gain_control_active_)
+    {
+        size_t max_output_frames = resampling_ ? resampler_.GetMaxOutputFrames(kChunkFrames) : kChunkFrames;
+        chunk_in_.resize(kChunkFrames * channels);
+        chunk_out_.resize(resampling_ ? max_output_frames * channels : 0);
+        processed_.resize(max_output_frames * bytes_per_frame_);
+    }
+    max_lag_samples_ = (int)((long long)sample_rate * max_read_latency_ms_ / 1000);
+    sample_rate_ = sample_rate;
+    num_blocking_samples_ = 0;
+    blocking_out_.clear();
 
     if (use_ringbuffer_)
     {
+        // Readers may still be attached from before Close(). Initialize()
+        // keeps the storage they read until they let go of it, but must not
+        // run alongside a resize one of them starts.
+        std::lock_guard<std::mutex> lock(resize_mutex_);
+
         // Allocates ring buffer memory.
         int ringbuffer_size = 16384;
 
-        // Initializes ring buffer.
-        if (-1 == ringbuffer_.Initialize(bits_per_sample / 8, ringbuffer_size))
+        // Touches and locks every page up front, so the callback never takes
+        // a page fault on the ring, not even in its first laps.
+        ring_storage::Options options;
+        options.prefault = true;
+        options.lock = true;
+
+        // Initializes ring buffer. Mirrored storage lets readers see every
+        // span as one contiguous block; fall back to the heap if unavailable.
+        if (-1 == ringbuffer_.Initialize(bytes_per_frame_, ringbuffer_size, kRingBufferMirrored, options))
         {
-            logger::Log(L"Initialize ring buffer failed.");
-            return false;
+            logger::Log(L"Mirrored ring buffer unavailable, using heap storage.");
+            if (-1 == ringbuffer_.Initialize(bytes_per_frame_, ringbuffer_size, kRingBufferHeap, options))
+            {
+                logger::Log(L"Initialize ring buffer failed.");
+                return false;
+            }
         }
+        if (!ringbuffer_.IsLocked())
+        {
+            logger::Log(L"Could not lock ring buffer memory, it may be paged out.");
+        }
+        initial_ringbuffer_size_ = ringbuffer_.GetBufferSize();
+        last_resize_time_ = last_pressure_time_ = std::chrono::steady_clock::now();
     }
 
-    const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(id);;
-
-    PaSampleFormat sampleFormat = 0;
-    if (bits_per_sample == 8)
-        sampleFormat = paInt8;
-    else if (bits_per_sample == 16)
-        sampleFormat = paInt16;
-    else if (bits_per_sample == 32)
-        sampleFormat = paInt32;
-    else
+    voice_detection_active_ = voice_detection_;
+    if (voice_detection_active_ && !vad_.Configure(sample_rate, channels, capture_format_.sample_format))
     {
-        logger::Log(L"Unsupported BitsPerSample: %d", bits_per_sample);
+        logger::Log(L"Cannot detect voice at %d Hz.", sample_rate);
         return false;
     }
 
-    PaStreamParameters inputParameters = {0};
-    inputParameters.device = id;
-    inputParameters.channelCount = channels;
-    inputParameters.sampleFormat = sampleFormat;
-    inputParameters.suggestedLatency = deviceInfo->defaultLowInputLatency;
+    CaptureFormat format;
+    format.sample_rate = capture_rate;
+    format.channels = channels;
+    format.bits_per_sample = float_samples_ ? 32 : capture_bits;
+    format.frames_per_block = (unsigned long)((long long)capture_rate * frame_ms_ / 1000);
+    format.float_samples = float_samples_;
 
-    PaError err = paNoError;
-    if (use_ringbuffer_)
-        err = Pa_OpenStream(&pa_stream_, &inputParameters, nullptr, sample_rate, paFramesPerBufferUnspecified, paNoFlag, PortAudioCallback, this);
-    else
-        err = Pa_OpenStream(&pa_stream_, &inputParameters, nullptr, sample_rate, 640, paNoFlag, nullptr, nullptr);
-    if (err)
+    // With the ring buffer the source pushes blocks to OnCapture(); without
+    // it Read() pulls them.
+    source_ = std::move(source);
+    if (!source_->Open(format, use_ringbuffer_ ? this : nullptr))
     {
-        logger::Log(L"Can not open the audio stream! %s", util::Utf8ToUnicode(Pa_GetErrorText(err)).c_str());
+        logger::Log(L"Can not open the audio stream! %ls", logger::FromUtf8(source_->GetError()).c_str());
+        source_.reset();
         return false;
     }
 
-    err = Pa_StartStream(pa_stream_);
-    if (err)
+    if (!source_->Start())
     {
-        logger::Log(L"Fail to start PortAudio stream! %s", util::Utf8ToUnicode(Pa_GetErrorText(err)).c_str());
+        logger::Log(L"Fail to start the audio stream! %ls", logger::FromUtf8(source_->GetError()).c_str());
+        source_.reset();
         return false;
     }
     return true;
@@ -83,71 +174,431 @@ bool Recorder::Open(int id, int sample_rate, int channels, int bits_per_sample)
 
 void Recorder::Close()
 {
-    if (pa_stream_)
+    if (source_)
     {
-        Pa_StopStream(pa_stream_);
-        Pa_CloseStream(pa_stream_);
-        pa_stream_ = nullptr;
+        source_->Stop();
+        source_->Close();
+        source_.reset();
     }
 }
 
-void Recorder::Read(std::vector<unsigned char> *data)
+void Recorder::Subscribe(Reader *reader)
 {
-    if (!use_ringbuffer_)
-    {
-        data->resize(1280);
-        Pa_ReadStream(pa_stream_, data->data(), 640);
-        return;
-    }
+    reader->cursor_.Attach(&ringbuffer_);
+    reader->metadata_cursor_.Attach(&metadata_);
+    memset(&reader->block_, 0, sizeof(reader->block_));
+    reader->num_reported_lost_samples_ = 0;
+    reader->num_seen_overruns_ = 0;
+}
+
+bool Recorder::Subscribe(Reader *reader, ring_buffer_pos_t position)
+{
+    Subscribe(reader);
 
-    // Checks ring buffer overflow.
-    if (num_lost_samples_ > 0)
+    // The metadata cursor starts at the oldest block and catches up with the
+    // sample cursor on the first read.
+    reader->metadata_cursor_.Seek(0);
+    bool resumed = reader->cursor_.Seek(position);
+    reader->num_reported_lost_samples_ = reader->cursor_.GetLostCount();
+    reader->num_seen_overruns_ = reader->cursor_.GetOverrunCount();
+    if (!resumed)
     {
-        logger::Log(L"Lost %d samples due to ring buffer overflow.", num_lost_samples_);
-        num_lost_samples_ = 0;
+        logger::Log(L"Cannot resume from sample %lld, resuming from sample %lld.",
+            position, reader->cursor_.GetPosition());
     }
+    return resumed;
+}
 
-    ring_buffer_size_t num_available_samples = 0;
-    while (true)
+void Recorder::Read(Reader *reader, std::vector<unsigned char> *data, CaptureInfo *info)
+{
+    if (!use_ringbuffer_)
     {
-        num_available_samples = ringbuffer_.GetReadAvailable();
-        if (num_available_samples >= min_read_samples_)
+        if (frame_samples_ > 0)
+        {
+            ReadBlocking(reader, frame_samples_, frame_samples_, data, info);
+        }
+        else
         {
-            break;
+            int sample_rate = GetSampleRate();
+            ReadBlocking(reader, (ring_buffer_size_t)(sample_rate * kBlockingReadMs / 1000),
+                         (ring_buffer_size_t)sample_rate, data, info);
         }
-        Pa_Sleep(5);
+        return;
     }
 
     // Reads data.
-    num_available_samples = ringbuffer_.GetReadAvailable();
-    data->resize(num_available_samples * 2);
-    ring_buffer_size_t num_read_samples = ringbuffer_.Read(data->data(), num_available_samples);
+    ring_buffer_size_t num_available_samples = WaitForSamples(reader);
+    if (num_available_samples == 0)
+    {
+        data->clear();
+        return;
+    }
+    if (frame_samples_ > 0)
+    {
+        num_available_samples = frame_samples_;
+    }
+    data->resize(num_available_samples * bytes_per_frame_);
+    ring_buffer_size_t num_read_samples = reader->cursor_.Read(data->data(), num_available_samples);
     if (num_read_samples != num_available_samples)
     {
         logger::Log(L"%d samples were available, but only %d samples were read.",
             num_available_samples, num_read_samples);
+        data->resize(num_read_samples * bytes_per_frame_);
+    }
+    ConvertToWire(reader, data);
+
+    // Read() may have skipped ahead or retried, so the samples are the ones
+    // just before where the cursor ended up.
+    if (info && num_read_samples > 0)
+    {
+        GetCaptureInfo(reader, reader->cursor_.GetPosition() - num_read_samples, num_read_samples, info);
+    }
+}
+
+ring_buffer_size_t Recorder::Peek(Reader *reader, RingBufferRegions *regions, CaptureInfo *info)
+{
+    // Hands out at most half the ring, so the callback has to write another
+    // half before it can reach samples that are still being sent.
+    ring_buffer_size_t num_available_samples = WaitForSamples(reader);
+    if (frame_samples_ > 0 && num_available_samples > frame_samples_)
+        num_available_samples = frame_samples_;
+    if (num_available_samples > ringbuffer_.GetBufferSize() / 2)
+        num_available_samples = ringbuffer_.GetBufferSize() / 2;
+    ring_buffer_size_t num_samples = reader->cursor_.Peek(num_available_samples, regions);
+    if (info && num_samples > 0)
+    {
+        GetCaptureInfo(reader, reader->cursor_.GetPosition(), num_samples, info);
+    }
+    return num_samples;
+}
+
+void Recorder::ReadBatch(Reader *reader, std::vector<unsigned char> *data,
+                         ring_buffer_size_t min_samples, ring_buffer_size_t max_samples,
+                         std::chrono::steady_clock::time_point deadline, CaptureInfo *info)
+{
+    if (!use_ringbuffer_)
+    {
+        // The source blocks until it has them all, so there is no deadline.
+        ReadBlocking(reader, min_samples, max_samples, data, info);
+        return;
+    }
+
+    reader->cursor_.SetMaxLag(max_lag_samples_);
+    data->resize(max_samples * bytes_per_frame_);
+    ring_buffer_size_t num_samples = reader->cursor_.ReadBatch(data->data(), min_samples, max_samples, deadline);
+    AdaptRingBufferSize(reader);
+    ReportLostSamples(reader);
+    data->resize(num_samples * bytes_per_frame_);
+    ConvertToWire(reader, data);
+    if (info && num_samples > 0)
+    {
+        GetCaptureInfo(reader, reader->cursor_.GetPosition() - num_samples, num_samples, info);
+    }
+}
+
+void Recorder::ReadBlocking(Reader *reader, ring_buffer_size_t min_samples, ring_buffer_size_t max_samples,
+                            std::vector<unsigned char> *data, CaptureInfo *info)
+{
+    std::lock_guard<std::mutex> lock(blocking_mutex_);
+    if (min_samples < 1)
+        min_samples = 1;
+    if (max_samples < min_samples)
+        max_samples = min_samples;
+
+    // Drains whatever is pending in one read instead of one buffer per call.
+    // The source counts frames at the capture rate; processed frames left
+    // over from the last call are already at the Open() rate.
+    ring_buffer_size_t num_pending_samples = (ring_buffer_size_t)(blocking_out_.size() / bytes_per_frame_);
+    unsigned long num_source_frames = (unsigned long)source_->GetReadAvailable();
+    if (resampling_)
+    {
+        num_source_frames = (unsigned long)((unsigned long long)num_source_frames * resampler_.GetOutputRate() /
+                                            resampler_.GetInputRate());
+    }
+    ring_buffer_size_t num_samples = num_pending_samples + (ring_buffer_size_t)num_source_frames;
+    if (num_samples < min_samples)
+        num_samples = min_samples;
+    if (num_samples > max_samples)
+        num_samples = max_samples;
+
+    PaStreamCallbackFlags status_flags = 0;
+    if (resampling_ || gain_control_active_)
+    {
+        // Reads what gives about the missing samples at the Open() rate, and
+        // processes it a chunk at a time. The resampler may give a frame
+        // more or less than asked for; a shortfall is read again and any
+        // surplus waits in blocking_out_ for the next call.
+        while (num_pending_samples < num_samples)
+        {
+            ring_buffer_size_t num_missing_samples = num_samples - num_pending_samples;
+            unsigned long num_input_frames = resampling_ ? (unsigned long)resampler_.GetInputFramesFor(num_missing_samples)
+                                                         : (unsigned long)num_missing_samples;
+            blocking_in_.resize(num_input_frames * bytes_per_frame_);
+            PaStreamCallbackFlags read_flags = 0;
+            unsigned long num_read_frames = source_->Read(blocking_in_.data(), num_input_frames, &read_flags);
+            status_flags |= read_flags;
+            for (unsigned long first = 0; first < num_read_frames; first += kChunkFrames)
+            {
+                unsigned long count = num_read_frames - first;
+                if (count > kChunkFrames)
+                    count = kChunkFrames;
+                unsigned long num_output_frames = ProcessChunk(&blocking_in_[first * bytes_per_frame_], count);
+                blocking_out_.insert(blocking_out_.end(), processed_.begin(),
+                                     processed_.begin() + num_output_frames * bytes_per_frame_);
+            }
+            num_pending_samples = (ring_buffer_size_t)(blocking_out_.size() / bytes_per_frame_);
+            if (num_read_frames < num_input_frames)
+            {
+                // End of input.
+                break;
+            }
+        }
+        if (num_samples > num_pending_samples)
+            num_samples = num_pending_samples;
+        data->assign(blocking_out_.begin(), blocking_out_.begin() + num_samples * bytes_per_frame_);
+        blocking_out_.erase(blocking_out_.begin(), blocking_out_.begin() + num_samples * bytes_per_frame_);
+        num_pending_samples -= num_samples;
+    }
+    else
+    {
+        data->resize(num_samples * bytes_per_frame_);
+        num_samples = source_->Read(data->data(), num_samples, &status_flags);
+        data->resize(num_samples * bytes_per_frame_);
+    }
+    bool voice = !voice_detection_active_ || vad_.Process(data->data(), num_samples);
+    ConvertToWire(reader, data);
+    if (status_flags & paInputOverflow)
+    {
+        logger::Log(L"Input overflow reported by the driver before sample %lld.", num_blocking_samples_);
     }
+
+    // No callback times here; the newest sample processed is about one
+    // input latency old when Read() returns, and the ones still pending
+    // came after those returned.
+    if (info)
+    {
+        info->first_sample = num_blocking_samples_;
+        info->capture_time = source_->GetTime() - (num_samples + num_pending_samples) / sample_rate_ -
+                             source_->GetInputLatency() - GetResamplerDelay() - GetGainControlDelay();
+        info->status_flags = status_flags;
+        info->voice = voice;
+    }
+    num_blocking_samples_ += num_samples;
+}
+
+static bool IsSameFormat(const pcm::StreamFormat &a, const pcm::StreamFormat &b)
+{
+    return a.sample_format == b.sample_format && a.channels == b.channels && a.layout == b.layout;
 }
 
-int Recorder::PortAudioCallback(const void *input,
-                                void *output,
-                                unsigned long frame_count,
-                                const PaStreamCallbackTimeInfo *time_info,
-                                PaStreamCallbackFlags status_flags,
-                                void *user_data)
+bool Recorder::NeedsConversion(const Reader *reader) const
 {
-    Recorder *self = reinterpret_cast<Recorder *>(user_data);
-    self->Callback(input, output, frame_count, time_info, status_flags);
-    return paContinue;
+    return !IsSameFormat(capture_format_, reader->has_format_ ? reader->format_ : wire_format_);
 }
 
-int Recorder::Callback(const void *input, void *output,
-                       unsigned long frame_count,
-                       const PaStreamCallbackTimeInfo *time_info,
-                       PaStreamCallbackFlags status_flags)
+void Recorder::ConvertToWire(Reader *reader, std::vector<unsigned char> *data)
 {
-    // Input audio.
-    ring_buffer_size_t num_written_samples = ringbuffer_.Write(input, frame_count);
-    num_lost_samples_ += frame_count - num_written_samples;
-    return paContinue;
+    if (!NeedsConversion(reader) || data->empty())
+    {
+        return;
+    }
+
+    // Reconfigures only when this Open() or SetFormat() changed a format.
+    const pcm::StreamFormat &format = reader->has_format_ ? reader->format_ : wire_format_;
+    pcm::Converter *converter = &reader->converter_;
+    if (!IsSameFormat(converter->GetInputFormat(), capture_format_) ||
+        !IsSameFormat(converter->GetOutputFormat(), format))
+    {
+        converter->Configure(capture_format_, format, dither_);
+    }
+    size_t num_frames = data->size() / bytes_per_frame_;
+    reader->converted_.resize(num_frames * format.GetBytesPerFrame());
+    converter->Process(data->data(), num_frames, reader->converted_.data());
+    data->swap(reader->converted_);
+}
+
+bool Recorder::Consume(Reader *reader, ring_buffer_size_t num_samples)
+{
+    return reader->cursor_.Consume(num_samples);
+}
+
+ring_buffer_size_t Recorder::WaitForSamples(Reader *reader)
+{
+    reader->cursor_.SetMaxLag(max_lag_samples_);
+
+    // Sleeps until the callback has written enough, but wakes up now and then
+    // so the caller can check whether it should stop.
+    ring_buffer_size_t num_available_samples =
+        reader->cursor_.WaitReadable(min_read_samples_, kReadTimeoutMs);
+    AdaptRingBufferSize(reader);
+    if (num_available_samples < min_read_samples_)
+    {
+        return 0;
+    }
+    ReportLostSamples(reader);
+    return num_available_samples;
 }
+
+void Recorder::ReportLostSamples(Reader *reader)
+{
+    // Checks samples skipped because this reader fell behind.
+    ring_buffer_pos_t num_lost_samples = reader->cursor_.GetLostCount() - reader->num_reported_lost_samples_;
+    if (num_lost_samples > 0)
+    {
+        logger::Log(L"Skipped %lld stale samples, %lld samples behind.",
+            num_lost_samples, reader->cursor_.GetLag());
+        reader->num_reported_lost_samples_ += num_lost_samples;
+    }
+}
+
+void Recorder::AdaptRingBufferSize(Reader *reader)
+{
+    std::unique_lock<std::mutex> lock(resize_mutex_, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        return;
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    ring_buffer_size_t size = ringbuffer_.GetBufferSize();
+    ring_buffer_pos_t lag = reader->cursor_.GetLag();
+    ring_buffer_pos_t num_overruns = reader->cursor_.GetOverrunCount();
+    bool lapped = num_overruns > reader->num_seen_overruns_;
+    reader->num_seen_overruns_ = num_overruns;
+    if (lapped || lag >= size / 4)
+    {
+        last_pressure_time_ = now;
+    }
+    if (now - last_resize_time_ < std::chrono::milliseconds(kResizeIntervalMs))
+    {
+        return;
+    }
+
+    // This reader copies the buffered samples over, and the callback only
+    // the block or so it wrote meanwhile when it switches at its next block;
+    // the old memory is released at a later resize, once no reader uses it.
+    ring_buffer_size_t new_size = size;
+    if ((lapped || lag > size / 4 * 3) && size < initial_ringbuffer_size_ * kMaxRingBufferGrowth)
+    {
+        new_size = size * 2;
+    }
+    else if (size > initial_ringbuffer_size_ &&
+             now - last_pressure_time_ >= std::chrono::milliseconds(kShrinkDelayMs))
+    {
+        new_size = size / 2;
+    }
+    if (new_size == size)
+    {
+        return;
+    }
+
+    if (ringbuffer_.Resize(new_size) == 0)
+    {
+        logger::Log(L"Resized ring buffer from %d to %d samples, reader %lld samples behind.",
+            (int)size, (int)new_size, lag);
+        last_resize_time_ = now;
+        last_pressure_time_ = now;
+    }
+}
+
+void Recorder::GetCaptureInfo(Reader *reader, ring_buffer_pos_t first_sample,
+                              ring_buffer_size_t num_samples, CaptureInfo *info)
+{
+    ring_buffer_pos_t end_sample = first_sample + num_samples;
+    CaptureBlock *block = &reader->block_;
+
+    // Skips blocks that end before our first sample.
+    while (block->first_sample + (ring_buffer_pos_t)block->frame_count <= first_sample &&
+           reader->metadata_cursor_.GetReadAvailable() > 0)
+    {
+        reader->metadata_cursor_.Read(block, 1);
+    }
+
+    // Blocks have no gaps, so the time of any sample follows from the time of
+    // the block it is in, or the nearest one if the metadata has been lost.
+    info->first_sample = first_sample;
+    info->capture_time = block->adc_time + (first_sample - block->first_sample) / sample_rate_;
+    info->status_flags = block->status_flags;
+    info->voice = block->voice;
+
+    // Collects the flags of the other blocks we deliver from. The block
+    // holding our last sample stays in reader->block_ for the next call.
+    while (block->first_sample + (ring_buffer_pos_t)block->frame_count < end_sample &&
+           reader->metadata_cursor_.GetReadAvailable() > 0)
+    {
+        reader->metadata_cursor_.Read(block, 1);
+        info->status_flags |= block->status_flags;
+        info->voice = info->voice || block->voice;
+    }
+
+    if (info->status_flags & paInputOverflow)
+    {
+        logger::Log(L"Input overflow reported by the driver before sample %lld.", end_sample);
+    }
+}
+
+unsigned long Recorder::ProcessChunk(const unsigned char *frames, unsigned long frame_count)
+{
+    int channels = capture_format_.channels;
+    pcm::ToFloat(frames, capture_format_.sample_format, frame_count * channels, chunk_in_.data());
+    float *out = chunk_in_.data();
+    size_t num_output_frames = frame_count;
+    if (resampling_)
+    {
+        num_output_frames = resampler_.Process(chunk_in_.data(), frame_count, chunk_out_.data());
+        out = chunk_out_.data();
+    }
+    if (gain_control_active_)
+    {
+        agc_.Process(out, num_output_frames);
+    }
+    pcm::FromFloat(out, num_output_frames * channels, capture_format_.sample_format, processed_.data());
+    return (unsigned long)num_output_frames;
+}
+
+void Recorder::OnCapture(const void *frames, unsigned long frame_count,
+                         PaTime capture_time, PaStreamCallbackFlags status_flags)
+{
+    if (!resampling_ && !gain_control_active_)
+    {
+        WriteBlock(frames, frame_count, capture_time, status_flags);
+        return;
+    }
+
+    // Each chunk goes out as its own block, timed by its first input frame
+    // less the filter and look-ahead delays. The scratch buffers are sized
+    // for one chunk, so the callback never allocates.
+    const unsigned char *in = (const unsigned char *)frames;
+    PaTime time = capture_time - GetResamplerDelay() - GetGainControlDelay();
+    double input_rate = resampling_ ? resampler_.GetInputRate() : sample_rate_;
+    while (frame_count > 0)
+    {
+        unsigned long count = frame_count;
+        if (count > kChunkFrames)
+            count = kChunkFrames;
+        unsigned long num_output_frames = ProcessChunk(in, count);
+        if (num_output_frames > 0)
+            WriteBlock(processed_.data(), num_output_frames, time, status_flags);
+        in += count * bytes_per_frame_;
+        frame_count -= count;
+        time += count / input_rate;
+    }
+}
+
+void Recorder::WriteBlock(const void *frames, unsigned long frame_count,
+                          PaTime capture_time, PaStreamCallbackFlags status_flags)
+{
+    // Describes the block before publishing it, so a reader that sees the
+    // samples also sees when they were captured.
+    CaptureBlock block;
+    block.first_sample = ringbuffer_.GetWritePosition();
+    block.frame_count = frame_count;
+    block.adc_time = capture_time;
+    block.status_flags = status_flags;
+    block.voice = !voice_detection_active_ || vad_.Process(frames, frame_count);
+    metadata_.Write(&block, 1);
+
+    // Input audio. The broadcast ring never refuses data; readers that fall
+    // too far behind detect it themselves.
+    ringbuffer_.Write(frames, frame_count);
+}
\ No newline at end of file
@@ -2,46 +2,376 @@
 #define RECORDER_H
 
 #include <portaudio.h>
+#include <string.h>
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <vector>
-#include "ring_buffer.h"
+#include "automatic_gain_control.h"
+#include "broadcast_ring_buffer.h"
+#include "capture_source.h"
+#include "fixed_broadcast_ring_buffer.h"
+#include "pcm_convert.h"
+#include "resampler.h"
+#include "voice_activity_detector.h"
 
-class Recorder
+class Recorder : private CaptureSource::Sink
 {
-    bool use_ringbuffer_;
+    // Longest time Read() and Peek() block waiting for samples.
+    static const int kReadTimeoutMs = 100;
+
+    // Without the ring buffer, Read() returns everything the source has
+    // pending, or waits for this much if nothing is.
+    static const int kBlockingReadMs = 10;
 
-    // Ring buffer wrapper.
-    RingBuffer ringbuffer_;
+    // The ring grows at most to this many times its size at Open(), and
+    // changes size at most once per kResizeIntervalMs. It shrinks back after
+    // kShrinkDelayMs without any reader getting close to being lapped.
+    static const int kMaxRingBufferGrowth = 16;
+    static const int kResizeIntervalMs = 2000;
+    static const int kShrinkDelayMs = 30000;
+
+    bool use_ringbuffer_;
 
-    // Pointer to PortAudio stream.
-    PaStream *pa_stream_;
+    // Ring buffer wrapper. The callback writes each sample once and every
+    // Reader sees all of them.
+    BroadcastRingBuffer ringbuffer_;
 
-    // Number of lost samples at each Read() due to ring buffer overflow.
-    int num_lost_samples_;
+    // Where the samples come from: a PortAudio device, or a file or
+    // generator for tests.
+    std::unique_ptr<CaptureSource> source_;
 
     // Wait for this number of samples in each Read() call.
     int min_read_samples_;
 
+    // Frame mode: every Read()/Peek() returns exactly frame_samples_
+    // samples, 0 if off. frame_ms_ is what SetFrameDuration() asked for.
+    int frame_ms_;
+    int frame_samples_;
+
+    // Size of one frame (all channels of one sample) in bytes, as captured
+    // and kept in the ring buffer.
+    int bytes_per_frame_;
+
+    // Float mode: frames are captured and buffered as floats and converted
+    // to wire_bits_per_sample_ integers when read. float_capture_ is what
+    // SetFloatCapture() asked for, float_samples_ what Open() set up.
+    bool float_capture_;
+    bool float_samples_;
+    int wire_bits_per_sample_;
+
+    // Integer bits to capture with if not the wire bits, 0 for the same.
+    // capture_format_ is what the ring buffer holds and wire_format_ what
+    // Read() returns to readers that did not ask for another format.
+    int capture_bits_per_sample_;
+    bool dither_;
+    pcm::StreamFormat capture_format_;
+    pcm::StreamFormat wire_format_;
+
+    // Rate to capture at if not the rate given to Open(), 0 for the same.
+    // When they differ, blocks are resampled once as they come in, and the
+    // ring buffer holds the stream at the Open() rate.
+    int capture_sample_rate_;
+    pcm::ResamplerQuality resampler_quality_;
+    bool resampling_;
+    pcm::Resampler resampler_;
+
+    // Evens out the level of blocks as they come in when gain_control_ is
+    // on, after resampling. The callback and reads go by
+    // gain_control_active_, latched by Open(), so SetGainControl() never
+    // changes the processing under a running stream.
+    bool gain_control_;
+    bool gain_control_active_;
+    AutomaticGainControl::Options agc_options_;
+    AutomaticGainControl agc_;
+
+    // Resampling and gain control work on floats, kChunkFrames input frames
+    // at a time, so the callback never allocates.
+    static const unsigned long kChunkFrames = 256;
+    std::vector<float> chunk_in_;
+    std::vector<float> chunk_out_;
+    std::vector<unsigned char> processed_;
+    std::vector<unsigned char> blocking_in_;
+
+    // Without the ring buffer: processed frames at the Open() rate that the
+    // last read produced beyond what it returned.
+    std::vector<unsigned char> blocking_out_;
+
+    // Runs on every block as it is written when voice_detection_ is on,
+    // so all readers share one decision. Latched into
+    // voice_detection_active_ by Open() like gain control.
+    bool voice_detection_;
+    bool voice_detection_active_;
+    VoiceActivityDetector vad_;
+
+    // Readers further behind than this skip ahead to the freshest samples.
+    int max_read_latency_ms_;
+    int max_lag_samples_;
+
+    double sample_rate_;
+
+    // Samples delivered so far without the ring buffer. Without it, readers
+    // share the source and each read takes the next samples; blocking_mutex_
+    // serializes them, as they all use source_, the processing state and
+    // the scratch buffers.
+    std::mutex blocking_mutex_;
+    ring_buffer_pos_t num_blocking_samples_;
+
+    // Ring size at Open(), and what the resize policy last saw. Readers take
+    // resize_mutex_ with try_lock(), so only one of them resizes at a time
+    // and none of them waits for it.
+    std::mutex resize_mutex_;
+    ring_buffer_size_t initial_ringbuffer_size_;
+    std::chrono::steady_clock::time_point last_resize_time_;
+    std::chrono::steady_clock::time_point last_pressure_time_;
+
+    // What the callback knew about one block of samples.
+    struct CaptureBlock
+    {
+        ring_buffer_pos_t first_sample;
+        unsigned long frame_count;
+        PaTime adc_time;
+        PaStreamCallbackFlags status_flags;
+        bool voice;
+    };
+
+    // One CaptureBlock per callback, written just before the samples of
+    // that callback, so a reader always finds the block for its samples.
+    // Callbacks carry at least a few samples, so this covers more history
+    // than the sample ring. Fixed, so readers keep it across Open() calls.
+    FixedBroadcastRingBuffer<CaptureBlock, 4096> metadata_;
+
 public:
+    // When and how the samples returned by Read()/Peek() were captured.
+    struct CaptureInfo
+    {
+        // Absolute index of the first sample, counted from Open().
+        ring_buffer_pos_t first_sample;
+
+        // ADC time of the first sample, on the Pa_GetStreamTime() clock.
+        PaTime capture_time;
+
+        // paInputOverflow etc. reported by the driver for any of the samples.
+        PaStreamCallbackFlags status_flags;
+
+        // False if voice detection is on and found no voice in any of the
+        // samples, so they can go out as silence.
+        bool voice;
+    };
+
+    // Read position of one consumer. Each consumer thread owns one and
+    // passes it to Read()/Peek()/Consume().
+    class Reader
+    {
+        friend class Recorder;
+
+        BroadcastRingBuffer::Reader cursor_;
+
+        // Read position in metadata_, and the last CaptureBlock read from it.
+        FixedBroadcastRingBuffer<CaptureBlock, 4096>::Reader metadata_cursor_;
+        CaptureBlock block_;
+
+        // Lost samples already logged, and overruns already acted on.
+        ring_buffer_pos_t num_reported_lost_samples_;
+        ring_buffer_pos_t num_seen_overruns_;
+
+        // What SetFormat() asked for, and the converter from the ring
+        // buffer format with its output buffer.
+        bool has_format_;
+        pcm::StreamFormat format_;
+        pcm::Converter converter_;
+        std::vector<unsigned char> converted_;
+
+    public:
+        Reader() : num_reported_lost_samples_(0), num_seen_overruns_(0), has_format_(false)
+        {
+            memset(&block_, 0, sizeof(block_));
+        }
+
+        // Makes Read() and ReadBatch() return |format| instead of the wire
+        // format, e.g. float planes for an analysis stage or a downmix for
+        // a mono client. Peek() is not affected.
+        void SetFormat(const pcm::StreamFormat &format)
+        {
+            format_ = format;
+            has_format_ = true;
+        }
+
+        // Absolute index of the next sample this reader gets, counted from
+        // Open(). Pass it to Subscribe() to resume from the same place.
+        ring_buffer_pos_t GetPosition() const { return cursor_.GetPosition(); }
+
+        // Number of samples this reader is behind the capture callback.
+        ring_buffer_pos_t GetLag() const { return cursor_.GetLag(); }
+
+        // Number of samples this reader lost because it fell too far behind.
+        ring_buffer_pos_t GetLostSamples() const { return cursor_.GetLostCount(); }
+    };
+
     Recorder(bool use_ringbuffer = true);
     ~Recorder();
 
+    // Captures from PortAudio device |id|.
     bool Open(int id, int sample_rate, int channels, int bits_per_sample);
+
+    // Captures from |source|, e.g. one made by CreateCaptureSource().
+    bool Open(std::unique_ptr<CaptureSource> source, int sample_rate, int channels, int bits_per_sample);
     void Close();
-    void Read(std::vector<unsigned char> *data);
+
+    // Bounds the latency of every reader: samples older than |ms| are skipped
+    // and counted as lost. 0 only skips what the ring buffer has overwritten.
+    // Takes effect at the next Open().
+    void SetMaxReadLatency(int ms) { max_read_latency_ms_ = ms; }
+
+    // Frame mode: Read() and Peek() return exactly |ms| worth of samples,
+    // e.g. 5, 10 or 20 ms, released as soon as the frame is complete, and
+    // the capture source is asked for blocks of that size. 0 turns it off,
+    // so reads wait for at least 100 ms and return all that is buffered.
+    // Takes effect at the next Open().
+    void SetFrameDuration(int ms) { frame_ms_ = ms; }
+
+    // Float mode: the source captures paFloat32 and the ring buffer holds
+    // the floats, so processing stages can work on them as they are.
+    // Read(), ReadBatch() and the blocking reads convert them once, to the
+    // |bits_per_sample| integers Open() was given; Peek() hands out the
+    // floats. Takes effect at the next Open().
+    void SetFloatCapture(bool on) { float_capture_ = on; }
+
+    // Captures |bits_per_sample| integers, e.g. the 24 bits the device
+    // delivers natively, and converts them to the bits Open() was given
+    // when read. 0 captures the wire bits. Float mode takes precedence.
+    // Takes effect at the next Open().
+    void SetCaptureBitsPerSample(int bits_per_sample) { capture_bits_per_sample_ = bits_per_sample; }
+
+    // Captures at |sample_rate|, e.g. the device's native 44.1 or 48 kHz,
+    // and resamples to the rate Open() was given with |quality|. 0 captures
+    // at the Open() rate. Takes effect at the next Open().
+    void SetCaptureSampleRate(int sample_rate, pcm::ResamplerQuality quality = pcm::kResampleDefault)
+    {
+        capture_sample_rate_ = sample_rate;
+        resampler_quality_ = quality;
+    }
+
+    // Evens out the level of the captured stream with automatic gain
+    // control, and keeps its peaks below the ceiling with a look-ahead
+    // limiter, once for all readers and before voice detection. Takes
+    // effect at the next Open().
+    void SetGainControl(bool on, const AutomaticGainControl::Options &options = AutomaticGainControl::Options())
+    {
+        gain_control_ = on;
+        agc_options_ = options;
+    }
+
+    // Runs voice activity detection on the captured stream, once for all
+    // readers, and reports it in CaptureInfo::voice. Takes effect at the
+    // next Open().
+    void SetVoiceDetection(bool on) { voice_detection_ = on; }
+    bool IsVoiceDetectionOn() const { return voice_detection_; }
+
+    // Adds TPDF dither when reads reduce the bit depth. Takes effect at the
+    // next Open().
+    void SetDither(bool on) { dither_ = on; }
+
+    // Starts |reader| at the newest captured sample.
+    void Subscribe(Reader *reader);
+
+    // Starts |reader| at the absolute sample index |position|, e.g. to resume
+    // a client after a reconnect. Returns false if some of those samples are
+    // no longer buffered; |reader| then starts at the oldest one that is.
+    bool Subscribe(Reader *reader, ring_buffer_pos_t position);
+
+    // Absolute index of the next sample the callback will capture.
+    ring_buffer_pos_t GetWritePosition() const { return ringbuffer_.GetWritePosition(); }
+
+    // Waits up to 100 ms for data, a frame in frame mode. |data| is left
+    // empty on timeout. If |info| is given it receives the capture time of
+    // the data.
+    void Read(Reader *reader, std::vector<unsigned char> *data, CaptureInfo *info = nullptr);
+
+    // Zero-copy read: waits up to 100 ms for data, a frame in frame mode, and
+    // returns the ring buffer region(s) holding it, or 0 on timeout. If |info| is given it receives
+    // the capture time of the data. The caller must release them with Consume() when done;
+    // Consume() returns false if the samples were overwritten meanwhile.
+    ring_buffer_size_t Peek(Reader *reader, RingBufferRegions *regions, CaptureInfo *info = nullptr);
+    bool Consume(Reader *reader, ring_buffer_size_t num_samples);
+
+    // Reads between |min_samples| and |max_samples| samples, so consumers get
+    // steady batches sized for their encoder or packet. Waits until
+    // |deadline| for |min_samples|; |data| is left empty if they did not
+    // arrive, and they stay buffered for the next call. Without the ring
+    // buffer it blocks for |min_samples| samples regardless of |deadline|.
+    void ReadBatch(Reader *reader, std::vector<unsigned char> *data,
+                   ring_buffer_size_t min_samples, ring_buffer_size_t max_samples,
+                   std::chrono::steady_clock::time_point deadline, CaptureInfo *info = nullptr);
+
+    bool IsUsingRingBuffer() const { return use_ringbuffer_; }
+    bool IsFloatCapture() const { return float_samples_; }
+
+    // Delay the resampler adds, in seconds, 0 if not resampling. Capture
+    // times in CaptureInfo already account for it.
+    double GetResamplerDelay() const { return resampling_ ? resampler_.GetDelay() : 0; }
+
+    // Delay the gain control's look-ahead adds, in seconds, 0 if it is off.
+    // Capture times in CaptureInfo already account for it.
+    double GetGainControlDelay() const { return gain_control_active_ ? agc_.GetDelay() : 0; }
+
+    int GetSampleRate() const { return (int)sample_rate_; }
+
+    // Format Read() returns to readers that did not ask for another one.
+    const pcm::StreamFormat &GetWireFormat() const { return wire_format_; }
+
+    // Format of the ring buffer, as Peek() returns it.
+    const pcm::StreamFormat &GetCaptureFormat() const { return capture_format_; }
+
+    // True if Read() converts what |reader| gets, so Peek() does not return
+    // it in the format it wants.
+    bool NeedsConversion(const Reader *reader) const;
+
+    // Size of a frame in the ring buffer, as Peek() returns it.
+    int GetBytesPerFrame() const { return bytes_per_frame_; }
 
 private:
-    static int PortAudioCallback(const void *input,
-                                 void *output,
-                                 unsigned long frame_count,
-                                 const PaStreamCallbackTimeInfo *time_info,
-                                 PaStreamCallbackFlags status_flags,
-                                 void *user_data);
-
-    int Callback(const void *input, void *output,
-                 unsigned long frame_count,
-                 const PaStreamCallbackTimeInfo *time_info,
-                 PaStreamCallbackFlags status_flags);
+    // Logs lost samples and waits until min_read_samples_ are buffered.
+    // Returns 0 if they did not arrive within kReadTimeoutMs.
+    ring_buffer_size_t WaitForSamples(Reader *reader);
+
+    // Logs the samples |reader| lost since the last call.
+    void ReportLostSamples(Reader *reader);
+
+    // Reads straight from the source, for when there is no ring buffer:
+    // all samples it has pending, limited to |min_samples|..|max_samples|,
+    // in one call. Blocks only for the samples short of |min_samples|, and
+    // for any other reader still in here.
+    void ReadBlocking(Reader *reader, ring_buffer_size_t min_samples, ring_buffer_size_t max_samples,
+                      std::vector<unsigned char> *data, CaptureInfo *info);
+
+    // Converts the frames in |data| from the capture format to the format
+    // of |reader|. Does nothing if they are the same.
+    void ConvertToWire(Reader *reader, std::vector<unsigned char> *data);
+
+    // Doubles the ring when |reader| got lapped or is more than 3/4 of the
+    // ring behind, and halves it when no reader has come within 1/4 of that
+    // for kShrinkDelayMs. Buffered samples are kept across the change.
+    void AdaptRingBufferSize(Reader *reader);
+
+    // Fills |info| for the |num_samples| samples from |first_sample| that
+    // |reader| gets, moving its metadata cursor along with its sample cursor.
+    void GetCaptureInfo(Reader *reader, ring_buffer_pos_t first_sample,
+                        ring_buffer_size_t num_samples, CaptureInfo *info);
+
+    // Resamples and applies gain control to |frame_count| frames of at most
+    // kChunkFrames, as far as they are on, into processed_, and returns the
+    // number of frames there.
+    unsigned long ProcessChunk(const unsigned char *frames, unsigned long frame_count);
+
+    // Publishes one block of frames at the Open() rate.
+    void WriteBlock(const void *frames, unsigned long frame_count,
+                    PaTime capture_time, PaStreamCallbackFlags status_flags);
+
+    // CaptureSource::Sink, called on the source's thread.
+    void OnCapture(const void *frames, unsigned long frame_count,
+                   PaTime capture_time, PaStreamCallbackFlags status_flags) override;
 };
 
 #endif
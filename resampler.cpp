@@ -0,0 +1,210 @@
+#include "resampler.h"
+#include "pcm_kernels.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+namespace pcm {
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+
+// Input frames appended to the history at a time.
+const size_t kChunkFrames = 256;
+
+struct QualityPreset
+{
+    int taps;
+    double rolloff;
+    double kaiser_beta;
+};
+
+const QualityPreset kPresets[] = {
+    {16, 0.80, 5.0},
+    {32, 0.88, 8.0},
+    {64, 0.94, 10.0},
+};
+
+int Gcd(int a, int b)
+{
+    while (b != 0)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Modified Bessel function of the first kind, order 0, for the Kaiser window.
+double BesselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+}
+
+Resampler::Resampler()
+{
+    in_rate_ = out_rate_ = 0;
+    channels_ = 0;
+    up_ = down_ = 1;
+    taps_ = 0;
+    delay_frames_ = 0;
+    history_stride_ = 0;
+    history_frames_ = 0;
+    next_ = 0;
+    phase_ = 0;
+}
+
+bool Resampler::Configure(int in_rate, int out_rate, int channels, ResamplerQuality quality)
+{
+    if (in_rate <= 0 || out_rate <= 0 || channels < 1)
+        return false;
+    int gcd = Gcd(in_rate, out_rate);
+    int up = out_rate / gcd;
+    int down = in_rate / gcd;
+    if (up > kMaxPhases)
+        return false;
+
+    in_rate_ = in_rate;
+    out_rate_ = out_rate;
+    channels_ = channels;
+    up_ = up;
+    down_ = down;
+    if (IsPassThrough())
+    {
+        taps_ = 0;
+        delay_frames_ = 0;
+        coefs_.clear();
+        history_.clear();
+        return true;
+    }
+
+    // Downsampling lowers the cutoff, so the filter spans more input samples
+    // for the same transition band. Every step between outputs must also
+    // stay within the history, and a multiple of 8 keeps the SIMD dot
+    // products free of tails.
+    const QualityPreset &preset = kPresets[quality];
+    int step = (down + up - 1) / up;
+    int taps = preset.taps * step;
+    if (taps < step + 1)
+        taps = step + 1;
+    taps = (taps + 7) & ~7;
+    taps_ = taps;
+
+    // Windowed-sinc prototype at up_ times the input rate, cut off just
+    // below the lower of the two Nyquist frequencies.
+    int length = taps * up;
+    double center = (length - 1) / 2.0;
+    double cutoff = preset.rolloff * 0.5 / (up > down ? up : down);
+    double window_scale = 1.0 / BesselI0(preset.kaiser_beta);
+    std::vector<double> prototype(length);
+    for (int j = 0; j < length; j++)
+    {
+        double t = j - center;
+        double sinc = t == 0 ? 1.0 : sin(2 * kPi * cutoff * t) / (2 * kPi * cutoff * t);
+        double r = t / (center + 0.5);
+        double window = BesselI0(preset.kaiser_beta * sqrt(1.0 - r * r)) * window_scale;
+        prototype[j] = sinc * window;
+    }
+    delay_frames_ = center / up;
+
+    // Splits it into branches, each normalized to unity gain at DC so the
+    // phases do not ripple against each other.
+    coefs_.assign((size_t)up * taps, 0.0f);
+    for (int p = 0; p < up; p++)
+    {
+        double sum = 0;
+        for (int k = 0; k < taps; k++)
+            sum += prototype[p + k * up];
+        for (int k = 0; k < taps; k++)
+            coefs_[(size_t)p * taps + (taps - 1 - k)] = (float)(prototype[p + k * up] / sum);
+    }
+
+    history_stride_ = taps - 1 + kChunkFrames;
+    history_.resize(history_stride_ * channels);
+    Reset();
+    return true;
+}
+
+void Resampler::Reset()
+{
+    // Starts on taps_ - 1 samples of silence, so the first output lines up
+    // with the first input.
+    std::fill(history_.begin(), history_.end(), 0.0f);
+    history_frames_ = taps_ > 0 ? taps_ - 1 : 0;
+    next_ = history_frames_;
+    phase_ = 0;
+}
+
+size_t Resampler::GetMaxOutputFrames(size_t in_frames) const
+{
+    return (size_t)((unsigned long long)in_frames * up_ / down_) + 2;
+}
+
+size_t Resampler::GetInputFramesFor(size_t out_frames) const
+{
+    return (size_t)(((unsigned long long)out_frames * down_ + up_ - 1) / up_) + 1;
+}
+
+size_t Resampler::Process(const float *in, size_t in_frames, float *out)
+{
+    if (IsPassThrough())
+    {
+        memcpy(out, in, in_frames * channels_ * sizeof(float));
+        return in_frames;
+    }
+
+    const Kernels &kernels = GetKernels();
+    size_t out_frames = 0;
+    while (in_frames > 0)
+    {
+        size_t n = in_frames < kChunkFrames ? in_frames : kChunkFrames;
+        for (int c = 0; c < channels_; c++)
+        {
+            float *row = &history_[c * history_stride_ + history_frames_];
+            for (size_t i = 0; i < n; i++)
+                row[i] = in[i * channels_ + c];
+        }
+        history_frames_ += n;
+        in += n * channels_;
+        in_frames -= n;
+
+        // Every output whose newest input sample has arrived.
+        while (next_ < history_frames_)
+        {
+            const float *branch = &coefs_[(size_t)phase_ * taps_];
+            size_t first = next_ + 1 - taps_;
+            for (int c = 0; c < channels_; c++)
+                *out++ = kernels.dot(&history_[c * history_stride_ + first], branch, taps_);
+            out_frames++;
+            phase_ += down_;
+            next_ += phase_ / up_;
+            phase_ %= up_;
+        }
+
+        // Keeps the taps_ - 1 samples the next output reaches back to.
+        size_t drop = next_ + 1 - taps_;
+        for (int c = 0; c < channels_; c++)
+        {
+            float *row = &history_[c * history_stride_];
+            memmove(row, row + drop, (history_frames_ - drop) * sizeof(float));
+        }
+        history_frames_ -= drop;
+        next_ -= drop;
+    }
+    return out_frames;
+}
+
+}
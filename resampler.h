@@ -0,0 +1,85 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace pcm {
+
+// Trade-off between passband, stopband and CPU. Taps are per output sample
+// and channel when upsampling; downsampling by a factor r takes r times as
+// many to keep the transition band.
+enum ResamplerQuality
+{
+    kResampleFast,    // 16 taps, passband to 0.80 of Nyquist
+    kResampleDefault, // 32 taps, passband to 0.88 of Nyquist
+    kResampleBest     // 64 taps, passband to 0.94 of Nyquist
+};
+
+// Streaming rational-ratio resampler: a windowed-sinc lowpass split into one
+// polyphase branch per output phase, so each output sample costs one dot
+// product of the taps with the input history. The dot products run on the
+// SIMD kernels of pcm_convert. Works on interleaved float frames and keeps
+// the input history between calls, so blocks of any size can be fed in.
+class Resampler
+{
+public:
+    Resampler();
+
+    // Converts |channels| channels from |in_rate| to |out_rate|. Returns
+    // false for rates whose reduced ratio needs more than kMaxPhases phases.
+    bool Configure(int in_rate, int out_rate, int channels, ResamplerQuality quality = kResampleDefault);
+
+    // Forgets the history, as if just configured.
+    void Reset();
+
+    // Resamples |in_frames| frames from |in| to |out| and returns the number
+    // of frames written, at most GetMaxOutputFrames(in_frames).
+    size_t Process(const float *in, size_t in_frames, float *out);
+
+    size_t GetMaxOutputFrames(size_t in_frames) const;
+
+    // Input frames that give about |out_frames| output frames, give or
+    // take one depending on the phase.
+    size_t GetInputFramesFor(size_t out_frames) const;
+
+    // Group delay of the filter: an output sample reflects the input from
+    // this long before it. Subtract it from capture times to line the output
+    // up with the input.
+    double GetDelay() const { return delay_frames_ / in_rate_; }
+    double GetDelayFrames() const { return delay_frames_; }
+
+    int GetInputRate() const { return in_rate_; }
+    int GetOutputRate() const { return out_rate_; }
+    bool IsPassThrough() const { return in_rate_ == out_rate_; }
+
+    static const int kMaxPhases = 1024;
+
+private:
+    int in_rate_;
+    int out_rate_;
+    int channels_;
+
+    // out_rate_ / in_rate_ reduced to up_ / down_. Output n is computed
+    // from input n * down_ / up_ with branch (n * down_) % up_.
+    int up_;
+    int down_;
+    int taps_;
+    double delay_frames_;
+
+    // up_ branches of taps_ coefficients, each reversed so that the dot
+    // product runs forward over the history.
+    std::vector<float> coefs_;
+
+    // One row of taps_ - 1 + kChunkFrames samples per channel. The newest
+    // input sample the next output uses is history_[next_], in phase_.
+    std::vector<float> history_;
+    size_t history_stride_;
+    size_t history_frames_;
+    size_t next_;
+    int phase_;
+};
+
+}
+
+#endif
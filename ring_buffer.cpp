@@ -1,130 +1,69 @@
 #include "ring_buffer.h"
+#include "ring_storage.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
 
-#if defined(__APPLE__)
-/* Support for the atomic library was added in C11.
- */
-#if (__STDC_VERSION__ < 201112L) || defined(__STDC_NO_ATOMICS__)
-#include <libkern/OSAtomic.h>
-/* Here are the memory barrier functions. Mac OS X only provides
-   full memory barriers, so the three types of barriers are the same,
-   however, these barriers are superior to compiler-based ones.
-   These were deprecated in MacOS 10.12. */
-#define FullMemoryBarrier() OSMemoryBarrier()
-#define ReadMemoryBarrier() OSMemoryBarrier()
-#define WriteMemoryBarrier() OSMemoryBarrier()
-#else
-#include <stdatomic.h>
-#define FullMemoryBarrier() atomic_thread_fence(memory_order_seq_cst)
-#define ReadMemoryBarrier() atomic_thread_fence(memory_order_acquire)
-#define WriteMemoryBarrier() atomic_thread_fence(memory_order_release)
-#endif
-#elif defined(__GNUC__)
-/* GCC >= 4.1 has built-in intrinsics. We'll use those */
-#if (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1)
-#define FullMemoryBarrier() __sync_synchronize()
-#define ReadMemoryBarrier() __sync_synchronize()
-#define WriteMemoryBarrier() __sync_synchronize()
-/* as a fallback, GCC understands volatile asm and "memory" to mean it
- * should not reorder memory read/writes */
-/* Note that it is not clear that any compiler actually defines __PPC__,
- * it can probably removed safely. */
-#elif defined(__ppc__) || defined(__powerpc__) || defined(__PPC__)
-#define FullMemoryBarrier() asm volatile("sync" :: \
-                                             : "memory")
-#define ReadMemoryBarrier() asm volatile("sync" :: \
-                                             : "memory")
-#define WriteMemoryBarrier() asm volatile("sync" :: \
-                                              : "memory")
-#elif defined(__i386__) || defined(__i486__) || defined(__i586__) || \
-    defined(__i686__) || defined(__x86_64__)
-#define FullMemoryBarrier() asm volatile("mfence" :: \
-                                             : "memory")
-#define ReadMemoryBarrier() asm volatile("lfence" :: \
-                                             : "memory")
-#define WriteMemoryBarrier() asm volatile("sfence" :: \
-                                              : "memory")
-#else
-#ifdef ALLOW_SMP_DANGERS
-#warning Memory barriers not defined on this system or system unknown
-#warning For SMP safety, you should fix this.
-#define FullMemoryBarrier()
-#define ReadMemoryBarrier()
-#define WriteMemoryBarrier()
-#else
-#error Memory barriers are not defined on this system. You can still compile by defining ALLOW_SMP_DANGERS, but SMP safety will not be guaranteed.
-#endif
-#endif
-#elif (_MSC_VER >= 1400) && !defined(_WIN32_WCE)
-#include <intrin.h>
-#pragma intrinsic(_ReadWriteBarrier)
-#pragma intrinsic(_ReadBarrier)
-#pragma intrinsic(_WriteBarrier)
-/* note that MSVC intrinsics _ReadWriteBarrier(), _ReadBarrier(), _WriteBarrier() are just compiler barriers *not* memory barriers */
-#define FullMemoryBarrier() _ReadWriteBarrier()
-#define ReadMemoryBarrier() _ReadBarrier()
-#define WriteMemoryBarrier() _WriteBarrier()
-#elif defined(_WIN32_WCE)
-#define FullMemoryBarrier()
-#define ReadMemoryBarrier()
-#define WriteMemoryBarrier()
-#elif defined(_MSC_VER) || defined(__BORLANDC__)
-#define FullMemoryBarrier() _asm { lock add    [esp], 0}
-#define ReadMemoryBarrier() _asm { lock add    [esp], 0}
-#define WriteMemoryBarrier() _asm { lock add    [esp], 0}
-#else
-#ifdef ALLOW_SMP_DANGERS
-#warning Memory barriers not defined on this system or system unknown
-#warning For SMP safety, you should fix this.
-#define FullMemoryBarrier()
-#define ReadMemoryBarrier()
-#define WriteMemoryBarrier()
-#else
-#error Memory barriers are not defined on this system. You can still compile by defining ALLOW_SMP_DANGERS, but SMP safety will not be guaranteed.
-#endif
-#endif
-
 RingBuffer::RingBuffer()
 {
     bufferSize_ = 0;
-    writeIndex_ = 0;
-    readIndex_ = 0;
-    bigMask_ = 0;
+    writePosition_.store(0, std::memory_order_relaxed);
+    readPosition_.store(0, std::memory_order_relaxed);
+    cachedReadPosition_ = 0;
+    cachedWritePosition_ = 0;
+    peekPosition_ = 0;
+    overwrittenCount_.store(0, std::memory_order_relaxed);
+    overflowPolicy_ = kRingBufferDropNewest;
     smallMask_ = 0;
     elementSizeBytes_ = 0;
     buffer_ = nullptr;
+    mirrored_ = false;
 }
 
 RingBuffer::~RingBuffer()
 {
-    if (buffer_)
-    {
-        free(buffer_);
-        buffer_ = nullptr;
-    }
+    FreeBuffer();
+}
+
+void RingBuffer::FreeBuffer()
+{
+    ring_storage::Free(&storage_);
+    buffer_ = nullptr;
+    mirrored_ = false;
 }
 
 /***************************************************************************
  * Initialize FIFO.
  * elementCount must be power of 2, returns -1 if not.
  */
-int RingBuffer::Initialize(ring_buffer_size_t elementSizeBytes, ring_buffer_size_t elementCount)
+int RingBuffer::Initialize(ring_buffer_size_t elementSizeBytes, ring_buffer_size_t elementCount,
+                           RingBufferStorage storage, const ring_storage::Options &options)
 {
-    if (buffer_)
-    {
-        free(buffer_);
-        buffer_ = nullptr;
-    }
+    FreeBuffer();
 
     if (((elementCount - 1) & elementCount) != 0)
         return -1; /* Not Power of two. */
+
+    bool mirrored = storage == kRingBufferMirrored;
+    if (mirrored)
+    {
+        /* The mirror must start on a granule boundary, and the granule is a
+           power of two, so doubling the count always gets there. */
+        size_t granularity = ring_storage::GetMirrorGranularity();
+        while (((size_t)elementCount * elementSizeBytes) % granularity != 0)
+            elementCount *= 2;
+    }
+    if (!ring_storage::Allocate((size_t)elementCount * elementSizeBytes, mirrored, options, &storage_))
+    {
+        bufferSize_ = 0;
+        return -1;
+    }
+    buffer_ = (char *)storage_.data;
+    mirrored_ = mirrored;
+
     bufferSize_ = elementCount;
-    buffer_ = (char *)malloc(elementCount * elementSizeBytes);
     Flush();
-    bigMask_ = (elementCount * 2) - 1;
     smallMask_ = elementCount - 1;
     elementSizeBytes_ = elementSizeBytes;
     return 0;
@@ -135,11 +74,37 @@ int RingBuffer::Initialize(ring_buffer_size_t elementSizeBytes, ring_buffer_size
  */
 ring_buffer_size_t RingBuffer::GetReadAvailable()
 {
-    return ((writeIndex_ - readIndex_) & bigMask_);
+    /* Read position first: both only grow, so the write position loaded
+       after it is never older. With kRingBufferOverwriteOldest the writer
+       moves the read position too, and a read position loaded before it
+       does can trail the write position by more than the buffer; clamp,
+       so the result always lies in [0, bufferSize_]. */
+    ring_buffer_pos_t readPosition = readPosition_.load(std::memory_order_acquire);
+    ring_buffer_pos_t available = writePosition_.load(std::memory_order_acquire) - readPosition;
+    if (available < 0)
+        return 0;
+    if (available > bufferSize_)
+        return bufferSize_;
+    return (ring_buffer_size_t)available;
+}
+
+/***************************************************************************
+ * Return number of elements available for reading, waiting for elementCount.
+ */
+ring_buffer_size_t RingBuffer::WaitReadable(ring_buffer_size_t elementCount, int timeoutMs)
+{
+    if (elementCount > bufferSize_)
+        elementCount = bufferSize_;
+    return ring_wait::WaitReadable(waitGate_, elementCount, timeoutMs,
+                                   [this, elementCount](int64_t *threshold) {
+                                       *threshold = elementCount;
+                                       return GetReadAvailable();
+                                   });
 }
 
 /***************************************************************************
- * Return number of elements available for writing.
+ * Return number of elements available for writing. GetReadAvailable() is
+ * clamped, so this never goes negative either.
  */
 ring_buffer_size_t RingBuffer::GetWriteAvailable()
 {
@@ -151,7 +116,95 @@ ring_buffer_size_t RingBuffer::GetWriteAvailable()
  */
 void RingBuffer::Flush()
 {
-    writeIndex_ = readIndex_ = 0;
+    /* Positions keep counting across a flush; only the unread data goes. */
+    ring_buffer_pos_t writePosition = writePosition_.load(std::memory_order_relaxed);
+    readPosition_.store(writePosition, std::memory_order_relaxed);
+    cachedReadPosition_ = cachedWritePosition_ = peekPosition_ = writePosition;
+    overwrittenCount_.store(0, std::memory_order_relaxed);
+}
+
+/***************************************************************************
+ */
+ring_buffer_pos_t RingBuffer::GetWritePosition() const
+{
+    return writePosition_.load(std::memory_order_acquire);
+}
+
+/***************************************************************************
+ */
+ring_buffer_pos_t RingBuffer::GetReadPosition() const
+{
+    return readPosition_.load(std::memory_order_acquire);
+}
+
+/***************************************************************************
+** Return elements skipped. */
+ring_buffer_size_t RingBuffer::SeekRead(ring_buffer_pos_t position)
+{
+    ring_buffer_size_t numSkipped = 0;
+    while (true)
+    {
+        ring_buffer_pos_t readPosition = GetReadPosition();
+        if (position <= readPosition)
+            break;
+
+        RingBufferRegions regions;
+        ring_buffer_size_t count = Peek((ring_buffer_size_t)(position - readPosition), &regions);
+        if (count == 0)
+            break; /* position is beyond the data written so far */
+        if (Consume(count))
+            numSkipped += count;
+        /* else the writer moved the read position itself; look again */
+    }
+    return numSkipped;
+}
+
+/***************************************************************************
+ */
+void RingBuffer::SetOverflowPolicy(RingBufferOverflowPolicy policy)
+{
+    overflowPolicy_ = policy;
+}
+
+/***************************************************************************
+ */
+ring_buffer_pos_t RingBuffer::GetOverwrittenCount() const
+{
+    return overwrittenCount_.load(std::memory_order_acquire);
+}
+
+/***************************************************************************
+** Discard the oldest unread elements so that elementCount elements fit.
+** The reader may be advancing the read position at the same time, so this
+** is a compare-and-swap loop against it.
+** Returns room available to be written.
+*/
+ring_buffer_size_t RingBuffer::DiscardOldest(ring_buffer_pos_t writePosition, ring_buffer_size_t elementCount)
+{
+    ring_buffer_pos_t readPosition = cachedReadPosition_;
+    ring_buffer_size_t available;
+    while (true)
+    {
+        available = bufferSize_ - (ring_buffer_size_t)(writePosition - readPosition);
+        if (available >= elementCount)
+            break; /* the reader made room meanwhile */
+
+        ring_buffer_size_t skip = elementCount - available;
+        ring_buffer_pos_t newReadPosition = readPosition + skip;
+        /* acquire: the reader is done with anything it released before;
+           a reader still copying the skipped elements fails its own CAS. */
+        if (readPosition_.compare_exchange_weak(readPosition, newReadPosition,
+                                             std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            overwrittenCount_.store(overwrittenCount_.load(std::memory_order_relaxed) + skip,
+                                    std::memory_order_release);
+            readPosition = newReadPosition;
+            available = elementCount;
+            break;
+        }
+    }
+    cachedReadPosition_ = readPosition;
+    return available;
 }
 
 /***************************************************************************
@@ -165,12 +218,28 @@ ring_buffer_size_t RingBuffer::GetWriteRegions(ring_buffer_size_t elementCount,
                                                void **dataPtr2, ring_buffer_size_t *sizePtr2)
 {
     ring_buffer_size_t index;
-    ring_buffer_size_t available = GetWriteAvailable();
+    ring_buffer_pos_t writePosition = writePosition_.load(std::memory_order_relaxed);
+    ring_buffer_size_t available = bufferSize_ - (ring_buffer_size_t)(writePosition - cachedReadPosition_);
     if (elementCount > available)
-        elementCount = available;
-    /* Check to see if write is not contiguous. */
-    index = writeIndex_ & smallMask_;
-    if ((index + elementCount) > bufferSize_)
+    {
+        /* Only look at the reader's cache line when the cached position says we
+           are short of room. Acquire pairs with the release in AdvanceReadPosition
+           so the reader is done with the elements before we overwrite them. */
+        cachedReadPosition_ = readPosition_.load(std::memory_order_acquire);
+        available = bufferSize_ - (ring_buffer_size_t)(writePosition - cachedReadPosition_);
+        if (elementCount > available && overflowPolicy_ == kRingBufferOverwriteOldest)
+        {
+            if (elementCount > bufferSize_)
+                elementCount = bufferSize_;
+            available = DiscardOldest(writePosition, elementCount);
+        }
+        if (elementCount > available)
+            elementCount = available;
+    }
+    /* Check to see if write is not contiguous. A mirrored buffer continues
+       past its end, so it never needs a second region. */
+    index = (ring_buffer_size_t)(writePosition & smallMask_);
+    if (!mirrored_ && (index + elementCount) > bufferSize_)
     {
         /* Write data in two blocks that wrap the buffer. */
         ring_buffer_size_t firstHalf = bufferSize_ - index;
@@ -187,21 +256,22 @@ ring_buffer_size_t RingBuffer::GetWriteRegions(ring_buffer_size_t elementCount,
         *sizePtr2 = 0;
     }
 
-    if (available)
-        FullMemoryBarrier(); /* (write-after-read) => full barrier */
-
     return elementCount;
 }
 
 /***************************************************************************
  */
-ring_buffer_size_t RingBuffer::AdvanceWriteIndex(ring_buffer_size_t elementCount)
+ring_buffer_pos_t RingBuffer::AdvanceWritePosition(ring_buffer_size_t elementCount)
 {
-    /* ensure that previous writes are seen before we update the write index
-       (write after write)
+    /* ensure that previous writes are seen before we update the write position
+       (release pairs with the acquire in GetReadRegions)
     */
-    WriteMemoryBarrier();
-    return writeIndex_ = (writeIndex_ + elementCount) & bigMask_;
+    ring_buffer_pos_t writePosition = writePosition_.load(std::memory_order_relaxed) + elementCount;
+    writePosition_.store(writePosition, std::memory_order_release);
+
+    if (waitGate_.HasWaiters())
+        waitGate_.Notify(writePosition - readPosition_.load(std::memory_order_acquire));
+    return writePosition;
 }
 
 /***************************************************************************
@@ -215,12 +285,25 @@ ring_buffer_size_t RingBuffer::GetReadRegions(ring_buffer_size_t elementCount,
                                               void **dataPtr2, ring_buffer_size_t *sizePtr2)
 {
     ring_buffer_size_t index;
-    ring_buffer_size_t available = GetReadAvailable(); /* doesn't use memory barrier */
+    /* Under kRingBufferOverwriteOldest the writer may have moved readPosition_,
+       possibly past our cached write position, which shows up as a negative
+       count available. */
+    ring_buffer_pos_t readPosition = readPosition_.load(std::memory_order_acquire);
+    ring_buffer_pos_t available = cachedWritePosition_ - readPosition;
+    peekPosition_ = readPosition;
     if (elementCount > available)
-        elementCount = available;
+    {
+        /* Only look at the writer's cache line when the cached position says there
+           is not enough data. Acquire pairs with the release in AdvanceWritePosition
+           so the elements are visible before we read them. */
+        cachedWritePosition_ = writePosition_.load(std::memory_order_acquire);
+        available = cachedWritePosition_ - readPosition;
+        if (elementCount > available)
+            elementCount = (ring_buffer_size_t)available;
+    }
     /* Check to see if read is not contiguous. */
-    index = readIndex_ & smallMask_;
-    if ((index + elementCount) > bufferSize_)
+    index = (ring_buffer_size_t)(readPosition & smallMask_);
+    if (!mirrored_ && (index + elementCount) > bufferSize_)
     {
         /* Write data in two blocks that wrap the buffer. */
         ring_buffer_size_t firstHalf = bufferSize_ - index;
@@ -237,20 +320,18 @@ ring_buffer_size_t RingBuffer::GetReadRegions(ring_buffer_size_t elementCount,
         *sizePtr2 = 0;
     }
 
-    if (available)
-        ReadMemoryBarrier(); /* (read-after-read) => read barrier */
-
     return elementCount;
 }
 /***************************************************************************
  */
-ring_buffer_size_t RingBuffer::AdvanceReadIndex(ring_buffer_size_t elementCount)
+ring_buffer_pos_t RingBuffer::AdvanceReadPosition(ring_buffer_size_t elementCount)
 {
-    /* ensure that previous reads (copies out of the ring buffer) are always completed before updating (writing) the read index.
-       (write-after-read) => full barrier
+    /* ensure that previous reads (copies out of the ring buffer) are always completed before updating (writing) the read position.
+       (release pairs with the acquire in GetWriteRegions)
     */
-    FullMemoryBarrier();
-    return readIndex_ = (readIndex_ + elementCount) & bigMask_;
+    ring_buffer_pos_t readPosition = readPosition_.load(std::memory_order_relaxed) + elementCount;
+    readPosition_.store(readPosition, std::memory_order_release);
+    return readPosition;
 }
 
 /***************************************************************************
@@ -271,7 +352,7 @@ ring_buffer_size_t RingBuffer::Write(const void *data, ring_buffer_size_t elemen
     {
         memcpy(data1, data, size1 * elementSizeBytes_);
     }
-    AdvanceWriteIndex(numWritten);
+    AdvanceWritePosition(numWritten);
     return numWritten;
 }
 
@@ -281,17 +362,87 @@ ring_buffer_size_t RingBuffer::Read(void *data, ring_buffer_size_t elementCount)
 {
     ring_buffer_size_t size1, size2, numRead;
     void *data1, *data2;
-    numRead = GetReadRegions(elementCount, &data1, &size1, &data2, &size2);
-    if (size2 > 0)
+    do
     {
-        memcpy(data, data1, size1 * elementSizeBytes_);
-        data = ((char *)data) + size1 * elementSizeBytes_;
-        memcpy(data, data2, size2 * elementSizeBytes_);
-    }
-    else
+        numRead = GetReadRegions(elementCount, &data1, &size1, &data2, &size2);
+        if (size2 > 0)
+        {
+            memcpy(data, data1, size1 * elementSizeBytes_);
+            memcpy(((char *)data) + size1 * elementSizeBytes_, data2, size2 * elementSizeBytes_);
+        }
+        else
+        {
+            memcpy(data, data1, size1 * elementSizeBytes_);
+        }
+    } while (!Consume(numRead)); /* only loops under kRingBufferOverwriteOldest */
+    return numRead;
+}
+
+/***************************************************************************
+** Return elements reserved. */
+ring_buffer_size_t RingBuffer::Reserve(ring_buffer_size_t elementCount, RingBufferRegions *regions)
+{
+    return GetWriteRegions(elementCount, &regions->data1, &regions->size1,
+                           &regions->data2, &regions->size2);
+}
+
+/***************************************************************************
+ */
+void RingBuffer::Commit(ring_buffer_size_t elementCount)
+{
+    AdvanceWritePosition(elementCount);
+}
+
+/***************************************************************************
+** Return elements available for reading in place. */
+ring_buffer_size_t RingBuffer::Peek(ring_buffer_size_t elementCount, RingBufferRegions *regions)
+{
+    return GetReadRegions(elementCount, &regions->data1, &regions->size1,
+                          &regions->data2, &regions->size2);
+}
+
+/***************************************************************************
+ */
+bool RingBuffer::Consume(ring_buffer_size_t elementCount)
+{
+    if (overflowPolicy_ == kRingBufferDropNewest)
     {
-        memcpy(data, data1, size1 * elementSizeBytes_);
+        AdvanceReadPosition(elementCount);
+        return true;
     }
-    AdvanceReadIndex(numRead);
-    return numRead;
+
+    /* The writer may have moved the read position since GetReadRegions; only
+       advance it if it is still where we read from. release: our copies out
+       of the ring are done before the writer can reuse these elements. */
+    ring_buffer_pos_t expected = peekPosition_;
+    return readPosition_.compare_exchange_strong(expected, peekPosition_ + elementCount,
+                                              std::memory_order_release, std::memory_order_relaxed);
+}
+
+/***************************************************************************
+ */
+ring_buffer_size_t RingBuffer::GetElementSize() const
+{
+    return elementSizeBytes_;
+}
+
+/***************************************************************************
+ */
+ring_buffer_size_t RingBuffer::GetBufferSize() const
+{
+    return bufferSize_;
+}
+
+/***************************************************************************
+ */
+bool RingBuffer::IsMirrored() const
+{
+    return mirrored_;
+}
+
+/***************************************************************************
+ */
+bool RingBuffer::IsLocked() const
+{
+    return storage_.locked;
 }
@@ -18,10 +18,24 @@
  the client prior to calling InitializeRingBuffer() and must outlive
  the use of the ring buffer.
 
+ The read and write positions are std::atomic and published with release/acquire
+ ordering. Each side keeps a cached copy of the other side's position and only
+ reloads it when the cached value says the ring is full (writer) or empty
+ (reader), so in steady state neither side touches the other's cache line.
+
+ Positions are absolute 64-bit element counts since the ring was created. They
+ never wrap in practice, so they double as stable stream offsets: the reader
+ can seek to a position and compare positions across its calls.
+
  @note The ring buffer functions are not normally exposed in the PortAudio libraries.
  If you want to call them then you will need to add pa_ringbuffer.c to your application source code.
 */
 
+#include <atomic>
+#include <stdint.h>
+#include "ring_storage.h"
+#include "ring_wait.h"
+
 #if defined(__APPLE__)
 #include <sys/types.h>
 typedef int32_t ring_buffer_size_t;
@@ -35,31 +49,125 @@ typedef long ring_buffer_size_t;
 typedef long ring_buffer_size_t;
 #endif
 
+/** Absolute position in a stream of elements. Never wraps in practice. */
+typedef int64_t ring_buffer_pos_t;
+
+/** Assumed size of a CPU cache line, used to keep the reader and writer
+ indices from sharing one.
+*/
+#define RING_BUFFER_CACHE_LINE_SIZE 64
+
+/** How RingBuffer allocates the memory holding its elements. */
+enum RingBufferStorage
+{
+    kRingBufferHeap,    /**< One heap block. Spans that cross the end come back as two regions. */
+    kRingBufferMirrored /**< The same pages mapped twice back to back. Every span is one region. */
+};
+
+/** What RingBuffer's writer does when there is not enough room. */
+enum RingBufferOverflowPolicy
+{
+    kRingBufferDropNewest,     /**< Write only what fits; the rest of the new data is dropped. */
+    kRingBufferOverwriteOldest /**< Move the read position forward and overwrite the oldest unread data. */
+};
+
+/** Up to two regions of the ring buffer returned by RingBuffer::Reserve() and
+ RingBuffer::Peek(). Sizes are in elements. If the region is contiguous,
+ data2 is NULL and size2 is zero.
+*/
+struct RingBufferRegions
+{
+    void *data1;
+    ring_buffer_size_t size1;
+    void *data2;
+    ring_buffer_size_t size2;
+};
+
 class RingBuffer
 {
-    ring_buffer_size_t bufferSize_;          /**< Number of elements in FIFO. Power of 2. Set by PaUtil_InitRingBuffer. */
-    volatile ring_buffer_size_t writeIndex_; /**< Index of next writable element. Set by AdvanceRingBufferWriteIndex. */
-    volatile ring_buffer_size_t readIndex_;  /**< Index of next readable element. Set by PaUtil_AdvanceRingBufferReadIndex. */
-    ring_buffer_size_t bigMask_;             /**< Used for wrapping indices with extra bit to distinguish full/empty. */
-    ring_buffer_size_t smallMask_;           /**< Used for fitting indices to buffer. */
+    /* Set by Initialize() and read-only afterwards. */
+    ring_buffer_size_t bufferSize_;          /**< Number of elements in FIFO. Power of 2. Set by Initialize. */
+    ring_buffer_size_t smallMask_;           /**< Used for fitting positions to buffer. */
     ring_buffer_size_t elementSizeBytes_;    /**< Number of bytes per element. */
     char *buffer_;                           /**< Pointer to the buffer containing the actual data. */
+    bool mirrored_;                          /**< True if buffer_ is followed by a mirror of itself. */
+    ring_storage::Block storage_;            /**< How buffer_ was allocated. */
+    RingBufferOverflowPolicy overflowPolicy_; /**< What the writer does when the ring is full. */
+    char pad0_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Writer side. Only the writer touches this cache line, except for the
+       reader loading writePosition_ when its cached copy says the ring is empty. */
+    std::atomic<ring_buffer_pos_t> writePosition_; /**< Position of next writable element. Set by AdvanceWritePosition. */
+    ring_buffer_pos_t cachedReadPosition_;         /**< Writer's last seen readPosition_. */
+    std::atomic<ring_buffer_pos_t> overwrittenCount_; /**< Unread elements discarded by kRingBufferOverwriteOldest. */
+    char pad1_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Reader side. Only the reader touches this cache line, except for the
+       writer loading readPosition_ when its cached copy says the ring is full,
+       and moving it forward under kRingBufferOverwriteOldest. */
+    std::atomic<ring_buffer_pos_t> readPosition_;  /**< Position of next readable element. Set by AdvanceReadPosition. */
+    ring_buffer_pos_t cachedWritePosition_;        /**< Reader's last seen writePosition_. */
+    ring_buffer_pos_t peekPosition_;               /**< readPosition_ as seen by the last GetReadRegions. */
+    char pad2_[RING_BUFFER_CACHE_LINE_SIZE];
+
+    /* Blocking reads. The writer only loads from here unless the reader is waiting. */
+    RingWaitGate waitGate_;                      /**< Progress is the number of readable elements. */
+    char pad3_[RING_BUFFER_CACHE_LINE_SIZE];
 
 public:
     RingBuffer();
     ~RingBuffer();
     
     /** Initialize Ring Buffer to empty state ready to have elements written to it.
+     With kRingBufferMirrored, elementCount is doubled until the storage is a whole
+     number of mapping granules (see ring_storage::GetMirrorGranularity()); use
+     GetBufferSize() to learn the final count.
      @param elementSizeBytes The size of a single data element in bytes.
      @param elementCount The number of elements in the buffer (must be a power of 2).
-     @return -1 if elementCount is not a power of 2, otherwise 0.
+     @param storage How the element memory is allocated.
+     @param options Alignment, prefaulting, locking and NUMA placement of the element memory.
+     @return -1 if elementCount is not a power of 2 or the storage could not be allocated, otherwise 0.
     */
-    int Initialize(ring_buffer_size_t elementSizeBytes, ring_buffer_size_t elementCount);
+    int Initialize(ring_buffer_size_t elementSizeBytes, ring_buffer_size_t elementCount,
+                   RingBufferStorage storage = kRingBufferHeap,
+                   const ring_storage::Options &options = ring_storage::Options());
 
     /** Reset buffer to empty. Should only be called when buffer is NOT being read or written.
+     The positions are kept: the read position moves up to the write position.
     */
     void Flush();
 
+    /** Retrieve the absolute position of the next element the writer will write,
+     which is the number of elements written since the ring was created.
+    */
+    ring_buffer_pos_t GetWritePosition() const;
+
+    /** Retrieve the absolute position of the next element the reader will read.
+    */
+    ring_buffer_pos_t GetReadPosition() const;
+
+    /** Move the read position forward to position, dropping the elements before it.
+     Only the reader may call this. Positions behind the read position are gone
+     already and leave it unchanged; positions past the write position stop there.
+     @param position The absolute position to read from next.
+     @return The number of elements skipped.
+    */
+    ring_buffer_size_t SeekRead(ring_buffer_pos_t position);
+
+    /** Choose what the writer does when the ring is full. Should only be called
+     when buffer is NOT being read or written. The default is kRingBufferDropNewest.
+     With kRingBufferOverwriteOldest the writer may move the read position forward
+     while the reader is reading; Consume() then returns false and
+     GetOverwrittenCount() tells how many elements were skipped.
+    */
+    void SetOverflowPolicy(RingBufferOverflowPolicy policy);
+
+    /** Retrieve the total number of unread elements discarded by the writer under
+     kRingBufferOverwriteOldest. The reader can diff successive values to learn
+     exactly how many elements it skipped.
+    */
+    ring_buffer_pos_t GetOverwrittenCount() const;
+
     /** Retrieve the number of elements available in the ring buffer for writing.
      @return The number of elements available for writing.
     */
@@ -70,6 +178,16 @@ public:
     */
     ring_buffer_size_t GetReadAvailable();
 
+    /** Wait until at least elementCount elements are available for reading.
+     Spins briefly, then sleeps until the writer crosses the threshold; the
+     writer only makes a wake-up call when that happens.
+     @param elementCount The number of elements needed, limited to the buffer size.
+     @param timeoutMs The longest time to wait, 0 to only spin, or RING_WAIT_INFINITE.
+     @return The number of elements available for reading, less than
+             elementCount if the wait timed out.
+    */
+    ring_buffer_size_t WaitReadable(ring_buffer_size_t elementCount, int timeoutMs);
+
     /** Write data to the ring buffer.
      @param data The address of new data to write to the buffer.
      @param elementCount The number of elements to be written.
@@ -77,14 +195,70 @@ public:
     */
     ring_buffer_size_t Write(const void *data, ring_buffer_size_t elementCount);
 
-    /** Read data from the ring buffer.
+    /** Read data from the ring buffer. Under kRingBufferOverwriteOldest the copy
+     is retried if the writer overwrites it meanwhile.
      @param data The address where the data should be stored.
      @param elementCount The number of elements to be read.
      @return The number of elements read.
     */
     ring_buffer_size_t Read(void *data, ring_buffer_size_t elementCount);
 
+    /** Reserve space so the writer can fill the ring buffer in place.
+     Must be followed by Commit() with the number of elements actually filled.
+     @param elementCount The number of elements desired.
+     @param regions Receives the writable region(s).
+     @return The number of elements reserved, which may be less than elementCount.
+    */
+    ring_buffer_size_t Reserve(ring_buffer_size_t elementCount, RingBufferRegions *regions);
+
+    /** Publish elements previously filled through Reserve() to the reader.
+     @param elementCount The number of elements to publish, not more than reserved.
+    */
+    void Commit(ring_buffer_size_t elementCount);
+
+    /** Get the readable region(s) without copying them out of the ring buffer.
+     The regions stay valid until Consume() is called.
+     @param elementCount The number of elements desired.
+     @param regions Receives the readable region(s).
+     @return The number of elements available, which may be less than elementCount.
+    */
+    ring_buffer_size_t Peek(ring_buffer_size_t elementCount, RingBufferRegions *regions);
+
+    /** Release elements previously obtained through Peek() back to the writer.
+     @param elementCount The number of elements to release, not more than peeked.
+     @return false if, under kRingBufferOverwriteOldest, the writer moved the read
+             position past the peeked elements and may have overwritten them. The
+             read position is then left where the writer put it.
+    */
+    bool Consume(ring_buffer_size_t elementCount);
+
+    /** Retrieve the size of a single element in bytes.
+    */
+    ring_buffer_size_t GetElementSize() const;
+
+    /** Retrieve the number of elements the ring buffer holds.
+    */
+    ring_buffer_size_t GetBufferSize() const;
+
+    /** Return true if the storage is mirrored, in which case Reserve() and Peek()
+     always return a single region.
+    */
+    bool IsMirrored() const;
+
+    /** Return true if the element memory was locked as requested through
+     ring_storage::Options::lock.
+    */
+    bool IsLocked() const;
+
 private:
+    /** Release the element storage, if any. */
+    void FreeBuffer();
+
+    /** Move the read position forward until elementCount elements fit.
+     @return The room available to be written.
+    */
+    ring_buffer_size_t DiscardOldest(ring_buffer_pos_t writePosition, ring_buffer_size_t elementCount);
+
     /** Get address of region(s) to which we can write data.
      @param elementCount The number of elements desired.
      @param dataPtr1 The address where the first (or only) region pointer will be stored.
@@ -99,11 +273,11 @@ private:
                                        void **dataPtr1, ring_buffer_size_t *sizePtr1,
                                        void **dataPtr2, ring_buffer_size_t *sizePtr2);
 
-    /** Advance the write index to the next location to be written.
+    /** Advance the write position to the next location to be written.
      @param elementCount The number of elements to advance.
      @return The new position.
     */
-    ring_buffer_size_t AdvanceWriteIndex(ring_buffer_size_t elementCount);
+    ring_buffer_pos_t AdvanceWritePosition(ring_buffer_size_t elementCount);
 
     /** Get address of region(s) from which we can read data.
      @param elementCount The number of elements desired.
@@ -119,11 +293,11 @@ private:
                                       void **dataPtr1, ring_buffer_size_t *sizePtr1,
                                       void **dataPtr2, ring_buffer_size_t *sizePtr2);
 
-    /** Advance the read index to the next location to be read.
+    /** Advance the read position to the next location to be read.
      @param elementCount The number of elements to advance.
      @return The new position.
     */
-    ring_buffer_size_t AdvanceReadIndex(ring_buffer_size_t elementCount);
+    ring_buffer_pos_t AdvanceReadPosition(ring_buffer_size_t elementCount);
 };
 
 #endif /* RING_BUFFER_H */
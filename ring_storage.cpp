@@ -0,0 +1,422 @@
+#include "ring_storage.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace ring_storage {
+
+#if defined(_WIN32)
+
+/* Placeholder flags from newer SDKs, spelled out so older ones still build. */
+#ifndef MEM_RESERVE_PLACEHOLDER
+#define MEM_RESERVE_PLACEHOLDER 0x00040000
+#endif
+#ifndef MEM_REPLACE_PLACEHOLDER
+#define MEM_REPLACE_PLACEHOLDER 0x00004000
+#endif
+#ifndef MEM_PRESERVE_PLACEHOLDER
+#define MEM_PRESERVE_PLACEHOLDER 0x00000002
+#endif
+
+/* VirtualAlloc2 and MapViewOfFile3 only exist from Windows 10 1803 on, so they
+   are looked up at runtime instead of linking onecore.lib. */
+typedef PVOID(WINAPI *VirtualAlloc2Proc)(HANDLE, PVOID, SIZE_T, ULONG, ULONG, void *, ULONG);
+typedef PVOID(WINAPI *MapViewOfFile3Proc)(HANDLE, HANDLE, PVOID, ULONG64, SIZE_T, ULONG, ULONG, void *, ULONG);
+
+size_t GetMirrorGranularity()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+}
+
+void *AllocateMirrored(size_t bytes, int numaNode)
+{
+    HMODULE kernelbase = GetModuleHandleW(L"kernelbase.dll");
+    if (!kernelbase)
+        return NULL;
+    VirtualAlloc2Proc virtualAlloc2 = (VirtualAlloc2Proc)GetProcAddress(kernelbase, "VirtualAlloc2");
+    MapViewOfFile3Proc mapViewOfFile3 = (MapViewOfFile3Proc)GetProcAddress(kernelbase, "MapViewOfFile3");
+    if (!virtualAlloc2 || !mapViewOfFile3)
+        return NULL;
+
+    /* Both views share the section's pages, so placing the section places
+       the whole block. */
+    unsigned long long size = bytes;
+    DWORD node = numaNode >= 0 ? (DWORD)numaNode : NUMA_NO_PREFERRED_NODE;
+    HANDLE section = CreateFileMappingNumaW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                            (DWORD)(size >> 32), (DWORD)size, NULL, node);
+    if (!section)
+        return NULL;
+
+    /* Reserve both halves as one placeholder, split it, then replace each
+       half with a view of the same section. */
+    char *placeholder = (char *)virtualAlloc2(NULL, NULL, 2 * bytes,
+                                              MEM_RESERVE | MEM_RESERVE_PLACEHOLDER, PAGE_NOACCESS, NULL, 0);
+    if (!placeholder)
+    {
+        CloseHandle(section);
+        return NULL;
+    }
+    VirtualFree(placeholder, bytes, MEM_RELEASE | MEM_PRESERVE_PLACEHOLDER);
+
+    void *view1 = mapViewOfFile3(section, NULL, placeholder, 0, bytes,
+                                 MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, NULL, 0);
+    void *view2 = mapViewOfFile3(section, NULL, placeholder + bytes, 0, bytes,
+                                 MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, NULL, 0);
+
+    /* The views keep the section alive. */
+    CloseHandle(section);
+
+    if (!view1 || !view2)
+    {
+        if (view1)
+            UnmapViewOfFile(view1);
+        else
+            VirtualFree(placeholder, 0, MEM_RELEASE);
+        if (view2)
+            UnmapViewOfFile(view2);
+        else
+            VirtualFree(placeholder + bytes, 0, MEM_RELEASE);
+        return NULL;
+    }
+    return placeholder;
+}
+
+void FreeMirrored(void *data, size_t bytes)
+{
+    UnmapViewOfFile(data);
+    UnmapViewOfFile((char *)data + bytes);
+}
+
+static size_t GetPageSize()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+}
+
+static void *AllocateAligned(size_t bytes, size_t alignment)
+{
+    return _aligned_malloc(bytes, alignment);
+}
+
+static void FreeAligned(void *data)
+{
+    _aligned_free(data);
+}
+
+/* Large pages need SeLockMemoryPrivilege and are never paged out. Falls back
+   to normal pages, on numaNode if one is given. */
+static void *MapPages(size_t bytes, const Options &options, size_t *mappedBytes, bool *hugePages)
+{
+    DWORD node = options.numaNode >= 0 ? (DWORD)options.numaNode : NUMA_NO_PREFERRED_NODE;
+    void *data = NULL;
+    *hugePages = false;
+    if (options.hugePages)
+    {
+        size_t largePage = GetLargePageMinimum();
+        if (largePage > 0)
+        {
+            *mappedBytes = (bytes + largePage - 1) / largePage * largePage;
+            data = VirtualAllocExNuma(GetCurrentProcess(), NULL, *mappedBytes,
+                                      MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+            *hugePages = data != NULL;
+        }
+    }
+    if (!data)
+    {
+        *mappedBytes = bytes;
+        data = VirtualAllocExNuma(GetCurrentProcess(), NULL, bytes,
+                                  MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+    }
+    return data;
+}
+
+static void UnmapPages(void *data, size_t /* mappedBytes */)
+{
+    VirtualFree(data, 0, MEM_RELEASE);
+}
+
+static bool LockPages(void *data, size_t bytes)
+{
+    if (VirtualLock(data, bytes))
+        return true;
+
+    /* VirtualLock is limited by the minimum working set; grow it and retry. */
+    SIZE_T minimum, maximum;
+    if (!GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum))
+        return false;
+    if (!SetProcessWorkingSetSize(GetCurrentProcess(), minimum + bytes, maximum + bytes))
+        return false;
+    return VirtualLock(data, bytes) != FALSE;
+}
+
+static void UnlockPages(void *data, size_t bytes)
+{
+    VirtualUnlock(data, bytes);
+}
+
+#else
+
+/* Returns an unlinked shared memory file descriptor of the given size. */
+static int CreateSharedMemory(size_t bytes)
+{
+    int fd = -1;
+#if defined(__linux__) && defined(SYS_memfd_create)
+    fd = (int)syscall(SYS_memfd_create, "ring_buffer", 0);
+#endif
+    if (fd < 0)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "/ring_buffer_%d_%p", (int)getpid(), (void *)&fd);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0)
+            return -1;
+        shm_unlink(name);
+    }
+    if (ftruncate(fd, (off_t)bytes) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+size_t GetMirrorGranularity()
+{
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/* Binds the pages of [data, data + bytes) to numaNode before they are first
+   touched. Uses the raw system call so libnuma is not needed. */
+static void BindToNode(void *data, size_t bytes, int numaNode)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    const int kPreferred = 1; /* MPOL_PREFERRED */
+    if (numaNode < 0 || numaNode >= (int)(sizeof(unsigned long) * 8))
+        return;
+    unsigned long nodeMask = 1UL << numaNode;
+    syscall(SYS_mbind, data, bytes, kPreferred, &nodeMask, sizeof(nodeMask) * 8, 0);
+#endif
+}
+
+void *AllocateMirrored(size_t bytes, int numaNode)
+{
+    int fd = CreateSharedMemory(bytes);
+    if (fd < 0)
+        return NULL;
+
+    /* Reserve address space for both copies, then map the file over each half. */
+    char *base = (char *)mmap(NULL, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+    void *view1 = mmap(base, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    void *view2 = mmap(base + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+
+    /* The mappings keep the file alive. */
+    close(fd);
+
+    if (view1 == MAP_FAILED || view2 == MAP_FAILED)
+    {
+        munmap(base, 2 * bytes);
+        return NULL;
+    }
+    BindToNode(base, 2 * bytes, numaNode);
+    return base;
+}
+
+void FreeMirrored(void *data, size_t bytes)
+{
+    munmap(data, 2 * bytes);
+}
+
+static size_t GetPageSize()
+{
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void *AllocateAligned(size_t bytes, size_t alignment)
+{
+    void *data = NULL;
+    if (alignment < sizeof(void *))
+        alignment = sizeof(void *);
+    if (posix_memalign(&data, alignment, bytes) != 0)
+        return NULL;
+    return data;
+}
+
+static void FreeAligned(void *data)
+{
+    free(data);
+}
+
+/* Transparent huge pages need a 2 MB aligned range. Alignments above the
+   page size are met by mapping one extra alignment unit and trimming the ends. */
+static void *MapPages(size_t bytes, const Options &options, size_t *mappedBytes, bool *hugePages)
+{
+    const size_t kHugePageSize = 2 * 1024 * 1024;
+    size_t pageSize = GetPageSize();
+    size_t alignment = options.alignment > pageSize ? options.alignment : pageSize;
+    if (options.hugePages && alignment < kHugePageSize)
+        alignment = kHugePageSize;
+    *hugePages = false;
+
+    *mappedBytes = (bytes + alignment - 1) / alignment * alignment;
+    size_t reserved = *mappedBytes + (alignment > pageSize ? alignment : 0);
+    char *base = (char *)mmap(NULL, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+    char *data = (char *)(((uintptr_t)base + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    if (data > base)
+        munmap(base, data - base);
+    if (base + reserved > data + *mappedBytes)
+        munmap(data + *mappedBytes, base + reserved - (data + *mappedBytes));
+
+#if defined(MADV_HUGEPAGE)
+    if (options.hugePages)
+        *hugePages = madvise(data, *mappedBytes, MADV_HUGEPAGE) == 0;
+#endif
+    BindToNode(data, *mappedBytes, options.numaNode);
+    return data;
+}
+
+static void UnmapPages(void *data, size_t mappedBytes)
+{
+    munmap(data, mappedBytes);
+}
+
+static bool LockPages(void *data, size_t bytes)
+{
+    return mlock(data, bytes) == 0;
+}
+
+static void UnlockPages(void *data, size_t bytes)
+{
+    munlock(data, bytes);
+}
+
+#endif
+
+/***************************************************************************
+ * Allocation with options.
+ */
+Options::Options()
+{
+    alignment = 64; /* one cache line */
+    hugePages = false;
+    prefault = false;
+    lock = false;
+    numaNode = -1;
+}
+
+Block::Block()
+{
+    data = NULL;
+    bytes = 0;
+    mappedBytes = 0;
+    kind = kNoBlock;
+    hugePages = false;
+    locked = false;
+}
+
+/* Writes one byte per page so every page is backed before the real-time
+   thread gets to it. */
+static void TouchPages(void *data, size_t bytes)
+{
+    size_t pageSize = GetPageSize();
+    volatile char *pages = (volatile char *)data;
+    for (size_t offset = 0; offset < bytes; offset += pageSize)
+        pages[offset] = 0;
+}
+
+/* Reads one byte per page, which maps pages already backed by another view. */
+static void ReadPages(const void *data, size_t bytes)
+{
+    size_t pageSize = GetPageSize();
+    const volatile char *pages = (const volatile char *)data;
+    for (size_t offset = 0; offset < bytes; offset += pageSize)
+        (void)pages[offset];
+}
+
+bool Allocate(size_t bytes, bool mirrored, const Options &options, Block *block)
+{
+    Block result;
+    result.bytes = bytes;
+
+    if (mirrored)
+    {
+        result.data = AllocateMirrored(bytes, options.numaNode);
+        result.kind = kMirroredBlock;
+    }
+    else if (options.hugePages || options.numaNode >= 0 || options.alignment > GetPageSize())
+    {
+        result.data = MapPages(bytes, options, &result.mappedBytes, &result.hugePages);
+        result.kind = kMappedBlock;
+    }
+    else
+    {
+        result.data = AllocateAligned(bytes, options.alignment > 0 ? options.alignment : sizeof(void *));
+        result.kind = kHeapBlock;
+    }
+    if (!result.data)
+        return false;
+
+    /* The second view of a mirrored block shares the first one's pages, but
+       still needs its own page table entries. */
+    size_t viewBytes = mirrored ? 2 * bytes : bytes;
+    if (options.prefault)
+    {
+        TouchPages(result.data, bytes);
+        if (mirrored)
+            ReadPages((char *)result.data + bytes, bytes);
+    }
+    if (options.lock)
+        result.locked = LockPages(result.data, viewBytes);
+
+    *block = result;
+    return true;
+}
+
+void Free(Block *block)
+{
+    if (block->data)
+    {
+        size_t viewBytes = block->kind == kMirroredBlock ? 2 * block->bytes : block->bytes;
+        if (block->locked)
+            UnlockPages(block->data, viewBytes);
+        switch (block->kind)
+        {
+        case kHeapBlock:
+            FreeAligned(block->data);
+            break;
+        case kMappedBlock:
+            UnmapPages(block->data, block->mappedBytes);
+            break;
+        case kMirroredBlock:
+            FreeMirrored(block->data, block->bytes);
+            break;
+        default:
+            break;
+        }
+    }
+    *block = Block();
+}
+
+}
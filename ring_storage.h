@@ -0,0 +1,93 @@
+#ifndef RING_STORAGE_H
+#define RING_STORAGE_H
+
+#include <stddef.h>
+
+/** @file
+ @brief Platform memory helpers for RingBuffer storage.
+
+ A mirrored block maps the same physical pages twice, back to back, so that
+ data[i] and data[i + bytes] alias each other. A ring buffer placed in such a
+ block can hand out any span of up to bytes as one contiguous pointer, even
+ when it wraps past the end.
+
+ Allocate() adds options aimed at real-time writers: alignment, huge pages,
+ touching every page up front so the first laps do not take page faults,
+ locking the pages so they are not paged out, and NUMA node placement.
+*/
+
+namespace ring_storage {
+
+/** How Allocate() obtains and prepares a block. */
+struct Options
+{
+    size_t alignment; /**< Alignment of the block in bytes, a power of 2. Defaults to one cache line.
+                           Above the page size the block is mapped from the OS; Windows
+                           aligns those to its allocation granularity (64 KB) at most. */
+    bool hugePages;   /**< Back the block with huge/large pages if the system allows it. Not for mirrored blocks. */
+    bool prefault;    /**< Touch every page at allocation, so no page faults happen later. */
+    bool lock;        /**< Lock the pages in memory (mlock/VirtualLock). Best effort, see Block::locked. */
+    int numaNode;     /**< NUMA node to place the pages on, or -1 for the default policy. */
+
+    Options();
+};
+
+/** Kinds of block, telling Free() how to release it. */
+enum BlockKind
+{
+    kNoBlock,
+    kHeapBlock,    /**< Aligned heap allocation. */
+    kMappedBlock,  /**< Pages mapped directly from the OS (huge pages, NUMA placement). */
+    kMirroredBlock /**< AllocateMirrored(). */
+};
+
+/** A block returned by Allocate(). */
+struct Block
+{
+    void *data;         /**< Start of the block. */
+    size_t bytes;       /**< Usable size. A mirrored block is followed by a second copy of this size. */
+    size_t mappedBytes; /**< Size actually mapped for kMappedBlock, after rounding to the page size. */
+    BlockKind kind;
+    bool hugePages;     /**< True if huge pages were requested and obtained. */
+    bool locked;        /**< True if locking was requested and succeeded. */
+
+    Block();
+};
+
+/** Allocate storage for a ring buffer.
+ Only failing to get the memory fails the call; huge pages, locking and NUMA
+ placement fall back silently when the system refuses them, so check the
+ Block to see what was obtained.
+ @param bytes The size of the block; for a mirrored block, a multiple of GetMirrorGranularity().
+ @param mirrored Map the block twice back to back, see AllocateMirrored().
+ @param options How to allocate and prepare the block.
+ @param block Receives the block.
+ @return false if the memory could not be allocated.
+*/
+bool Allocate(size_t bytes, bool mirrored, const Options &options, Block *block);
+
+/** Release a block returned by Allocate() and reset it to empty.
+*/
+void Free(Block *block);
+
+/** Retrieve the size that a mirrored block must be a multiple of
+ (the page size on POSIX, the allocation granularity on Windows).
+*/
+size_t GetMirrorGranularity();
+
+/** Map bytes of memory twice back to back.
+ @param bytes The size of one copy; must be a multiple of GetMirrorGranularity().
+ @param numaNode NUMA node to place the pages on, or -1 for the default policy.
+ @return The start of the first copy, or NULL if the platform cannot do it.
+*/
+void *AllocateMirrored(size_t bytes, int numaNode = -1);
+
+/** Release a block returned by AllocateMirrored().
+ @param data The pointer returned by AllocateMirrored().
+ @param bytes The size passed to AllocateMirrored().
+*/
+void FreeMirrored(void *data, size_t bytes);
+
+}
+
+#endif /* RING_STORAGE_H */
@@ -0,0 +1,143 @@
+#include "ring_wait.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#if defined(_MSC_VER)
+/* WaitOnAddress and WakeByAddressAll (Windows 8 and later). */
+#pragma comment(lib, "Synchronization.lib")
+#endif
+#else
+#include <errno.h>
+#include <time.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include <limits>
+
+namespace ring_wait {
+
+void Pause()
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+    _mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* Sleep while *address == expected, for at most timeoutMs (negative: no limit). */
+static void WaitOnValue(std::atomic<uint32_t> *address, uint32_t expected, int timeoutMs)
+{
+#if defined(_WIN32)
+    WaitOnAddress(address, &expected, sizeof(expected), timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs);
+#elif defined(__linux__)
+    struct timespec timeout;
+    struct timespec *timeoutPtr = NULL;
+    if (timeoutMs >= 0)
+    {
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        timeoutPtr = &timeout;
+    }
+    syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, timeoutPtr, NULL, 0);
+#else
+    /* No wait-on-address primitive; nap briefly and let the caller re-check. */
+    (void)address;
+    (void)expected;
+    struct timespec nap = {0, 1000000L};
+    if (timeoutMs >= 0 && timeoutMs < 1)
+        nap.tv_nsec = 100000L;
+    nanosleep(&nap, NULL);
+#endif
+}
+
+static void WakeAll(std::atomic<uint32_t> *address)
+{
+#if defined(_WIN32)
+    WakeByAddressAll(address);
+#elif defined(__linux__)
+    syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, std::numeric_limits<int>::max(), NULL, NULL, 0);
+#else
+    (void)address;
+#endif
+}
+
+}
+
+/***************************************************************************
+ */
+RingWaitGate::RingWaitGate()
+{
+    sequence_.store(0, std::memory_order_relaxed);
+    waiterCount_.store(0, std::memory_order_relaxed);
+    threshold_.store(std::numeric_limits<int64_t>::max(), std::memory_order_relaxed);
+}
+
+/***************************************************************************
+** Return the wake sequence to wait on. */
+uint32_t RingWaitGate::Prepare(int64_t threshold)
+{
+    waiterCount_.fetch_add(1, std::memory_order_seq_cst);
+
+    /* Read the sequence before lowering the threshold: if Notify() resets the
+       threshold after we lowered it, it bumps the sequence afterwards, and
+       Wait() returns at once so we register again. */
+    uint32_t sequence = sequence_.load(std::memory_order_seq_cst);
+    int64_t current = threshold_.load(std::memory_order_relaxed);
+    while (threshold < current &&
+           !threshold_.compare_exchange_weak(current, threshold, std::memory_order_seq_cst,
+                                             std::memory_order_relaxed))
+    {
+    }
+
+    /* The caller's re-check must not move above the registration. */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return sequence;
+}
+
+/***************************************************************************
+ */
+void RingWaitGate::Wait(uint32_t sequence, int timeoutMs)
+{
+    ring_wait::WaitOnValue(&sequence_, sequence, timeoutMs);
+}
+
+/***************************************************************************
+ */
+void RingWaitGate::Finish()
+{
+    waiterCount_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/***************************************************************************
+ */
+bool RingWaitGate::HasWaiters() const
+{
+    /* Pairs with the seq_cst increment in Prepare(): either the writer sees
+       the waiter here, or the waiter's re-check sees the writer's data. */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return waiterCount_.load(std::memory_order_relaxed) > 0;
+}
+
+/***************************************************************************
+ */
+void RingWaitGate::Notify(int64_t progress)
+{
+    if (progress < threshold_.load(std::memory_order_seq_cst))
+        return;
+
+    /* Waiters still short of their threshold register again. */
+    threshold_.store(std::numeric_limits<int64_t>::max(), std::memory_order_seq_cst);
+    sequence_.fetch_add(1, std::memory_order_seq_cst);
+    ring_wait::WakeAll(&sequence_);
+}
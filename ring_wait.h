@@ -0,0 +1,124 @@
+#ifndef RING_WAIT_H
+#define RING_WAIT_H
+
+/** @file
+ @brief Blocking wait support for the lock-free ring buffers.
+
+ A RingWaitGate lets a reader sleep until the writer has made enough progress,
+ without the writer ever taking a lock. The reader registers the progress it
+ needs (a threshold), then parks on a 32-bit wake sequence with the OS
+ wait-on-address primitive (WaitOnAddress on Windows, futex on Linux). After
+ publishing, the writer calls Notify() with its progress; it only makes the
+ wake system call when a reader is waiting and the threshold was crossed, so
+ the fast path is one fence and one load.
+
+ What "progress" means is up to the ring: an absolute write position for
+ BroadcastRingBuffer, the number of readable elements for RingBuffer.
+ Included by ring_buffer.h, so it does not depend on it.
+*/
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+/** Pass to the WaitReadable() functions to wait without a timeout. */
+#define RING_WAIT_INFINITE (-1)
+
+class RingWaitGate
+{
+    std::atomic<uint32_t> sequence_;          /**< Bumped by the writer on every wake. Waiters park on it. */
+    std::atomic<int> waiterCount_;            /**< Number of readers between Prepare() and Finish(). */
+    std::atomic<int64_t> threshold_; /**< Smallest threshold any waiter registered. */
+
+public:
+    RingWaitGate();
+
+    /** Register as a waiter that needs progress to reach threshold.
+     Must be followed by Finish(). The caller should check its condition
+     again between Prepare() and Wait(), since the writer may have got there
+     before the registration was visible.
+     @return The wake sequence to pass to Wait().
+    */
+    uint32_t Prepare(int64_t threshold);
+
+    /** Sleep until the writer wakes the waiters or timeoutMs elapses.
+     May return early; callers loop on their own condition.
+     @param sequence The value returned by Prepare().
+     @param timeoutMs The longest time to sleep, or RING_WAIT_INFINITE.
+    */
+    void Wait(uint32_t sequence, int timeoutMs);
+
+    /** Deregister a waiter registered with Prepare(). */
+    void Finish();
+
+    /** Called by the writer after publishing. Wakes all waiters if progress
+     has reached the smallest registered threshold.
+     @param progress The writer's progress, in the units the waiters used.
+    */
+    void Notify(int64_t progress);
+
+    /** Return true if any reader is registered. Lets the writer skip
+     computing its progress when nobody is waiting.
+    */
+    bool HasWaiters() const;
+};
+
+namespace ring_wait {
+
+/** Spin iterations before a reader parks; covers data that is only
+ microseconds away without a system call. */
+const int kSpinCount = 200;
+
+/** Hint to the CPU that this is a spin-wait loop. */
+void Pause();
+
+/** Wait until poll() reports at least elementCount readable elements: spin
+ for a while, then park on gate. poll(&threshold) returns the elements
+ available and sets the writer progress that would make elementCount of
+ them available.
+ @return The last value returned by poll(), less than elementCount on timeout.
+*/
+template <class Size, class Poll>
+Size WaitReadable(RingWaitGate &gate, Size elementCount, int timeoutMs, Poll poll)
+{
+    int64_t threshold;
+    Size available = poll(&threshold);
+    for (int i = 0; available < elementCount && i < kSpinCount; i++)
+    {
+        Pause();
+        available = poll(&threshold);
+    }
+    if (available >= elementCount || timeoutMs == 0)
+        return available;
+
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true)
+    {
+        uint32_t sequence = gate.Prepare(threshold);
+        available = poll(&threshold);
+        if (available >= elementCount)
+        {
+            gate.Finish();
+            return available;
+        }
+
+        int remainingMs = RING_WAIT_INFINITE;
+        if (timeoutMs != RING_WAIT_INFINITE)
+        {
+            std::chrono::steady_clock::duration remaining = deadline - std::chrono::steady_clock::now();
+            if (remaining <= std::chrono::steady_clock::duration::zero())
+            {
+                gate.Finish();
+                return available;
+            }
+            remainingMs = (int)std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count() + 1;
+        }
+        gate.Wait(sequence, remainingMs);
+        gate.Finish();
+    }
+}
+
+}
+
+#endif /* RING_WAIT_H */
@@ -0,0 +1,107 @@
+#ifndef STREAM_PROTOCOL_H
+#define STREAM_PROTOCOL_H
+
+#include <stdint.h>
+
+// Packets of the framed streams. The plain port sends nothing but PCM; the
+// framed port sends a kPacketFormat first and then one packet per frame,
+// each starting with a PacketHeader. The lip-sync port sends the same
+// kPacketFormat and then only kPacketLipSync packets. All fields are little
+// endian.
+namespace stream_protocol {
+
+enum PacketType
+{
+    // Payload: a FormatPayload describing the PCM that follows.
+    kPacketFormat = 1,
+
+    // Payload: |frames| frames of PCM.
+    kPacketPcm = 2,
+
+    // No payload: |frames| frames without voice, to be played as silence.
+    kPacketSilence = 3,
+
+    // Payload: |frames| LipSyncFrames, one per kLipSyncFrameMs from
+    // |position| on.
+    kPacketLipSync = 4
+};
+
+const int kLipSyncFrameMs = 10;
+
+// Vowel classes of LipSyncFrame::vowel.
+enum Vowel
+{
+    kVowelNone,
+    kVowelA,
+    kVowelE,
+    kVowelI,
+    kVowelO,
+    kVowelU
+};
+
+// Mouth shapes, in the order of LipSyncFrame::visemes.
+enum Viseme
+{
+    kVisemeRest,      // closed or relaxed mouth
+    kVisemeA,
+    kVisemeE,
+    kVisemeI,
+    kVisemeO,
+    kVisemeU,
+    kVisemeFricative, // s, f, sh: teeth together, lips apart
+    kNumVisemes
+};
+
+#pragma pack(push, 1)
+
+struct PacketHeader
+{
+    uint8_t type;
+    uint8_t reserved[3];
+
+    // Frames the packet covers.
+    uint32_t frames;
+
+    // Absolute index of its first frame, counted from the start of capture,
+    // so clients can line packets up across gaps and reconnects.
+    uint64_t position;
+
+    // Bytes of payload after the header.
+    uint32_t payload_bytes;
+};
+
+struct FormatPayload
+{
+    uint32_t sample_rate;
+    uint16_t channels;
+    uint16_t bits_per_sample;
+
+    // Microseconds the server's resampler and gain control look-ahead
+    // delay the stream behind the microphone, so clients can line it up
+    // with video or other media.
+    uint32_t delay_us;
+};
+
+// What the server heard in one kLipSyncFrameMs frame.
+struct LipSyncFrame
+{
+    // Loudness from -80 dBFS (0) to 0 dBFS (255).
+    uint8_t loudness;
+
+    // Spectral centroid in units of 32 Hz.
+    uint8_t centroid;
+
+    // Vowel in the low 4 bits, kLipSyncVoice if the frame holds voice.
+    uint8_t vowel;
+
+    // Weight of each Viseme, summing to 255.
+    uint8_t visemes[kNumVisemes];
+};
+
+const uint8_t kLipSyncVoice = 0x80;
+
+#pragma pack(pop)
+
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include "synthetic_capture_source.h"
+#include "pcm_convert.h"
+#include <math.h>
+#include <string.h>
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+
+// First two formants of a few vowels, in Hz.
+const double kVowelFormants[][2] = {
+    {730, 1090}, // a
+    {530, 1840}, // e
+    {270, 2290}, // i
+    {570, 840},  // o
+    {300, 870},  // u
+};
+
+}
+
+SyntheticCaptureSource::SyntheticCaptureSource(Signal signal, double speed, unsigned int seed)
+    : GeneratedCaptureSource(speed)
+{
+    signal_ = signal;
+    seed_ = seed;
+}
+
+SyntheticCaptureSource::~SyntheticCaptureSource()
+{
+    Stop();
+}
+
+bool SyntheticCaptureSource::Prepare(const CaptureFormat &format)
+{
+    if (!pcm::IsSupportedBits(format.bits_per_sample))
+    {
+        error_ = "Unsupported bits per sample.";
+        return false;
+    }
+    sample_rate_ = format.sample_rate;
+    random_state_ = seed_ ? seed_ : 1;
+    phase_ = 0;
+    syllable_length_ = 0;
+    syllable_pos_ = 0;
+    syllables_until_pause_ = 0;
+    in_pause_ = true;
+    pitch_ = 120;
+    formant_freq_[0] = formant_freq_[1] = 1000;
+    memset(formant_state_, 0, sizeof(formant_state_));
+    row_.resize(kRowFrames * format.channels);
+    return true;
+}
+
+unsigned long SyntheticCaptureSource::Generate(void *frames, unsigned long frame_count)
+{
+    // Builds a row of float frames at a time and converts it like captured
+    // floats, so samples round the same way as everywhere else.
+    const CaptureFormat &fmt = format();
+    pcm::SampleFormat sample_format = pcm::GetSampleFormat(fmt.bits_per_sample, fmt.float_samples);
+    size_t bytes_per_row = kRowFrames * fmt.channels * pcm::GetSampleBytes(sample_format);
+    unsigned char *out = (unsigned char *)frames;
+    for (unsigned long first = 0; first < frame_count; first += kRowFrames)
+    {
+        unsigned long count = frame_count - first < kRowFrames ? frame_count - first : kRowFrames;
+        float *row = row_.data();
+        for (unsigned long i = 0; i < count; i++)
+        {
+            // Every channel gets the same signal.
+            float sample = (float)NextSample();
+            for (int c = 0; c < fmt.channels; c++)
+                *row++ = sample;
+        }
+        pcm::FromFloat(row_.data(), count * fmt.channels, sample_format, out);
+        out += bytes_per_row;
+    }
+    return frame_count;
+}
+
+double SyntheticCaptureSource::NextRandom()
+{
+    // xorshift32: cheap, and the same sequence everywhere.
+    random_state_ ^= random_state_ << 13;
+    random_state_ ^= random_state_ >> 17;
+    random_state_ ^= random_state_ << 5;
+    return random_state_ / 4294967296.0;
+}
+
+double SyntheticCaptureSource::NextSample()
+{
+    switch (signal_)
+    {
+    case kTone:
+    {
+        double sample = 0.5 * sin(phase_);
+        phase_ += 2 * kPi * 440 / sample_rate_;
+        if (phase_ > 2 * kPi)
+            phase_ -= 2 * kPi;
+        return sample;
+    }
+    case kNoise:
+        return NextRandom() - 0.5;
+    case kSpeech:
+        return NextSpeechSample();
+    }
+    return 0;
+}
+
+void SyntheticCaptureSource::StartSyllable()
+{
+    syllable_pos_ = 0;
+    if (!in_pause_ && syllables_until_pause_ == 0)
+    {
+        // 300..700 ms of silence between phrases.
+        in_pause_ = true;
+        syllable_length_ = (long long)(sample_rate_ * (0.3 + 0.4 * NextRandom()));
+        return;
+    }
+    if (in_pause_)
+    {
+        syllables_until_pause_ = 3 + (int)(NextRandom() * 6);
+        in_pause_ = false;
+    }
+    syllables_until_pause_--;
+
+    // 150..300 ms syllables, pitch drifting around 120 Hz.
+    syllable_length_ = (long long)(sample_rate_ * (0.15 + 0.15 * NextRandom()));
+    pitch_ = 100 + 40 * NextRandom();
+    const double *formants = kVowelFormants[(int)(NextRandom() * 5)];
+    formant_freq_[0] = formants[0];
+    formant_freq_[1] = formants[1];
+}
+
+double SyntheticCaptureSource::NextSpeechSample()
+{
+    if (syllable_pos_ >= syllable_length_)
+    {
+        StartSyllable();
+    }
+    double t = (double)syllable_pos_ / syllable_length_;
+    syllable_pos_++;
+
+    // A little breath noise even in pauses, so it is never digital silence.
+    double noise = (NextRandom() - 0.5) * 0.002;
+    if (in_pause_)
+    {
+        return noise;
+    }
+
+    // Glottal pulse train, shaped by two resonators at the formants.
+    phase_ += pitch_ / sample_rate_;
+    double excitation = 0;
+    if (phase_ >= 1)
+    {
+        phase_ -= 1;
+        excitation = 1;
+    }
+    double sample = 0;
+    for (int f = 0; f < 2; f++)
+    {
+        double r = 0.97;
+        double w = 2 * kPi * formant_freq_[f] / sample_rate_;
+        double *state = formant_state_[f];
+        double y = (1 - r) * excitation + 2 * r * cos(w) * state[0] - r * r * state[1];
+        state[1] = state[0];
+        state[0] = y;
+        sample += y;
+    }
+
+    // Syllable envelope rises and falls smoothly.
+    double envelope = sin(kPi * t);
+    return sample * envelope * envelope * 4 + noise;
+}
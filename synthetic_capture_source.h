@@ -0,0 +1,59 @@
+#ifndef SYNTHETIC_CAPTURE_SOURCE_H
+#define SYNTHETIC_CAPTURE_SOURCE_H
+
+#include "capture_source.h"
+#include <vector>
+
+// Generates test signals, the same on every run for a given seed, so load
+// tests and latency measurements are reproducible.
+class SyntheticCaptureSource : public GeneratedCaptureSource
+{
+public:
+    enum Signal
+    {
+        kTone,   // 440 Hz sine at half scale.
+        kNoise,  // White noise at half scale.
+        kSpeech  // Voiced syllables with moving formants and pauses, roughly
+                 // like speech to a level meter or a voice activity detector.
+    };
+
+    SyntheticCaptureSource(Signal signal, double speed = 1.0, unsigned int seed = 1);
+    ~SyntheticCaptureSource() override;
+
+protected:
+    bool Prepare(const CaptureFormat &format) override;
+    unsigned long Generate(void *frames, unsigned long frame_count) override;
+
+private:
+    // Next sample of the signal, in [-1, 1].
+    double NextSample();
+    double NextSpeechSample();
+
+    // Uniform in [0, 1).
+    double NextRandom();
+
+    // Picks pitch, vowel and length of the next syllable, or a pause.
+    void StartSyllable();
+
+    Signal signal_;
+    unsigned int seed_;
+    unsigned int random_state_;
+    double sample_rate_;
+    double phase_;
+
+    // Speech state: the current syllable, the glottal pulse phase and two
+    // formant resonators.
+    long long syllable_length_;
+    long long syllable_pos_;
+    int syllables_until_pause_;
+    bool in_pause_;
+    double pitch_;
+    double formant_freq_[2];
+    double formant_state_[2][2];
+
+    // Generated frames waiting for conversion to the capture format.
+    static const unsigned long kRowFrames = 256;
+    std::vector<float> row_;
+};
+
+#endif
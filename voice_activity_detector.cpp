@@ -0,0 +1,219 @@
+#include "voice_activity_detector.h"
+#include <math.h>
+
+namespace {
+
+const float kPi = 3.14159265f;
+
+// Analysis frame length, and how many frames are converted at a time.
+const int kFrameMs = 10;
+const size_t kScratchFrames = 256;
+
+// Band the spectral flatness is measured on, where voice has its formants.
+const float kFlatnessLowHz = 100.0f;
+const float kFlatnessHighHz = 4000.0f;
+
+// The noise floor follows drops in energy at once, and rises by at most
+// this much per frame: slowly while there is voice, faster otherwise.
+const float kNoiseFallRate = 0.5f;
+const float kNoiseRiseDb = 0.03f;
+const float kNoiseRiseDuringVoiceDb = 0.005f;
+
+}
+
+VoiceActivityDetector::VoiceActivityDetector()
+{
+    sample_rate_ = 0;
+    channels_ = 1;
+    format_ = pcm::kInt16;
+    frame_size_ = 0;
+    fft_size_ = 0;
+    hangover_frames_ = 0;
+    frame_fill_ = 0;
+    scratch_frames_ = 0;
+    noise_initialized_ = false;
+    noise_db_ = 0;
+    hangover_ = 0;
+    memset(&features_, 0, sizeof(features_));
+}
+
+bool VoiceActivityDetector::Configure(int sample_rate, int channels, pcm::SampleFormat format, const Options &options)
+{
+    if (sample_rate < 1000 || channels < 1)
+        return false;
+    options_ = options;
+    sample_rate_ = sample_rate;
+    channels_ = channels;
+    format_ = format;
+    frame_size_ = (size_t)(sample_rate * kFrameMs / 1000);
+    hangover_frames_ = (options.hangover_ms + kFrameMs - 1) / kFrameMs;
+
+    fft_size_ = 1;
+    while (fft_size_ < frame_size_)
+        fft_size_ *= 2;
+    frame_.assign(frame_size_, 0.0f);
+    scratch_frames_ = kScratchFrames;
+    scratch_.resize(scratch_frames_ * channels);
+
+    // Hann window; the frame is zero-padded to the FFT size.
+    window_.resize(frame_size_);
+    for (size_t i = 0; i < frame_size_; i++)
+        window_[i] = 0.5f - 0.5f * cosf(2 * kPi * i / frame_size_);
+    windowed_.assign(fft_size_, 0.0f);
+    power_.resize(fft_size_ / 2 + 1);
+    fft_.Configure(fft_size_);
+
+    Reset();
+    return true;
+}
+
+void VoiceActivityDetector::Reset()
+{
+    frame_fill_ = 0;
+    noise_initialized_ = false;
+    noise_db_ = 0;
+    hangover_ = 0;
+    memset(&features_, 0, sizeof(features_));
+}
+
+bool VoiceActivityDetector::Process(const void *frames, size_t num_frames)
+{
+    const unsigned char *in = (const unsigned char *)frames;
+    int bytes_per_frame = channels_ * pcm::GetSampleBytes(format_);
+    bool completed = false;
+    bool active = false;
+    while (num_frames > 0)
+    {
+        // Converts no more than fits the scratch or completes the frame.
+        size_t n = frame_size_ - frame_fill_;
+        if (n > num_frames)
+            n = num_frames;
+        if (n > scratch_frames_)
+            n = scratch_frames_;
+        pcm::ToFloat(in, format_, n * channels_, scratch_.data());
+        float gain = 1.0f / channels_;
+        for (size_t i = 0; i < n; i++)
+        {
+            float sum = 0;
+            for (int c = 0; c < channels_; c++)
+                sum += scratch_[i * channels_ + c];
+            frame_[frame_fill_ + i] = sum * gain;
+        }
+        frame_fill_ += n;
+        in += n * bytes_per_frame;
+        num_frames -= n;
+
+        if (frame_fill_ == frame_size_)
+        {
+            AnalyzeFrame();
+            frame_fill_ = 0;
+            completed = true;
+            active = active || IsActive();
+        }
+    }
+    return completed ? active : IsActive();
+}
+
+bool VoiceActivityDetector::ProcessFrame(const float *samples, size_t num_samples,
+                                         const float *power, size_t num_bins, float bin_hz)
+{
+    float energy_db;
+    float zero_crossing_rate;
+    Measure(samples, num_samples, nullptr, &energy_db, &zero_crossing_rate);
+    Decide(energy_db, GetFlatness(power, num_bins, bin_hz), zero_crossing_rate);
+    return IsActive();
+}
+
+void VoiceActivityDetector::Measure(const float *samples, size_t num_samples, float *mean_out,
+                                    float *energy_db, float *zero_crossing_rate)
+{
+    // Energy and zero crossings, around the mean so DC offsets do not count.
+    float mean = 0;
+    for (size_t i = 0; i < num_samples; i++)
+        mean += samples[i];
+    mean /= num_samples;
+    float energy = 0;
+    int crossings = 0;
+    float previous = samples[0] - mean;
+    for (size_t i = 0; i < num_samples; i++)
+    {
+        float x = samples[i] - mean;
+        energy += x * x;
+        crossings += (x >= 0) != (previous >= 0);
+        previous = x;
+    }
+    *energy_db = 10 * log10f(energy / num_samples + 1e-12f);
+    *zero_crossing_rate = (float)crossings / num_samples;
+    if (mean_out)
+        *mean_out = mean;
+}
+
+float VoiceActivityDetector::GetFlatness(const float *power, size_t num_bins, float bin_hz)
+{
+    // Geometric over arithmetic mean of the power.
+    size_t low = (size_t)(kFlatnessLowHz / bin_hz) + 1;
+    size_t high = (size_t)(kFlatnessHighHz / bin_hz);
+    if (high > num_bins - 2)
+        high = num_bins - 2;
+    float log_sum = 0;
+    float sum = 0;
+    for (size_t k = low; k <= high; k++)
+    {
+        float p = power[k] + 1e-12f;
+        log_sum += logf(p);
+        sum += p;
+    }
+    size_t count = high >= low ? high - low + 1 : 1;
+    return expf(log_sum / count) / (sum / count);
+}
+
+void VoiceActivityDetector::AnalyzeFrame()
+{
+    float mean;
+    float energy_db;
+    float zero_crossing_rate;
+    Measure(frame_.data(), frame_size_, &mean, &energy_db, &zero_crossing_rate);
+
+    for (size_t i = 0; i < frame_size_; i++)
+        windowed_[i] = (frame_[i] - mean) * window_[i];
+    fft_.PowerSpectrum(windowed_.data(), power_.data());
+    float flatness = GetFlatness(power_.data(), power_.size(), (float)sample_rate_ / fft_size_);
+
+    Decide(energy_db, flatness, zero_crossing_rate);
+}
+
+void VoiceActivityDetector::Decide(float energy_db, float flatness, float zero_crossing_rate)
+{
+    // Voice stands out of the noise floor and is not noise-like itself.
+    if (!noise_initialized_)
+    {
+        noise_db_ = energy_db;
+        noise_initialized_ = true;
+    }
+    float above = energy_db - noise_db_;
+    bool voice = energy_db > options_.min_energy_db &&
+                 (above > options_.strong_threshold_db ||
+                  (above > options_.threshold_db &&
+                   (flatness < options_.max_flatness || zero_crossing_rate < options_.max_zero_crossing_rate)));
+
+    if (above < 0)
+    {
+        noise_db_ += kNoiseFallRate * above;
+    }
+    else
+    {
+        float rise = voice ? kNoiseRiseDuringVoiceDb : kNoiseRiseDb;
+        noise_db_ += above < rise ? above : rise;
+    }
+
+    if (voice)
+        hangover_ = hangover_frames_ > 0 ? hangover_frames_ : 1;
+    else if (hangover_ > 0)
+        hangover_--;
+
+    features_.energy_db = energy_db;
+    features_.noise_db = noise_db_;
+    features_.flatness = flatness;
+    features_.zero_crossing_rate = zero_crossing_rate;
+    features_.voice = voice;
+}
@@ -0,0 +1,122 @@
+#ifndef VOICE_ACTIVITY_DETECTOR_H
+#define VOICE_ACTIVITY_DETECTOR_H
+
+#include <vector>
+#include "fft.h"
+#include "pcm_convert.h"
+
+// Streaming voice activity detector. Cuts the stream into 10 ms analysis
+// frames, downmixed to mono, and calls a frame voice when its energy stands
+// well above the tracked noise floor and it looks like speech rather than
+// noise: a peaky spectrum (low spectral flatness) or a low zero-crossing
+// rate. A hangover keeps it active for a while after the last voice frame,
+// so word endings and short pauses are not cut.
+class VoiceActivityDetector
+{
+public:
+    struct Options
+    {
+        // Energy above the noise floor for a frame to count as voice, and
+        // above which it counts regardless of its spectrum.
+        float threshold_db;
+        float strong_threshold_db;
+
+        // Frames quieter than this are never voice.
+        float min_energy_db;
+
+        // Above this flatness (0 for a pure tone, 1 for white noise), or
+        // this fraction of zero crossings per sample, a frame looks like
+        // noise.
+        float max_flatness;
+        float max_zero_crossing_rate;
+
+        // How long the detector stays active after the last voice frame.
+        int hangover_ms;
+
+        Options()
+            : threshold_db(9.0f), strong_threshold_db(20.0f), min_energy_db(-60.0f),
+              max_flatness(0.35f), max_zero_crossing_rate(0.3f), hangover_ms(300)
+        {
+        }
+    };
+
+    // What the detector saw in the last complete analysis frame.
+    struct Features
+    {
+        float energy_db;
+        float noise_db;
+        float flatness;
+        float zero_crossing_rate;
+        bool voice;
+    };
+
+    VoiceActivityDetector();
+
+    // Analyzes |channels| channels of interleaved |format| at |sample_rate|.
+    // Returns false for an unusable format.
+    bool Configure(int sample_rate, int channels, pcm::SampleFormat format, const Options &options = Options());
+
+    // Forgets the noise floor and any partial frame.
+    void Reset();
+
+    // Feeds |num_frames| frames and returns whether the detector was active
+    // in any analysis frame they completed, or is active now if they
+    // completed none. Does not allocate.
+    bool Process(const void *frames, size_t num_frames);
+
+    // Analyzes one 10 ms frame of |num_samples| mono samples whose power
+    // spectrum someone else has computed, e.g. a FeatureExtractor, so it is
+    // not transformed twice: |num_bins| bins |bin_hz| apart. Use instead of
+    // Process(), not along with it. Returns whether the detector is active.
+    bool ProcessFrame(const float *samples, size_t num_samples,
+                      const float *power, size_t num_bins, float bin_hz);
+
+    bool IsActive() const { return hangover_ > 0; }
+    const Features &GetFeatures() const { return features_; }
+
+private:
+    // Analyzes the full frame in frame_ and updates the state.
+    void AnalyzeFrame();
+
+    // Mean, energy and zero-crossing rate of |num_samples| samples. |mean|
+    // may be null.
+    static void Measure(const float *samples, size_t num_samples, float *mean,
+                        float *energy_db, float *zero_crossing_rate);
+
+    // Spectral flatness of |power| over the band voice has its formants in.
+    static float GetFlatness(const float *power, size_t num_bins, float bin_hz);
+
+    // Decides on one analyzed frame and updates the noise floor, the
+    // hangover and features_.
+    void Decide(float energy_db, float flatness, float zero_crossing_rate);
+
+    Options options_;
+    int sample_rate_;
+    int channels_;
+    pcm::SampleFormat format_;
+
+    // Analysis frame length, and the power of two its spectrum is taken on.
+    size_t frame_size_;
+    size_t fft_size_;
+    int hangover_frames_;
+
+    // Mono samples of the current frame, and how many have arrived.
+    std::vector<float> frame_;
+    size_t frame_fill_;
+
+    // Input converted to float, one block of frames at a time.
+    std::vector<float> scratch_;
+    size_t scratch_frames_;
+
+    std::vector<float> window_;
+    std::vector<float> windowed_;
+    std::vector<float> power_;
+    Fft fft_;
+
+    bool noise_initialized_;
+    float noise_db_;
+    int hangover_;
+    Features features_;
+};
+
+#endif